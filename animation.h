@@ -0,0 +1,157 @@
+#ifndef ANIMATION_H
+#define ANIMATION_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include "vector.h"
+#include "bvh.h"
+
+//moves some of the plain spheres of a flattened scene every frame, see --animate. the object bvh keeps its
+//topology and only the nodes above a moved sphere get their bounds recomputed, so a frame costs the moved
+//spheres and their paths to the root instead of rebuilding the whole bvh. the lists of changed
+//spheres and nodes are kept so only those parts of the device buffers are written again
+typedef struct SceneAnimation{
+    flattenedScene* fscene;
+    int num_moving;
+    int* moving; //indices into the plain spheres, ascending
+    float* velocity; //3 per moving sphere
+    float box[6]; //the spheres bounce inside the bounds the scene started with
+    float gravity;
+    int* parent; //per bvh node, -1 for the root
+    int* leaf_of; //per plain sphere, the leaf holding it
+    char* node_dirty;
+    int* dirty_nodes; //nodes refit by the last step, ascending
+    int num_dirty_nodes;
+    uint32_t random_state;
+} SceneAnimation;
+
+uint32_t animation_random(SceneAnimation* anim){
+    uint32_t x = anim->random_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    anim->random_state = x;
+    return x;
+}
+
+float animation_random_range(SceneAnimation* anim, float min, float max){
+    return min + (max-min)*(animation_random(anim)/4294967296.0f);
+}
+
+int compare_ints(const void* a, const void* b){
+    int x = *(const int*)a;
+    int y = *(const int*)b;
+    return (x > y)-(x < y);
+}
+
+//count spheres spread evenly over the scene start moving. NULL if the scene has no plain spheres
+SceneAnimation* create_scene_animation(flattenedScene* fscene, int count, uint32_t seed){
+    SphereBVH* bvh = fscene->objectbvh;
+    if(fscene->num_objects == 0 || bvh == NULL || bvh->num_nodes == 0){
+        printf("The scene has no spheres to animate\n");
+        return NULL;
+    }
+    if(count > fscene->num_objects) count = fscene->num_objects;
+    if(count < 1) count = 1;
+
+    SceneAnimation* anim;
+    anim = (SceneAnimation*)malloc(sizeof(SceneAnimation));
+    anim->fscene = fscene;
+    anim->num_moving = count;
+    anim->moving = (int*)malloc(sizeof(int)*count);
+    anim->velocity = (float*)malloc(sizeof(float)*count*3);
+    anim->parent = (int*)malloc(sizeof(int)*bvh->num_nodes);
+    anim->leaf_of = (int*)malloc(sizeof(int)*fscene->num_objects);
+    anim->node_dirty = (char*)calloc(bvh->num_nodes, 1);
+    anim->dirty_nodes = (int*)malloc(sizeof(int)*bvh->num_nodes);
+    anim->num_dirty_nodes = 0;
+    anim->random_state = seed ? seed : 1;
+    memcpy(anim->box, bvh->bounds, sizeof(anim->box));
+
+    bvh_parents(bvh, anim->parent);
+    for(int node = 0; node < bvh->num_nodes; node++){
+        int first = bvh->nodes[node*2];
+        int leaf_count = bvh->nodes[node*2+1];
+        for(int s = first; s < first+leaf_count; s++) anim->leaf_of[s] = node;
+    }
+
+    //the spheres are in leaf order, so evenly spaced indices land all over the tree
+    float extent = fmaxf(anim->box[3]-anim->box[0], fmaxf(anim->box[4]-anim->box[1], anim->box[5]-anim->box[2]));
+    anim->gravity = extent;
+    for(int i = 0; i < count; i++){
+        anim->moving[i] = (int)((long)i*fscene->num_objects/count);
+        anim->velocity[i*3] = animation_random_range(anim, -0.5f, 0.5f)*extent;
+        anim->velocity[i*3+1] = animation_random_range(anim, 0, 0.5f)*extent;
+        anim->velocity[i*3+2] = animation_random_range(anim, -0.5f, 0.5f)*extent;
+    }
+
+    return anim;
+}
+
+//one physics tick of dt seconds: gravity along -y and elastic bounces off the walls of the box, then the
+//bvh is refit bottom up over the nodes above the moved spheres
+void step_scene_animation(SceneAnimation* anim, float dt){
+    flattenedScene* fscene = anim->fscene;
+    SphereBVH* bvh = fscene->objectbvh;
+    float* box = anim->box;
+
+    for(int i = 0; i < anim->num_moving; i++){
+        int s = anim->moving[i];
+        float* p = &fscene->objectpos[s*3];
+        float* v = &anim->velocity[i*3];
+        float r = fscene->objectradius[s];
+        v[1] -= anim->gravity*dt;
+        for(int k = 0; k < 3; k++){
+            p[k] += v[k]*dt;
+            float low = box[k]+r;
+            float high = box[k+3]-r;
+            //a sphere wider than the box just sits in the middle of it
+            if(low > high){
+                p[k] = (box[k]+box[k+3])*0.5f;
+                v[k] = 0;
+            }else if(p[k] < low){
+                p[k] = 2*low-p[k];
+                v[k] = -v[k];
+            }else if(p[k] > high){
+                p[k] = 2*high-p[k];
+                v[k] = -v[k];
+            }
+            if(p[k] < low || p[k] > high) p[k] = fminf(fmaxf(p[k], low), high);
+        }
+    }
+
+    //stop walking up at a node another sphere already marked, everything above it is marked too
+    anim->num_dirty_nodes = 0;
+    for(int i = 0; i < anim->num_moving; i++){
+        for(int node = anim->leaf_of[anim->moving[i]]; node >= 0 && !anim->node_dirty[node]; node = anim->parent[node]){
+            anim->node_dirty[node] = 1;
+            anim->dirty_nodes[anim->num_dirty_nodes++] = node;
+        }
+    }
+    qsort(anim->dirty_nodes, anim->num_dirty_nodes, sizeof(int), compare_ints);
+
+    //children always come after their parent, so going down the indices refits them first
+    for(int i = anim->num_dirty_nodes-1; i >= 0; i--){
+        int node = anim->dirty_nodes[i];
+        refit_bvh_node(bvh, fscene->objectpos, fscene->objectradius, node);
+        anim->node_dirty[node] = 0;
+    }
+}
+
+void destroy_scene_animation(SceneAnimation* anim){
+    if(anim == NULL) return;
+
+    free(anim->moving);
+    free(anim->velocity);
+    free(anim->parent);
+    free(anim->leaf_of);
+    free(anim->node_dirty);
+    free(anim->dirty_nodes);
+
+    free(anim);
+    return;
+}
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef ARENA_H
+#define ARENA_H
+#include <stdlib.h>
+#include <stddef.h>
+
+//bump allocator for things that are created and destroyed together, like everything a loaded Scene is made of.
+//allocations are carved one after the other out of a few big blocks, so things allocated in order sit next to
+//each other in memory, and they are only given back all at once by destroy_arena
+
+#define ARENA_ALIGNMENT 16
+#define ARENA_MIN_BLOCK (64*1024)
+
+typedef struct ArenaBlock{
+    struct ArenaBlock* next;
+    size_t size;
+    size_t used;
+    _Alignas(ARENA_ALIGNMENT) char data[];
+} ArenaBlock;
+
+typedef struct Arena{
+    ArenaBlock* blocks; //the one being filled first
+    size_t block_size;
+} Arena;
+
+#define ARENA_NEW(arena, type) ((type*)arena_alloc(arena, sizeof(type)))
+#define ARENA_ARRAY(arena, type, count) ((type*)arena_alloc(arena, sizeof(type)*(count)))
+
+size_t arena_aligned(size_t size){
+    return (size+ARENA_ALIGNMENT-1)/ARENA_ALIGNMENT*ARENA_ALIGNMENT;
+}
+
+ArenaBlock* create_arena_block(size_t size){
+    ArenaBlock* block;
+    block = (ArenaBlock*)malloc(sizeof(ArenaBlock)+size);
+
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+
+    return block;
+}
+
+//size is how much the first block holds, pass the whole estimate so a scene ends up in a single block
+Arena* create_arena(size_t size){
+    Arena* arena;
+    arena = (Arena*)malloc(sizeof(Arena));
+
+    arena->block_size = size > ARENA_MIN_BLOCK ? size : ARENA_MIN_BLOCK;
+    arena->blocks = create_arena_block(arena->block_size);
+
+    return arena;
+}
+
+//memory is not zeroed
+void* arena_alloc(Arena* arena, size_t size){
+    size = arena_aligned(size);
+    ArenaBlock* block = arena->blocks;
+    if(block->used+size > block->size){
+        //the estimate was short, later blocks double so a bad guess still needs few of them
+        arena->block_size *= 2;
+        block = create_arena_block(size > arena->block_size ? size : arena->block_size);
+        block->next = arena->blocks;
+        arena->blocks = block;
+    }
+
+    void* pointer = block->data+block->used;
+    block->used += size;
+    return pointer;
+}
+
+void destroy_arena(Arena* arena){
+    while(arena->blocks != NULL){
+        ArenaBlock* temp = arena->blocks;
+        arena->blocks = temp->next;
+        free(temp);
+    }
+
+    free(arena);
+    return;
+}
+
+#endif
@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <time.h>
+#include "vector.h"
+#include "utils.h"
+#include "raytracer.h"
+
+//renders every STEP-th pixel of the default frame, enough to compare the light loops without waiting forever
+#define STEP 6
+
+double now_ms(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1000.0 + ts.tv_nsec/1000000.0;
+}
+
+float random_range(float min, float max){
+    return min + (max-min)*((float)rand()/RAND_MAX);
+}
+
+//grid of spheres in front of the camera lit by num_lights small ranged lights plus one global light
+Scene* build_bench_scene(int num_spheres, int num_lights, float range){
+    ObjectList* objects = create_objectlist();
+    LightList* lights = create_lightlist();
+
+    Material** materials = (Material**)malloc(sizeof(Material*));
+    materials[0] = create_material(0.4, 0.4, 0.1, 0.5, 1);
+    Material* material = materials[0];
+
+    int side = (int)ceilf(sqrtf(num_spheres));
+    for(int i = 0; i < num_spheres; i++){
+        float x = -20 + 40*((float)(i%side)+0.5f)/side;
+        float y = -14 + 28*((float)(i/side)+0.5f)/side;
+        Sphere* sphere = create_sphere(x, y, 40, 20.0f/side, random_range(0, 1), random_range(0, 1), random_range(0, 1), material);
+        objects = add_to_objectlist(objects, sphere);
+    }
+
+    Light* sun = create_light(-10, 0, -20, create_color(0.2, 0.2, 0.2), create_color(0.1, 0.1, 0.1));
+    lights = add_to_lightlist(lights, sun);
+    for(int i = 0; i < num_lights; i++){
+        Light* light = create_light(random_range(-22, 22), random_range(-16, 16), random_range(30, 38), create_color(0.5, 0.5, 0.5), create_color(0.1, 0.1, 0.1));
+        light->range = range;
+        lights = add_to_lightlist(lights, light);
+    }
+
+    vector3D* camera = create_vector3D(0, 0, -1);
+    plane3D* plane = create_plane3D(1, 0.66);
+    plane->x1->z += camera->z+1;
+    plane->x2->z += camera->z+1;
+    plane->x3->z += camera->z+1;
+    plane->x4->z += camera->z+1;
+
+    Scene* scene = create_scene(camera, plane, create_color(0.5, 0.5, 0.5), lights, objects, num_lights+1, num_spheres);
+    set_scene_materials(scene, materials, 1);
+    build_scene_light_bvh(scene);
+
+    return scene;
+}
+
+//returns the render time and writes the summed color, which has to match between the two modes
+double render_sample(Scene* scene, double* checksum){
+    double start = now_ms();
+    double sum = 0;
+    for(int x = 0; x < WIDTH; x += STEP){
+        for(int y = 0; y < HEIGHT; y += STEP){
+            float alpha = (float)x/WIDTH;
+            float beta = (float)y/HEIGHT;
+
+            vector3D origin;
+            origin.x = (scene->plane->x1->x*(1-alpha) + scene->plane->x2->x*alpha)*(1-beta) + (scene->plane->x3->x*(1-alpha) + scene->plane->x4->x*alpha)*beta;
+            origin.y = (scene->plane->x1->y*(1-alpha) + scene->plane->x2->y*alpha)*(1-beta) + (scene->plane->x3->y*(1-alpha) + scene->plane->x4->y*alpha)*beta;
+            origin.z = (scene->plane->x1->z*(1-alpha) + scene->plane->x2->z*alpha)*(1-beta) + (scene->plane->x3->z*(1-alpha) + scene->plane->x4->z*alpha)*beta;
+            vector3D* direction = subtractVectors(scene->camera, &origin);
+
+            Color* color = colorFromRecursiveRayCast(direction, &origin, scene, 3, NULL);
+            sum += color->red + color->green + color->blue;
+
+            free(color);
+            free(direction);
+        }
+    }
+    *checksum = sum;
+    return now_ms()-start;
+}
+
+int main(int argc, char* argv[]){
+    int max_lights = argc > 1 ? atoi(argv[1]) : 1024;
+    int num_spheres = argc > 2 ? atoi(argv[2]) : 64;
+    float range = argc > 3 ? atof(argv[3]) : 6;
+
+    printf("%d spheres, light range %.1f, %dx%d sampled pixels\n", num_spheres, range, WIDTH/STEP, HEIGHT/STEP);
+    printf("%8s %12s %12s %9s %12s\n", "lights", "culled ms", "all ms", "speedup", "color diff");
+
+    for(int num_lights = 1; num_lights <= max_lights; num_lights *= 4){
+        srand(42);
+        Scene* scene = build_bench_scene(num_spheres, num_lights, range);
+
+        double culled_sum;
+        double culled = render_sample(scene, &culled_sum);
+
+        SphereBVH* lightbvh = scene->lightbvh;
+        scene->lightbvh = NULL;
+        double all_sum;
+        double all = render_sample(scene, &all_sum);
+        scene->lightbvh = lightbvh;
+
+        printf("%8d %12.1f %12.1f %8.2fx %12.6f\n", num_lights, culled, all, all/culled, fabs(culled_sum-all_sum));
+
+        destroy_scene(scene);
+    }
+
+    return 0;
+}
@@ -0,0 +1,571 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "vector.h"
+#include "utils.h"
+#include "raytracer.h"
+
+//microbenchmarks of the innermost routines of the cpu tracer: quadraticFormula, the sphere distance, the
+//vector.h operations and the shading of checkCollisionColor. every primitive runs in the pointer and malloc
+//form the tracer uses next to variants written here, so a change to the hot path can be argued with numbers
+//before it is made. a variant goes in the table below with the primitive it replaces as its baseline, and
+//the diff column says how far its results are from the baseline's over the same inputs
+//
+//usage: ./bench_primitives [filter] [--reps n] [--warmup ms] [--rep-ms ms]
+//each benchmark is warmed up for --warmup ms (100), sized so a repetition takes about --rep-ms ms (20) and
+//repeated --reps times (15). the times are per call, cycles come from perf_event_open when the kernel allows
+//it and from rdtsc otherwise, which counts at the nominal clock and not the core's
+
+//the inputs are cycled through, enough of them to defeat the branch predictor but few enough to stay in cache
+#define INPUTS 4096
+#define MAX_REPS 256
+
+typedef struct BenchData{
+    vector3D a[INPUTS]; //directions or any vector
+    vector3D b[INPUTS]; //origins
+    float s[INPUTS]; //scalars
+    float qa[INPUTS], qb[INPUTS], qc[INPUTS]; //quadratic coefficients, with and without real roots
+    Sphere* spheres[INPUTS];
+    Collision collisions[INPUTS]; //hits of camera rays in the shading scene
+    Scene* scene;
+    float* out; //up to 3 results per input, written so nothing is optimized away
+} BenchData;
+
+typedef struct Bench{
+    const char* name;
+    const char* variant;
+    int baseline; //index of the benchmark it is compared with, -1 for a baseline
+    void (*run)(BenchData* data, int n); //n calls over the inputs
+} Bench;
+
+double now_ns(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1e9 + ts.tv_nsec;
+}
+
+float random_range(float min, float max){
+    return min + (max-min)*((float)rand()/RAND_MAX);
+}
+
+//cycles of this thread through perf_event_open, -1 when perf events are not allowed (containers,
+//perf_event_paranoid) and rdtsc is used instead
+int cycle_fd = -1;
+
+void open_cycle_counter(){
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CPU_CYCLES;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    cycle_fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+const char* cycle_source(){
+    if(cycle_fd >= 0) return "perf cycles";
+#if defined(__x86_64__) || defined(__i386__)
+    return "rdtsc";
+#else
+    return "none";
+#endif
+}
+
+uint64_t read_cycles(){
+    if(cycle_fd >= 0){
+        uint64_t count = 0;
+        if(read(cycle_fd, &count, sizeof(count)) == sizeof(count)) return count;
+    }
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+//value forms of the vector.h operations, same argument order and the same float operations in the same order
+vector3D add_value(vector3D v1, vector3D v2){
+    return (vector3D){v1.x + v2.x, v1.y + v2.y, v1.z + v2.z};
+}
+//v2 - v1, like subtractVectors
+vector3D subtract_value(vector3D v1, vector3D v2){
+    return (vector3D){v2.x - v1.x, v2.y - v1.y, v2.z - v1.z};
+}
+vector3D scale_value(vector3D v, float scalar){
+    return (vector3D){v.x * scalar, v.y * scalar, v.z * scalar};
+}
+float dot_value(vector3D v1, vector3D v2){
+    return v1.x*v2.x + v1.y*v2.y + v1.z*v2.z;
+}
+float magnitude_value(vector3D v){
+    return sqrtf(v.x*v.x + v.y*v.y + v.z*v.z);
+}
+vector3D normalize_value(vector3D v){
+    return scale_value(v, 1/magnitude_value(v));
+}
+Color product_value(Color c1, Color c2){
+    return (Color){c1.red*c2.red, c1.green*c2.green, c1.blue*c2.blue};
+}
+Color scale_color_value(Color c, float scalar){
+    return (Color){c.red*scalar, c.green*scalar, c.blue*scalar};
+}
+Color clamp_color_value(Color c, float min, float max){
+    return (Color){clamp(c.red, min, max), clamp(c.green, min, max), clamp(c.blue, min, max)};
+}
+void add_color_value(Color* c1, Color c2){
+    c1->red = c1->red+c2.red;
+    c1->green = c1->green+c2.green;
+    c1->blue = c1->blue+c2.blue;
+}
+
+//quadraticFormula in floats, fmin and fmax go through double in the original
+float quadratic_float(float a, float b, float c){
+    float delta = b*b - 4*a*c;
+    if(delta < 0) return delta;
+    delta = sqrtf(delta);
+
+    float t1 = (-b+delta)/(2*a);
+    float t2 = (-b-delta)/(2*a);
+
+    if(fminf(t1, t2) < 0) return fmaxf(t1, t2);
+    else return fminf(t1, t2);
+}
+
+//one division instead of two, rounds differently in the last bit
+float quadratic_reciprocal(float a, float b, float c){
+    float delta = b*b - 4*a*c;
+    if(delta < 0) return delta;
+    delta = sqrtf(delta);
+
+    float inverse = 1/(2*a);
+    float t1 = (-b+delta)*inverse;
+    float t2 = (-b-delta)*inverse;
+
+    if(fminf(t1, t2) < 0) return fmaxf(t1, t2);
+    else return fminf(t1, t2);
+}
+
+float sphere_distance_value(vector3D dir, vector3D origin, Sphere* sphere){
+    vector3D oc = subtract_value(*sphere->center, origin);
+    float a = dot_value(dir, dir);
+    float b = 2*dot_value(oc, dir);
+    float c = dot_value(oc, oc)-sphere->radius*sphere->radius;
+    return quadraticFormula(a, b, c);
+}
+
+//isInShadow, shadeLight and checkCollisionColor without a single malloc, the shadow ray is the same for
+//every sphere so it is made once
+int in_shadow_value(Collision* col, Light* light, ObjectList* objects){
+    ray_counters[STAT_SHADOW_RAYS]++;
+    vector3D sub = subtract_value(col->colPoint, *light->position);
+    for(ObjectList* index = objects; index->sphere != NULL; index = index->next){
+        if(index->sphere == col->colObject) continue;
+        float t = sphere_distance_value(sub, col->colPoint, index->sphere);
+        ray_counters[STAT_SPHERE_TESTS]++;
+        if(0 < t && t < 1) return 1;
+    }
+    return 0;
+}
+
+void shade_light_value(Collision* col, Light* light, vector3D normalized, vector3D view, Scene* scene, Color* drawn_color){
+    if(in_shadow_value(col, light, scene->objects)) return;
+
+    vector3D sub = subtract_value(col->colPoint, *light->position);
+    float attenuation = lightAttenuation(magnitude_value(sub), light->range);
+    vector3D L = normalize_value(sub);
+    float dot = dot_value(L, normalized);
+    vector3D reflectance = subtract_value(L, scale_value(normalized, 2*dot));
+    float dot2 = dot_value(reflectance, view);
+    if(dot < 0) return;
+
+    Material* material = col->colObject->material;
+    add_color_value(drawn_color, clamp_color_value(scale_color_value(product_value(*light->diffuse, *material->diffuse), dot*attenuation), 0, 1));
+    dot2 = powf(dot2, material->albedo);
+    add_color_value(drawn_color, clamp_color_value(scale_color_value(product_value(*light->specular, *material->specular), dot2*attenuation), 0, 1));
+}
+
+Color collision_color_value(Collision* col, Scene* scene){
+    Color drawn_color = {0, 0, 0};
+    vector3D normalized = normalize_value(subtract_value(*col->colObject->center, col->colPoint));
+    vector3D view = subtract_value(col->colPoint, normalize_value(*scene->camera));
+
+    if(scene->lightbvh == NULL){
+        for(LightList* index = scene->lights; index->light != NULL; index = index->next){
+            shade_light_value(col, index->light, normalized, view, scene, &drawn_color);
+        }
+    }else{
+        for(int i = 0; i < scene->num_global_lights; i++){
+            shade_light_value(col, scene->light_array[i], normalized, view, scene, &drawn_color);
+        }
+        vector3D p = col->colPoint;
+        int stack[BVH_STACK_SIZE];
+        int top = 0;
+        if(scene->lightbvh->num_nodes > 0) stack[top++] = 0;
+        while(top > 0){
+            int node = stack[--top];
+            if(!bvh_node_contains(scene->lightbvh, node, p.x, p.y, p.z)) continue;
+
+            int first = scene->lightbvh->nodes[node*2];
+            int count = scene->lightbvh->nodes[node*2+1];
+            if(count == 0){
+                stack[top++] = first;
+                stack[top++] = first+1;
+                continue;
+            }
+            for(int i = first; i < first+count; i++){
+                Light* light = scene->light_array[i];
+                if(magnitude_value(subtract_value(p, *light->position)) < light->range) shade_light_value(col, light, normalized, view, scene, &drawn_color);
+            }
+        }
+    }
+
+    Material* material = col->colObject->material;
+    add_color_value(&drawn_color, product_value(*material->ambient, *scene->ALI));
+    add_color_value(&drawn_color, scale_color_value(*col->colObject->color, 0.2));
+    return clamp_color_value(drawn_color, 0, 1);
+}
+
+//the benchmarks, each one does n calls cycling through the inputs
+#define EACH_INPUT for(int k = 0, i = 0; k < n; k++, i = (i+1) & (INPUTS-1))
+
+//with vector.h in the same file gcc inlines addVectors and the rest and drops the malloc and free of a vector
+//that never leaves the loop, so the pointer forms would measure no allocation at all. handing the pointer to
+//an empty asm makes it escape and keeps the pair. the malloc inside checkSingleObjectCollisionDistance is
+//dropped the same way in the tracer itself, build with -fno-builtin-malloc -fno-builtin-free to time it
+static inline void escape(void* p){
+    asm volatile("" :: "r"(p) : "memory");
+}
+
+void store_vector(float* out, vector3D v){
+    out[0] = v.x; out[1] = v.y; out[2] = v.z;
+}
+void store_color(float* out, Color c){
+    out[0] = c.red; out[1] = c.green; out[2] = c.blue;
+}
+
+void bench_quadratic(BenchData* d, int n){
+    EACH_INPUT d->out[i*3] = quadraticFormula(d->qa[i], d->qb[i], d->qc[i]);
+}
+void bench_quadratic_float(BenchData* d, int n){
+    EACH_INPUT d->out[i*3] = quadratic_float(d->qa[i], d->qb[i], d->qc[i]);
+}
+void bench_quadratic_reciprocal(BenchData* d, int n){
+    EACH_INPUT d->out[i*3] = quadratic_reciprocal(d->qa[i], d->qb[i], d->qc[i]);
+}
+
+void bench_distance(BenchData* d, int n){
+    EACH_INPUT d->out[i*3] = checkSingleObjectCollisionDistance(&d->a[i], &d->b[i], d->spheres[i]);
+}
+void bench_distance_value(BenchData* d, int n){
+    EACH_INPUT d->out[i*3] = sphere_distance_value(d->a[i], d->b[i], d->spheres[i]);
+}
+
+void bench_add(BenchData* d, int n){
+    EACH_INPUT{
+        vector3D* v = addVectors(&d->a[i], &d->b[i]);
+        store_vector(&d->out[i*3], *v);
+        escape(v);
+        free(v);
+    }
+}
+void bench_add_value(BenchData* d, int n){
+    EACH_INPUT store_vector(&d->out[i*3], add_value(d->a[i], d->b[i]));
+}
+void bench_add_in_place(BenchData* d, int n){
+    EACH_INPUT{
+        vector3D v = d->a[i];
+        addVectors2(&v, d->b[i].x, d->b[i].y, d->b[i].z);
+        store_vector(&d->out[i*3], v);
+    }
+}
+
+void bench_subtract(BenchData* d, int n){
+    EACH_INPUT{
+        vector3D* v = subtractVectors(&d->a[i], &d->b[i]);
+        store_vector(&d->out[i*3], *v);
+        escape(v);
+        free(v);
+    }
+}
+void bench_subtract_value(BenchData* d, int n){
+    EACH_INPUT store_vector(&d->out[i*3], subtract_value(d->a[i], d->b[i]));
+}
+
+void bench_scale(BenchData* d, int n){
+    EACH_INPUT{
+        vector3D* v = scaleVector(&d->a[i], d->s[i]);
+        store_vector(&d->out[i*3], *v);
+        escape(v);
+        free(v);
+    }
+}
+void bench_scale_value(BenchData* d, int n){
+    EACH_INPUT store_vector(&d->out[i*3], scale_value(d->a[i], d->s[i]));
+}
+
+void bench_dot(BenchData* d, int n){
+    EACH_INPUT d->out[i*3] = dotProduct(&d->a[i], &d->b[i]);
+}
+void bench_dot_value(BenchData* d, int n){
+    EACH_INPUT d->out[i*3] = dot_value(d->a[i], d->b[i]);
+}
+
+void bench_magnitude(BenchData* d, int n){
+    EACH_INPUT d->out[i*3] = getMagnitude(&d->a[i]);
+}
+
+void bench_normalize(BenchData* d, int n){
+    EACH_INPUT{
+        vector3D* v = normalizeVector(&d->a[i]);
+        store_vector(&d->out[i*3], *v);
+        escape(v);
+        free(v);
+    }
+}
+void bench_normalize_value(BenchData* d, int n){
+    EACH_INPUT store_vector(&d->out[i*3], normalize_value(d->a[i]));
+}
+
+void bench_shading(BenchData* d, int n){
+    EACH_INPUT{
+        Color* color = checkCollisionColor(&d->collisions[i], d->scene);
+        store_color(&d->out[i*3], *color);
+        free(color);
+    }
+}
+void bench_shading_value(BenchData* d, int n){
+    EACH_INPUT store_color(&d->out[i*3], collision_color_value(&d->collisions[i], d->scene));
+}
+
+Bench benches[] = {
+    {"quadraticFormula", "original", -1, bench_quadratic},
+    {"quadraticFormula", "float", 0, bench_quadratic_float},
+    {"quadraticFormula", "reciprocal", 0, bench_quadratic_reciprocal},
+    {"checkSingleObjectCollisionDistance", "pointer", -1, bench_distance},
+    {"checkSingleObjectCollisionDistance", "value", 3, bench_distance_value},
+    {"addVectors", "pointer", -1, bench_add},
+    {"addVectors", "value", 5, bench_add_value},
+    {"addVectors", "addVectors2", 5, bench_add_in_place},
+    {"subtractVectors", "pointer", -1, bench_subtract},
+    {"subtractVectors", "value", 8, bench_subtract_value},
+    {"scaleVector", "pointer", -1, bench_scale},
+    {"scaleVector", "value", 10, bench_scale_value},
+    {"dotProduct", "pointer", -1, bench_dot},
+    {"dotProduct", "value", 12, bench_dot_value},
+    {"getMagnitude", "pointer", -1, bench_magnitude},
+    {"normalizeVector", "pointer", -1, bench_normalize},
+    {"normalizeVector", "value", 15, bench_normalize_value},
+    {"checkCollisionColor", "pointer", -1, bench_shading},
+    {"checkCollisionColor", "value", 17, bench_shading_value},
+};
+#define NUM_BENCHES (int)(sizeof(benches)/sizeof(benches[0]))
+
+//a few dozen spheres in front of the camera lit by a global light and some ranged ones, like bench_lights
+Scene* build_shading_scene(){
+    ObjectList* objects = create_objectlist();
+    LightList* lights = create_lightlist();
+    Material** materials = (Material**)malloc(sizeof(Material*));
+    materials[0] = create_material(0.4, 0.4, 0.1, 0.5, 8);
+
+    const int side = 6;
+    for(int i = 0; i < side*side; i++){
+        float x = -20 + 40*((float)(i%side)+0.5f)/side;
+        float y = -14 + 28*((float)(i/side)+0.5f)/side;
+        objects = add_to_objectlist(objects, create_sphere(x, y, 40+random_range(-3, 3), 20.0f/side, random_range(0, 1), random_range(0, 1), random_range(0, 1), materials[0]));
+    }
+    lights = add_to_lightlist(lights, create_light(-10, 10, -20, create_color(0.4, 0.4, 0.4), create_color(0.2, 0.2, 0.2)));
+    const int ranged = 16;
+    for(int i = 0; i < ranged; i++){
+        Light* light = create_light(random_range(-22, 22), random_range(-16, 16), random_range(30, 38), create_color(0.5, 0.5, 0.5), create_color(0.1, 0.1, 0.1));
+        light->range = 12;
+        lights = add_to_lightlist(lights, light);
+    }
+
+    vector3D* camera = create_vector3D(0, 0, -1);
+    plane3D* plane = create_plane3D(1, 0.66);
+    plane->x1->z += camera->z+1;
+    plane->x2->z += camera->z+1;
+    plane->x3->z += camera->z+1;
+    plane->x4->z += camera->z+1;
+
+    Scene* scene = create_scene(camera, plane, create_color(0.5, 0.5, 0.5), lights, objects, ranged+1, side*side);
+    set_scene_materials(scene, materials, 1);
+    build_scene_light_bvh(scene);
+    return scene;
+}
+
+//random inputs in the ranges the tracer sees, and hits of rays through random points of the view plane
+void fill_bench_data(BenchData* d){
+    d->scene = build_shading_scene();
+    ObjectList* list = d->scene->objects;
+    for(int i = 0; i < INPUTS; i++){
+        d->a[i] = (vector3D){random_range(-1, 1), random_range(-1, 1), random_range(0.5f, 2)};
+        d->b[i] = (vector3D){random_range(-20, 20), random_range(-14, 14), random_range(-2, 30)};
+        d->s[i] = random_range(0.1f, 60);
+        //about a third without real roots, like the rays that miss
+        d->qa[i] = random_range(0.5f, 3);
+        d->qb[i] = random_range(-150, -20);
+        d->qc[i] = random_range(100, 1500);
+
+        if(list->sphere == NULL) list = d->scene->objects;
+        d->spheres[i] = list->sphere;
+        list = list->next;
+    }
+
+    plane3D* p = d->scene->plane;
+    int hits = 0;
+    while(hits < INPUTS){
+        float alpha = random_range(0, 1);
+        float beta = random_range(0, 1);
+        vector3D origin;
+        origin.x = (p->x1->x*(1-alpha) + p->x2->x*alpha)*(1-beta) + (p->x3->x*(1-alpha) + p->x4->x*alpha)*beta;
+        origin.y = (p->x1->y*(1-alpha) + p->x2->y*alpha)*(1-beta) + (p->x3->y*(1-alpha) + p->x4->y*alpha)*beta;
+        origin.z = (p->x1->z*(1-alpha) + p->x2->z*alpha)*(1-beta) + (p->x3->z*(1-alpha) + p->x4->z*alpha)*beta;
+        vector3D* direction = subtractVectors(d->scene->camera, &origin);
+        Collision* collision = checkRayCollisions(direction, &origin, d->scene->objects);
+        if(collision->colObject != NULL) d->collisions[hits++] = *collision;
+        destroy_collision(collision);
+        free(direction);
+    }
+    d->out = (float*)calloc(INPUTS*3, sizeof(float));
+}
+
+int compare_doubles(const void* a, const void* b){
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+typedef struct BenchResult{
+    double median_ns; //per call
+    double min_ns;
+    double mean_ns;
+    double stddev_ns;
+    double median_cycles;
+    float* results; //what one pass over the inputs gave, for the diff against the baseline
+} BenchResult;
+
+//runs one benchmark: warm up, pick the calls per repetition, then time the repetitions
+void run_bench(Bench* bench, BenchData* d, int reps, double warmup_ms, double rep_ms, BenchResult* result){
+    int n = INPUTS;
+    double start = now_ns();
+    while(now_ns()-start < warmup_ms*1e6) bench->run(d, n);
+
+    //calibrate on a pass after the warm up
+    double t = now_ns();
+    bench->run(d, n);
+    double pass_ns = now_ns()-t;
+    if(pass_ns <= 0) pass_ns = 1;
+    long calls = (long)(rep_ms*1e6/pass_ns*n);
+    if(calls < n) calls = n;
+    if(calls > 1000000000L) calls = 1000000000L;
+
+    double ns[MAX_REPS];
+    double cycles[MAX_REPS];
+    for(int r = 0; r < reps; r++){
+        uint64_t c0 = read_cycles();
+        double t0 = now_ns();
+        bench->run(d, (int)calls);
+        double t1 = now_ns();
+        uint64_t c1 = read_cycles();
+        ns[r] = (t1-t0)/calls;
+        cycles[r] = (double)(c1-c0)/calls;
+    }
+
+    double sum = 0;
+    for(int r = 0; r < reps; r++) sum += ns[r];
+    result->mean_ns = sum/reps;
+    double squares = 0;
+    for(int r = 0; r < reps; r++) squares += (ns[r]-result->mean_ns)*(ns[r]-result->mean_ns);
+    result->stddev_ns = reps > 1 ? sqrt(squares/(reps-1)) : 0;
+    qsort(ns, reps, sizeof(double), compare_doubles);
+    qsort(cycles, reps, sizeof(double), compare_doubles);
+    result->min_ns = ns[0];
+    result->median_ns = reps%2 ? ns[reps/2] : (ns[reps/2-1]+ns[reps/2])/2;
+    result->median_cycles = reps%2 ? cycles[reps/2] : (cycles[reps/2-1]+cycles[reps/2])/2;
+
+    //one clean pass for the results
+    memset(d->out, 0, sizeof(float)*INPUTS*3);
+    bench->run(d, INPUTS);
+    result->results = (float*)malloc(sizeof(float)*INPUTS*3);
+    memcpy(result->results, d->out, sizeof(float)*INPUTS*3);
+}
+
+//largest difference between two passes, relative to the value where it is far from zero
+double max_difference(const float* a, const float* b){
+    double worst = 0;
+    for(int i = 0; i < INPUTS*3; i++){
+        double diff = fabs((double)a[i]-b[i]);
+        double size = fabs((double)b[i]);
+        if(size > 1) diff /= size;
+        if(diff > worst) worst = diff;
+    }
+    return worst;
+}
+
+int main(int argc, char* argv[]){
+    char* reps_option = take_option(&argc, argv, "--reps");
+    char* warmup_option = take_option(&argc, argv, "--warmup");
+    char* rep_ms_option = take_option(&argc, argv, "--rep-ms");
+    const char* filter = argc > 1 ? argv[1] : NULL;
+    int reps = reps_option ? atoi(reps_option) : 15;
+    double warmup_ms = warmup_option ? atof(warmup_option) : 100;
+    double rep_ms = rep_ms_option ? atof(rep_ms_option) : 20;
+    if(reps < 1 || reps > MAX_REPS || warmup_ms < 0 || rep_ms <= 0){
+        printf("Usage: ./bench_primitives [filter] [--reps 1 to %d] [--warmup ms] [--rep-ms ms]\n", MAX_REPS);
+        exit(2);
+    }
+
+    srand(42);
+    BenchData* d = (BenchData*)calloc(1, sizeof(BenchData));
+    fill_bench_data(d);
+    open_cycle_counter();
+
+    printf("%d inputs, %d repetitions of ~%.0f ms after %.0f ms of warm up, cycles from %s\n", INPUTS, reps, rep_ms, warmup_ms, cycle_source());
+    printf("%-36s %-12s %9s %9s %9s %8s %10s %8s %10s\n", "primitive", "variant", "median ns", "min ns", "mean ns", "stddev", "cycles", "speedup", "diff");
+
+    //a variant needs its baseline to compare with, even when the filter only names the variant
+    int selected[NUM_BENCHES] = {0};
+    for(int b = 0; b < NUM_BENCHES; b++){
+        Bench* bench = &benches[b];
+        if(filter != NULL && strstr(bench->name, filter) == NULL && strstr(bench->variant, filter) == NULL) continue;
+        selected[b] = 1;
+        if(bench->baseline >= 0) selected[bench->baseline] = 1;
+    }
+
+    BenchResult results[NUM_BENCHES];
+    memset(results, 0, sizeof(results));
+    for(int b = 0; b < NUM_BENCHES; b++){
+        if(!selected[b]) continue;
+        Bench* bench = &benches[b];
+        run_bench(bench, d, reps, warmup_ms, rep_ms, &results[b]);
+
+        BenchResult* r = &results[b];
+        char speedup[16] = "";
+        char diff[16] = "";
+        if(bench->baseline >= 0){
+            BenchResult* base = &results[bench->baseline];
+            snprintf(speedup, sizeof(speedup), "%.2fx", base->median_ns/r->median_ns);
+            snprintf(diff, sizeof(diff), "%.2g", max_difference(r->results, base->results));
+        }
+        printf("%-36s %-12s %9.2f %9.2f %9.2f %7.1f%% %10.1f %8s %10s\n", bench->name, bench->variant, r->median_ns, r->min_ns, r->mean_ns,
+            100*r->stddev_ns/r->mean_ns, r->median_cycles, speedup, diff);
+    }
+
+    for(int b = 0; b < NUM_BENCHES; b++) free(results[b].results);
+    free(d->out);
+    destroy_scene(d->scene);
+    free(d);
+    if(cycle_fd >= 0) close(cycle_fd);
+    return 0;
+}
@@ -0,0 +1,176 @@
+#ifndef BVH_H
+#define BVH_H
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+//bvh over spheres (center + radius), used for the light influence ranges but works for anything round
+//nodes are stored so that children always come after their parent, node 0 is the root
+typedef struct SphereBVH{
+    int num_nodes;
+    float* bounds; //6 floats per node: min x, y, z then max x, y, z
+    int* nodes; //2 ints per node: first child (internal) or first sphere (leaf), sphere count (0 means internal)
+} SphereBVH;
+
+#define BVH_LEAF_SIZE 4
+#define BVH_STACK_SIZE 32 //median splits keep the depth at log2(n), 32 is plenty
+
+void sphere_bounds(float* centers, float* radii, int* order, int first, int count, float* out){
+    out[0] = out[1] = out[2] = INFINITY;
+    out[3] = out[4] = out[5] = -INFINITY;
+    for(int i = first; i < first+count; i++){
+        int s = order[i];
+        for(int k = 0; k < 3; k++){
+            out[k] = fminf(out[k], centers[s*3+k]-radii[s]);
+            out[k+3] = fmaxf(out[k+3], centers[s*3+k]+radii[s]);
+        }
+    }
+}
+
+//quickselect on the order array so that the k-th element along the axis ends up in place
+void partition_spheres(float* centers, int* order, int first, int last, int k, int axis){
+    while(first < last){
+        float pivot = centers[order[(first+last)/2]*3+axis];
+        int i = first;
+        int j = last;
+        while(i <= j){
+            while(centers[order[i]*3+axis] < pivot) i++;
+            while(centers[order[j]*3+axis] > pivot) j--;
+            if(i <= j){
+                int temp = order[i];
+                order[i] = order[j];
+                order[j] = temp;
+                i++;
+                j--;
+            }
+        }
+        if(k <= j) last = j;
+        else if(k >= i) first = i;
+        else return;
+    }
+}
+
+void build_bvh_node(SphereBVH* bvh, float* centers, float* radii, int* order, int node, int first, int count){
+    sphere_bounds(centers, radii, order, first, count, &bvh->bounds[node*6]);
+
+    if(count <= BVH_LEAF_SIZE){
+        bvh->nodes[node*2] = first;
+        bvh->nodes[node*2+1] = count;
+        return;
+    }
+
+    //split on the longest axis of the centers, not of the bounds, big spheres would skew it otherwise
+    float cmin[3] = {INFINITY, INFINITY, INFINITY};
+    float cmax[3] = {-INFINITY, -INFINITY, -INFINITY};
+    for(int i = first; i < first+count; i++){
+        for(int k = 0; k < 3; k++){
+            cmin[k] = fminf(cmin[k], centers[order[i]*3+k]);
+            cmax[k] = fmaxf(cmax[k], centers[order[i]*3+k]);
+        }
+    }
+    int axis = 0;
+    if(cmax[1]-cmin[1] > cmax[axis]-cmin[axis]) axis = 1;
+    if(cmax[2]-cmin[2] > cmax[axis]-cmin[axis]) axis = 2;
+
+    int half = count/2;
+    partition_spheres(centers, order, first, first+count-1, first+half, axis);
+
+    int left = bvh->num_nodes;
+    bvh->num_nodes += 2;
+    bvh->nodes[node*2] = left;
+    bvh->nodes[node*2+1] = 0;
+
+    build_bvh_node(bvh, centers, radii, order, left, first, half);
+    build_bvh_node(bvh, centers, radii, order, left+1, first+half, count-half);
+}
+
+//order must have room for count ints, it receives the permutation the leaves refer to:
+//leaf spheres are order[first] .. order[first+count-1]
+SphereBVH* build_sphere_bvh(float* centers, float* radii, int* order, int count){
+    SphereBVH* bvh;
+    bvh = (SphereBVH*)malloc(sizeof(SphereBVH));
+
+    int max_nodes = count > 0 ? 2*count-1 : 1;
+    bvh->bounds = (float*)malloc(sizeof(float)*max_nodes*6);
+    bvh->nodes = (int*)malloc(sizeof(int)*max_nodes*2);
+    bvh->num_nodes = 0;
+
+    for(int i = 0; i < count; i++) order[i] = i;
+    if(count == 0) return bvh;
+
+    bvh->num_nodes = 1;
+    build_bvh_node(bvh, centers, radii, order, 0, 0, count);
+
+    return bvh;
+}
+void destroy_sphere_bvh(SphereBVH* bvh){
+    if(bvh == NULL) return;
+
+    free(bvh->bounds);
+    free(bvh->nodes);
+
+    free(bvh);
+    return;
+}
+
+//recomputes the bounds of one node after its spheres moved, for a bvh whose spheres were permuted into leaf
+//order (leaf spheres are centers[first] .. centers[first+count-1]). the topology stays the same, so the children
+//of an internal node have to be refit before it
+void refit_bvh_node(SphereBVH* bvh, float* centers, float* radii, int node){
+    float* out = &bvh->bounds[node*6];
+    int first = bvh->nodes[node*2];
+    int count = bvh->nodes[node*2+1];
+    out[0] = out[1] = out[2] = INFINITY;
+    out[3] = out[4] = out[5] = -INFINITY;
+    if(count == 0){
+        for(int child = first; child < first+2; child++){
+            float* b = &bvh->bounds[child*6];
+            for(int k = 0; k < 3; k++){
+                out[k] = fminf(out[k], b[k]);
+                out[k+3] = fmaxf(out[k+3], b[k+3]);
+            }
+        }
+        return;
+    }
+    for(int s = first; s < first+count; s++){
+        for(int k = 0; k < 3; k++){
+            out[k] = fminf(out[k], centers[s*3+k]-radii[s]);
+            out[k+3] = fmaxf(out[k+3], centers[s*3+k]+radii[s]);
+        }
+    }
+}
+
+//parent[node] for every node, -1 for the root
+void bvh_parents(SphereBVH* bvh, int* parent){
+    if(bvh->num_nodes > 0) parent[0] = -1;
+    for(int node = 0; node < bvh->num_nodes; node++){
+        if(bvh->nodes[node*2+1] != 0) continue;
+        parent[bvh->nodes[node*2]] = node;
+        parent[bvh->nodes[node*2]+1] = node;
+    }
+}
+
+int bvh_node_contains(SphereBVH* bvh, int node, float x, float y, float z){
+    float* b = &bvh->bounds[node*6];
+    return x >= b[0] && y >= b[1] && z >= b[2] && x <= b[3] && y <= b[4] && z <= b[5];
+}
+
+//reorders an array of count elements with stride floats each, so that new[i] = old[order[i]]
+void permute_floats(float* array, int* order, int count, int stride){
+    float* copy = (float*)malloc(sizeof(float)*count*stride);
+    memcpy(copy, array, sizeof(float)*count*stride);
+    for(int i = 0; i < count; i++){
+        for(int k = 0; k < stride; k++) array[i*stride+k] = copy[order[i]*stride+k];
+    }
+    free(copy);
+}
+void permute_ints(int* array, int* order, int count, int stride){
+    int* copy = (int*)malloc(sizeof(int)*count*stride);
+    memcpy(copy, array, sizeof(int)*count*stride);
+    for(int i = 0; i < count; i++){
+        for(int k = 0; k < stride; k++) array[i*stride+k] = copy[order[i]*stride+k];
+    }
+    free(copy);
+}
+
+#endif
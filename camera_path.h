@@ -0,0 +1,154 @@
+#ifndef CAMERA_PATH_H
+#define CAMERA_PATH_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "vector.h"
+
+#define CAMERA_PATH_LINE 256
+#define CAMERA_PATH_SAMPLES 4096
+
+//where the camera is and where it looks. yaw turns around y and pitch tilts up and down, both in degrees,
+//0 and 0 looking down +z like a scene file camera
+typedef struct CameraPose{
+    float position[3];
+    float yaw;
+    float pitch;
+} CameraPose;
+
+//reads the keyframes of a path file, one "x y z yaw pitch" per line, blank lines and lines starting with #
+//are skipped. NULL if the file cannot be read or has no keyframes
+CameraPose* load_camera_path(char* file_path, int* count){
+    FILE* file = fopen(file_path, "r");
+    if(file == NULL){
+        printf("Could not open the camera path %s\n", file_path);
+        return NULL;
+    }
+
+    int capacity = 16;
+    CameraPose* keys = (CameraPose*)malloc(sizeof(CameraPose)*capacity);
+    char line[CAMERA_PATH_LINE];
+    int line_number = 0;
+    *count = 0;
+    while(fgets(line, sizeof(line), file) != NULL){
+        line_number++;
+        char* start = line;
+        while(*start == ' ' || *start == '\t') start++;
+        if(*start == '#' || *start == '\n' || *start == '\r' || *start == '\0') continue;
+
+        CameraPose pose;
+        if(sscanf(start, "%f %f %f %f %f", &pose.position[0], &pose.position[1], &pose.position[2], &pose.yaw, &pose.pitch) != 5){
+            printf("Error in the camera path at line %d: expected x y z yaw pitch\n", line_number);
+            free(keys);
+            fclose(file);
+            return NULL;
+        }
+        if(*count == capacity){
+            capacity *= 2;
+            keys = (CameraPose*)realloc(keys, sizeof(CameraPose)*capacity);
+        }
+        keys[(*count)++] = pose;
+    }
+    fclose(file);
+
+    if(*count == 0){
+        printf("The camera path %s has no keyframes\n", file_path);
+        free(keys);
+        return NULL;
+    }
+    return keys;
+}
+
+//frames poses spread evenly along the keyframes, linearly between each pair
+CameraPose* sample_camera_path(CameraPose* keys, int num_keys, int frames){
+    CameraPose* poses = (CameraPose*)malloc(sizeof(CameraPose)*frames);
+    for(int frame = 0; frame < frames; frame++){
+        float t = frames > 1 ? (float)frame*(num_keys-1)/(frames-1) : 0;
+        int key = (int)t;
+        if(key >= num_keys-1) key = num_keys > 1 ? num_keys-2 : 0;
+        int next = num_keys > 1 ? key+1 : key;
+        float alpha = t-key;
+
+        CameraPose* a = &keys[key];
+        CameraPose* b = &keys[next];
+        for(int k = 0; k < 3; k++) poses[frame].position[k] = a->position[k]*(1-alpha)+b->position[k]*alpha;
+        poses[frame].yaw = a->yaw*(1-alpha)+b->yaw*alpha;
+        poses[frame].pitch = a->pitch*(1-alpha)+b->pitch*alpha;
+    }
+    return poses;
+}
+
+int compare_floats(const void* a, const void* b){
+    float x = *(const float*)a;
+    float y = *(const float*)b;
+    return (x > y)-(x < y);
+}
+
+//median position of the spheres and instances, taken from at most CAMERA_PATH_SAMPLES of them. the median and
+//not the middle of the bounds because a huge ground sphere would drag that far below everything else
+void scene_middle(flattenedScene* fscene, float center[]){
+    long items = (long)fscene->num_objects+fscene->num_instances;
+    center[0] = center[1] = center[2] = 0;
+    if(items == 0) return;
+
+    long samples = items < CAMERA_PATH_SAMPLES ? items : CAMERA_PATH_SAMPLES;
+    float* values = (float*)malloc(sizeof(float)*samples);
+    for(int k = 0; k < 3; k++){
+        for(long i = 0; i < samples; i++){
+            long item = i*items/samples;
+            if(item < fscene->num_objects) values[i] = fscene->objectpos[item*3+k];
+            else values[i] = fscene->instancebounds[(item-fscene->num_objects)*4+k];
+        }
+        qsort(values, samples, sizeof(float), compare_floats);
+        center[k] = values[samples/2];
+    }
+    free(values);
+}
+
+//frames poses on a circle around the middle of the scene, at the height and distance of the scene camera and
+//always looking at the middle. the last frame stops one step short of the first so the sequence loops
+CameraPose* turntable_path(flattenedScene* fscene, int frames){
+    float center[3];
+    scene_middle(fscene, center);
+    float dx = fscene->camera[0]-center[0];
+    float dy = fscene->camera[1]-center[1];
+    float dz = fscene->camera[2]-center[2];
+    float radius = sqrtf(dx*dx+dz*dz);
+    if(radius < 1e-3f) radius = 1;
+    float start = atan2f(dx, -dz);
+    float pitch = atan2f(dy, radius)*180/M_PI;
+
+    CameraPose* poses = (CameraPose*)malloc(sizeof(CameraPose)*frames);
+    for(int frame = 0; frame < frames; frame++){
+        float angle = start+2*M_PI*frame/frames;
+        poses[frame].position[0] = center[0]+radius*sinf(angle);
+        poses[frame].position[1] = fscene->camera[1];
+        poses[frame].position[2] = center[2]-radius*cosf(angle);
+        poses[frame].yaw = -angle*180/M_PI;
+        poses[frame].pitch = pitch;
+    }
+    return poses;
+}
+
+//camera and plane corners of a pose, the plane is half_width by half_height at distance 1 like the one image.c
+//builds from the scene file. pitch is applied before yaw so looking down stays looking down while turning
+void apply_camera_pose(CameraPose* pose, float half_width, float half_height, float camera[], float plane[]){
+    float yaw = pose->yaw*M_PI/180;
+    float pitch = pose->pitch*M_PI/180;
+    float corners[12] = {half_width, half_height, 1, -half_width, half_height, 1, half_width, -half_height, 1, -half_width, -half_height, 1};
+
+    for(int k = 0; k < 3; k++) camera[k] = pose->position[k];
+    for(int corner = 0; corner < 4; corner++){
+        float x = corners[corner*3];
+        float y = corners[corner*3+1];
+        float z = corners[corner*3+2];
+        //same rotations as cam_dir.txt, tilt around x then turn around y
+        float tilted_y = y*cosf(pitch)-z*sinf(pitch);
+        float tilted_z = y*sinf(pitch)+z*cosf(pitch);
+        plane[corner*3] = camera[0]+x*cosf(yaw)+tilted_z*sinf(yaw);
+        plane[corner*3+1] = camera[1]+tilted_y;
+        plane[corner*3+2] = camera[2]-x*sinf(yaw)+tilted_z*cosf(yaw);
+    }
+}
+
+#endif
@@ -0,0 +1,114 @@
+#ifndef CHECKERBOARD_H
+#define CHECKERBOARD_H
+#include <stdlib.h>
+#include <stdint.h>
+#include "vector.h"
+
+//cpu side of the checkerboard mode: every frame only the pixels where x+y+parity is even are traced,
+//the other half is rebuilt from the last frame and the traced neighbours that saw the same sphere
+typedef struct Checkerboard{
+    int width;
+    int height;
+    int samples;
+    int parity;
+    int valid; //0 until a full frame of this size was stored
+    uint32_t* colors; //ARGB8888, row 0 is y = 0 of the renderer
+    Sphere** ids; //sphere seen by each pixel, NULL for the background
+} Checkerboard;
+
+Checkerboard* create_checkerboard(){
+    Checkerboard* checkerboard;
+    checkerboard = (Checkerboard*)malloc(sizeof(Checkerboard));
+
+    checkerboard->width = 0;
+    checkerboard->height = 0;
+    checkerboard->samples = 0;
+    checkerboard->parity = 0;
+    checkerboard->valid = 0;
+    checkerboard->colors = NULL;
+    checkerboard->ids = NULL;
+
+    return checkerboard;
+}
+void destroy_checkerboard(Checkerboard* checkerboard){
+
+    free(checkerboard->colors);
+    free(checkerboard->ids);
+
+    free(checkerboard);
+    return;
+}
+
+//returns 1 when the whole frame has to be traced, the first frame or after the resolution changed
+int checkerboard_begin(Checkerboard* checkerboard, int width, int height, int samples){
+    if(checkerboard->width != width || checkerboard->height != height || checkerboard->samples != samples){
+        free(checkerboard->colors);
+        free(checkerboard->ids);
+        checkerboard->colors = (uint32_t*)malloc(sizeof(uint32_t)*width*height);
+        checkerboard->ids = (Sphere**)malloc(sizeof(Sphere*)*width*height);
+        checkerboard->width = width;
+        checkerboard->height = height;
+        checkerboard->samples = samples;
+        checkerboard->valid = 0;
+    }
+    return !checkerboard->valid;
+}
+
+int checkerboard_traced(Checkerboard* checkerboard, int x, int y){
+    return ((x+y+checkerboard->parity) & 1) == 0;
+}
+
+//fills the pixels that were not traced this frame, if nothing moved the stored value from the
+//last frame is still exact, otherwise average the neighbours that hit the same sphere as that pixel did
+void checkerboard_reconstruct(Checkerboard* checkerboard, int moving){
+    if(!moving) return;
+
+    int width = checkerboard->width;
+    int height = checkerboard->height;
+    for(int y = 0; y < height; y++){
+        for(int x = 0; x < width; x++){
+            if(checkerboard_traced(checkerboard, x, y)) continue;
+
+            int i = y*width+x;
+            int neighbours[4];
+            int count = 0;
+            if(x > 0) neighbours[count++] = i-1;
+            if(x < width-1) neighbours[count++] = i+1;
+            if(y > 0) neighbours[count++] = i-width;
+            if(y < height-1) neighbours[count++] = i+width;
+
+            float same[3] = {0, 0, 0};
+            float all[3] = {0, 0, 0};
+            int same_count = 0;
+            for(int n = 0; n < count; n++){
+                uint32_t color = checkerboard->colors[neighbours[n]];
+                for(int c = 0; c < 3; c++){
+                    float channel = (color >> (16-8*c)) & 0xFF;
+                    all[c] += channel;
+                    if(checkerboard->ids[neighbours[n]] == checkerboard->ids[i]) same[c] += channel;
+                }
+                if(checkerboard->ids[neighbours[n]] == checkerboard->ids[i]) same_count++;
+            }
+
+            float result[3];
+            for(int c = 0; c < 3; c++){
+                if(same_count > 0) result[c] = same[c]/same_count;
+                else result[c] = all[c]/count;
+            }
+            if(same_count == count){
+                //inside the same sphere, the last frame still helps keeping the detail
+                uint32_t previous = checkerboard->colors[i];
+                for(int c = 0; c < 3; c++) result[c] = (result[c] + ((previous >> (16-8*c)) & 0xFF))*0.5f;
+            }
+
+            checkerboard->colors[i] = (255u << 24) | ((uint32_t)result[0] << 16) | ((uint32_t)result[1] << 8) | (uint32_t)result[2];
+        }
+    }
+}
+
+void checkerboard_end(Checkerboard* checkerboard){
+    checkerboard->valid = 1;
+    checkerboard->parity ^= 1;
+}
+
+#endif
@@ -0,0 +1,595 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <time.h>
+#include "vector.h"
+#include "utils.h"
+#include "raytracer.h"
+#include "tonemap.h"
+
+//renders a chunked scene (see scene_chunks.h) on the cpu with a bounded amount of it in memory.
+//rays are traced in batches: every ray of the batch is sorted into the chunks its path crosses, then the
+//chunks are visited one after the other and only the rays waiting on the current chunk are tested against
+//it, so each chunk is brought in once per batch instead of once per ray. the shading is the one of the
+//opencl kernel (render.txt): one reflection bounce and a shadow ray per light
+//usage: ./chunk_render scene.chunks output.ppm [--cache-mb n] [--size WxH] [--samples 1-4] [--sweep]
+//       [--tonemap clamp|reinhard|filmic] [--exposure f] [--srgb] [--dither]
+
+#define RAY_BATCH (1<<20) //rays sorted against the chunks at a time, also the size of the shadow ray queue
+
+typedef struct ChunkRay{
+    float origin[3];
+    float dir[3];
+    float t; //closest hit so far, INFINITY before any. shadow rays only look up to 1 and set it to 0 once blocked
+    int chunk; //chunk and sphere that were hit, -1 for none. shadow rays leave from this sphere and skip it
+    int sphere;
+} ChunkRay;
+
+//what shading needs from the sphere that was hit, copied while its chunk is resident
+typedef struct ChunkHit{
+    float center[3];
+    float color[3];
+    int material;
+} ChunkHit;
+
+//one ray waiting on a chunk, entry is where it enters the chunk bounds
+typedef struct ChunkEntry{
+    int chunk;
+    int ray;
+    float entry;
+} ChunkEntry;
+
+typedef struct ChunkRenderer{
+    ChunkedScene* cscene;
+    ChunkCache* cache;
+    SphereBVH* top; //over the chunk bounds, leaves refer to top_order
+    int* top_order;
+    int* chunk_order; //front to back from the camera
+    int passes; //every other pass visits the chunks back to front, starting with the ones still resident
+    ChunkEntry* entries;
+    ChunkEntry* sorted;
+    size_t entry_capacity;
+    int* chunk_start; //per chunk, into sorted
+} ChunkRenderer;
+
+double now_ms(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1000.0 + ts.tv_nsec/1000000.0;
+}
+
+//where the ray enters the box between 0 and tmax, INFINITY if it does not
+float ray_box_entry(float* origin, float* inverse, float* box, float tmax){
+    float tnear = 0;
+    float tfar = tmax;
+    for(int k = 0; k < 3; k++){
+        float t1 = (box[k]-origin[k])*inverse[k];
+        float t2 = (box[k+3]-origin[k])*inverse[k];
+        tnear = fmaxf(tnear, fminf(t1, t2));
+        tfar = fminf(tfar, fmaxf(t1, t2));
+    }
+    return tnear <= tfar ? tnear : INFINITY;
+}
+
+int compare_distances(const void* a, const void* b){
+    float da = ((float*)a)[0];
+    float db = ((float*)b)[0];
+    return (da > db)-(da < db);
+}
+
+ChunkRenderer* create_chunk_renderer(ChunkedScene* cscene, size_t budget){
+    ChunkRenderer* renderer;
+    renderer = (ChunkRenderer*)malloc(sizeof(ChunkRenderer));
+
+    int chunks = cscene->header->num_chunks;
+    renderer->cscene = cscene;
+    renderer->cache = create_chunk_cache(cscene, budget);
+    renderer->passes = 0;
+
+    //the top bvh is built over spheres around the chunk boxes, then its bounds are tightened to the boxes
+    float* centers = (float*)malloc(sizeof(float)*3*(chunks+1));
+    float* radii = (float*)malloc(sizeof(float)*(chunks+1));
+    for(int c = 0; c < chunks; c++){
+        float* b = cscene->chunks[c].bounds;
+        float half[3];
+        for(int k = 0; k < 3; k++){
+            centers[c*3+k] = (b[k]+b[k+3])/2;
+            half[k] = (b[k+3]-b[k])/2;
+        }
+        radii[c] = sqrtf(half[0]*half[0]+half[1]*half[1]+half[2]*half[2]);
+    }
+    renderer->top_order = (int*)malloc(sizeof(int)*(chunks+1));
+    renderer->top = build_sphere_bvh(centers, radii, renderer->top_order, chunks);
+    for(int node = renderer->top->num_nodes-1; node >= 0; node--){
+        float* out = &renderer->top->bounds[node*6];
+        int first = renderer->top->nodes[node*2];
+        int count = renderer->top->nodes[node*2+1];
+        for(int k = 0; k < 3; k++){
+            out[k] = INFINITY;
+            out[k+3] = -INFINITY;
+        }
+        //children come after their parent, so they are already tight
+        for(int i = 0; i < (count == 0 ? 2 : count); i++){
+            float* b = count == 0 ? &renderer->top->bounds[(first+i)*6] : cscene->chunks[renderer->top_order[first+i]].bounds;
+            for(int k = 0; k < 3; k++){
+                out[k] = fminf(out[k], b[k]);
+                out[k+3] = fmaxf(out[k+3], b[k+3]);
+            }
+        }
+    }
+
+    //distance from the camera to the closest point of each chunk
+    float* distances = (float*)malloc(sizeof(float)*2*(chunks+1));
+    for(int c = 0; c < chunks; c++){
+        float* b = cscene->chunks[c].bounds;
+        float squared = 0;
+        for(int k = 0; k < 3; k++){
+            float d = fmaxf(fmaxf(b[k]-cscene->header->camera[k], cscene->header->camera[k]-b[k+3]), 0);
+            squared += d*d;
+        }
+        distances[c*2] = squared;
+        memcpy(&distances[c*2+1], &c, sizeof(int));
+    }
+    qsort(distances, chunks, sizeof(float)*2, compare_distances);
+    renderer->chunk_order = (int*)malloc(sizeof(int)*(chunks+1));
+    for(int c = 0; c < chunks; c++) memcpy(&renderer->chunk_order[c], &distances[c*2+1], sizeof(int));
+
+    renderer->entry_capacity = RAY_BATCH;
+    renderer->entries = (ChunkEntry*)malloc(sizeof(ChunkEntry)*renderer->entry_capacity);
+    renderer->sorted = (ChunkEntry*)malloc(sizeof(ChunkEntry)*renderer->entry_capacity);
+    renderer->chunk_start = (int*)malloc(sizeof(int)*(chunks+1));
+
+    free(distances);
+    free(centers);
+    free(radii);
+    return renderer;
+}
+
+void destroy_chunk_renderer(ChunkRenderer* renderer){
+    destroy_chunk_cache(renderer->cache);
+    destroy_sphere_bvh(renderer->top);
+    free(renderer->top_order);
+    free(renderer->chunk_order);
+    free(renderer->entries);
+    free(renderer->sorted);
+    free(renderer->chunk_start);
+
+    free(renderer);
+    return;
+}
+
+//fills renderer->sorted with the (chunk, ray) pairs of the batch grouped by chunk, chunk_start[c] is the
+//first one of chunk c and chunk_start[c+1] the end. returns the amount of pairs
+size_t sort_rays_into_chunks(ChunkRenderer* renderer, ChunkRay* rays, int count){
+    SphereBVH* top = renderer->top;
+    int chunks = renderer->cscene->header->num_chunks;
+    size_t num_entries = 0;
+    for(int r = 0; r < count; r++){
+        ChunkRay* ray = &rays[r];
+        if(ray->t <= 0 || top->num_nodes == 0) continue;
+        float inverse[3] = {1/ray->dir[0], 1/ray->dir[1], 1/ray->dir[2]};
+
+        int stack[BVH_STACK_SIZE];
+        int size = 0;
+        stack[size++] = 0;
+        while(size > 0){
+            int node = stack[--size];
+            float entry = ray_box_entry(ray->origin, inverse, &top->bounds[node*6], ray->t);
+            if(entry == INFINITY) continue;
+
+            int first = top->nodes[node*2];
+            int leaf_count = top->nodes[node*2+1];
+            if(leaf_count == 0){
+                stack[size++] = first;
+                stack[size++] = first+1;
+                continue;
+            }
+            for(int i = first; i < first+leaf_count; i++){
+                int chunk = renderer->top_order[i];
+                entry = ray_box_entry(ray->origin, inverse, renderer->cscene->chunks[chunk].bounds, ray->t);
+                if(entry == INFINITY) continue;
+
+                if(num_entries == renderer->entry_capacity){
+                    renderer->entry_capacity *= 2;
+                    renderer->entries = (ChunkEntry*)realloc(renderer->entries, sizeof(ChunkEntry)*renderer->entry_capacity);
+                    renderer->sorted = (ChunkEntry*)realloc(renderer->sorted, sizeof(ChunkEntry)*renderer->entry_capacity);
+                }
+                ChunkEntry* e = &renderer->entries[num_entries++];
+                e->chunk = chunk;
+                e->ray = r;
+                e->entry = entry;
+            }
+        }
+    }
+
+    //counting sort by chunk, the rays of a chunk stay in screen order which keeps neighbouring rays together
+    memset(renderer->chunk_start, 0, sizeof(int)*(chunks+1));
+    for(size_t i = 0; i < num_entries; i++) renderer->chunk_start[renderer->entries[i].chunk+1]++;
+    for(int c = 0; c < chunks; c++) renderer->chunk_start[c+1] += renderer->chunk_start[c];
+    for(size_t i = 0; i < num_entries; i++){
+        //chunk_start[c] is moved forward while filling and ends where chunk c+1 starts
+        renderer->sorted[renderer->chunk_start[renderer->entries[i].chunk]++] = renderer->entries[i];
+    }
+    for(int c = chunks; c > 0; c--) renderer->chunk_start[c] = renderer->chunk_start[c-1];
+    renderer->chunk_start[0] = 0;
+
+    return num_entries;
+}
+
+//closest hit of ray inside one chunk, hit is only written when it gets closer
+void intersect_chunk(ChunkArrays* arrays, int chunk, ChunkRay* ray, ChunkHit* hit){
+    float inverse[3] = {1/ray->dir[0], 1/ray->dir[1], 1/ray->dir[2]};
+    vector3D dir = {ray->dir[0], ray->dir[1], ray->dir[2]};
+    float a = dotProduct(&dir, &dir);
+
+    int stack[BVH_STACK_SIZE];
+    int size = 0;
+    stack[size++] = 0;
+    while(size > 0){
+        int node = stack[--size];
+        if(ray_box_entry(ray->origin, inverse, &arrays->bounds[node*6], ray->t) == INFINITY) continue;
+
+        int first = arrays->nodes[node*2];
+        int count = arrays->nodes[node*2+1];
+        if(count == 0){
+            stack[size++] = first;
+            stack[size++] = first+1;
+            continue;
+        }
+        for(int s = first; s < first+count; s++){
+            vector3D oc = {ray->origin[0]-arrays->pos[s*3], ray->origin[1]-arrays->pos[s*3+1], ray->origin[2]-arrays->pos[s*3+2]};
+            float b = 2*dotProduct(&oc, &dir);
+            float c = dotProduct(&oc, &oc)-arrays->radius[s]*arrays->radius[s];
+            float t = quadraticFormula(a, b, c);
+
+            //same as the kernel, hits closer than 1 are ignored
+            if(t >= 1 && t < ray->t){
+                ray->t = t;
+                ray->chunk = chunk;
+                ray->sphere = s;
+                memcpy(hit->center, &arrays->pos[s*3], sizeof(float)*3);
+                memcpy(hit->color, &arrays->color[s*3], sizeof(float)*3);
+                hit->material = arrays->material[s];
+            }
+        }
+    }
+}
+
+//sets ray->t to 0 if something in the chunk is between the ray origin and origin+dir
+void occlude_chunk(ChunkArrays* arrays, int chunk, ChunkRay* ray){
+    float inverse[3] = {1/ray->dir[0], 1/ray->dir[1], 1/ray->dir[2]};
+    vector3D dir = {ray->dir[0], ray->dir[1], ray->dir[2]};
+    float a = dotProduct(&dir, &dir);
+
+    int stack[BVH_STACK_SIZE];
+    int size = 0;
+    stack[size++] = 0;
+    while(size > 0){
+        int node = stack[--size];
+        if(ray_box_entry(ray->origin, inverse, &arrays->bounds[node*6], 1) == INFINITY) continue;
+
+        int first = arrays->nodes[node*2];
+        int count = arrays->nodes[node*2+1];
+        if(count == 0){
+            stack[size++] = first;
+            stack[size++] = first+1;
+            continue;
+        }
+        for(int s = first; s < first+count; s++){
+            if(chunk == ray->chunk && s == ray->sphere) continue;
+
+            vector3D oc = {ray->origin[0]-arrays->pos[s*3], ray->origin[1]-arrays->pos[s*3+1], ray->origin[2]-arrays->pos[s*3+2]};
+            float b = 2*dotProduct(&oc, &dir);
+            float c = dotProduct(&oc, &oc)-arrays->radius[s]*arrays->radius[s];
+            float t = quadraticFormula(a, b, c);
+
+            if(0 < t && t < 1){
+                ray->t = 0;
+                return;
+            }
+        }
+    }
+}
+
+//hits is NULL for shadow rays
+void trace_chunk_rays(ChunkRenderer* renderer, ChunkRay* rays, ChunkHit* hits, int count){
+    int chunks = renderer->cscene->header->num_chunks;
+    for(int start = 0; start < count; start += RAY_BATCH){
+        int batch = count-start < RAY_BATCH ? count-start : RAY_BATCH;
+        ChunkRay* batch_rays = &rays[start];
+        sort_rays_into_chunks(renderer, batch_rays, batch);
+
+        int reverse = renderer->passes++ & 1;
+        for(int i = 0; i < chunks; i++){
+            int chunk = renderer->chunk_order[reverse ? chunks-1-i : i];
+            int first = renderer->chunk_start[chunk];
+            int last = renderer->chunk_start[chunk+1];
+            if(first == last) continue;
+
+            //rays that found a hit in front of the chunk do not need it at all
+            int needed = 0;
+            for(int e = first; e < last && !needed; e++) needed = renderer->sorted[e].entry < batch_rays[renderer->sorted[e].ray].t;
+            if(!needed) continue;
+
+            ChunkArrays arrays;
+            acquire_chunk(renderer->cache, chunk, &arrays);
+            for(int e = first; e < last; e++){
+                ChunkEntry* entry = &renderer->sorted[e];
+                ChunkRay* ray = &batch_rays[entry->ray];
+                if(entry->entry >= ray->t) continue;
+
+                if(hits != NULL) intersect_chunk(&arrays, chunk, ray, &hits[start+entry->ray]);
+                else occlude_chunk(&arrays, chunk, ray);
+            }
+        }
+    }
+}
+
+//kernel's check_collision_color for every ray that hit something, colors gets 3 floats per ray.
+//the shadow rays of all the hits and lights are queued and traced RAY_BATCH at a time
+void shade_chunk_hits(ChunkRenderer* renderer, ChunkRay* rays, ChunkHit* hits, int count, float* colors){
+    ChunkedScene* cscene = renderer->cscene;
+    SceneChunksHeader* header = cscene->header;
+    ChunkRay* shadow = (ChunkRay*)malloc(sizeof(ChunkRay)*RAY_BATCH);
+    int* shadow_ray = (int*)malloc(sizeof(int)*RAY_BATCH);
+    float* shadow_color = (float*)malloc(sizeof(float)*3*RAY_BATCH);
+    int queued = 0;
+
+    vector3D camera = {header->camera[0], header->camera[1], header->camera[2]};
+    vector3D* normalized_camera = normalizeVector(&camera);
+
+    memset(colors, 0, sizeof(float)*3*count);
+    for(int r = 0; r <= count; r++){
+        //flush before the queue could overflow with the lights of this hit, and once at the end
+        if(queued > 0 && (r == count || queued+(int)header->num_lights > RAY_BATCH)){
+            trace_chunk_rays(renderer, shadow, NULL, queued);
+            for(int i = 0; i < queued; i++){
+                if(shadow[i].t == 0) continue;
+                for(int k = 0; k < 3; k++) colors[shadow_ray[i]*3+k] += shadow_color[i*3+k];
+            }
+            queued = 0;
+        }
+        if(r == count || rays[r].chunk < 0) continue;
+
+        ChunkRay* ray = &rays[r];
+        ChunkHit* hit = &hits[r];
+        float p[3];
+        for(int k = 0; k < 3; k++) p[k] = ray->origin[k]+ray->dir[k]*ray->t;
+        vector3D sub = {p[0]-hit->center[0], p[1]-hit->center[1], p[2]-hit->center[2]};
+        vector3D* normalized = normalizeVector(&sub);
+        vector3D view = {normalized_camera->x-p[0], normalized_camera->y-p[1], normalized_camera->z-p[2]};
+        int material = hit->material;
+
+        for(uint32_t l = 0; l < header->num_lights; l++){
+            float* light = &cscene->lightpos[l*3];
+            vector3D to_light = {light[0]-p[0], light[1]-p[1], light[2]-p[2]};
+            float distance = getMagnitude(&to_light);
+            if(l >= header->num_global_lights && distance >= cscene->lightrange[l]) continue;
+
+            //the kernel tests the shadow first, but a light behind the surface adds nothing either way
+            vector3D* L = normalizeVector(&to_light);
+            float dot = dotProduct(L, normalized);
+            if(dot < 0){
+                free(L);
+                continue;
+            }
+            vector3D reflectance = {normalized->x*2*dot-L->x, normalized->y*2*dot-L->y, normalized->z*2*dot-L->z};
+            float dot2 = powf(dotProduct(&reflectance, &view), cscene->materialalbedo[material]);
+            float attenuation = lightAttenuation(distance, cscene->lightrange[l]);
+            free(L);
+
+            for(int k = 0; k < 3; k++){
+                float diffuse = clamp(cscene->lightdiffuse[l*3+k]*cscene->materialdiffuse[material*3+k]*dot*attenuation, 0, 1);
+                float specular = clamp(cscene->lightspecular[l*3+k]*cscene->materialspecular[material*3+k]*dot2*attenuation, 0, 1);
+                shadow_color[queued*3+k] = diffuse+specular;
+            }
+            ChunkRay* s = &shadow[queued];
+            memcpy(s->origin, p, sizeof(p));
+            s->dir[0] = to_light.x;
+            s->dir[1] = to_light.y;
+            s->dir[2] = to_light.z;
+            s->t = 1;
+            s->chunk = ray->chunk;
+            s->sphere = ray->sphere;
+            shadow_ray[queued++] = r;
+        }
+        free(normalized);
+
+        for(int k = 0; k < 3; k++){
+            colors[r*3+k] += cscene->materialambient[material*3+k]*header->ALI[k] + hit->color[k]*0.2f;
+        }
+    }
+    for(int i = 0; i < count*3; i++) colors[i] = clamp(colors[i], 0, 1);
+
+    free(normalized_camera);
+    free(shadow);
+    free(shadow_ray);
+    free(shadow_color);
+}
+
+//same as get_origin in the kernel, sample 0 is the pixel corner
+void chunk_sample_origin(float* plane, int x, int y, int sample, int width, int height, float* out){
+    float alpha = ((float)x + (sample & 1 ? 0.5f : 0))/width;
+    float beta = ((float)y + (sample & 2 ? 0.5f : 0))/height;
+    for(int k = 0; k < 3; k++){
+        float t = plane[k]*(1-alpha)+plane[3+k]*alpha;
+        float b = plane[6+k]*(1-alpha)+plane[9+k]*alpha;
+        out[k] = t*(1-beta)+b*beta;
+    }
+}
+
+//accumulates the frame into pixels (3 floats per pixel), each sample is a primary pass, a reflection pass
+//and the shadow passes of both
+void render_chunked(ChunkRenderer* renderer, int width, int height, int samples, float* pixels){
+    SceneChunksHeader* header = renderer->cscene->header;
+    int count = width*height;
+    ChunkRay* rays = (ChunkRay*)malloc(sizeof(ChunkRay)*count);
+    ChunkRay* bounces = (ChunkRay*)malloc(sizeof(ChunkRay)*count);
+    ChunkHit* hits = (ChunkHit*)malloc(sizeof(ChunkHit)*count);
+    ChunkHit* bounce_hits = (ChunkHit*)malloc(sizeof(ChunkHit)*count);
+    float* colors = (float*)malloc(sizeof(float)*3*count);
+    float* bounce_colors = (float*)malloc(sizeof(float)*3*count);
+
+    //plane corners are relative to the camera, same as image.c
+    float plane[12];
+    for(int corner = 0; corner < 4; corner++){
+        for(int k = 0; k < 3; k++) plane[corner*3+k] = header->plane[corner*3+k]+header->camera[k]+(k == 2);
+    }
+
+    memset(pixels, 0, sizeof(float)*3*count);
+    for(int sample = 0; sample < samples; sample++){
+        for(int i = 0; i < count; i++){
+            ChunkRay* ray = &rays[i];
+            chunk_sample_origin(plane, i % width, i/width, sample, width, height, ray->origin);
+            for(int k = 0; k < 3; k++) ray->dir[k] = ray->origin[k]-header->camera[k];
+            ray->t = INFINITY;
+            ray->chunk = -1;
+        }
+        trace_chunk_rays(renderer, rays, hits, count);
+        shade_chunk_hits(renderer, rays, hits, count, colors);
+
+        //the kernel bounces 3 times but scales the last one by depth/2 = 0, so only one reflection shows
+        for(int i = 0; i < count; i++){
+            ChunkRay* ray = &rays[i];
+            ChunkRay* bounce = &bounces[i];
+            bounce->t = ray->chunk < 0 ? 0 : INFINITY;
+            bounce->chunk = -1;
+            if(ray->chunk < 0) continue;
+
+            vector3D inverse = {-ray->dir[0], -ray->dir[1], -ray->dir[2]};
+            vector3D* V = normalizeVector(&inverse);
+            float p[3];
+            for(int k = 0; k < 3; k++) p[k] = ray->origin[k]+ray->dir[k]*ray->t;
+            vector3D sub = {p[0]-hits[i].center[0], p[1]-hits[i].center[1], p[2]-hits[i].center[2]};
+            vector3D* N = normalizeVector(&sub);
+            float dot = dotProduct(V, N);
+            memcpy(bounce->origin, p, sizeof(p));
+            bounce->dir[0] = N->x*2*dot-V->x;
+            bounce->dir[1] = N->y*2*dot-V->y;
+            bounce->dir[2] = N->z*2*dot-V->z;
+            free(V);
+            free(N);
+        }
+        trace_chunk_rays(renderer, bounces, bounce_hits, count);
+        shade_chunk_hits(renderer, bounces, bounce_hits, count, bounce_colors);
+
+        for(int i = 0; i < count; i++){
+            if(rays[i].chunk < 0) continue;
+            float* reflectivity = &renderer->cscene->materialreflectivity[bounce_hits[i].material*3];
+            for(int k = 0; k < 3; k++){
+                float color = colors[i*3+k];
+                if(bounces[i].chunk >= 0) color = clamp(color+bounce_colors[i*3+k]*reflectivity[k], 0, 1);
+                pixels[i*3+k] += color/samples;
+            }
+        }
+    }
+
+    free(rays);
+    free(bounces);
+    free(hits);
+    free(bounce_hits);
+    free(colors);
+    free(bounce_colors);
+}
+
+int write_ppm(char* file_path, float* pixels, int width, int height, ToneSettings* tone){
+    FILE* file = fopen(file_path, "wb");
+    if(file == NULL){
+        printf("Could not open %s for writing\n", file_path);
+        return 0;
+    }
+    fprintf(file, "P6\n%d %d\n255\n", width, height);
+    unsigned char* rgb = (unsigned char*)malloc((size_t)width*height*3);
+    ToneMapper* tone_mapper = create_tone_mapper(*tone);
+    tone_map_rgb(tone_mapper, pixels, 1, width, height, rgb);
+    destroy_tone_mapper(tone_mapper);
+    fwrite(rgb, 1, (size_t)width*height*3, file);
+    free(rgb);
+
+    int ok = !ferror(file);
+    if(fclose(file) != 0) ok = 0;
+    if(!ok) printf("Error writing %s\n", file_path);
+    return ok;
+}
+
+//bytes this process really read from the disk, page cache hits not included. 0 where /proc/self/io is missing
+long long disk_read_bytes(){
+    FILE* file = fopen("/proc/self/io", "r");
+    if(file == NULL) return 0;
+    char line[128];
+    long long bytes = 0;
+    while(fgets(line, sizeof(line), file) != NULL){
+        if(sscanf(line, "read_bytes: %lld", &bytes) == 1) break;
+    }
+    fclose(file);
+    return bytes;
+}
+
+//one render with the given cache budget, prints what it cost
+void render_with_budget(ChunkedScene* cscene, size_t budget, int width, int height, int samples, float* pixels){
+    ChunkRenderer* renderer = create_chunk_renderer(cscene, budget);
+    long long disk = disk_read_bytes();
+    double start = now_ms();
+
+    render_chunked(renderer, width, height, samples, pixels);
+
+    double ms = now_ms()-start;
+    ChunkCache* cache = renderer->cache;
+    printf("%10.1f %10ld %12.1f %12.1f %12.1f %10.2f\n", budget/1e6, cache->loads, cache->bytes_loaded/1e6,
+        cache->peak_bytes/1e6, (disk_read_bytes()-disk)/1e6, ms/1000);
+    destroy_chunk_renderer(renderer);
+}
+
+int main(int argc, char* argv[]){
+    char* cache_option = take_option(&argc, argv, "--cache-mb");
+    char* size_option = take_option(&argc, argv, "--size");
+    char* samples_option = take_option(&argc, argv, "--samples");
+    int sweep = take_flag(&argc, argv, "--sweep");
+    ToneSettings tone;
+    int tone_valid = take_tone_options(&argc, argv, &tone);
+    if(argc != 3 || !tone_valid){
+        printf("Usage: %s <scene.chunks> <output.ppm> [--cache-mb n] [--size WxH] [--samples 1-4] [--sweep]\n"
+        "       [--tonemap clamp|reinhard|filmic] [--exposure f] [--srgb] [--dither]\n", argv[0]);
+        exit(2);
+    }
+
+    int width = 1080;
+    int height = 720;
+    if(size_option != NULL && sscanf(size_option, "%dx%d", &width, &height) != 2){
+        printf("Error: --size takes WIDTHxHEIGHT, for example 1920x1080\n");
+        exit(2);
+    }
+    int samples = samples_option ? atoi(samples_option) : 1;
+    if(width < 1 || height < 1 || samples < 1 || samples > 4){
+        printf("Error: the size must be positive and the samples between 1 and 4\n");
+        exit(2);
+    }
+
+    ChunkedScene* cscene = map_chunked_scene(argv[1]);
+    if(cscene == NULL) exit(1);
+
+    uint64_t chunk_bytes = 0;
+    for(uint32_t c = 0; c < cscene->header->num_chunks; c++) chunk_bytes += cscene->chunks[c].size;
+    printf("Mapped %s: %lu spheres in %u chunks, %.1f MB of chunks, %u lights\n", argv[1],
+        (unsigned long)cscene->header->num_spheres, cscene->header->num_chunks, chunk_bytes/1e6, cscene->header->num_lights);
+
+    float* pixels = (float*)malloc(sizeof(float)*3*width*height);
+    printf("%10s %10s %12s %12s %12s %10s\n", "cache MB", "loads", "loaded MB", "peak MB", "disk MB", "seconds");
+    if(sweep){
+        //from everything resident down to a 32nd of the chunks
+        for(int divisor = 1; divisor <= 32; divisor *= 2){
+            render_with_budget(cscene, chunk_bytes/divisor, width, height, samples, pixels);
+        }
+    }else{
+        size_t budget = cache_option ? (size_t)(atof(cache_option)*1e6) : 256*1000*1000;
+        render_with_budget(cscene, budget, width, height, samples, pixels);
+    }
+
+    int ok = write_ppm(argv[2], pixels, width, height, &tone);
+    if(ok) printf("Image saved as %s\n", argv[2]);
+
+    free(pixels);
+    destroy_chunked_scene(cscene);
+    return ok ? 0 : 1;
+}
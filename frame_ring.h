@@ -0,0 +1,213 @@
+#ifndef FRAME_RING_H
+#define FRAME_RING_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+//the frames of the live modes in posix shared memory (--shm name), for other programs to read without copies.
+//one producer, the renderer, and one consumer share a ring of slots through two counters: the renderer
+//publishes a frame by bumping write_index and the consumer hands its slot back by bumping read_index. the
+//renderer never waits, a frame that finds every slot still unread is dropped and counted instead
+//the layout below is the whole interface, a consumer in any language only needs to map the object
+
+#define FRAME_RING_MAGIC 0x474e4952 //"RING"
+#define FRAME_RING_VERSION 1
+#define FRAME_RING_SLOTS 4
+#define FRAME_RING_ALIGN 64
+
+//the only format so far, what the SDL texture holds: a uint32 0xAARRGGBB per pixel, so B G R A in memory on
+//little endian machines, rows from the top of the image down
+#define FRAME_RING_ARGB8888 1
+
+typedef struct FrameRingHeader{
+    uint32_t magic; //written last, a consumer that sees it sees the rest
+    uint32_t version;
+    uint32_t format;
+    uint32_t num_slots;
+    uint32_t max_width;
+    uint32_t max_height;
+    uint64_t slot_size; //bytes from one slot to the next, its FrameRingSlot included
+    uint64_t data_offset; //where the first slot starts
+    _Atomic uint64_t write_index; //frames published so far, the next one goes to slot write_index % num_slots
+    _Atomic uint64_t read_index; //frames the consumer is done with, slots from here to write_index are its own
+    _Atomic uint64_t dropped; //frames the renderer had no free slot for
+} FrameRingHeader;
+
+//in front of the pixels of every slot
+typedef struct FrameRingSlot{
+    uint64_t sequence; //frame number of the renderer, gaps are dropped frames
+    uint64_t timestamp_ns; //CLOCK_MONOTONIC when it was published
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride; //bytes per row
+    uint32_t reserved;
+} FrameRingSlot;
+
+typedef struct FrameRing{
+    char name[256];
+    int owner; //the renderer, it removes the object when done
+    FrameRingHeader* header;
+    size_t size;
+    uint64_t frames; //every frame the renderer offered, published or not
+} FrameRing;
+
+size_t frame_ring_round(size_t size){
+    return (size+FRAME_RING_ALIGN-1)/FRAME_RING_ALIGN*FRAME_RING_ALIGN;
+}
+
+FrameRingSlot* frame_ring_slot(FrameRing* ring, uint64_t index){
+    FrameRingHeader* header = ring->header;
+    return (FrameRingSlot*)((uint8_t*)header+header->data_offset+(index % header->num_slots)*header->slot_size);
+}
+
+uint8_t* frame_ring_pixels(FrameRingSlot* slot){
+    return (uint8_t*)slot+frame_ring_round(sizeof(FrameRingSlot));
+}
+
+//shm_open wants the name to start with a slash
+void frame_ring_name(const char* name, char* full_name, size_t size){
+    snprintf(full_name, size, "%s%s", name[0] == '/' ? "" : "/", name);
+}
+
+//the renderer side, slots for frames up to max_width x max_height. a ring left behind under the same name is
+//replaced, consumers still mapping it have to open the new one. NULL on failure
+FrameRing* create_frame_ring(const char* name, int max_width, int max_height){
+    FrameRing* ring = (FrameRing*)calloc(1, sizeof(FrameRing));
+    frame_ring_name(name, ring->name, sizeof(ring->name));
+    ring->owner = 1;
+
+    const size_t data_offset = frame_ring_round(sizeof(FrameRingHeader));
+    const size_t slot_size = frame_ring_round(sizeof(FrameRingSlot))+frame_ring_round((size_t)max_width*max_height*4);
+    ring->size = data_offset+slot_size*FRAME_RING_SLOTS;
+
+    shm_unlink(ring->name);
+    int fd = shm_open(ring->name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if(fd < 0 || ftruncate(fd, ring->size) != 0){
+        printf("Could not create the shared memory %s\n", ring->name);
+        if(fd >= 0) close(fd);
+        free(ring);
+        return NULL;
+    }
+    void* mapping = mmap(NULL, ring->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(mapping == MAP_FAILED){
+        printf("Could not map the shared memory %s\n", ring->name);
+        shm_unlink(ring->name);
+        free(ring);
+        return NULL;
+    }
+
+    //ftruncate already zeroed everything, the indices included
+    FrameRingHeader* header = (FrameRingHeader*)mapping;
+    header->version = FRAME_RING_VERSION;
+    header->format = FRAME_RING_ARGB8888;
+    header->num_slots = FRAME_RING_SLOTS;
+    header->max_width = max_width;
+    header->max_height = max_height;
+    header->slot_size = slot_size;
+    header->data_offset = data_offset;
+    atomic_thread_fence(memory_order_release);
+    header->magic = FRAME_RING_MAGIC;
+    ring->header = header;
+    return ring;
+}
+
+//the pixels to render the next width x height frame into, rows of width*4 bytes. NULL when the consumer has
+//not handed back any slot, the frame is then counted as dropped and only shown in the window
+uint8_t* frame_ring_begin(FrameRing* ring, int width, int height){
+    FrameRingHeader* header = ring->header;
+    ring->frames++;
+    uint64_t write = atomic_load_explicit(&header->write_index, memory_order_relaxed);
+    uint64_t read = atomic_load_explicit(&header->read_index, memory_order_acquire);
+    if(write-read >= header->num_slots || (uint32_t)width > header->max_width || (uint32_t)height > header->max_height){
+        atomic_fetch_add_explicit(&header->dropped, 1, memory_order_relaxed);
+        return NULL;
+    }
+
+    FrameRingSlot* slot = frame_ring_slot(ring, write);
+    slot->width = width;
+    slot->height = height;
+    slot->stride = width*4;
+    return frame_ring_pixels(slot);
+}
+
+//hands the frame frame_ring_begin returned to the consumer
+void frame_ring_publish(FrameRing* ring){
+    FrameRingHeader* header = ring->header;
+    uint64_t write = atomic_load_explicit(&header->write_index, memory_order_relaxed);
+    FrameRingSlot* slot = frame_ring_slot(ring, write);
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    slot->sequence = ring->frames-1;
+    slot->timestamp_ns = (uint64_t)now.tv_sec*1000000000ull+now.tv_nsec;
+    atomic_store_explicit(&header->write_index, write+1, memory_order_release);
+}
+
+//the consumer side, NULL if there is no ring under name or it is not one this code knows
+FrameRing* open_frame_ring(const char* name){
+    FrameRing* ring = (FrameRing*)calloc(1, sizeof(FrameRing));
+    frame_ring_name(name, ring->name, sizeof(ring->name));
+
+    int fd = shm_open(ring->name, O_RDWR, 0);
+    struct stat info;
+    if(fd < 0 || fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(FrameRingHeader)){
+        if(fd >= 0) close(fd);
+        free(ring);
+        return NULL;
+    }
+    ring->size = info.st_size;
+    void* mapping = mmap(NULL, ring->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(mapping == MAP_FAILED){
+        free(ring);
+        return NULL;
+    }
+
+    FrameRingHeader* header = (FrameRingHeader*)mapping;
+    int valid = header->magic == FRAME_RING_MAGIC;
+    atomic_thread_fence(memory_order_acquire);
+    if(!valid || header->version != FRAME_RING_VERSION || header->data_offset+header->slot_size*header->num_slots > ring->size){
+        printf("%s is not a frame ring this program can read\n", ring->name);
+        munmap(mapping, ring->size);
+        free(ring);
+        return NULL;
+    }
+    ring->header = header;
+    return ring;
+}
+
+//the oldest frame the consumer has not handed back, read in place until frame_ring_release. NULL if there is
+//no new frame. latest skips straight to the newest one, for consumers that only show frames
+FrameRingSlot* frame_ring_acquire(FrameRing* ring, int latest){
+    FrameRingHeader* header = ring->header;
+    uint64_t write = atomic_load_explicit(&header->write_index, memory_order_acquire);
+    uint64_t read = atomic_load_explicit(&header->read_index, memory_order_relaxed);
+    if(read == write) return NULL;
+    if(latest && write-read > 1){
+        read = write-1;
+        atomic_store_explicit(&header->read_index, read, memory_order_release);
+    }
+    return frame_ring_slot(ring, read);
+}
+
+//gives the slot of the last frame_ring_acquire back to the renderer
+void frame_ring_release(FrameRing* ring){
+    atomic_fetch_add_explicit(&ring->header->read_index, 1, memory_order_release);
+}
+
+//unmaps the ring, the renderer also removes it
+void destroy_frame_ring(FrameRing* ring){
+    if(ring == NULL) return;
+    munmap(ring->header, ring->size);
+    if(ring->owner) shm_unlink(ring->name);
+    free(ring);
+}
+
+#endif
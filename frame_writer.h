@@ -0,0 +1,390 @@
+#ifndef FRAME_WRITER_H
+#define FRAME_WRITER_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include "stb_image_write.h"
+#include "trace.h"
+
+#define FRAME_WRITER_MAX_THREADS 8
+//rows per job of the formats that can be written in strips
+#define FRAME_WRITER_STRIP_ROWS 128
+
+typedef enum FrameFormat{
+    FRAME_Y4M, //yuv 4:2:0 video stream, what ffmpeg, x264 and most players read from a pipe
+    FRAME_RGB, //raw 8 bit rgb frames back to back, no header
+    FRAME_PPM, //uncompressed, the rest are one image file per frame too
+    FRAME_PAM,
+    FRAME_PNG,
+    FRAME_JPG
+} FrameFormat;
+
+enum{SLOT_FREE, SLOT_FILLING, SLOT_QUEUED};
+
+typedef struct FrameSlot{
+    uint8_t* rgb;
+    int state;
+    int index; //frame number
+    int strips; //jobs the frame is split into
+    int next_strip; //first strip no thread took yet
+    int pending; //strips not finished
+} FrameSlot;
+
+//writes the rgb frames of a sequence or a single image on worker threads, so the next frame renders while the
+//last ones are being encoded. the streams go to a file, a fifo or stdout ("-") in order on one thread. image
+//frames are encoded by several threads at once, and the uncompressed ones are also split into strips of rows
+//written in parallel, since stb encodes a png or jpeg as a whole
+typedef struct FrameWriter{
+    FrameFormat format;
+    int width;
+    int height;
+    FILE* stream; //NULL for the image formats
+    char* output; //file name, or the prefix of the numbered files
+    int numbered;
+    uint8_t* yuv; //conversion scratch of the stream thread
+    FrameSlot* slots;
+    int num_slots;
+    FrameSlot* filling; //the slot frame_writer_next handed out
+    int submitted;
+    int written;
+    int closing;
+    int failed;
+    double wait_seconds; //time the renderer spent waiting for a free slot
+    int num_threads;
+    pthread_t threads[FRAME_WRITER_MAX_THREADS];
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+} FrameWriter;
+
+int parse_frame_format(const char* name, FrameFormat* format){
+    if(!strcmp(name, "y4m")) *format = FRAME_Y4M;
+    else if(!strcmp(name, "rgb")) *format = FRAME_RGB;
+    else if(!strcmp(name, "ppm")) *format = FRAME_PPM;
+    else if(!strcmp(name, "pam")) *format = FRAME_PAM;
+    else if(!strcmp(name, "png")) *format = FRAME_PNG;
+    else if(!strcmp(name, "jpg")) *format = FRAME_JPG;
+    else return 0;
+    return 1;
+}
+
+const char* frame_format_extension(FrameFormat format){
+    switch(format){
+    case FRAME_Y4M: return "y4m";
+    case FRAME_RGB: return "rgb";
+    case FRAME_PPM: return "ppm";
+    case FRAME_PAM: return "pam";
+    case FRAME_PNG: return "png";
+    default: return "jpg";
+    }
+}
+
+int is_stream_format(FrameFormat format){
+    return format == FRAME_Y4M || format == FRAME_RGB;
+}
+
+//full range bt.601, the 4:2:0 chroma is the average of each 2x2 block
+void rgb_to_yuv420(const uint8_t* rgb, uint8_t* yuv, int width, int height){
+    const int chroma_width = (width+1)/2;
+    const int chroma_height = (height+1)/2;
+    uint8_t* luma = yuv;
+    uint8_t* cb = yuv+(size_t)width*height;
+    uint8_t* cr = cb+(size_t)chroma_width*chroma_height;
+
+    for(long i = 0; i < (long)width*height; i++){
+        const uint8_t* p = &rgb[i*3];
+        luma[i] = (uint8_t)(0.299f*p[0]+0.587f*p[1]+0.114f*p[2]+0.5f);
+    }
+    for(int cy = 0; cy < chroma_height; cy++){
+        for(int cx = 0; cx < chroma_width; cx++){
+            float r = 0; float g = 0; float b = 0;
+            for(int k = 0; k < 4; k++){
+                int x = cx*2+(k & 1);
+                int y = cy*2+(k >> 1);
+                if(x >= width) x = width-1;
+                if(y >= height) y = height-1;
+                const uint8_t* p = &rgb[((long)y*width+x)*3];
+                r += p[0]; g += p[1]; b += p[2];
+            }
+            r *= 0.25f; g *= 0.25f; b *= 0.25f;
+            cb[cy*chroma_width+cx] = (uint8_t)(128-0.168736f*r-0.331264f*g+0.5f*b+0.5f);
+            cr[cy*chroma_width+cx] = (uint8_t)(128+0.5f*r-0.418688f*g-0.081312f*b+0.5f);
+        }
+    }
+}
+
+size_t yuv420_size(int width, int height){
+    return (size_t)width*height+2*(size_t)((width+1)/2)*((height+1)/2);
+}
+
+void frame_file_name(FrameWriter* writer, int index, char* name, size_t size){
+    if(writer->numbered) snprintf(name, size, "%s%04d.%s", writer->output, index+1, frame_format_extension(writer->format));
+    else snprintf(name, size, "%s", writer->output);
+}
+
+//the header of the uncompressed formats (ppm unless format is pam), its length
+int raw_image_header(FrameFormat format, int width, int height, char* header, size_t size){
+    if(format == FRAME_PAM){
+        return snprintf(header, size, "P7\nWIDTH %d\nHEIGHT %d\nDEPTH 3\nMAXVAL 255\nTUPLTYPE RGB\nENDHDR\n", width, height);
+    }
+    return snprintf(header, size, "P6\n%d %d\n255\n", width, height);
+}
+
+//every strip opens the file on its own and writes its rows where they belong, the first one also writes the
+//header and cuts the file to its final size in case it replaces a bigger one
+int write_raw_strip(FrameWriter* writer, FrameSlot* slot, int strip){
+    char name[4096];
+    char header[128];
+    frame_file_name(writer, slot->index, name, sizeof(name));
+    int header_size = raw_image_header(writer->format, writer->width, writer->height, header, sizeof(header));
+    const size_t row_size = (size_t)writer->width*3;
+    int first_row = strip*FRAME_WRITER_STRIP_ROWS;
+    int rows = writer->height-first_row < FRAME_WRITER_STRIP_ROWS ? writer->height-first_row : FRAME_WRITER_STRIP_ROWS;
+
+    int fd = open(name, O_WRONLY | O_CREAT, 0644);
+    if(fd < 0) return 0;
+    int ok = 1;
+    if(strip == 0){
+        ok = pwrite(fd, header, header_size, 0) == header_size && ftruncate(fd, header_size+row_size*writer->height) == 0;
+    }
+    size_t size = row_size*rows;
+    if(ok) ok = pwrite(fd, slot->rgb+row_size*first_row, size, header_size+row_size*first_row) == (ssize_t)size;
+    if(close(fd) != 0) ok = 0;
+    return ok;
+}
+
+//1 if the job was written
+int write_frame_strip(FrameWriter* writer, FrameSlot* slot, int strip){
+    if(writer->format == FRAME_PPM || writer->format == FRAME_PAM) return write_raw_strip(writer, slot, strip);
+
+    char name[4096];
+    frame_file_name(writer, slot->index, name, sizeof(name));
+    if(writer->format == FRAME_PNG) return stbi_write_png(name, writer->width, writer->height, 3, slot->rgb, writer->width*3) != 0;
+    if(writer->format == FRAME_JPG) return stbi_write_jpg(name, writer->width, writer->height, 3, slot->rgb, 100) != 0;
+
+    if(writer->format == FRAME_Y4M){
+        rgb_to_yuv420(slot->rgb, writer->yuv, writer->width, writer->height);
+        size_t size = yuv420_size(writer->width, writer->height);
+        return fputs("FRAME\n", writer->stream) >= 0 && fwrite(writer->yuv, 1, size, writer->stream) == size;
+    }
+    size_t size = (size_t)writer->width*writer->height*3;
+    return fwrite(slot->rgb, 1, size, writer->stream) == size;
+}
+
+typedef struct EncodedImage{
+    uint8_t* data;
+    size_t size;
+    size_t capacity;
+} EncodedImage;
+
+void append_encoded(void* context, void* data, int size){
+    EncodedImage* image = (EncodedImage*)context;
+    if(image->size+size > image->capacity){
+        while(image->size+size > image->capacity) image->capacity *= 2;
+        image->data = (uint8_t*)realloc(image->data, image->capacity);
+    }
+    memcpy(image->data+image->size, data, size);
+    image->size += size;
+}
+
+//a whole image file in memory instead of on disk, for sending it somewhere. every format but y4m, rgb is just
+//the pixels. NULL if stb fails, the caller frees the bytes
+uint8_t* encode_image(FrameFormat format, const uint8_t* rgb, int width, int height, size_t* size){
+    const size_t pixels_size = (size_t)width*height*3;
+    EncodedImage image = {(uint8_t*)malloc(pixels_size+128), 0, pixels_size+128};
+    int ok = 1;
+    if(format == FRAME_PPM || format == FRAME_PAM){
+        char header[128];
+        append_encoded(&image, header, raw_image_header(format, width, height, header, sizeof(header)));
+        append_encoded(&image, (void*)rgb, pixels_size);
+    }else if(format == FRAME_RGB) append_encoded(&image, (void*)rgb, pixels_size);
+    else if(format == FRAME_PNG) ok = stbi_write_png_to_func(append_encoded, &image, width, height, 3, rgb, width*3) != 0;
+    else if(format == FRAME_JPG) ok = stbi_write_jpg_to_func(append_encoded, &image, width, height, 3, rgb, 100) != 0;
+    else ok = 0;
+
+    if(!ok){
+        free(image.data);
+        return NULL;
+    }
+    *size = image.size;
+    return image.data;
+}
+
+//the queued frame with the lowest number that still has strips nobody took, so the streams stay in order
+FrameSlot* next_queued_slot(FrameWriter* writer){
+    FrameSlot* next = NULL;
+    for(int s = 0; s < writer->num_slots; s++){
+        FrameSlot* slot = &writer->slots[s];
+        if(slot->state != SLOT_QUEUED || slot->next_strip == slot->strips) continue;
+        if(next == NULL || slot->index < next->index) next = slot;
+    }
+    return next;
+}
+
+void* frame_writer_thread(void* argument){
+    FrameWriter* writer = (FrameWriter*)argument;
+    TRACE_THREAD("frame writer");
+    pthread_mutex_lock(&writer->lock);
+    while(1){
+        FrameSlot* slot;
+        while((slot = next_queued_slot(writer)) == NULL && !writer->closing) pthread_cond_wait(&writer->changed, &writer->lock);
+        if(slot == NULL) break;
+        int strip = slot->next_strip++;
+        int failed = writer->failed;
+        pthread_mutex_unlock(&writer->lock);
+
+        int ok = 0;
+        TRACE_SPAN("encode") ok = failed ? 0 : write_frame_strip(writer, slot, strip);
+
+        pthread_mutex_lock(&writer->lock);
+        if(!ok && !writer->failed){
+            fprintf(stderr, "Error writing frame %d\n", slot->index+1);
+            writer->failed = 1;
+        }
+        if(--slot->pending == 0){
+            slot->state = SLOT_FREE;
+            writer->written++;
+            pthread_cond_broadcast(&writer->changed);
+        }
+    }
+    pthread_mutex_unlock(&writer->lock);
+    return NULL;
+}
+
+//numbered: output is a prefix and frame n goes to prefix000n.ext, otherwise it is the file name of a single
+//image. NULL if a stream output cannot be opened. for stdout the real stdout is kept for the frames and printf
+//is sent to stderr from here on, so the log lines do not end up inside the video
+FrameWriter* open_frame_writer(FrameFormat format, char* output, int width, int height, int fps, int numbered){
+    FrameWriter* writer;
+    writer = (FrameWriter*)malloc(sizeof(FrameWriter));
+    writer->format = format;
+    writer->width = width;
+    writer->height = height;
+    writer->stream = NULL;
+    writer->output = output;
+    writer->numbered = numbered;
+    writer->yuv = NULL;
+
+    if(is_stream_format(format)){
+        if(!strcmp(output, "-")){
+            fflush(stdout);
+            int fd = dup(STDOUT_FILENO);
+            dup2(STDERR_FILENO, STDOUT_FILENO);
+            writer->stream = fdopen(fd, "wb");
+        }else{
+            //opening a fifo waits here until the encoder on the other end opens it too
+            writer->stream = fopen(output, "wb");
+        }
+        if(writer->stream == NULL){
+            printf("Could not open %s for writing\n", output);
+            free(writer);
+            return NULL;
+        }
+        //an encoder that quits early shows up as a failed write instead of killing the renderer
+        signal(SIGPIPE, SIG_IGN);
+    }
+    if(format == FRAME_Y4M){
+        writer->yuv = (uint8_t*)malloc(yuv420_size(width, height));
+        fprintf(writer->stream, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg XCOLORRANGE=FULL\n", width, height, fps);
+    }
+    //stb's default png level 8 searches hard for matches, for frames that are written once and converted later
+    //the time matters more than the size
+    if(format == FRAME_PNG) stbi_write_png_compression_level = 1;
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    writer->num_threads = is_stream_format(format) ? 1 : (int)(cpus < 1 ? 1 : cpus > FRAME_WRITER_MAX_THREADS ? FRAME_WRITER_MAX_THREADS : cpus);
+    //one frame for each thread to write plus two for the renderer to fill meanwhile
+    writer->num_slots = writer->num_threads+2;
+    writer->slots = (FrameSlot*)malloc(sizeof(FrameSlot)*writer->num_slots);
+    for(int s = 0; s < writer->num_slots; s++){
+        writer->slots[s].rgb = (uint8_t*)malloc((size_t)width*height*3);
+        writer->slots[s].state = SLOT_FREE;
+    }
+    writer->filling = NULL;
+    writer->submitted = 0;
+    writer->written = 0;
+    writer->closing = 0;
+    writer->failed = 0;
+    writer->wait_seconds = 0;
+    pthread_mutex_init(&writer->lock, NULL);
+    pthread_cond_init(&writer->changed, NULL);
+    for(int t = 0; t < writer->num_threads; t++) pthread_create(&writer->threads[t], NULL, frame_writer_thread, writer);
+
+    return writer;
+}
+
+//a sequence, see open_frame_writer
+FrameWriter* create_frame_writer(FrameFormat format, char* output, int width, int height, int fps){
+    return open_frame_writer(format, output, width, height, fps, 1);
+}
+
+//one image file, written in the background while the caller goes on
+FrameWriter* create_image_writer(FrameFormat format, char* file_name, int width, int height){
+    return open_frame_writer(format, file_name, width, height, 30, 0);
+}
+
+//the buffer to render the next frame into, width*height*3 bytes. waits while every slot is in use, NULL once a
+//write failed since there is no point rendering frames nobody can receive
+uint8_t* frame_writer_next(FrameWriter* writer){
+    TRACE_BEGIN(span, "frame_writer_next");
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pthread_mutex_lock(&writer->lock);
+    FrameSlot* free_slot = NULL;
+    while(!writer->failed){
+        for(int s = 0; s < writer->num_slots && free_slot == NULL; s++){
+            if(writer->slots[s].state == SLOT_FREE) free_slot = &writer->slots[s];
+        }
+        if(free_slot != NULL) break;
+        pthread_cond_wait(&writer->changed, &writer->lock);
+    }
+    if(free_slot != NULL) free_slot->state = SLOT_FILLING;
+    writer->filling = free_slot;
+    pthread_mutex_unlock(&writer->lock);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    writer->wait_seconds += (end.tv_sec-start.tv_sec)+(end.tv_nsec-start.tv_nsec)/1e9;
+    TRACE_END(span);
+    return free_slot != NULL ? free_slot->rgb : NULL;
+}
+
+//queues the buffer frame_writer_next returned
+void frame_writer_submit(FrameWriter* writer){
+    FrameSlot* slot = writer->filling;
+    int raw = writer->format == FRAME_PPM || writer->format == FRAME_PAM;
+    pthread_mutex_lock(&writer->lock);
+    slot->index = writer->submitted++;
+    slot->strips = raw ? (writer->height+FRAME_WRITER_STRIP_ROWS-1)/FRAME_WRITER_STRIP_ROWS : 1;
+    slot->next_strip = 0;
+    slot->pending = slot->strips;
+    slot->state = SLOT_QUEUED;
+    writer->filling = NULL;
+    pthread_cond_broadcast(&writer->changed);
+    pthread_mutex_unlock(&writer->lock);
+}
+
+//writes whatever is still queued and closes the output, 1 if every frame made it
+int destroy_frame_writer(FrameWriter* writer){
+    pthread_mutex_lock(&writer->lock);
+    writer->closing = 1;
+    pthread_cond_broadcast(&writer->changed);
+    pthread_mutex_unlock(&writer->lock);
+    for(int t = 0; t < writer->num_threads; t++) pthread_join(writer->threads[t], NULL);
+
+    int ok = !writer->failed;
+    if(writer->stream != NULL && fclose(writer->stream) != 0) ok = 0;
+    for(int s = 0; s < writer->num_slots; s++) free(writer->slots[s].rgb);
+    free(writer->slots);
+    free(writer->yuv);
+    pthread_mutex_destroy(&writer->lock);
+    pthread_cond_destroy(&writer->changed);
+
+    free(writer);
+    return ok;
+}
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef GOVERNOR_H
+#define GOVERNOR_H
+#include <math.h>
+
+#define GOVERNOR_MIN_SCALE 0.25f
+#define GOVERNOR_REFINE_FRAMES 10 //frames without input before going back to full quality
+
+//keeps the live modes around a target frame time by lowering the internal resolution and the
+//antialliasing samples while the user is moving, the output is upscaled to the window by SDL
+typedef struct FrameGovernor{
+    float target_ms; //0 disables the governor, always full quality
+    float scale;
+    int samples;
+    int max_width;
+    int max_height;
+    int max_samples;
+    int width;
+    int height;
+    int idle_frames;
+} FrameGovernor;
+
+void governor_apply_scale(FrameGovernor* governor){
+    governor->width = (int)(governor->max_width*governor->scale);
+    governor->height = (int)(governor->max_height*governor->scale);
+    if(governor->width < 1) governor->width = 1;
+    if(governor->height < 1) governor->height = 1;
+}
+
+void init_governor(FrameGovernor* governor, float target_ms, int max_width, int max_height, int max_samples){
+    governor->target_ms = target_ms;
+    governor->scale = 1;
+    governor->samples = max_samples;
+    governor->max_width = max_width;
+    governor->max_height = max_height;
+    governor->max_samples = max_samples;
+    governor->idle_frames = GOVERNOR_REFINE_FRAMES;
+    governor_apply_scale(governor);
+}
+
+//call for every input event that changes the view
+void governor_input(FrameGovernor* governor){
+    governor->idle_frames = 0;
+}
+
+//the view changed in the last few frames
+int governor_moving(FrameGovernor* governor){
+    return governor->idle_frames < GOVERNOR_REFINE_FRAMES;
+}
+
+//call once per frame with how long the previous frame took, it sets width, height and samples for the next one
+void governor_update(FrameGovernor* governor, float frame_ms){
+    if(governor->target_ms <= 0){
+        if(governor->idle_frames < GOVERNOR_REFINE_FRAMES) governor->idle_frames++;
+        return;
+    }
+
+    if(governor->idle_frames >= GOVERNOR_REFINE_FRAMES){
+        //nothing is moving, refine back to the full quality frame
+        governor->scale = 1;
+        governor->samples = governor->max_samples;
+        governor_apply_scale(governor);
+        return;
+    }
+    governor->idle_frames++;
+
+    if(frame_ms > governor->target_ms*1.1f){
+        //dropping the antialliasing is the cheapest 4x, then the resolution
+        if(governor->samples > 1){
+            governor->samples = 1;
+            frame_ms /= governor->max_samples;
+        }
+        if(frame_ms > governor->target_ms*1.1f){
+            //cost goes with the pixel count, so the scale goes with the square root of the time ratio
+            governor->scale *= sqrtf(governor->target_ms/frame_ms);
+        }
+    }else if(frame_ms < governor->target_ms*0.7f){
+        if(governor->scale < 1){
+            governor->scale *= fminf(sqrtf(governor->target_ms*0.9f/frame_ms), 1.25f);
+        }else if(governor->samples < governor->max_samples && frame_ms*governor->max_samples < governor->target_ms){
+            governor->samples = governor->max_samples;
+        }
+    }
+
+    if(governor->scale < GOVERNOR_MIN_SCALE) governor->scale = GOVERNOR_MIN_SCALE;
+    if(governor->scale > 1) governor->scale = 1;
+    governor_apply_scale(governor);
+}
+
+#endif
@@ -0,0 +1,164 @@
+#ifndef HEATMAP_H
+#define HEATMAP_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "stats.h"
+#include "tonemap.h"
+
+//--heatmap tests|shadows|bounces|time replaces the shaded frame with how much work each pixel took, to see where
+//a better bvh or light culling would pay off. the counts come from the ray counters of stats.h: the cpu tracer
+//takes the difference of its counters around every pixel, the render kernel writes its work item's counters
+//into pixelcolors instead of the color. time is only measured on the cpu, per pixel and then averaged over
+//tiles of HEAT_TILE pixels because a single pixel is too short to time well
+
+#define HEAT_TILE 16
+
+typedef enum HeatMetric{
+    HEAT_OFF,
+    HEAT_TESTS, //ray sphere tests, every kind of ray
+    HEAT_SHADOWS, //shadow rays
+    HEAT_BOUNCES, //reflection rays
+    HEAT_TIME //microseconds, cpu only
+} HeatMetric;
+
+typedef struct HeatMap{
+    HeatMetric metric;
+    float* costs; //per pixel, rows from the top of the image down, up to WIDTH x HEIGHT
+    float scale; //the cost drawn white, the most expensive pixel of the last frame
+    char caption[96];
+} HeatMap;
+
+int parse_heat_metric(const char* name, HeatMetric* metric){
+    const char* names[] = {"off", "tests", "shadows", "bounces", "time"};
+    for(int i = 0; i < 5; i++){
+        if(!strcmp(name, names[i])){
+            *metric = (HeatMetric)i;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+const char* heat_metric_label(HeatMetric metric){
+    switch(metric){
+    case HEAT_TESTS: return "sphere tests";
+    case HEAT_SHADOWS: return "shadow rays";
+    case HEAT_BOUNCES: return "reflection rays";
+    case HEAT_TIME: return "time";
+    default: return "";
+    }
+}
+
+//the ray counter a metric follows, -1 for the time
+int heat_metric_counter(HeatMetric metric){
+    switch(metric){
+    case HEAT_TESTS: return STAT_SPHERE_TESTS;
+    case HEAT_SHADOWS: return STAT_SHADOW_RAYS;
+    case HEAT_BOUNCES: return STAT_REFLECTION_RAYS;
+    default: return -1;
+    }
+}
+
+//NULL for HEAT_OFF, so callers can pass the result straight on
+HeatMap* create_heat_map(HeatMetric metric, int max_width, int max_height){
+    if(metric == HEAT_OFF) return NULL;
+    HeatMap* heat = (HeatMap*)calloc(1, sizeof(HeatMap));
+    heat->metric = metric;
+    heat->costs = (float*)calloc((size_t)max_width*max_height, sizeof(float));
+    heat->scale = 1;
+    return heat;
+}
+
+void destroy_heat_map(HeatMap* heat){
+    if(heat == NULL) return;
+    free(heat->costs);
+    free(heat);
+}
+
+//what the cpu tracer notes before a pixel, heat_pixel_end turns it into the pixel's cost
+typedef struct HeatSample{
+    uint64_t counter;
+    struct timespec start;
+} HeatSample;
+
+void heat_pixel_begin(HeatMap* heat, HeatSample* sample){
+    int counter = heat_metric_counter(heat->metric);
+    if(counter >= 0) sample->counter = ray_counters[counter];
+    else clock_gettime(CLOCK_MONOTONIC, &sample->start);
+}
+
+float heat_pixel_end(HeatMap* heat, HeatSample* sample){
+    int counter = heat_metric_counter(heat->metric);
+    if(counter >= 0) return (float)(ray_counters[counter]-sample->counter);
+    return elapsed_seconds(&sample->start)*1e6f;
+}
+
+//adds up the samples planes of a pixelcolors buffer the kernel filled with counts, the planes of a pixel hold
+//its work split between them
+void heat_costs_from_samples(HeatMap* heat, const float* pixels, int samples, int width, int height){
+    const size_t plane = (size_t)width*height;
+    for(size_t i = 0; i < plane; i++){
+        float cost = 0;
+        for(int z = 0; z < samples; z++) cost += pixels[(z*plane+i)*3];
+        heat->costs[i] = cost;
+    }
+}
+
+//every pixel of a HEAT_TILE x HEAT_TILE tile gets the tile's mean, for the timings
+void heat_average_tiles(HeatMap* heat, int width, int height){
+    for(int ty = 0; ty < height; ty += HEAT_TILE){
+        for(int tx = 0; tx < width; tx += HEAT_TILE){
+            int w = width-tx < HEAT_TILE ? width-tx : HEAT_TILE;
+            int h = height-ty < HEAT_TILE ? height-ty : HEAT_TILE;
+            float sum = 0;
+            for(int y = ty; y < ty+h; y++) for(int x = tx; x < tx+w; x++) sum += heat->costs[y*width+x];
+            float mean = sum/(w*h);
+            for(int y = ty; y < ty+h; y++) for(int x = tx; x < tx+w; x++) heat->costs[y*width+x] = mean;
+        }
+    }
+}
+
+//black through purple, red and orange to a pale yellow, t from 0 to 1
+uint32_t heat_color(float t){
+    static const float stops[5][3] = {{0, 0, 0}, {60, 15, 120}, {200, 40, 80}, {250, 150, 30}, {255, 255, 210}};
+    t = t < 0 ? 0 : (t > 1 ? 1 : t);
+    float position = t*4;
+    int stop = position >= 4 ? 3 : (int)position;
+    float f = position-stop;
+    uint32_t color = 0xff000000;
+    for(int c = 0; c < 3; c++){
+        float value = stops[stop][c]+(stops[stop+1][c]-stops[stop][c])*f;
+        color |= (uint32_t)(value+0.5f) << (16-c*8);
+    }
+    return color;
+}
+
+//draws the costs of a width x height frame scaled to its most expensive pixel into rows pitch bytes apart, as
+//rgb bytes or ARGB8888 words like the tone mapper
+void heat_map_frame(HeatMap* heat, int width, int height, uint8_t* out, int pitch, TonePacking packing){
+    const size_t size = (size_t)width*height;
+    if(heat->metric == HEAT_TIME) heat_average_tiles(heat, width, height);
+    float scale = 0;
+    for(size_t i = 0; i < size; i++) if(heat->costs[i] > scale) scale = heat->costs[i];
+    heat->scale = scale > 0 ? scale : 1;
+    if(heat->metric == HEAT_TIME) snprintf(heat->caption, sizeof(heat->caption), "us per pixel, mean of %dx%d tiles: 0 to %.1f", HEAT_TILE, HEAT_TILE, heat->scale);
+    else snprintf(heat->caption, sizeof(heat->caption), "%s per pixel: 0 to %.0f", heat_metric_label(heat->metric), heat->scale);
+
+    for(int y = 0; y < height; y++){
+        uint8_t* row = out+(size_t)y*pitch;
+        for(int x = 0; x < width; x++){
+            uint32_t color = heat_color(heat->costs[y*width+x]/heat->scale);
+            if(packing == TONE_ARGB8888) ((uint32_t*)row)[x] = color;
+            else{
+                row[x*3] = (color >> 16) & 0xff;
+                row[x*3+1] = (color >> 8) & 0xff;
+                row[x*3+2] = color & 0xff;
+            }
+        }
+    }
+}
+
+#endif
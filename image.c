@@ -13,336 +13,232 @@
 #define WIDTH 1080
 #define HEIGHT 720
 
-OpenclContext* init_opencl(Scene* scene, char* postproc_file){
-    //iniciando opencl
+#include "opencl.h"
+#include "camera_path.h"
+#include "frame_writer.h"
+#include "tiles.h"
+#include "tonemap.h"
+#include "trace.h"
+
+//renders every pose of a camera path with the same context and buffers, only the camera and plane are written
+//again between frames
+int render_sequence(OpenclContext* opencl_context, cl_command_queue queue, ToneMapper* tone_mapper, FrameWriter* writer, CameraPose* poses, int frames, float half_width, float half_height){
     cl_int err;
-    cl_platform_id plataforms;
-    err = clGetPlatformIDs(1, &plataforms, NULL);
-    if(err != CL_SUCCESS){
-        printf("an error ocurred while finding available opencl plataforms");
-        exit(1);
-    }
-    cl_device_id devices;
-    err = clGetDeviceIDs(plataforms, CL_DEVICE_TYPE_GPU, 1, &devices, NULL);
-    if(err != CL_SUCCESS){
-        printf("an error ocurred while finding available opencl devices");
-        exit(1);
-    }
-    cl_context context = clCreateContext(NULL, 1, &devices, NULL, NULL, &err);
-    if(!context || err != CL_SUCCESS){
-        printf("An error ocurred while creating the context\n");
-        exit(1);
-    }
+    flattenedScene* fscene = opencl_context->fscene;
+    float* pixels = (float*)malloc(sizeof(float)*WIDTH*HEIGHT*3*4);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int frame;
+    for(frame = 0; frame < frames; frame++){
+        apply_camera_pose(&poses[frame], half_width, half_height, fscene->camera, fscene->plane);
+        TRACE_SPAN("clEnqueueWriteBuffer camera"){
+            err = clEnqueueWriteBuffer(queue, opencl_context->camera, CL_TRUE, 0, sizeof(float)*3, fscene->camera, 0, NULL, NULL);
+            if(err == CL_SUCCESS) err = clEnqueueWriteBuffer(queue, opencl_context->plane, CL_TRUE, 0, sizeof(float)*12, fscene->plane, 0, NULL, NULL);
+        }
+        if (err != CL_SUCCESS) {
+            printf("Error executing queued command: %d\n", err);
+            exit(1);
+        }
+        render_opencl_frame(opencl_context, queue, pixels, WIDTH, HEIGHT, 4);
 
-    const char* render_kernel_source = load_strfile("render.txt");
-    cl_program render_program = clCreateProgramWithSource(context, 1, &render_kernel_source, NULL, &err);
-    if(err != CL_SUCCESS){
-        printf("an error ocurred while creating the opencl program: %d\n", err);
-        exit(1);
-    }
-    err = clBuildProgram(render_program, 1, &devices, NULL, NULL, NULL);
-    if (err == CL_BUILD_PROGRAM_FAILURE) {
-        //this block came from stackoveflow, will search for the link to credit when i can
-        size_t log_size;
-        clGetProgramBuildInfo(render_program, devices, CL_PROGRAM_BUILD_LOG, 0, NULL, &log_size);
-    
-        char *log = (char *) malloc(log_size);
-    
-        clGetProgramBuildInfo(render_program, devices, CL_PROGRAM_BUILD_LOG, log_size, log, NULL);
-    
-        printf("%s\n", log);
-        exit(1);
-    }else if(err != CL_SUCCESS){
-        printf("an error ocurred while building the opencl program: %d\n", err);
-        exit(1);
-    }
-    const char* post_processing_source = load_strfile(postproc_file);
-    cl_program post_processing_program = clCreateProgramWithSource(context, 1, &post_processing_source, NULL, &err);
-    if(err != CL_SUCCESS){
-        printf("an error ocurred while creating the opencl program: %d\n", err);
-        exit(1);
-    }
-    err = clBuildProgram(post_processing_program, 1, &devices, NULL, NULL, NULL);
-    if (err == CL_BUILD_PROGRAM_FAILURE) {
-        size_t log_size;
-        clGetProgramBuildInfo(post_processing_program, devices, CL_PROGRAM_BUILD_LOG, 0, NULL, &log_size);
-    
-        char *log = (char *) malloc(log_size);
-    
-        clGetProgramBuildInfo(post_processing_program, devices, CL_PROGRAM_BUILD_LOG, log_size, log, NULL);
-    
-        printf("%s\n", log);
-        exit(5);
-    }else if(err != CL_SUCCESS){
-        printf("an error ocurred while building the opencl program: %d\n", err);
-        exit(1);
+        uint8_t* rgb = frame_writer_next(writer);
+        if(rgb == NULL) break;
+        tone_map_rgb(tone_mapper, pixels, 4, WIDTH, HEIGHT, rgb);
+        frame_writer_submit(writer);
     }
+    double seconds = elapsed_seconds(&start);
+    double wait_seconds = writer->wait_seconds;
+    int ok = destroy_frame_writer(writer) && frame == frames;
 
-    cl_command_queue queue = clCreateCommandQueueWithProperties(context, devices, NULL, NULL);
-    
-    const long screensize = WIDTH*HEIGHT;
-    const size_t screensizebytes = screensize*sizeof(float)*3;
-    cl_mem pixelcolors = clCreateBuffer(context, CL_MEM_READ_WRITE, screensizebytes*4, NULL, NULL);
-
-    cl_mem camera = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(float)*3, NULL, NULL);
-    cl_mem  plane = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(float)*12, NULL, NULL);
-    cl_mem ALI = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(float)*3, NULL, NULL);
-    cl_mem lightpos = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(float)*scene->num_lights*3, NULL, NULL);
-    cl_mem lightdiffuse = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(float)*scene->num_lights*3, NULL, NULL);
-    cl_mem lightspecular = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(float)*scene->num_lights*3, NULL, NULL);
-    cl_mem objectpos = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(float)*scene->num_objects*3, NULL, NULL);
-    cl_mem objectcolor = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(float)*scene->num_objects*3, NULL, NULL);
-    cl_mem objectambient = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(float)*scene->num_objects*3, NULL, NULL);
-    cl_mem objectdiffuse = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(float)*scene->num_objects*3, NULL, NULL);
-    cl_mem objectspecular = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(float)*scene->num_objects*3, NULL, NULL);
-    cl_mem objectreflectivity = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(float)*scene->num_objects*3, NULL, NULL);
-    cl_mem objectalbedo = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(float)*scene->num_objects, NULL, NULL);
-    cl_mem objectradius = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(float)*scene->num_objects, NULL, NULL);
-
-    flattenedScene* fscene = flattenScene(scene);
-    clEnqueueWriteBuffer(queue, camera, CL_TRUE, 0, sizeof(float)*3, fscene->camera, 0, NULL, NULL);
-    clEnqueueWriteBuffer(queue, plane, CL_TRUE, 0, sizeof(float)*12, fscene->plane, 0, NULL, NULL);
-    clEnqueueWriteBuffer(queue, ALI, CL_TRUE, 0, sizeof(float)*3, fscene->ALI, 0, NULL, NULL);
-    clEnqueueWriteBuffer(queue, lightpos, CL_TRUE, 0, sizeof(float)*scene->num_lights*3, fscene->lightpos, 0, NULL, NULL);
-    clEnqueueWriteBuffer(queue, lightdiffuse, CL_TRUE, 0, sizeof(float)*scene->num_lights*3, fscene->lightdiffuse, 0, NULL, NULL);
-    clEnqueueWriteBuffer(queue, lightspecular, CL_TRUE, 0, sizeof(float)*scene->num_lights*3, fscene->lightspecular, 0, NULL, NULL);
-    clEnqueueWriteBuffer(queue, objectpos, CL_TRUE, 0, sizeof(float)*scene->num_objects*3, fscene->objectpos, 0, NULL, NULL);
-    clEnqueueWriteBuffer(queue, objectcolor, CL_TRUE, 0, sizeof(float)*scene->num_objects*3, fscene->objectcolor, 0, NULL, NULL);
-    clEnqueueWriteBuffer(queue, objectambient, CL_TRUE, 0, sizeof(float)*scene->num_objects*3, fscene->objectambient, 0, NULL, NULL);
-    clEnqueueWriteBuffer(queue, objectdiffuse, CL_TRUE, 0, sizeof(float)*scene->num_objects*3, fscene->objectdiffuse, 0, NULL, NULL);
-    clEnqueueWriteBuffer(queue, objectspecular, CL_TRUE, 0, sizeof(float)*scene->num_objects*3, fscene->objectspecular, 0, NULL, NULL);
-    clEnqueueWriteBuffer(queue, objectreflectivity, CL_TRUE, 0, sizeof(float)*scene->num_objects*3, fscene->objectreflectivity, 0, NULL, NULL);
-    clEnqueueWriteBuffer(queue, objectalbedo, CL_TRUE, 0, sizeof(float)*scene->num_objects, fscene->objectalbedo, 0, NULL, NULL);
-    clEnqueueWriteBuffer(queue, objectradius, CL_TRUE, 0, sizeof(float)*scene->num_objects, fscene->objectradius, 0, NULL, NULL);
-
-    cl_kernel render_kernel = clCreateKernel(render_program, "render", NULL);
-    cl_kernel post_processing_kernel = clCreateKernel(post_processing_program, "postprocess", NULL);
-
-    err = clSetKernelArg(render_kernel, 0, sizeof(cl_mem), &pixelcolors);
-    if (err != CL_SUCCESS) {
-        printf("Error setting kernel arg: %d\n", err);
-        exit(1);
-    }
-    err = clSetKernelArg(render_kernel, 1, sizeof(long), &screensize);
-    if (err != CL_SUCCESS) {
-        printf("Error setting kernel arg: %d\n", err);
-        exit(1);
-    }
-    err = clSetKernelArg(render_kernel, 2, sizeof(cl_mem), &camera);
-    if (err != CL_SUCCESS) {
-        printf("Error setting kernel arg: %d\n", err);
-        exit(1);
-    }
-    err = clSetKernelArg(render_kernel, 3, sizeof(cl_mem), &plane);
-    if (err != CL_SUCCESS) {
-        printf("Error setting kernel arg: %d\n", err);
-        exit(1);
-    }
-    err = clSetKernelArg(render_kernel, 4, sizeof(cl_mem), &ALI);
-    if (err != CL_SUCCESS) {
-        printf("Error setting kernel arg: %d\n", err);
-        exit(1);
-    }
-    err = clSetKernelArg(render_kernel, 5, sizeof(cl_mem), &lightpos);
-    if (err != CL_SUCCESS) {
-        printf("Error setting kernel arg: %d\n", err);
-        exit(1);
-    }
-    err = clSetKernelArg(render_kernel, 6, sizeof(cl_mem), &lightdiffuse);
-    if (err != CL_SUCCESS) {
-        printf("Error setting kernel arg: %d\n", err);
-        exit(1);
-    }
-    err = clSetKernelArg(render_kernel, 7, sizeof(cl_mem), &lightspecular);
-    if (err != CL_SUCCESS) {
-        printf("Error setting kernel arg: %d\n", err);
-        exit(1);
-    }
-    err = clSetKernelArg(render_kernel, 8, sizeof(cl_mem), &objectpos);
-    if (err != CL_SUCCESS) {
-        printf("Error setting kernel arg: %d\n", err);
-        exit(1);
-    }
-    err = clSetKernelArg(render_kernel, 9, sizeof(cl_mem), &objectcolor);
-    if (err != CL_SUCCESS) {
-        printf("Error setting kernel arg: %d\n", err);
-        exit(1);
-    }
-    err = clSetKernelArg(render_kernel, 10, sizeof(cl_mem), &objectambient);
-    if (err != CL_SUCCESS) {
-        printf("Error setting kernel arg: %d\n", err);
-        exit(1);
-    }
-    err = clSetKernelArg(render_kernel, 11, sizeof(cl_mem), &objectdiffuse);
-    if (err != CL_SUCCESS) {
-        printf("Error setting kernel arg: %d\n", err);
-        exit(1);
-    }
-    err = clSetKernelArg(render_kernel, 12, sizeof(cl_mem), &objectspecular);
-    if (err != CL_SUCCESS) {
-        printf("Error setting kernel arg: %d\n", err);
-        exit(1);
-    }
-    err = clSetKernelArg(render_kernel, 13, sizeof(cl_mem), &objectreflectivity);
-    if (err != CL_SUCCESS) {
-        printf("Error setting kernel arg: %d\n", err);
-        exit(1);
-    }
-    err = clSetKernelArg(render_kernel, 14, sizeof(cl_mem), &objectalbedo);
-    if (err != CL_SUCCESS) {
-        printf("Error setting kernel arg: %d\n", err);
-        exit(1);
-    }
-    err = clSetKernelArg(render_kernel, 15, sizeof(cl_mem), &objectradius);
-    if (err != CL_SUCCESS) {
-        printf("Error setting kernel arg: %d\n", err);
-        exit(1);
-    }
-    err = clSetKernelArg(render_kernel, 16, sizeof(int), &fscene->num_lights);
-    if (err != CL_SUCCESS) {
-        printf("Error setting kernel arg: %d\n", err);
-        exit(1);
-    }
-    err = clSetKernelArg(render_kernel, 17, sizeof(int), &fscene->num_objects);
-    if (err != CL_SUCCESS) {
-        printf("Error setting kernel arg: %d\n", err);
-        exit(1);
-    }
+    printf("Rendered %d frames in %.2f s (%.1f fps), %.2f s of it waiting on the writer\n", frame, seconds, frame/seconds, wait_seconds);
+    free(pixels);
+    return ok;
+}
 
-    err = clSetKernelArg(post_processing_kernel, 0, sizeof(cl_mem), &pixelcolors);
-    if (err != CL_SUCCESS) { 
-        printf("Error setting kernel arg: %d\n", err);
-        exit(1);
+//renders a width x height image in tiles of at most tile_width x tile_height, each one rendered with the plane
+//cut down to it, resolved and written to its place in the file. the memory used is the same for any size
+int render_tiled(OpenclContext* opencl_context, cl_command_queue queue, ToneMapper* tone_mapper, int width, int height, int tile_width, int tile_height, FrameFormat format, char* file_name){
+    TiledImage* image = create_tiled_image(file_name, format, width, height);
+    if(image == NULL) return 0;
+
+    flattenedScene* fscene = opencl_context->fscene;
+    float plane[12];
+    memcpy(plane, fscene->plane, sizeof(plane));
+    float* pixels = (float*)malloc(sizeof(float)*tile_width*tile_height*3*4);
+    uint8_t* rgb = (uint8_t*)malloc((size_t)tile_width*tile_height*3);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int ok = 1;
+    int tiles = 0;
+    for(int y = 0; y < height && ok; y += tile_height){
+        for(int x = 0; x < width && ok; x += tile_width){
+            int w = width-x < tile_width ? width-x : tile_width;
+            int h = height-y < tile_height ? height-y : tile_height;
+            tile_plane(plane, x, y, w, h, width, height, fscene->plane);
+            cl_int err;
+            TRACE_SPAN("clEnqueueWriteBuffer plane") err = clEnqueueWriteBuffer(queue, opencl_context->plane, CL_TRUE, 0, sizeof(float)*12, fscene->plane, 0, NULL, NULL);
+            if (err != CL_SUCCESS) {
+                printf("Error executing queued command: %d\n", err);
+                exit(1);
+            }
+            render_opencl_frame(opencl_context, queue, pixels, w, h, 4);
+            ToneJob job = {pixels, 4, (long)w*h*3, w, h, rgb, w*3, TONE_RGB8, x, y, 0};
+            tone_map_frame(tone_mapper, &job);
+            TRACE_SPAN("write_image_tile") ok = write_image_tile(image, rgb, x, y, w, h, 0);
+            tiles++;
+        }
     }
+    if(!destroy_tiled_image(image)) ok = 0;
+    memcpy(fscene->plane, plane, sizeof(plane));
 
-    clReleaseCommandQueue(queue);
-
-    return create_opencl_context(
-        fscene,
-        pixelcolors,
-        camera,
-        plane,
-        ALI,
-        lightpos,
-        lightdiffuse,
-        lightspecular,
-        objectpos,
-        objectcolor,
-        objectambient,
-        objectdiffuse,
-        objectspecular,
-        objectreflectivity,
-        objectalbedo,
-        objectradius,
-        render_kernel,
-        post_processing_kernel,
-        render_program,
-        post_processing_program,
-        devices,
-        context
-    );
+    if(ok) printf("Rendered %dx%d in %d tiles in %.2f s, peak memory %.1f MB, saved as %s\n", width, height, tiles, elapsed_seconds(&start), peak_memory_mb(), file_name);
+    else printf("Failed to write %s\n", file_name);
+    free(pixels);
+    free(rgb);
+    return ok;
 }
 
+//usage: ./image scene.json output postprocess.txt [--path poses.txt [--frames n] | --turntable n] [--format y4m|rgb|ppm|pam|png|jpg] [--fps n]
+//       [--size WxH [--tile WxH]] [--tonemap clamp|reinhard|filmic] [--exposure f] [--srgb] [--dither] [--trace file.json]
 int main(int argc, char* argv[]){
-    Scene* scene;
-
-    FILE *file = fopen(argv[1], "r");
-    if (file == NULL){
-        printf("Could not open file\n");
+    char* path_option = take_option(&argc, argv, "--path");
+    char* turntable_option = take_option(&argc, argv, "--turntable");
+    char* frames_option = take_option(&argc, argv, "--frames");
+    char* format_option = take_option(&argc, argv, "--format");
+    char* fps_option = take_option(&argc, argv, "--fps");
+    char* size_option = take_option(&argc, argv, "--size");
+    char* tile_option = take_option(&argc, argv, "--tile");
+    char* trace_option = take_option(&argc, argv, "--trace");
+    ToneSettings tone;
+    int tone_valid = take_tone_options(&argc, argv, &tone);
+    if(argc < 4 || !tone_valid){
+        printf("Usage: ./image scene.json output postprocess.txt [--path poses.txt [--frames n] | --turntable n] [--format y4m|rgb|ppm|pam|png|jpg] [--fps n] [--size WxH [--tile WxH]]\n"
+        "       [--tonemap clamp|reinhard|filmic] [--exposure f] [--srgb] [--dither] [--trace file.json]\n");
+        exit(2);
+    }
+    if(trace_option != NULL) trace_start(trace_option);
+
+    //the writer goes first, with the output on stdout everything printed after it has to go to stderr
+    FrameWriter* writer = NULL;
+    int sequence = path_option != NULL || turntable_option != NULL;
+    int tiled = size_option != NULL;
+    FrameFormat format = sequence ? FRAME_Y4M : tiled ? FRAME_PPM : FRAME_JPG;
+    if(format_option != NULL && !parse_frame_format(format_option, &format)){
+        printf("Unknown format %s, use y4m, rgb, ppm, pam, png or jpg\n", format_option);
+        exit(2);
+    }
+    int image_width = WIDTH; int image_height = HEIGHT;
+    int tile_width = WIDTH; int tile_height = HEIGHT;
+    if(tiled){
+        if(sequence || !parse_size(size_option, &image_width, &image_height) || (tile_option != NULL && !parse_size(tile_option, &tile_width, &tile_height))){
+            printf("--size and --tile take WxH, and only for a single image\n");
+            exit(2);
+        }
+        //the tiles are rendered in the buffers of a WIDTH x HEIGHT frame
+        if((long)tile_width*tile_height > (long)WIDTH*HEIGHT){
+            printf("A tile can have at most %d pixels\n", WIDTH*HEIGHT);
+            exit(2);
+        }
+    }
+    char file_name[4096];
+    if(tiled){
+        snprintf(file_name, sizeof(file_name), "%s.%s", argv[2], frame_format_extension(format));
+    }else if(sequence){
+        int fps = fps_option ? atoi(fps_option) : 30;
+        if(fps < 1) fps = 30;
+        writer = create_frame_writer(format, argv[2], WIDTH, HEIGHT, fps);
+    }else{
+        snprintf(file_name, sizeof(file_name), "%s.%s", argv[2], frame_format_extension(format));
+        writer = create_image_writer(format, file_name, WIDTH, HEIGHT);
+    }
+    if(writer == NULL && !tiled) exit(1);
+
+    flattenedScene* fscene;
+    TRACE_SPAN("load_scene") fscene = load_flattened_scene(argv[1]);
+    if(fscene == NULL){
+        printf("Error: Could not load the scene\n");
         exit(1);
     }
 
-    fseek(file, 0, SEEK_END);
-    long file_size = ftell(file);
-    fseek(file, 0, SEEK_SET);
+    if(sequence){
+        int frames;
+        CameraPose* poses;
+        if(path_option != NULL){
+            int num_keys;
+            CameraPose* keys = load_camera_path(path_option, &num_keys);
+            if(keys == NULL) exit(1);
+            frames = frames_option ? atoi(frames_option) : num_keys;
+            if(frames < 1) frames = num_keys;
+            poses = sample_camera_path(keys, num_keys, frames);
+            free(keys);
+        }else{
+            frames = atoi(turntable_option);
+            if(frames < 1){
+                printf("--turntable needs the number of frames\n");
+                exit(2);
+            }
+            poses = turntable_path(fscene, frames);
+        }
+        //the scene plane is still relative to the camera here, its first corner holds the half sizes
+        float half_width = fscene->plane[0];
+        float half_height = fscene->plane[1];
 
-    char *json_str = malloc(file_size + 1);
-    fread(json_str, 1, file_size, file);
-    json_str[file_size] = '\0';
-    scene = load_scene(json_str);
+        OpenclContext *opencl_context = init_opencl(fscene, argv[3], "postprocess");
+        set_kernel_arg(opencl_context->post_processing_kernel, 0, sizeof(cl_mem), &opencl_context->pixelcolors);
+        cl_command_queue queue = clCreateCommandQueueWithProperties(opencl_context->context, opencl_context->devices, NULL, NULL);
 
-    fclose(file);
+        ToneMapper* tone_mapper = create_tone_mapper(tone);
+        int ok = render_sequence(opencl_context, queue, tone_mapper, writer, poses, frames, half_width, half_height);
 
-    if(scene == NULL){
-        printf("Error: Could not load the scene\n");
-        exit(1);
+        free(poses);
+        destroy_tone_mapper(tone_mapper);
+        destroy_openclcontext(opencl_context);
+        clReleaseCommandQueue(queue);
+        return ok ? 0 : 1;
     }
 
-    scene->plane->x1->x += scene->camera->x; //Manually doing this so that the users can
-    scene->plane->x2->x += scene->camera->x; //change the camera position without distorting
-    scene->plane->x3->x += scene->camera->x; //the view
-    scene->plane->x4->x += scene->camera->x;
-    scene->plane->x1->y += scene->camera->y;
-    scene->plane->x2->y += scene->camera->y;
-    scene->plane->x3->y += scene->camera->y;
-    scene->plane->x4->y += scene->camera->y;
-    scene->plane->x1->z += scene->camera->z+1;
-    scene->plane->x2->z += scene->camera->z+1;
-    scene->plane->x3->z += scene->camera->z+1;
-    scene->plane->x4->z += scene->camera->z+1;
-
-    cl_int err;
+    //Manually doing this so that the users can change the camera position without distorting the view
+    for(int corner = 0; corner < 4; corner++){
+        fscene->plane[corner*3] += fscene->camera[0];
+        fscene->plane[corner*3+1] += fscene->camera[1];
+        fscene->plane[corner*3+2] += fscene->camera[2]+1;
+    }
 
-    OpenclContext *opencl_context = init_opencl(scene, argv[3]);
+    OpenclContext *opencl_context = init_opencl(fscene, argv[3], "postprocess");
+    set_kernel_arg(opencl_context->post_processing_kernel, 0, sizeof(cl_mem), &opencl_context->pixelcolors);
     cl_command_queue queue = clCreateCommandQueueWithProperties(opencl_context->context, opencl_context->devices, NULL, NULL);
 
     const long screensize = WIDTH*HEIGHT;
     const size_t screensizebytes = screensize*sizeof(float)*3;
+    ToneMapper* tone_mapper = create_tone_mapper(tone);
 
-    size_t globalsize = screensize*4;//times the amount of extra rays for the antialliasing
-    size_t localsize = 128;
-    float* pixels = (float*)malloc(screensizebytes*4);
-
-    err = clEnqueueNDRangeKernel(queue, opencl_context->render_kernel, 1, NULL, &globalsize, &localsize, 0, NULL, NULL);
-    if (err != CL_SUCCESS) {
-        printf("Error executing queued command: %d\n", err);
-        exit(1);
-    }
-    clFinish(queue);
-
-    err = clEnqueueNDRangeKernel(queue, opencl_context->post_processing_kernel, 1, NULL, &globalsize, &localsize, 0, NULL, NULL);
-    if (err != CL_SUCCESS) {
-        printf("Error executing queued command: %d\n", err);
-        exit(1);
-    }
-    clFinish(queue);
-
-    err = clEnqueueReadBuffer(queue, opencl_context->pixelcolors, CL_TRUE, 0, screensizebytes*4, pixels, 0, NULL, NULL);
-    if (err != CL_SUCCESS) {
-        printf("Error reading queued buffer: %d\n", err);
-        exit(1);
+    if(tiled){
+        int ok = render_tiled(opencl_context, queue, tone_mapper, image_width, image_height, tile_width, tile_height, format, file_name);
+        destroy_tone_mapper(tone_mapper);
+        destroy_openclcontext(opencl_context);
+        clReleaseCommandQueue(queue);
+        return ok ? 0 : 1;
     }
-    clFinish(queue);
 
-    unsigned char *img = (unsigned char*)malloc(WIDTH * HEIGHT * 3);  // 3 for RGB channels
-    
-    for(int i = 0; i < screensize; i++){
-        int y = (int)floor((float)i/1080) % 720;
-        int x = i % 1080;
+    float* pixels = (float*)malloc(screensizebytes*4);
+    render_opencl_frame(opencl_context, queue, pixels, WIDTH, HEIGHT, 4);
 
-        int image_index = (y * WIDTH + x)*3;
-        
-        for(int z = 0; z < 4; z++){
-            int pos = (i*3)+777600*z*3;
-            img[image_index] += (uint8_t)(pixels[pos]*255);
-            img[image_index+1] += (uint8_t)(pixels[pos+1]*255);
-            img[image_index+2] += (uint8_t)(pixels[pos+2]*255);
-        }
-    }
+    tone_map_rgb(tone_mapper, pixels, 4, WIDTH, HEIGHT, frame_writer_next(writer));
+    frame_writer_submit(writer);
+    free(pixels);
+    destroy_tone_mapper(tone_mapper);
 
-    int success = stbi_write_jpg(strcat(argv[2], ".jpg"), WIDTH, HEIGHT, 3, img, 100);
+    //the image is encoded on the writer's thread while the opencl context is torn down
+    destroy_openclcontext(opencl_context);
+    clReleaseCommandQueue(queue);
 
-    if (!success) {
+    if(!destroy_frame_writer(writer)){
         printf("Failed to write image\n");
-        free(img);
         exit(1);
     }
-    
-    printf("Image created and saved as %s\n", argv[2]);
-
-    free(img);
-    destroy_openclcontext(opencl_context);
-    clReleaseCommandQueue(queue);
+    printf("Image created and saved as %s\n", file_name);
 
     return 0;
 }
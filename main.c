@@ -4,7 +4,6 @@
 #include <math.h>
 #include <string.h>
 #include <SDL3/SDL.h>
-#include <SDL3_image/SDL_image.h>
 #include <CL/cl.h>
 #include "vector.h"
 #include "utils.h"
@@ -13,563 +12,201 @@
 #define WIDTH 1080
 #define HEIGHT 720
 
-//implementation with some adjusts for the collision checking function
-float quadraticFormula(float a, float b, float c){
-    float delta = b*b - 4*a*c;
-    if(delta < 0) return delta;
-    delta = sqrtf(delta);
-
-    float t1 = (-b+delta)/(2*a);
-    float t2 = (-b-delta)/(2*a);
-
-    if(fmin(t1, t2) < 0) return fmax(t1, t2);
-    else return fmin(t1,t2);
-}
+#include "raytracer.h"
+#include "opencl.h"
+#include "governor.h"
+#include "checkerboard.h"
+#include "watch.h"
+#include "animation.h"
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+#include "frame_writer.h"
+#include "tiles.h"
+#include "frame_ring.h"
+#include "tonemap.h"
+#include "stats.h"
+#include "heatmap.h"
+#include "trace.h"
+
+//renders a width x height frame as ARGB8888 rows pitch bytes apart, from the top of the image down
+//with a checkerboard only half of the pixels are traced and the rest is reconstructed
+//with a heat map the pixels show what they cost instead, it does not go with a checkerboard
+void renderFrame(uint8_t* texture_pixels, int pitch, Scene* scene, int width, int height, int samples, int shared_shading, ToneSettings* tone, Checkerboard* checkerboard, int moving, HeatMap* heat){
+    int full_frame = checkerboard == NULL || checkerboard_begin(checkerboard, width, height, samples);
+
+    for(int x = 0; x < width; x++){
+        for(int y = 0; y < height; y++){
+            if(!full_frame && !checkerboard_traced(checkerboard, x, y)) continue;
+
+            Sphere* hit;
+            HeatSample sample;
+            if(heat != NULL) heat_pixel_begin(heat, &sample);
+            Color* renderedColor = renderPixel(scene, x, y, width, height, samples, shared_shading, &hit);
+            if(heat != NULL){
+                heat->costs[(height-1-y)*width+x] = heat_pixel_end(heat, &sample);
+                free(renderedColor);
+                continue;
+            }
+            uint32_t color = tone_map_pixel(tone, renderedColor->red, renderedColor->green, renderedColor->blue, x, height-1-y); // ARGB8888
+            free(renderedColor);
 
-//Se não houver colisão retorna uma estrutura com colObject vazio
-Collision* checkRayCollisions(vector3D * dir, vector3D * origin, ObjectList * objects){
-    float t = INFINITY;
-    Collision* collision = create_collision();
-    
-    ObjectList* index = objects;
-    while(index->sphere != NULL){
-        vector3D * oc = subtractVectors(index->sphere->center, origin);
-        float a = dotProduct(dir, dir);
-        float b = 2*dotProduct(oc, dir);
-        float c = dotProduct(oc, oc)-index->sphere->radius*index->sphere->radius;
-        free(oc);
-
-        float temp = quadraticFormula(a, b, c);
-        /*
-            there is a bug in the reflexion that ocurs when two objects are pretty close to each other,
-            it is originated from this line bellow, it ignores collisions too close to the origin, something
-            that makes sense for rays originated from the camera but not for rays originated from other objects.
-            The problem is that changing this to temp > 0 causes a lot of dots and artifacts to appear
-            dont really understand why but need to take a look at this. 
-            There is the chance that it is a perspective thing too, i need to test it.
-        */
-        if(temp >= 1 && temp < t){ 
-            t = temp;
-            vector3D* scale = scaleVector(dir, t);
-            vector3D* sumn = addVectors(origin, scale);
-            update_collision(collision, *sumn, index->sphere);
-            free(scale);
-            free(sumn);
+            if(checkerboard != NULL){
+                checkerboard->colors[y*width+x] = color;
+                checkerboard->ids[y*width+x] = hit;
+            }else{
+                uint32_t* texture_row = (uint32_t*)(texture_pixels + (height-1-y) * pitch);
+                texture_row[x] = color;
+            }
         }
-        
-        index = index->next;
     }
-
-    return collision;
-}
-
-float checkSingleObjectCollisionDistance(vector3D * dir, vector3D * origin, Sphere* sphere){
-        vector3D * oc = subtractVectors(sphere->center, origin);
-        float a = dotProduct(dir, dir);
-        float b = 2*dotProduct(oc, dir);
-        float c = dotProduct(oc, oc)-sphere->radius*sphere->radius;
-        free(oc);
-
-        return quadraticFormula(a, b, c);
-}
-
-int isInShadow(Collision* col, Light* light, ObjectList* objects){
-    ObjectList* index = objects;
-    while(index->sphere != NULL){
-        if(index->sphere == col->colObject){
-            index = index->next;
-            continue;
-        }
-
-        vector3D* sub = subtractVectors(&col->colPoint, light->position);
-        float t = checkSingleObjectCollisionDistance(sub, &col->colPoint, index->sphere);
-        free(sub);
-
-        if(0 < t && t < 1){
-            return 1;
-        }
-
-        index = index->next;
+    if(heat != NULL){
+        heat_map_frame(heat, width, height, texture_pixels, pitch, TONE_ARGB8888);
+        return;
     }
-    return 0;
-}
-
-Color* checkCollisionColor(Collision* col, Scene* scene){
-    Color * drawn_color = create_color(0, 0, 0);
-
-    vector3D* sub = subtractVectors(col->colObject->center, &col->colPoint);
-    vector3D* normalized = normalizeVector(sub);
-    free(sub);
 
-    vector3D* normCam = normalizeVector(scene->camera);
-    vector3D* view = subtractVectors(&col->colPoint , normCam);
-    free(normCam);
-
-    LightList* index = scene->lights;
-    while(index->light != NULL){
-        if(isInShadow(col, index->light, scene->objects)){
-            index = index->next;
-            continue;
+    if(checkerboard != NULL){
+        if(!full_frame) checkerboard_reconstruct(checkerboard, moving);
+        for(int y = 0; y < height; y++){
+            uint32_t* texture_row = (uint32_t*)(texture_pixels + (height-1-y) * pitch);
+            memcpy(texture_row, &checkerboard->colors[y*width], sizeof(uint32_t)*width);
         }
-        vector3D* sub = subtractVectors(&col->colPoint, index->light->position);
-        vector3D* L = normalizeVector(sub);
-        free(sub);
-
-        float dot = dotProduct(L, normalized);
-
-        vector3D* scaled = scaleVector(normalized, 2*dot);
-        vector3D* reflectance = subtractVectors(L, scaled);
-        free(scaled);
-
-        float dot2 = dotProduct(reflectance, view);
-        free(L);
-        free(reflectance);
-
-        if(dot < 0){
-            index = index->next;
-            continue;
-        };
-
-        Color* diffuseProd = productColors(index->light->diffuse, col->colObject->material->diffuse);
-        Color* diffuseScale = scaleColor(diffuseProd, dot);
-        Color* diffuseResult = clampColor(diffuseScale, 0, 1);
-        addColors(drawn_color, diffuseResult);
-        free(diffuseProd);
-        free(diffuseScale);
-        free(diffuseResult);
-
-        dot2 = powf(dot2, col->colObject->material->albedo);
-        
-        Color* specProd = productColors(index->light->specular, col->colObject->material->specular);
-        Color* specScale = scaleColor(specProd, dot2);
-        Color* specResult = clampColor(specScale, 0, 1);
-        addColors(drawn_color, specResult);
-        free(specProd);
-        free(specScale);
-        free(specResult);
-
-        index = index->next;
+        checkerboard_end(checkerboard);
     }
-
-    Color* ambProd = productColors(col->colObject->material->ambient, scene->ALI);
-    addColors(drawn_color, ambProd);
-    free(ambProd);
-
-    Color* hueScale = scaleColor(col->colObject->color, 0.2);
-    addColors(drawn_color, hueScale);
-    free(hueScale);
-
-    free(normalized);
-    free(view);
-
-    Color* result = clampColor(drawn_color, 0, 1);
-    free(drawn_color);
-    return result;
 }
 
-Color* colorFromRecursiveRayCast(vector3D * dir, vector3D * origin, Scene* scene, int depth){
-    Color* drawn_color = create_color(0, 0, 0);
-    if(depth <= 0) return drawn_color;
-
-    Collision* collision = checkRayCollisions(dir, origin, scene->objects);
-    if(collision->colObject == NULL){
-        destroy_collision(collision);
+//renders a width x height frame into the top left corner of a streaming ARGB8888 texture
+void renderScene(SDL_Texture* texture, Scene* scene, int width, int height, int samples, int shared_shading, ToneSettings* tone, Checkerboard* checkerboard, int moving, HeatMap* heat){
+    uint8_t* texture_pixels;
+    int pitch;
+    SDL_Rect rect = {0, 0, width, height};
+    TRACE_SPAN("SDL_LockTexture") SDL_LockTexture(texture, &rect, (void**)&texture_pixels, &pitch);
+    TRACE_SPAN("renderFrame") renderFrame(texture_pixels, pitch, scene, width, height, samples, shared_shading, tone, checkerboard, moving, heat);
+    TRACE_SPAN("SDL_UnlockTexture") SDL_UnlockTexture(texture);
+}
 
-        return drawn_color;
-    }
-    Color* colColor = checkCollisionColor(collision, scene);
-    Color* reflecScaled = scaleColor(collision->colObject->material->reflectivity, depth/2); //3 de depth hard coded basicamente, dá pra melhorar depois
-    Color* reflecColor = productColors(colColor, reflecScaled);
-    free(colColor);
-    free(reflecScaled);
-
-    addColors(drawn_color, reflecColor);
-    free(reflecColor);
-
-    vector3D* inverse = scaleVector(dir, -1);
-    vector3D* V = normalizeVector(inverse);
-    vector3D* sub = subtractVectors(collision->colObject->center, &collision->colPoint);
-    vector3D* N = normalizeVector(sub);
-    float dot = dotProduct(V, N);
-    vector3D* normalScaled = scaleVector(N, 2*dot);
-    vector3D* reflectance = subtractVectors(V, normalScaled);
-    free(inverse);
-    free(V);
-    free(sub);
-    free(N);
-    free(normalScaled);
-
-    Color* reflected = colorFromRecursiveRayCast(reflectance, &collision->colPoint, scene, depth-1);
-    addColors(drawn_color, reflected);
-    destroy_collision(collision);
-    free(reflected);
-    free(reflectance);
-
-    Color* final_color = clampColor(drawn_color, 0, 1);
-    free(drawn_color);
-
-    return final_color;
+//copies a frame that was rendered somewhere else, into the shared memory ring, to the texture
+void uploadFrame(SDL_Texture* texture, uint8_t* pixels, int width, int height){
+    TRACE_BEGIN(span, "upload texture");
+    uint8_t* texture_pixels;
+    int pitch;
+    SDL_Rect rect = {0, 0, width, height};
+    SDL_LockTexture(texture, &rect, (void**)&texture_pixels, &pitch);
+    for(int y = 0; y < height; y++) memcpy(texture_pixels+y*pitch, pixels+y*width*4, width*4);
+    SDL_UnlockTexture(texture);
+    TRACE_END(span);
 }
 
-Color* antialliased(Scene* scene, int x, int y){
-    Color* base_color = create_color(0, 0, 0);
-    int index = 0;
-    while(index < 4){
-        float alpha;
-        float beta;
-        switch (index)
-        {
-        case 0:
-            alpha = (float)x/WIDTH;
-            beta = (float)y/HEIGHT;
-            break;
-        case 1:
-            alpha = ((float)x + 0.5)/WIDTH;
-            beta = (float)y/HEIGHT;
-            break;
-        case 2:
-            alpha = (float)x/WIDTH;
-            beta = ((float)y + 0.5)/HEIGHT;
-            break;
-        default:
-            alpha = ((float)x + 0.5)/WIDTH;
-            beta = ((float)y + 0.5)/HEIGHT;
-            break;
+//draws the width x height corner of the texture stretched over the whole window, with the statistics of the
+//frame over its top left corner unless stats is NULL and the scale of the heat map at the bottom unless heat is
+void presentFrame(SDL_Renderer* renderer, SDL_Texture* texture, int width, int height, const RenderStats* stats, const HeatMap* heat){
+    SDL_FRect source = {0, 0, (float)width, (float)height};
+    SDL_RenderClear(renderer);
+    TRACE_SPAN("SDL_RenderTexture") SDL_RenderTexture(renderer, texture, &source, NULL);
+    if(heat != NULL){
+        //the colors from 0 to the scale in a 256 pixel bar, the caption above it says what the scale is
+        for(int i = 0; i < 256; i++){
+            uint32_t color = heat_color(i/255.0f);
+            SDL_SetRenderDrawColor(renderer, (color >> 16) & 0xff, (color >> 8) & 0xff, color & 0xff, 255);
+            SDL_FRect step = {8.0f+i, HEIGHT-20.0f, 1, 12};
+            SDL_RenderFillRect(renderer, &step);
         }
-
-        vector3D* scalex1 = scaleVector(scene->plane->x1, 1.0-alpha);
-        vector3D* scalex2 = scaleVector(scene->plane->x2, alpha);
-        vector3D * t = addVectors(scalex1, scalex2);
-        free(scalex1);
-        free(scalex2);
-
-        vector3D* scalex3 = scaleVector(scene->plane->x3, 1.0-alpha);
-        vector3D* scalex4 = scaleVector(scene->plane->x4, alpha);
-        vector3D * b = addVectors(scalex3, scalex4);
-        free(scalex3);
-        free(scalex4);
-
-        vector3D* scalet = scaleVector(t, 1.0-beta);
-        vector3D* scaleb = scaleVector(b, beta);
-        vector3D * origin = addVectors(scalet, scaleb);
-        free(scalet);
-        free(scaleb);
-
-        free(t);
-        free(b);
-
-        vector3D * direction = subtractVectors(scene->camera, origin);
-
-        Color* renderedColor = colorFromRecursiveRayCast(direction, origin, scene, 3);
-        addColors(base_color, renderedColor);
-        free(origin);
-        free(direction);
-        free(renderedColor);
-
-        index+=1;
-    }
-
-    Color* averageColor = scaleColor(base_color, (float)1/4);
-    Color* finalColor = clampColor(averageColor, 0, 1);
-    free(base_color);
-    free(averageColor);
-
-    return finalColor;
+        SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+        SDL_RenderDebugText(renderer, 8, HEIGHT-32.0f, heat->caption);
+        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+    }
+    if(stats != NULL){
+        char lines[STATS_OVERLAY_LINES][96];
+        int count = render_stats_overlay(stats, lines);
+        size_t longest = 0;
+        for(int i = 0; i < count; i++) if(strlen(lines[i]) > longest) longest = strlen(lines[i]);
+
+        //the debug font is 8x8, a dark box behind it keeps it readable over bright spheres
+        SDL_FRect background = {4, 4, longest*8+8.0f, count*12+4.0f};
+        SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 160);
+        SDL_RenderFillRect(renderer, &background);
+        SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+        for(int i = 0; i < count; i++) SDL_RenderDebugText(renderer, 8, 8+i*12, lines[i]);
+        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255); //what SDL_RenderClear clears with
+    }
+    TRACE_SPAN("SDL_RenderPresent") SDL_RenderPresent(renderer);
 }
 
-void renderScene(SDL_Renderer* renderer, Scene* scene, int antialliasing){
-    for(int x = 0; x < WIDTH; x++){
-        for(int y = 0; y < HEIGHT; y++){
-            Color* renderedColor;
-
-            if(!antialliasing){
-                float alpha = (float)x/WIDTH;
-                float beta = (float)y/HEIGHT;
-
-                //(1-alpha)*x1 + alpha*x2
-                vector3D* scalex1 = scaleVector(scene->plane->x1, 1.0-alpha);
-                vector3D* scalex2 = scaleVector(scene->plane->x2, alpha);
-                vector3D * t = addVectors(scalex1, scalex2);
-                free(scalex1);
-                free(scalex2);
-
-                vector3D* scalex3 = scaleVector(scene->plane->x3, 1.0-alpha);
-                vector3D* scalex4 = scaleVector(scene->plane->x4, alpha);
-                vector3D * b = addVectors(scalex3, scalex4);
-                free(scalex3);
-                free(scalex4);
-
-                vector3D* scalet = scaleVector(t, 1.0-beta);
-                vector3D* scaleb = scaleVector(b, beta);
-                vector3D* origin = addVectors(scalet, scaleb);
-                free(scalet);
-                free(scaleb);
-
-                free(t);
-                free(b);
-
-                vector3D* direction = subtractVectors(scene->camera, origin);
-
-                renderedColor = colorFromRecursiveRayCast(direction, origin, scene, 3);
-
-                free(direction);
-                free(origin);
+//image mode with --size, traces a width x height image a tile at a time with the plane cut down to the tile and
+//writes every tile to the file when it is done, so only one tile is ever in memory. 1 if it was saved
+int renderTiled(Scene* scene, int width, int height, int tile_width, int tile_height, int shared_shading, ToneSettings* tone, FrameFormat format, char* file_name){
+    TiledImage* image = create_tiled_image(file_name, format, width, height);
+    if(image == NULL) return 0;
+
+    vector3D* corners[4] = {scene->plane->x1, scene->plane->x2, scene->plane->x3, scene->plane->x4};
+    float plane[12];
+    float tile[12];
+    for(int corner = 0; corner < 4; corner++){
+        plane[corner*3] = corners[corner]->x;
+        plane[corner*3+1] = corners[corner]->y;
+        plane[corner*3+2] = corners[corner]->z;
+    }
+    uint8_t* rgb = (uint8_t*)malloc((size_t)tile_width*tile_height*3);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int ok = 1;
+    int tiles = 0;
+    //y goes up in the tracer, write_image_tile flips the rows back
+    for(int y = 0; y < height && ok; y += tile_height){
+        for(int x = 0; x < width && ok; x += tile_width){
+            int w = width-x < tile_width ? width-x : tile_width;
+            int h = height-y < tile_height ? height-y : tile_height;
+            tile_plane(plane, x, y, w, h, width, height, tile);
+            for(int corner = 0; corner < 4; corner++){
+                corners[corner]->x = tile[corner*3];
+                corners[corner]->y = tile[corner*3+1];
+                corners[corner]->z = tile[corner*3+2];
             }
-            else renderedColor = antialliased(scene, x, y);
 
-            SDL_SetRenderDrawColor(renderer, (int)(renderedColor->red*255), (int)(renderedColor->green*255), (int)(renderedColor->blue*255), 255);
-
-            free(renderedColor);
-
-            SDL_RenderPoint(renderer, x, HEIGHT-y);
+            TRACE_SPAN("trace tile") for(int ty = 0; ty < h; ty++){
+                for(int tx = 0; tx < w; tx++){
+                    Sphere* hit;
+                    Color* renderedColor = renderPixel(scene, tx, ty, w, h, 4, shared_shading, &hit);
+                    uint8_t* pixel = &rgb[(ty*w+tx)*3];
+                    float threshold = tone_threshold(tone, x+tx, y+h-1-ty);
+                    pixel[0] = tone_map_value(tone, renderedColor->red, threshold);
+                    pixel[1] = tone_map_value(tone, renderedColor->green, threshold);
+                    pixel[2] = tone_map_value(tone, renderedColor->blue, threshold);
+                    free(renderedColor);
+                }
+            }
+            TRACE_SPAN("write_image_tile") ok = write_image_tile(image, rgb, x, y, w, h, 1);
+            tiles++;
         }
     }
+    if(!destroy_tiled_image(image)) ok = 0;
+    for(int corner = 0; corner < 4; corner++){
+        corners[corner]->x = plane[corner*3];
+        corners[corner]->y = plane[corner*3+1];
+        corners[corner]->z = plane[corner*3+2];
+    }
+    free(rgb);
+    if(ok) printf("Rendered %dx%d in %d tiles in %.2f s, peak memory %.1f MB, saved as %s\n", width, height, tiles, elapsed_seconds(&start), peak_memory_mb(), file_name);
+    return ok;
 }
 
-OpenclContext* init_opencl(SDL_Renderer* renderer, Scene* scene){
-    //iniciando opencl
-    cl_int err;
-    cl_platform_id plataforms;
-    err = clGetPlatformIDs(1, &plataforms, NULL);
-    if(err != CL_SUCCESS){
-        printf("an error ocurred while finding available opencl plataforms");
-        exit(1);
-    }
-    cl_device_id devices;
-    err = clGetDeviceIDs(plataforms, CL_DEVICE_TYPE_GPU, 1, &devices, NULL);
-    if(err != CL_SUCCESS){
-        printf("an error ocurred while finding available opencl devices");
-        exit(1);
-    }
-    cl_context context = clCreateContext(NULL, 1, &devices, NULL, NULL, &err);
-    if(!context || err != CL_SUCCESS){
-        printf("An error ocurred while creating the context\n");
-        exit(1);
-    }
+//the file name of the image modes, jpegs keep the .jpeg they always had
+void image_file_name(char* name, size_t size, const char* base, FrameFormat format){
+    snprintf(name, size, "%s.%s", base, format == FRAME_JPG ? "jpeg" : frame_format_extension(format));
+}
 
-    const char* render_kernel_source = load_strfile("render.txt");
-    cl_program render_program = clCreateProgramWithSource(context, 1, &render_kernel_source, NULL, &err);
-    if(err != CL_SUCCESS){
-        printf("an error ocurred while creating the opencl program: %d\n", err);
-        exit(1);
-    }
-    err = clBuildProgram(render_program, 1, &devices, NULL, NULL, NULL);
-    if (err == CL_BUILD_PROGRAM_FAILURE) {
-        //this block came from stackoveflow, will search for the link to credit when i can
-        size_t log_size;
-        clGetProgramBuildInfo(render_program, devices, CL_PROGRAM_BUILD_LOG, 0, NULL, &log_size);
-    
-        char *log = (char *) malloc(log_size);
-    
-        clGetProgramBuildInfo(render_program, devices, CL_PROGRAM_BUILD_LOG, log_size, log, NULL);
-    
-        printf("%s\n", log);
-        exit(1);
-    }else if(err != CL_SUCCESS){
-        printf("an error ocurred while building the opencl program: %d\n", err);
-        exit(1);
-    }
-    const char* cam_kernel_source = load_strfile("cam_dir.txt");
-    cl_program cam_program = clCreateProgramWithSource(context, 1, &cam_kernel_source, NULL, &err);
-    if(err != CL_SUCCESS){
-        printf("an error ocurred while creating the opencl program: %d\n", err);
-        exit(1);
-    }
-    err = clBuildProgram(cam_program, 1, &devices, NULL, NULL, NULL);
-    if (err == CL_BUILD_PROGRAM_FAILURE) {
-        size_t log_size;
-        clGetProgramBuildInfo(cam_program, devices, CL_PROGRAM_BUILD_LOG, 0, NULL, &log_size);
-    
-        char *log = (char *) malloc(log_size);
-    
-        clGetProgramBuildInfo(cam_program, devices, CL_PROGRAM_BUILD_LOG, log_size, log, NULL);
-    
-        printf("%s\n", log);
-        exit(1);
-    }else if(err != CL_SUCCESS){
-        printf("an error ocurred while building the opencl program: %d\n", err);
-        exit(1);
-    }
+OpenclContext* init_opencl_live(flattenedScene* fscene){
+    OpenclContext* opencl_context = init_opencl(fscene, "cam_dir.txt", "cam_dir");
+    cl_kernel cam_kernel = opencl_context->post_processing_kernel;
 
-    cl_command_queue queue = clCreateCommandQueueWithProperties(context, devices, NULL, NULL);
-    
-    const long screensize = WIDTH*HEIGHT;
-    const size_t screensizebytes = screensize*sizeof(float)*3;
-    cl_mem pixelcolors = clCreateBuffer(context, CL_MEM_READ_WRITE, screensizebytes*4, NULL, NULL);
-
-    cl_mem camera = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(float)*3, NULL, NULL);
-    cl_mem  plane = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(float)*12, NULL, NULL);
-    cl_mem ALI = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(float)*3, NULL, NULL);
-    cl_mem lightpos = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(float)*scene->num_lights*3, NULL, NULL);
-    cl_mem lightdiffuse = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(float)*scene->num_lights*3, NULL, NULL);
-    cl_mem lightspecular = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(float)*scene->num_lights*3, NULL, NULL);
-    cl_mem objectpos = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(float)*scene->num_objects*3, NULL, NULL);
-    cl_mem objectcolor = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(float)*scene->num_objects*3, NULL, NULL);
-    cl_mem objectambient = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(float)*scene->num_objects*3, NULL, NULL);
-    cl_mem objectdiffuse = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(float)*scene->num_objects*3, NULL, NULL);
-    cl_mem objectspecular = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(float)*scene->num_objects*3, NULL, NULL);
-    cl_mem objectreflectivity = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(float)*scene->num_objects*3, NULL, NULL);
-    cl_mem objectalbedo = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(float)*scene->num_objects, NULL, NULL);
-    cl_mem objectradius = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(float)*scene->num_objects, NULL, NULL);
-
-    flattenedScene* fscene = flattenScene(scene);
-    clEnqueueWriteBuffer(queue, camera, CL_TRUE, 0, sizeof(float)*3, fscene->camera, 0, NULL, NULL);
-    clEnqueueWriteBuffer(queue, plane, CL_TRUE, 0, sizeof(float)*12, fscene->plane, 0, NULL, NULL);
-    clEnqueueWriteBuffer(queue, ALI, CL_TRUE, 0, sizeof(float)*3, fscene->ALI, 0, NULL, NULL);
-    clEnqueueWriteBuffer(queue, lightpos, CL_TRUE, 0, sizeof(float)*scene->num_lights*3, fscene->lightpos, 0, NULL, NULL);
-    clEnqueueWriteBuffer(queue, lightdiffuse, CL_TRUE, 0, sizeof(float)*scene->num_lights*3, fscene->lightdiffuse, 0, NULL, NULL);
-    clEnqueueWriteBuffer(queue, lightspecular, CL_TRUE, 0, sizeof(float)*scene->num_lights*3, fscene->lightspecular, 0, NULL, NULL);
-    clEnqueueWriteBuffer(queue, objectpos, CL_TRUE, 0, sizeof(float)*scene->num_objects*3, fscene->objectpos, 0, NULL, NULL);
-    clEnqueueWriteBuffer(queue, objectcolor, CL_TRUE, 0, sizeof(float)*scene->num_objects*3, fscene->objectcolor, 0, NULL, NULL);
-    clEnqueueWriteBuffer(queue, objectambient, CL_TRUE, 0, sizeof(float)*scene->num_objects*3, fscene->objectambient, 0, NULL, NULL);
-    clEnqueueWriteBuffer(queue, objectdiffuse, CL_TRUE, 0, sizeof(float)*scene->num_objects*3, fscene->objectdiffuse, 0, NULL, NULL);
-    clEnqueueWriteBuffer(queue, objectspecular, CL_TRUE, 0, sizeof(float)*scene->num_objects*3, fscene->objectspecular, 0, NULL, NULL);
-    clEnqueueWriteBuffer(queue, objectreflectivity, CL_TRUE, 0, sizeof(float)*scene->num_objects*3, fscene->objectreflectivity, 0, NULL, NULL);
-    clEnqueueWriteBuffer(queue, objectalbedo, CL_TRUE, 0, sizeof(float)*scene->num_objects, fscene->objectalbedo, 0, NULL, NULL);
-    clEnqueueWriteBuffer(queue, objectradius, CL_TRUE, 0, sizeof(float)*scene->num_objects, fscene->objectradius, 0, NULL, NULL);
-
-    cl_kernel render_kernel = clCreateKernel(render_program, "render", NULL);
-    cl_kernel cam_kernel = clCreateKernel(cam_program, "cam_dir", NULL);
-
-    err = clSetKernelArg(render_kernel, 0, sizeof(cl_mem), &pixelcolors);
-    if (err != CL_SUCCESS) {
-        printf("Error setting kernel arg: %d\n", err);
-        exit(1);
-    }
-    err = clSetKernelArg(render_kernel, 1, sizeof(long), &screensize);
-    if (err != CL_SUCCESS) {
-        printf("Error setting kernel arg: %d\n", err);
-        exit(1);
-    }
-    err = clSetKernelArg(render_kernel, 2, sizeof(cl_mem), &camera);
-    if (err != CL_SUCCESS) {
-        printf("Error setting kernel arg: %d\n", err);
-        exit(1);
-    }
-    err = clSetKernelArg(render_kernel, 3, sizeof(cl_mem), &plane);
-    if (err != CL_SUCCESS) {
-        printf("Error setting kernel arg: %d\n", err);
-        exit(1);
-    }
-    err = clSetKernelArg(render_kernel, 4, sizeof(cl_mem), &ALI);
-    if (err != CL_SUCCESS) {
-        printf("Error setting kernel arg: %d\n", err);
-        exit(1);
-    }
-    err = clSetKernelArg(render_kernel, 5, sizeof(cl_mem), &lightpos);
-    if (err != CL_SUCCESS) {
-        printf("Error setting kernel arg: %d\n", err);
-        exit(1);
-    }
-    err = clSetKernelArg(render_kernel, 6, sizeof(cl_mem), &lightdiffuse);
-    if (err != CL_SUCCESS) {
-        printf("Error setting kernel arg: %d\n", err);
-        exit(1);
-    }
-    err = clSetKernelArg(render_kernel, 7, sizeof(cl_mem), &lightspecular);
-    if (err != CL_SUCCESS) {
-        printf("Error setting kernel arg: %d\n", err);
-        exit(1);
-    }
-    err = clSetKernelArg(render_kernel, 8, sizeof(cl_mem), &objectpos);
-    if (err != CL_SUCCESS) {
-        printf("Error setting kernel arg: %d\n", err);
-        exit(1);
-    }
-    err = clSetKernelArg(render_kernel, 9, sizeof(cl_mem), &objectcolor);
-    if (err != CL_SUCCESS) {
-        printf("Error setting kernel arg: %d\n", err);
-        exit(1);
-    }
-    err = clSetKernelArg(render_kernel, 10, sizeof(cl_mem), &objectambient);
-    if (err != CL_SUCCESS) {
-        printf("Error setting kernel arg: %d\n", err);
-        exit(1);
-    }
-    err = clSetKernelArg(render_kernel, 11, sizeof(cl_mem), &objectdiffuse);
-    if (err != CL_SUCCESS) {
-        printf("Error setting kernel arg: %d\n", err);
-        exit(1);
-    }
-    err = clSetKernelArg(render_kernel, 12, sizeof(cl_mem), &objectspecular);
-    if (err != CL_SUCCESS) {
-        printf("Error setting kernel arg: %d\n", err);
-        exit(1);
-    }
-    err = clSetKernelArg(render_kernel, 13, sizeof(cl_mem), &objectreflectivity);
-    if (err != CL_SUCCESS) {
-        printf("Error setting kernel arg: %d\n", err);
-        exit(1);
-    }
-    err = clSetKernelArg(render_kernel, 14, sizeof(cl_mem), &objectalbedo);
-    if (err != CL_SUCCESS) {
-        printf("Error setting kernel arg: %d\n", err);
-        exit(1);
-    }
-    err = clSetKernelArg(render_kernel, 15, sizeof(cl_mem), &objectradius);
-    if (err != CL_SUCCESS) {
-        printf("Error setting kernel arg: %d\n", err);
-        exit(1);
-    }
-    err = clSetKernelArg(render_kernel, 16, sizeof(int), &fscene->num_lights);
-    if (err != CL_SUCCESS) {
-        printf("Error setting kernel arg: %d\n", err);
-        exit(1);
-    }
-    err = clSetKernelArg(render_kernel, 17, sizeof(int), &fscene->num_objects);
-    if (err != CL_SUCCESS) {
-        printf("Error setting kernel arg: %d\n", err);
-        exit(1);
-    }
-
-    err = clSetKernelArg(cam_kernel, 0, sizeof(cl_mem), &camera);
-    if (err != CL_SUCCESS) {
-        printf("Error setting kernel arg: %d\n", err);
-        exit(1);
-    }
-    err = clSetKernelArg(cam_kernel, 1, sizeof(cl_mem), &plane);
-    if (err != CL_SUCCESS) {
-        printf("Error setting kernel arg: %d\n", err);
-        exit(1);
-    }
+    set_kernel_arg(cam_kernel, 0, sizeof(cl_mem), &opencl_context->camera);
+    set_kernel_arg(cam_kernel, 1, sizeof(cl_mem), &opencl_context->plane);
     int cam_xmov = 0; int cam_ymov = 0;
-    err = clSetKernelArg(cam_kernel, 2, sizeof(int), &cam_xmov);
-    if (err != CL_SUCCESS) {
-        printf("Error setting kernel arg: %d\n", err);
-        exit(1);
-    }
-    err = clSetKernelArg(cam_kernel, 3, sizeof(int), &cam_ymov);
-    if (err != CL_SUCCESS) {
-        printf("Error setting kernel arg: %d\n", err);
-        exit(1);
-    }
+    set_kernel_arg(cam_kernel, 2, sizeof(int), &cam_xmov);
+    set_kernel_arg(cam_kernel, 3, sizeof(int), &cam_ymov);
 
-    clReleaseCommandQueue(queue);
-
-    return create_opencl_context(
-        fscene,
-        pixelcolors,
-        camera,
-        plane,
-        ALI,
-        lightpos,
-        lightdiffuse,
-        lightspecular,
-        objectpos,
-        objectcolor,
-        objectambient,
-        objectdiffuse,
-        objectspecular,
-        objectreflectivity,
-        objectalbedo,
-        objectradius,
-        render_kernel,
-        cam_kernel,
-        render_program,
-        cam_program,
-        devices,
-        context
-    );
+    return opencl_context;
 }
 
 /*xyz: float[3]*
@@ -590,6 +227,53 @@ OpenclContext* init_opencl(SDL_Renderer* renderer, Scene* scene){
 */
 int main(int argc, char* argv[]){
 
+    char* target_ms_option = take_option(&argc, argv, "--target-ms");
+    float target_ms = target_ms_option ? atof(target_ms_option) : 0;
+    int use_checkerboard = take_flag(&argc, argv, "--checkerboard");
+    int shared_shading = take_flag(&argc, argv, "--shared-shading");
+    int watch = take_flag(&argc, argv, "--watch");
+    char* animate_option = take_option(&argc, argv, "--animate");
+    int animate = animate_option ? atoi(animate_option) : 0;
+    char* format_option = take_option(&argc, argv, "--format");
+    FrameFormat image_format = FRAME_JPG;
+    if(format_option != NULL && (!parse_frame_format(format_option, &image_format) || is_stream_format(image_format))){
+        printf("Unknown image format %s, use ppm, pam, png or jpg\n", format_option);
+        exit(2);
+    }
+    //--size renders the image mode in tiles of --tile pixels straight into a ppm or pam of any size
+    char* size_option = take_option(&argc, argv, "--size");
+    char* tile_option = take_option(&argc, argv, "--tile");
+    int image_width = 0; int image_height = 0;
+    int tile_width = 256; int tile_height = 256;
+    if(size_option != NULL){
+        if(!parse_size(size_option, &image_width, &image_height) || (tile_option != NULL && !parse_size(tile_option, &tile_width, &tile_height))){
+            printf("--size and --tile take WxH\n");
+            exit(2);
+        }
+        if(format_option == NULL) image_format = FRAME_PPM;
+    }
+
+    //--shm name also publishes the frames of the live modes to a shared memory ring, see frame_ring.h
+    char* shm_option = take_option(&argc, argv, "--shm");
+    //--stats draws the ray counters of every frame over it, --stats-fd n writes them to fd n as json lines
+    int show_stats = take_flag(&argc, argv, "--stats");
+    char* stats_fd_option = take_option(&argc, argv, "--stats-fd");
+    //--heatmap tests|shadows|bounces|time draws what every pixel cost instead of its color, see heatmap.h
+    char* heatmap_option = take_option(&argc, argv, "--heatmap");
+    HeatMetric heat_metric = HEAT_OFF;
+    if(heatmap_option != NULL && !parse_heat_metric(heatmap_option, &heat_metric)){
+        printf("Unknown heatmap %s, use tests, shadows, bounces or time\n", heatmap_option);
+        exit(2);
+    }
+    //--trace file.json writes chrome trace spans of the whole run at exit, in builds with -DTRACE, see trace.h
+    char* trace_option = take_option(&argc, argv, "--trace");
+    if(trace_option != NULL) trace_start(trace_option);
+    ToneSettings tone;
+    if(!take_tone_options(&argc, argv, &tone)){
+        printf("--tonemap is clamp, reinhard or filmic and --exposure a number above 0\n");
+        exit(2);
+    }
+
     if(argc <= 1 || argc >= 7){
         printf("Unexpected number of arguments\n"
         "Check the readme to see the usage\n");
@@ -609,67 +293,166 @@ int main(int argc, char* argv[]){
         exit(1);
     }
 
-    Scene* scene;
+    flattenedScene* fscene;
     if(!strcmp(argv[1], "file")){
-        FILE *file = fopen(argv[2], "r");
-        if (file == NULL){
-            printf("Could not open file\n");
-            exit(1);
-        }
-
-        fseek(file, 0, SEEK_END);
-        long file_size = ftell(file);
-        fseek(file, 0, SEEK_SET);
-
-        char *json_str = malloc(file_size + 1);
-        fread(json_str, 1, file_size, file);
-        json_str[file_size] = '\0';
-        scene = load_scene(json_str);
-
-        fclose(file);
+        TRACE_SPAN("load_scene") fscene = load_flattened_scene(argv[2]);
     }else{
         printf("Options:\n"
         "'file' then provide a valid json file name\n");
         exit(2);
     }
-    if(scene == NULL){
+    if(fscene == NULL){
         printf("Error: Could not load the scene\n");
         exit(1);
     }
 
+    //--watch reloads the scene in the live modes whenever the file is saved
+    SceneWatcher* watcher = NULL;
+    if(watch && (!strcmp(argv[3], "live") || !strcmp(argv[3], "opencl"))) watcher = create_scene_watcher(argv[2]);
+    if(animate > 0 && strcmp(argv[3], "opencl")) printf("--animate only works in the opencl mode, ignoring it\n");
+    FrameRing* ring = NULL;
+    if(shm_option != NULL){
+        if(strcmp(argv[3], "live") && strcmp(argv[3], "opencl")) printf("--shm only works in the live modes, ignoring it\n");
+        else if((ring = create_frame_ring(shm_option, WIDTH, HEIGHT)) == NULL) exit(1);
+    }
+    RenderStats stats;
+    int count_stats = 0;
+    if(show_stats || stats_fd_option != NULL){
+        if(strcmp(argv[3], "live") && strcmp(argv[3], "opencl")) printf("--stats and --stats-fd only work in the live modes, ignoring them\n");
+        else{
+            count_stats = 1;
+            init_render_stats(&stats, strcmp(argv[3], "opencl") ? "cpu" : "opencl", stats_fd_option ? atoi(stats_fd_option) : -1);
+        }
+    }
+    const RenderStats* overlay = show_stats && count_stats ? &stats : NULL;
+    if(heat_metric != HEAT_OFF){
+        if(heat_metric == HEAT_TIME && (!strcmp(argv[3], "opencl") || !strcmp(argv[3], "image_opencl"))){
+            printf("--heatmap time only works in the cpu modes, the gpu ones count tests, shadows or bounces\n");
+            exit(2);
+        }
+        if(size_option != NULL && !strcmp(argv[3], "image")){
+            printf("--heatmap does not work with --size, the tiles would each have their own scale, ignoring it\n");
+            heat_metric = HEAT_OFF;
+        }
+        if(use_checkerboard){
+            //the pixels that were not traced have no cost to show
+            printf("--heatmap traces every pixel, ignoring --checkerboard\n");
+            use_checkerboard = 0;
+        }
+    }
+    HeatMap* heat = create_heat_map(heat_metric, WIDTH, HEIGHT);
+
+    //the cpu modes trace the linked list scene, the opencl ones upload the flattened arrays as they are
+    Scene* scene = NULL;
+    if(!strcmp(argv[3], "live") || !strcmp(argv[3], "image")){
+        scene = scene_from_flattened(fscene);
+        destroy_flattened_scene(fscene);
+        fscene = NULL;
+    }
+
     if(!strcmp(argv[3], "live")){
         int antialliasing = 0;
         if(argc > 4) antialliasing = 1;
+
+        FrameGovernor governor;
+        init_governor(&governor, target_ms, WIDTH, HEIGHT, antialliasing ? 4 : 1);
+        SDL_Texture* texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, WIDTH, HEIGHT);
+        SDL_SetTextureScaleMode(texture, SDL_SCALEMODE_LINEAR);
+        Checkerboard* checkerboard = use_checkerboard ? create_checkerboard() : NULL;
+
         int running = 1;
         while (running) {
             SDL_Event e;
             while(SDL_PollEvent(&e)){
                 if (e.type == SDL_EVENT_QUIT){
                     running = 0;
+                }else if(e.type == SDL_EVENT_KEY_DOWN){
+                    governor_input(&governor);
                 }
             }
             
-            renderScene(renderer, scene, antialliasing);
+            if(scene_file_changed(watcher)){
+                flattenedScene* reloaded;
+                TRACE_SPAN("load_scene") reloaded = load_flattened_scene(argv[2]);
+                if(reloaded != NULL){
+                    destroy_scene(scene);
+                    scene = scene_from_flattened(reloaded);
+                    destroy_flattened_scene(reloaded);
+                    if(checkerboard != NULL) checkerboard->valid = 0; //its ids point into the old scene
+                }else printf("Keeping the last scene\n");
+            }
 
-            SDL_RenderPresent(renderer);
+            TRACE_BEGIN(frame, "frame");
+            uint64_t frame_start = SDL_GetTicksNS();
+            if(count_stats) begin_render_stats(&stats, governor.width, governor.height, governor.samples);
+            //with a consumer keeping up the frame is rendered straight into the shared memory and copied to the window
+            uint8_t* shared_pixels = ring != NULL ? frame_ring_begin(ring, governor.width, governor.height) : NULL;
+            if(shared_pixels != NULL){
+                TRACE_SPAN("renderFrame") renderFrame(shared_pixels, governor.width*4, scene, governor.width, governor.height, governor.samples, shared_shading, &tone, checkerboard, governor_moving(&governor), heat);
+                frame_ring_publish(ring);
+                uploadFrame(texture, shared_pixels, governor.width, governor.height);
+            }else renderScene(texture, scene, governor.width, governor.height, governor.samples, shared_shading, &tone, checkerboard, governor_moving(&governor), heat);
+
+            if(count_stats){
+                //the frame is traced on this thread alone, its counters are the whole frame
+                merge_ray_counters(&stats);
+                stats.frame_ms = (SDL_GetTicksNS()-frame_start)/1000000.0;
+            }
+            presentFrame(renderer, texture, governor.width, governor.height, overlay, heat);
+            if(count_stats) end_render_stats(&stats);
+            governor_update(&governor, (SDL_GetTicksNS()-frame_start)/1000000.0f);
+            TRACE_END(frame);
         }
+        if(checkerboard != NULL) destroy_checkerboard(checkerboard);
+        SDL_DestroyTexture(texture);
     }
     else if(!strcmp(argv[3], "image")){
         if(argv[4] == NULL){
             printf("Provide the desired filename as the second argument\n");
             exit(2);
         }
-        SDL_Surface* surface = NULL;
+        char file_name[4096];
+        image_file_name(file_name, sizeof(file_name), argv[4], image_format);
+        if(size_option != NULL){
+            if(!renderTiled(scene, image_width, image_height, tile_width, tile_height, shared_shading, &tone, image_format, file_name)){
+                printf("Error while saving the image\n");
+                exit(1);
+            }
+            destroy_scene(scene);
+            SDL_DestroyRenderer(renderer);
+            SDL_DestroyWindow(window);
+            SDL_Quit();
+            return 0;
+        }
+        FrameWriter* writer = create_image_writer(image_format, file_name, WIDTH, HEIGHT);
+        SDL_Texture* texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, WIDTH, HEIGHT);
 
-        renderScene(renderer, scene, 1);
-        surface = SDL_RenderReadPixels(renderer, NULL);
-        SDL_RenderPresent(renderer);
+        renderScene(texture, scene, WIDTH, HEIGHT, 4, shared_shading, &tone, NULL, 0, heat);
+        SDL_RenderTexture(renderer, texture, NULL, NULL);
+        SDL_Surface* surface;
+        SDL_Surface* rgb_surface;
+        TRACE_SPAN("SDL_RenderReadPixels"){
+            surface = SDL_RenderReadPixels(renderer, NULL);
+            rgb_surface = surface ? SDL_ConvertSurface(surface, SDL_PIXELFORMAT_RGB24) : NULL;
+        }
+        TRACE_SPAN("SDL_RenderPresent") SDL_RenderPresent(renderer);
 
-        if(IMG_SaveJPG(surface, strcat(argv[4], ".jpeg"), 100)) printf("Image saved\n");
-        else printf("Error while saving the image\n");
+        uint8_t* rgb = frame_writer_next(writer);
+        if(rgb_surface != NULL){
+            for(int y = 0; y < HEIGHT; y++) memcpy(&rgb[y*WIDTH*3], (uint8_t*)rgb_surface->pixels+y*rgb_surface->pitch, WIDTH*3);
+            frame_writer_submit(writer);
+        }
 
         SDL_Delay(1000); //delay só dar pra ver rapidinho a imagem antes de fechar
+        //the image was encoded on the writer's threads during the delay
+        //destroyed even without a frame, so its threads and slots go too
+        int saved = destroy_frame_writer(writer) && rgb_surface != NULL;
+        if(saved) printf("Image saved as %s\n", file_name);
+        else printf("Error while saving the image\n");
+        if(heat != NULL) printf("Heatmap of %s\n", heat->caption);
+        SDL_DestroySurface(rgb_surface);
         SDL_DestroySurface(surface);
+        SDL_DestroyTexture(texture);
     }
     else if(!strcmp(argv[3], "image_opencl")){
         if(argv[4] == NULL){
@@ -679,71 +462,69 @@ int main(int argc, char* argv[]){
         cl_int err;
         uint8_t* texture_pixels;
         int pitch;
-        SDL_Surface* surface = NULL;
+        char file_name[4096];
+        image_file_name(file_name, sizeof(file_name), argv[4], image_format);
+        FrameWriter* writer = create_image_writer(image_format, file_name, WIDTH, HEIGHT);
 
-        OpenclContext *opencl_context = init_opencl(renderer, scene);
+        OpenclContext *opencl_context = init_opencl_live(fscene);
         cl_command_queue queue = clCreateCommandQueueWithProperties(opencl_context->context, opencl_context->devices, NULL, NULL);
         SDL_Texture* texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, WIDTH, HEIGHT);
 
         const long screensize = WIDTH*HEIGHT;
         const size_t screensizebytes = screensize*sizeof(float)*3;
 
-        size_t globalsize = screensize*4;//times the amount of extra rays for the antialliasing
         size_t localsize = 128;
+        size_t globalsize = screensize*4;//times the amount of extra rays for the antialliasing
+        cl_kernel render_kernel = opencl_context->render_kernel;
+        if(shared_shading){
+            globalsize = render_global_size(WIDTH, HEIGHT, 1, localsize);
+            render_kernel = opencl_context->shared_render_kernel;
+        }
+        if(heat != NULL) set_heat_counter(render_kernel, heat_metric_counter(heat->metric));
         float* pixels = (float*)malloc(screensizebytes*4);
 
-        err = clEnqueueNDRangeKernel(queue, opencl_context->render_kernel, 1, NULL, &globalsize, &localsize, 0, NULL, NULL);
+        TRACE_SPAN("clEnqueueNDRangeKernel render") err = clEnqueueNDRangeKernel(queue, render_kernel, 1, NULL, &globalsize, &localsize, 0, NULL, NULL);
         if (err != CL_SUCCESS) {
             printf("Error executing queued command: %d\n", err);
             exit(1);
         }
-        clFinish(queue);
+        TRACE_SPAN("clFinish render") clFinish(queue);
 
-        err = clEnqueueReadBuffer(queue, opencl_context->pixelcolors, CL_TRUE, 0, screensizebytes*4, pixels, 0, NULL, NULL);
+        TRACE_SPAN("clEnqueueReadBuffer pixelcolors") err = clEnqueueReadBuffer(queue, opencl_context->pixelcolors, CL_TRUE, 0, screensizebytes*4, pixels, 0, NULL, NULL);
         if (err != CL_SUCCESS) {
             printf("Error reading queued buffer: %d\n", err);
             exit(1);
         }
-        clFinish(queue);
-
-        SDL_LockTexture(texture, NULL, (void**)&texture_pixels, &pitch);
-        
-        for(int i = 0; i < screensize; i++){
-            int y = (int)floor((float)i/1080) % 720;
-            int x = i % 1080;
-
-            uint32_t* texture_row = (uint32_t*)(texture_pixels + y * pitch);
-            
-            float red = 0; float green = 0; float blue = 0;
-            for(int z = 0; z < 4; z++){
-                int pos = (i*3)+777600*z*3;
-                red+=pixels[pos];
-                green+=pixels[pos+1];
-                blue+=pixels[pos+2];
-            }
-
-            texture_row[x] = (255 << 24) | ((uint8_t)(red*255) << 16) | ((uint8_t)(green*255) << 8) | (uint8_t)(blue*255); // ARGB8888
-        }
-        SDL_UnlockTexture(texture);
+        TRACE_SPAN("clFinish readback") clFinish(queue);
+
+        //the writer gets the samples resolved straight from the buffer, no need to read the window back
+        ToneMapper* tone_mapper = create_tone_mapper(tone);
+        if(heat != NULL){
+            heat_costs_from_samples(heat, pixels, 4, WIDTH, HEIGHT);
+            heat_map_frame(heat, WIDTH, HEIGHT, frame_writer_next(writer), WIDTH*3, TONE_RGB8);
+            printf("Heatmap of %s\n", heat->caption);
+        }else tone_map_rgb(tone_mapper, pixels, 4, WIDTH, HEIGHT, frame_writer_next(writer));
+        frame_writer_submit(writer);
+
+        TRACE_SPAN("SDL_LockTexture") SDL_LockTexture(texture, NULL, (void**)&texture_pixels, &pitch);
+        if(heat != NULL) heat_map_frame(heat, WIDTH, HEIGHT, texture_pixels, pitch, TONE_ARGB8888);
+        else tone_map_argb(tone_mapper, pixels, 4, WIDTH, HEIGHT, texture_pixels, pitch);
+        TRACE_SPAN("SDL_UnlockTexture") SDL_UnlockTexture(texture);
+        destroy_tone_mapper(tone_mapper);
         SDL_RenderTexture(renderer, texture, NULL, NULL);
-
-        surface = SDL_RenderReadPixels(renderer, NULL);
-        SDL_RenderPresent(renderer);
-
-        if(IMG_SaveJPG(surface, strcat(argv[4], ".jpeg"), 100)) printf("Image saved\n");
-        else printf("Error while saving the image\n");
+        TRACE_SPAN("SDL_RenderPresent") SDL_RenderPresent(renderer);
 
         destroy_openclcontext(opencl_context);
         clReleaseCommandQueue(queue);
-        SDL_DestroySurface(surface);
+        if(destroy_frame_writer(writer)) printf("Image saved as %s\n", file_name);
+        else printf("Error while saving the image\n");
     }
     else if(!strcmp(argv[3], "opencl")){
         cl_int err;    
         uint8_t* texture_pixels;
         int pitch;
 
-        OpenclContext *opencl_context = init_opencl(renderer, scene);
-        flattenedScene *fscene = opencl_context->fscene;
+        OpenclContext *opencl_context = init_opencl_live(fscene);
         cl_command_queue queue = clCreateCommandQueueWithProperties(opencl_context->context, opencl_context->devices, NULL, NULL);
         SDL_Texture* texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, WIDTH, HEIGHT);
 
@@ -752,9 +533,22 @@ int main(int argc, char* argv[]){
 
         int cam_xmov = 0; int cam_ymov = 0; int cam_moved = 0;
 
-        size_t globalsize = screensize*4;//times the amount of extra rays for the antialliasing
+        FrameGovernor governor;
+        init_governor(&governor, target_ms, WIDTH, HEIGHT, 4);
+        SDL_SetTextureScaleMode(texture, SDL_SCALEMODE_LINEAR);
+        int frame_parity = 0;
+        int last_width = 0; int last_height = 0; int last_samples = 0;
+        cl_kernel render_kernel = shared_shading ? opencl_context->shared_render_kernel : opencl_context->render_kernel;
+        if(count_stats) set_ray_stats(render_kernel, 1);
+        if(heat != NULL) set_heat_counter(render_kernel, heat_metric_counter(heat->metric));
+
+        //--animate n moves n spheres, only their positions and the bvh nodes above them are uploaded each frame
+        SceneAnimation* animation = animate > 0 ? create_scene_animation(fscene, animate, 1) : NULL;
+        uint64_t last_step = SDL_GetTicksNS();
+
         size_t localsize = 128;
         float* pixels = (float*)malloc(screensizebytes*4);
+        ToneMapper* tone_mapper = create_tone_mapper(tone);
         int running = 1;
         while (running) {
             SDL_Event e;
@@ -762,6 +556,7 @@ int main(int argc, char* argv[]){
                 if (e.type == SDL_EVENT_QUIT){
                     running = 0;
                 }else if(e.type == SDL_EVENT_KEY_DOWN){
+                    governor_input(&governor);
                     const char* key_pressed = SDL_GetKeyName(e.key.key);
                     if(!strcmp(key_pressed, "Escape")) running = 0;
                     else if(!strcmp(key_pressed, "Up")){
@@ -790,12 +585,58 @@ int main(int argc, char* argv[]){
                 }
             }
 
-            err = clEnqueueWriteBuffer(queue, opencl_context->camera, CL_TRUE, 0, sizeof(float)*3, fscene->camera, 0, NULL, NULL);
+            if(scene_file_changed(watcher)){
+                //only the scene buffers change, and only the ones that grew are allocated again
+                uint64_t reload_start = SDL_GetTicksNS();
+                flattenedScene* reloaded;
+                TRACE_SPAN("load_scene") reloaded = load_flattened_scene(argv[2]);
+                if(reloaded != NULL){
+                    reload_opencl_scene(opencl_context, queue, reloaded);
+                    fscene = reloaded;
+                    if(animation != NULL){
+                        destroy_scene_animation(animation);
+                        animation = create_scene_animation(fscene, animate, 1);
+                    }
+                    last_width = 0; //the checkerboard has no last frame of this scene
+                    printf("Reloaded %s in %.1f ms\n", argv[2], (SDL_GetTicksNS()-reload_start)/1000000.0);
+                }else printf("Keeping the last scene\n");
+            }
+
+            TRACE_BEGIN(frame, "frame");
+            uint64_t frame_start = SDL_GetTicksNS();
+            if(animation != NULL){
+                //a long frame would make the spheres jump through each other, the motion just slows down then
+                float dt = fminf((frame_start-last_step)/1000000000.0f, 0.05f);
+                step_scene_animation(animation, dt);
+                update_scene_elements(queue, opencl_context->objectpos, fscene->objectpos, sizeof(float)*3, animation->moving, animation->num_moving);
+                update_scene_elements(queue, opencl_context->objectbvhbounds, fscene->objectbvh->bounds, sizeof(float)*6, animation->dirty_nodes, animation->num_dirty_nodes);
+            }
+            last_step = frame_start;
+            const int width = governor.width;
+            const int height = governor.height;
+            const int samples = governor.samples;
+            set_render_resolution(render_kernel, width, height, samples);
+            if(count_stats){
+                begin_render_stats(&stats, width, height, samples);
+                clear_opencl_ray_stats(opencl_context, queue);
+            }
+
+            //the first frame and any resolution change have no last frame to rebuild from
+            int half_frame = use_checkerboard && width == last_width && height == last_height && samples == last_samples;
+            last_width = width; last_height = height; last_samples = samples;
+            set_checkerboard(render_kernel, half_frame, frame_parity);
+            //render_shared does all the samples of a pixel in one work item
+            int item_samples = shared_shading ? 1 : samples;
+            size_t globalsize;
+            if(half_frame) globalsize = render_global_size((width+1)/2, height, item_samples, localsize);
+            else globalsize = render_global_size(width, height, item_samples, localsize);
+
+            TRACE_SPAN("clEnqueueWriteBuffer camera") err = clEnqueueWriteBuffer(queue, opencl_context->camera, CL_TRUE, 0, sizeof(float)*3, fscene->camera, 0, NULL, NULL);
             if (err != CL_SUCCESS) {
                 printf("Error executing queued command: %d\n", err);
                 exit(1);
             }
-            err = clEnqueueWriteBuffer(queue, opencl_context->plane, CL_TRUE, 0, sizeof(float)*12, fscene->plane, 0, NULL, NULL);
+            TRACE_SPAN("clEnqueueWriteBuffer plane") err = clEnqueueWriteBuffer(queue, opencl_context->plane, CL_TRUE, 0, sizeof(float)*12, fscene->plane, 0, NULL, NULL);
             if (err != CL_SUCCESS) {
                 printf("Error executing queued command: %d\n", err);
                 exit(1);
@@ -803,7 +644,7 @@ int main(int argc, char* argv[]){
             
             if(cam_moved){
                 const size_t four = 4;//ill probably look at this later and wonder what was i doing
-                err = clEnqueueNDRangeKernel(queue, opencl_context->post_processing_kernel, 1, NULL, &four, &four, 0, NULL, NULL);
+                TRACE_SPAN("clEnqueueNDRangeKernel cam_dir") err = clEnqueueNDRangeKernel(queue, opencl_context->post_processing_kernel, 1, NULL, &four, &four, 0, NULL, NULL);
                 if (err != CL_SUCCESS) {
                     printf("Error executing queued command: %d\n", err);
                     exit(1);
@@ -811,61 +652,84 @@ int main(int argc, char* argv[]){
                 cam_xmov = 0; cam_ymov = 0; cam_moved = 0;
             }
             
-            err = clEnqueueNDRangeKernel(queue, opencl_context->render_kernel, 1, NULL, &globalsize, &localsize, 0, NULL, NULL);
+            TRACE_SPAN("clEnqueueNDRangeKernel render") err = clEnqueueNDRangeKernel(queue, render_kernel, 1, NULL, &globalsize, &localsize, 0, NULL, NULL);
             if (err != CL_SUCCESS) {
                 printf("Error executing queued command: %d\n", err);
                 exit(1);
             }
-            clFinish(queue);
+            if(half_frame){
+                //moving spheres leave the same ghosts behind as a moving camera
+                int moving = governor_moving(&governor) || animation != NULL;
+                cl_kernel reconstruct = opencl_context->reconstruct_kernel;
+                set_kernel_arg(reconstruct, 2, sizeof(int), &width);
+                set_kernel_arg(reconstruct, 3, sizeof(int), &height);
+                set_kernel_arg(reconstruct, 4, sizeof(int), &samples);
+                set_kernel_arg(reconstruct, 5, sizeof(int), &frame_parity);
+                set_kernel_arg(reconstruct, 6, sizeof(int), &moving);
+
+                size_t reconstructsize = render_global_size(width, height, 1, localsize);
+                TRACE_SPAN("clEnqueueNDRangeKernel reconstruct") err = clEnqueueNDRangeKernel(queue, reconstruct, 1, NULL, &reconstructsize, &localsize, 0, NULL, NULL);
+                if (err != CL_SUCCESS) {
+                    printf("Error executing queued command: %d\n", err);
+                    exit(1);
+                }
+            }
+            frame_parity ^= 1;
+            TRACE_SPAN("clFinish render") clFinish(queue);
+            if(count_stats) read_opencl_ray_stats(opencl_context, queue, &stats);
 
-            err = clEnqueueReadBuffer(queue, opencl_context->pixelcolors, CL_TRUE, 0, screensizebytes*4, pixels, 0, NULL, NULL);
+            TRACE_SPAN("clEnqueueReadBuffer pixelcolors") err = clEnqueueReadBuffer(queue, opencl_context->pixelcolors, CL_TRUE, 0, sizeof(float)*3*width*height*samples, pixels, 0, NULL, NULL);
             if (err != CL_SUCCESS) {
                 printf("Error reading queued buffer: %d\n", err);
                 exit(1);
             }
-            err = clEnqueueReadBuffer(queue, opencl_context->camera, CL_TRUE, 0, sizeof(float)*3, fscene->camera, 0, NULL, NULL);
+            TRACE_SPAN("clEnqueueReadBuffer camera") err = clEnqueueReadBuffer(queue, opencl_context->camera, CL_TRUE, 0, sizeof(float)*3, fscene->camera, 0, NULL, NULL);
             if (err != CL_SUCCESS) {
                 printf("Error reading queued buffer: %d\n", err);
                 exit(1);
             }
-            err = clEnqueueReadBuffer(queue, opencl_context->plane, CL_TRUE, 0, sizeof(float)*12, fscene->plane, 0, NULL, NULL);
+            TRACE_SPAN("clEnqueueReadBuffer plane") err = clEnqueueReadBuffer(queue, opencl_context->plane, CL_TRUE, 0, sizeof(float)*12, fscene->plane, 0, NULL, NULL);
             if (err != CL_SUCCESS) {
                 printf("Error reading queued buffer: %d\n", err);
                 exit(1);
             }
 
-            clFinish(queue);
-
-            SDL_LockTexture(texture, NULL, (void**)&texture_pixels, &pitch);
-            
-            SDL_RenderClear(renderer);
-            for(int i = 0; i < screensize; i++){
-                int y = (int)floor((float)i/1080) % 720;
-                int x = i % 1080;
-
-                uint32_t* texture_row = (uint32_t*)(texture_pixels + y * pitch);
-                
-                float red = 0; float green = 0; float blue = 0;
-                for(int z = 0; z < 4; z++){
-                    int pos = (i*3)+777600*z*3;
-                    red+=pixels[pos];
-                    green+=pixels[pos+1];
-                    blue+=pixels[pos+2];
-                }
-
-                texture_row[x] = (255 << 24) | ((uint8_t)(red*255) << 16) | ((uint8_t)(green*255) << 8) | (uint8_t)(blue*255); // ARGB8888
+            TRACE_SPAN("clFinish readback") clFinish(queue);
+
+            if(heat != NULL) heat_costs_from_samples(heat, pixels, samples, width, height);
+            uint8_t* shared_pixels = ring != NULL ? frame_ring_begin(ring, width, height) : NULL;
+            if(shared_pixels != NULL){
+                if(heat != NULL) heat_map_frame(heat, width, height, shared_pixels, width*4, TONE_ARGB8888);
+                else tone_map_argb(tone_mapper, pixels, samples, width, height, shared_pixels, width*4);
+                frame_ring_publish(ring);
+                uploadFrame(texture, shared_pixels, width, height);
+            }else{
+                SDL_Rect rect = {0, 0, width, height};
+                TRACE_SPAN("SDL_LockTexture") SDL_LockTexture(texture, &rect, (void**)&texture_pixels, &pitch);
+                if(heat != NULL) heat_map_frame(heat, width, height, texture_pixels, pitch, TONE_ARGB8888);
+                else tone_map_argb(tone_mapper, pixels, samples, width, height, texture_pixels, pitch);
+                TRACE_SPAN("SDL_UnlockTexture") SDL_UnlockTexture(texture);
             }
-            SDL_UnlockTexture(texture);
-            SDL_RenderTexture(renderer, texture, NULL, NULL);
-            SDL_RenderPresent(renderer);
+
+            if(count_stats) stats.frame_ms = (SDL_GetTicksNS()-frame_start)/1000000.0;
+            presentFrame(renderer, texture, width, height, overlay, heat);
+            if(count_stats) end_render_stats(&stats);
+            governor_update(&governor, (SDL_GetTicksNS()-frame_start)/1000000.0f);
+            TRACE_END(frame);
         }
         
+        destroy_scene_animation(animation);
+        destroy_tone_mapper(tone_mapper);
         destroy_openclcontext(opencl_context);
         SDL_DestroyTexture(texture);
         clReleaseCommandQueue(queue);
     }
 
-    destroy_scene(scene);
+    if(scene != NULL) destroy_scene(scene);
+    destroy_scene_watcher(watcher);
+    destroy_heat_map(heat);
+    if(ring != NULL) printf("Published %llu of %llu frames to %s\n", (unsigned long long)atomic_load(&ring->header->write_index), (unsigned long long)ring->frames, ring->name);
+    destroy_frame_ring(ring);
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
     SDL_Quit();
@@ -0,0 +1,135 @@
+#ifndef NET_H
+#define NET_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+//sockets of render_server and the programs that talk to it. an address is a unix socket path, a port number
+//to listen on every interface, or host:port to connect to
+
+#define NET_BACKLOG 64
+
+//1 if address is only digits, a tcp port
+int is_port_address(const char* address){
+    if(*address == '\0') return 0;
+    for(const char* c = address; *c; c++){
+        if(*c < '0' || *c > '9') return 0;
+    }
+    return 1;
+}
+
+//1 once every byte went out
+int send_all(int fd, const void* data, size_t size){
+    const char* bytes = (const char*)data;
+    while(size > 0){
+        ssize_t sent = send(fd, bytes, size, MSG_NOSIGNAL);
+        if(sent < 0 && errno == EINTR) continue;
+        if(sent <= 0) return 0;
+        bytes += sent;
+        size -= sent;
+    }
+    return 1;
+}
+
+//1 once size bytes arrived, 0 if the connection ended first
+int read_all(int fd, void* data, size_t size){
+    char* bytes = (char*)data;
+    while(size > 0){
+        ssize_t received = recv(fd, bytes, size, 0);
+        if(received < 0 && errno == EINTR) continue;
+        if(received <= 0) return 0;
+        bytes += received;
+        size -= received;
+    }
+    return 1;
+}
+
+//the listening socket at address, replacing a unix socket file a previous server left behind. -1 on failure
+int listen_address(char* address){
+    int fd;
+    int ok;
+    if(is_port_address(address)){
+        struct sockaddr_in tcp_address;
+        memset(&tcp_address, 0, sizeof(tcp_address));
+        tcp_address.sin_family = AF_INET;
+        tcp_address.sin_addr.s_addr = htonl(INADDR_ANY);
+        tcp_address.sin_port = htons(atoi(address));
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        int reuse = 1;
+        ok = fd >= 0 && setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) == 0 && bind(fd, (struct sockaddr*)&tcp_address, sizeof(tcp_address)) == 0;
+    }else{
+        struct sockaddr_un unix_address;
+        memset(&unix_address, 0, sizeof(unix_address));
+        unix_address.sun_family = AF_UNIX;
+        if(strlen(address) >= sizeof(unix_address.sun_path)){
+            printf("The socket path %s is too long\n", address);
+            return -1;
+        }
+        strcpy(unix_address.sun_path, address);
+
+        struct stat info;
+        if(stat(address, &info) == 0 && S_ISSOCK(info.st_mode)) unlink(address);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        ok = fd >= 0 && bind(fd, (struct sockaddr*)&unix_address, sizeof(unix_address)) == 0;
+    }
+
+    if(!ok || listen(fd, NET_BACKLOG) != 0){
+        printf("Could not listen on %s\n", address);
+        if(fd >= 0) close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+//-1 if nothing answers at address. tcp connections send small requests right away instead of batching them
+int connect_address(const char* address){
+    const char* colon = strrchr(address, ':');
+    if(colon == NULL){
+        struct sockaddr_un unix_address;
+        memset(&unix_address, 0, sizeof(unix_address));
+        unix_address.sun_family = AF_UNIX;
+        snprintf(unix_address.sun_path, sizeof(unix_address.sun_path), "%s", address);
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if(fd < 0) return -1;
+        if(connect(fd, (struct sockaddr*)&unix_address, sizeof(unix_address)) != 0){
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    char host[256];
+    snprintf(host, sizeof(host), "%.*s", (int)(colon-address), address);
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* results;
+    if(getaddrinfo(host, colon+1, &hints, &results) != 0) return -1;
+
+    int fd = -1;
+    for(struct addrinfo* result = results; result != NULL && fd < 0; result = result->ai_next){
+        fd = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+        if(fd < 0) continue;
+        if(connect(fd, result->ai_addr, result->ai_addrlen) != 0){
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(results);
+    if(fd >= 0){
+        int no_delay = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+    }
+    return fd;
+}
+
+#endif
@@ -0,0 +1,634 @@
+#ifndef OPENCL_H
+#define OPENCL_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <CL/cl.h>
+#include "vector.h"
+#include "utils.h"
+#include "stats.h"
+#include "trace.h"
+
+#ifndef WIDTH
+#define WIDTH 1080
+#endif
+#ifndef HEIGHT
+#define HEIGHT 720
+#endif
+
+#define RENDER_KERNEL_ARGS 40
+
+typedef struct OpenclContext{
+    flattenedScene* fscene;
+    cl_mem pixelcolors;
+    cl_mem camera;
+    cl_mem plane;
+    cl_mem ALI;
+    cl_mem lightpos;
+    cl_mem lightdiffuse;
+    cl_mem lightspecular;
+    cl_mem lightrange;
+    cl_mem lightbvhbounds;
+    cl_mem lightbvhnodes;
+    cl_mem objectpos;
+    cl_mem objectcolor;
+    cl_mem materialambient;
+    cl_mem materialdiffuse;
+    cl_mem materialspecular;
+    cl_mem materialreflectivity;
+    cl_mem materialalbedo;
+    cl_mem objectradius;
+    cl_mem objectmaterial;
+    cl_mem instancetransform;
+    cl_mem instanceranges;
+    cl_mem instancebounds;
+    cl_mem objectbvhbounds;
+    cl_mem objectbvhnodes;
+    cl_mem objectids;
+    cl_mem raystats; //the frame's ray counters as low and high words, see add_ray_stats in render.txt
+    cl_kernel render_kernel;
+    cl_kernel shared_render_kernel; //render_shared, one work item per pixel, see --shared-shading
+    cl_kernel reconstruct_kernel;
+    cl_kernel post_processing_kernel;
+    cl_program render_program;
+    cl_program post_processing_program;
+    cl_device_id devices;
+    cl_context context;
+    size_t buffer_capacity[RENDER_KERNEL_ARGS]; //bytes allocated for each scene buffer, by render kernel argument
+} OpenclContext;
+
+OpenclContext* create_opencl_context(
+    flattenedScene* fscene,
+    cl_mem pixelcolors,
+    cl_mem camera,
+    cl_mem plane,
+    cl_mem ALI,
+    cl_mem lightpos,
+    cl_mem lightdiffuse,
+    cl_mem lightspecular,
+    cl_mem lightrange,
+    cl_mem lightbvhbounds,
+    cl_mem lightbvhnodes,
+    cl_mem objectpos,
+    cl_mem objectcolor,
+    cl_mem materialambient,
+    cl_mem materialdiffuse,
+    cl_mem materialspecular,
+    cl_mem materialreflectivity,
+    cl_mem materialalbedo,
+    cl_mem objectradius,
+    cl_mem objectmaterial,
+    cl_mem instancetransform,
+    cl_mem instanceranges,
+    cl_mem instancebounds,
+    cl_mem objectbvhbounds,
+    cl_mem objectbvhnodes,
+    cl_mem objectids,
+    cl_mem raystats,
+    cl_kernel render_kernel,
+    cl_kernel shared_render_kernel,
+    cl_kernel reconstruct_kernel,
+    cl_kernel post_processing_kernel,
+    cl_program render_program,
+    cl_program post_processing_program,
+    cl_device_id devices,
+    cl_context context
+){
+    OpenclContext * oc;
+    oc = (OpenclContext*)malloc(sizeof(OpenclContext));
+
+    oc->fscene = fscene;
+    oc->pixelcolors = pixelcolors;
+    oc->camera = camera;
+    oc->plane = plane;
+    oc->ALI = ALI;
+    oc->lightpos = lightpos;
+    oc->lightdiffuse = lightdiffuse;
+    oc->lightspecular = lightspecular;
+    oc->lightrange = lightrange;
+    oc->lightbvhbounds = lightbvhbounds;
+    oc->lightbvhnodes = lightbvhnodes;
+    oc->objectpos = objectpos;
+    oc->objectcolor = objectcolor;
+    oc->materialambient = materialambient;
+    oc->materialdiffuse = materialdiffuse;
+    oc->materialspecular = materialspecular;
+    oc->materialreflectivity = materialreflectivity;
+    oc->materialalbedo = materialalbedo;
+    oc->objectradius = objectradius;
+    oc->objectmaterial = objectmaterial;
+    oc->instancetransform = instancetransform;
+    oc->instanceranges = instanceranges;
+    oc->instancebounds = instancebounds;
+    oc->objectbvhbounds = objectbvhbounds;
+    oc->objectbvhnodes = objectbvhnodes;
+    oc->objectids = objectids;
+    oc->raystats = raystats;
+    oc->render_kernel = render_kernel;
+    oc->shared_render_kernel = shared_render_kernel;
+    oc->reconstruct_kernel = reconstruct_kernel;
+    oc->post_processing_kernel = post_processing_kernel;
+    oc->render_program = render_program;
+    oc->post_processing_program = post_processing_program;
+    oc->devices = devices;
+    oc->context = context;
+    memset(oc->buffer_capacity, 0, sizeof(oc->buffer_capacity));
+
+    return oc;
+}
+
+void destroy_openclcontext(OpenclContext *opencl_context){
+    if(opencl_context->fscene != NULL) destroy_flattened_scene(opencl_context->fscene);
+    clReleaseMemObject(opencl_context->pixelcolors);
+    clReleaseMemObject(opencl_context->camera);
+    clReleaseMemObject(opencl_context->plane);
+    clReleaseMemObject(opencl_context->ALI);
+    clReleaseMemObject(opencl_context->lightpos);
+    clReleaseMemObject(opencl_context->lightdiffuse);
+    clReleaseMemObject(opencl_context->lightspecular);
+    clReleaseMemObject(opencl_context->lightrange);
+    clReleaseMemObject(opencl_context->lightbvhbounds);
+    clReleaseMemObject(opencl_context->lightbvhnodes);
+    clReleaseMemObject(opencl_context->objectpos);
+    clReleaseMemObject(opencl_context->objectcolor);
+    clReleaseMemObject(opencl_context->materialambient);
+    clReleaseMemObject(opencl_context->materialdiffuse);
+    clReleaseMemObject(opencl_context->materialspecular);
+    clReleaseMemObject(opencl_context->materialreflectivity);
+    clReleaseMemObject(opencl_context->materialalbedo);
+    clReleaseMemObject(opencl_context->objectradius);
+    clReleaseMemObject(opencl_context->objectmaterial);
+    clReleaseMemObject(opencl_context->instancetransform);
+    clReleaseMemObject(opencl_context->instanceranges);
+    clReleaseMemObject(opencl_context->instancebounds);
+    clReleaseMemObject(opencl_context->objectbvhbounds);
+    clReleaseMemObject(opencl_context->objectbvhnodes);
+    clReleaseMemObject(opencl_context->objectids);
+    clReleaseMemObject(opencl_context->raystats);
+    clReleaseKernel(opencl_context->render_kernel);
+    clReleaseKernel(opencl_context->shared_render_kernel);
+    clReleaseKernel(opencl_context->reconstruct_kernel);
+    clReleaseProgram(opencl_context->render_program);
+    clReleaseKernel(opencl_context->post_processing_kernel);
+    clReleaseProgram(opencl_context->post_processing_program);
+    clReleaseDevice(opencl_context->devices);
+    clReleaseContext(opencl_context->context);
+
+    free(opencl_context);
+}
+
+void set_kernel_arg(cl_kernel kernel, cl_uint index, size_t size, const void* value){
+    cl_int err = clSetKernelArg(kernel, index, size, value);
+    if (err != CL_SUCCESS) {
+        printf("Error setting kernel arg %d: %d\n", index, err);
+        exit(1);
+    }
+}
+
+cl_program build_opencl_program(cl_context context, cl_device_id devices, char* file_path){
+    cl_int err;
+    const char* kernel_source = load_strfile(file_path);
+    cl_program program = clCreateProgramWithSource(context, 1, &kernel_source, NULL, &err);
+    if(err != CL_SUCCESS){
+        printf("an error ocurred while creating the opencl program: %d\n", err);
+        exit(1);
+    }
+    err = clBuildProgram(program, 1, &devices, NULL, NULL, NULL);
+    if (err == CL_BUILD_PROGRAM_FAILURE) {
+        //this block came from stackoveflow, will search for the link to credit when i can
+        size_t log_size;
+        clGetProgramBuildInfo(program, devices, CL_PROGRAM_BUILD_LOG, 0, NULL, &log_size);
+
+        char *log = (char *) malloc(log_size);
+
+        clGetProgramBuildInfo(program, devices, CL_PROGRAM_BUILD_LOG, log_size, log, NULL);
+
+        printf("%s: %s\n", file_path, log);
+        exit(1);
+    }else if(err != CL_SUCCESS){
+        printf("an error ocurred while building the opencl program: %d\n", err);
+        exit(1);
+    }
+    free((char*)kernel_source);
+
+    return program;
+}
+
+//pixelcolors is allocated for the full resolution with 4 samples, anything up to that fits
+void set_render_resolution(cl_kernel render_kernel, int width, int height, int samples){
+    set_kernel_arg(render_kernel, 23, sizeof(int), &width);
+    set_kernel_arg(render_kernel, 24, sizeof(int), &height);
+    set_kernel_arg(render_kernel, 25, sizeof(int), &samples);
+}
+
+void set_checkerboard(cl_kernel render_kernel, int checkerboard, int frame_parity){
+    set_kernel_arg(render_kernel, 27, sizeof(int), &checkerboard);
+    set_kernel_arg(render_kernel, 28, sizeof(int), &frame_parity);
+}
+
+//whether the render kernel counts its rays into the raystats buffer, off it skips the local memory sums
+void set_ray_stats(cl_kernel render_kernel, int enabled){
+    set_kernel_arg(render_kernel, 38, sizeof(int), &enabled);
+}
+
+//makes the render kernel write the ray counter counter of every sample (see stats.h) instead of its color,
+//for the heatmap. -1 goes back to colors
+void set_heat_counter(cl_kernel render_kernel, int counter){
+    int heatmap = counter+1;
+    set_kernel_arg(render_kernel, 39, sizeof(int), &heatmap);
+}
+
+//zeroes the counters before a frame that counts its rays
+void clear_opencl_ray_stats(OpenclContext* opencl_context, cl_command_queue queue){
+    const cl_uint zero = 0;
+    cl_int err;
+    TRACE_SPAN("clEnqueueFillBuffer raystats") err = clEnqueueFillBuffer(queue, opencl_context->raystats, &zero, sizeof(zero), 0, sizeof(cl_uint)*RAY_STATS*2, 0, NULL, NULL);
+    if (err != CL_SUCCESS) {
+        printf("Error executing queued command: %d\n", err);
+        exit(1);
+    }
+}
+
+//adds what the kernels counted since clear_opencl_ray_stats to the frame's counters
+void read_opencl_ray_stats(OpenclContext* opencl_context, cl_command_queue queue, RenderStats* stats){
+    cl_uint words[RAY_STATS*2];
+    cl_int err;
+    TRACE_SPAN("clEnqueueReadBuffer raystats") err = clEnqueueReadBuffer(queue, opencl_context->raystats, CL_TRUE, 0, sizeof(words), words, 0, NULL, NULL);
+    if (err != CL_SUCCESS) {
+        printf("Error reading queued buffer: %d\n", err);
+        exit(1);
+    }
+    for(int k = 0; k < RAY_STATS; k++){
+        stats->counters[k] += ((uint64_t)words[k*2+1] << 32) | words[k*2];
+    }
+}
+
+//work items for a frame, rounded up to a multiple of the local size
+size_t render_global_size(int width, int height, int samples, size_t localsize){
+    size_t items = (size_t)width*height*samples;
+    return ((items+localsize-1)/localsize)*localsize;
+}
+
+//clCreateBuffer does not accept 0 bytes, scenes without ranged lights still need something to bind
+size_t nonzero_size(size_t size){
+    return size > 0 ? size : sizeof(float);
+}
+
+//builds render.txt plus a second program, its kernel (extra_kernel_name) arguments are left to the caller
+//the context keeps fscene and destroys it with the rest
+OpenclContext* init_opencl(flattenedScene* fscene, char* extra_program_file, char* extra_kernel_name){
+    //iniciando opencl
+    TRACE_BEGIN(init, "init_opencl");
+    TRACE_BEGIN(discovery, "init_opencl discovery");
+    cl_int err;
+    cl_platform_id plataforms;
+    err = clGetPlatformIDs(1, &plataforms, NULL);
+    if(err != CL_SUCCESS){
+        printf("an error ocurred while finding available opencl plataforms");
+        exit(1);
+    }
+    cl_device_id devices;
+    err = clGetDeviceIDs(plataforms, CL_DEVICE_TYPE_GPU, 1, &devices, NULL);
+    //without a gpu any device will do, a cpu runtime like pocl runs the same kernels (regress.c relies on it)
+    if(err != CL_SUCCESS) err = clGetDeviceIDs(plataforms, CL_DEVICE_TYPE_ALL, 1, &devices, NULL);
+    if(err != CL_SUCCESS){
+        printf("an error ocurred while finding available opencl devices");
+        exit(1);
+    }
+    cl_context context = clCreateContext(NULL, 1, &devices, NULL, NULL, &err);
+    if(!context || err != CL_SUCCESS){
+        printf("An error ocurred while creating the context\n");
+        exit(1);
+    }
+    TRACE_END(discovery);
+
+    TRACE_BEGIN(build, "init_opencl build");
+    cl_program render_program = build_opencl_program(context, devices, "render.txt");
+    cl_program extra_program = build_opencl_program(context, devices, extra_program_file);
+    TRACE_END(build);
+
+    TRACE_BEGIN(buffers, "init_opencl buffers");
+    cl_command_queue queue = clCreateCommandQueueWithProperties(context, devices, NULL, NULL);
+
+    const size_t lightbvhnodes_size = sizeof(int)*fscene->lightbvh->num_nodes*2;
+    const size_t lightbvhbounds_size = sizeof(float)*fscene->lightbvh->num_nodes*6;
+    //the group spheres are stored once after the plain ones, the instances only add their small table
+    const size_t num_stored_objects = (size_t)fscene->num_objects+fscene->num_group_objects;
+    const size_t instancetransform_size = sizeof(float)*fscene->num_instances*4;
+    const size_t instanceranges_size = sizeof(int)*fscene->num_instances*3;
+    const size_t objectbvhbounds_size = sizeof(float)*fscene->objectbvh->num_nodes*6;
+    const size_t objectbvhnodes_size = sizeof(int)*fscene->objectbvh->num_nodes*2;
+
+    const long screensize = WIDTH*HEIGHT;
+    const size_t screensizebytes = screensize*sizeof(float)*3;
+    cl_mem pixelcolors = clCreateBuffer(context, CL_MEM_READ_WRITE, screensizebytes*4, NULL, NULL);
+
+    cl_mem camera = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(float)*3, NULL, NULL);
+    cl_mem  plane = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(float)*12, NULL, NULL);
+    cl_mem ALI = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(float)*3, NULL, NULL);
+    cl_mem lightpos = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(float)*fscene->num_lights*3, NULL, NULL);
+    cl_mem lightdiffuse = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(float)*fscene->num_lights*3, NULL, NULL);
+    cl_mem lightspecular = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(float)*fscene->num_lights*3, NULL, NULL);
+    cl_mem lightrange = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(float)*fscene->num_lights, NULL, NULL);
+    cl_mem lightbvhbounds = clCreateBuffer(context, CL_MEM_READ_ONLY, nonzero_size(lightbvhbounds_size), NULL, NULL);
+    cl_mem lightbvhnodes = clCreateBuffer(context, CL_MEM_READ_ONLY, nonzero_size(lightbvhnodes_size), NULL, NULL);
+    cl_mem objectpos = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(float)*num_stored_objects*3, NULL, NULL);
+    cl_mem objectcolor = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(float)*num_stored_objects*3, NULL, NULL);
+    cl_mem materialambient = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(float)*fscene->num_materials*3, NULL, NULL);
+    cl_mem materialdiffuse = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(float)*fscene->num_materials*3, NULL, NULL);
+    cl_mem materialspecular = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(float)*fscene->num_materials*3, NULL, NULL);
+    cl_mem materialreflectivity = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(float)*fscene->num_materials*3, NULL, NULL);
+    cl_mem materialalbedo = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(float)*fscene->num_materials, NULL, NULL);
+    cl_mem objectradius = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(float)*num_stored_objects, NULL, NULL);
+    cl_mem objectmaterial = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(int)*num_stored_objects, NULL, NULL);
+    cl_mem instancetransform = clCreateBuffer(context, CL_MEM_READ_ONLY, nonzero_size(instancetransform_size), NULL, NULL);
+    cl_mem instanceranges = clCreateBuffer(context, CL_MEM_READ_ONLY, nonzero_size(instanceranges_size), NULL, NULL);
+    cl_mem instancebounds = clCreateBuffer(context, CL_MEM_READ_ONLY, nonzero_size(instancetransform_size), NULL, NULL);
+    cl_mem objectbvhbounds = clCreateBuffer(context, CL_MEM_READ_ONLY, nonzero_size(objectbvhbounds_size), NULL, NULL);
+    cl_mem objectbvhnodes = clCreateBuffer(context, CL_MEM_READ_ONLY, nonzero_size(objectbvhnodes_size), NULL, NULL);
+    cl_mem objectids = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(int)*screensize, NULL, NULL);
+    cl_mem raystats = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint)*RAY_STATS*2, NULL, NULL);
+
+    clEnqueueWriteBuffer(queue, camera, CL_TRUE, 0, sizeof(float)*3, fscene->camera, 0, NULL, NULL);
+    clEnqueueWriteBuffer(queue, plane, CL_TRUE, 0, sizeof(float)*12, fscene->plane, 0, NULL, NULL);
+    clEnqueueWriteBuffer(queue, ALI, CL_TRUE, 0, sizeof(float)*3, fscene->ALI, 0, NULL, NULL);
+    clEnqueueWriteBuffer(queue, lightpos, CL_TRUE, 0, sizeof(float)*fscene->num_lights*3, fscene->lightpos, 0, NULL, NULL);
+    clEnqueueWriteBuffer(queue, lightdiffuse, CL_TRUE, 0, sizeof(float)*fscene->num_lights*3, fscene->lightdiffuse, 0, NULL, NULL);
+    clEnqueueWriteBuffer(queue, lightspecular, CL_TRUE, 0, sizeof(float)*fscene->num_lights*3, fscene->lightspecular, 0, NULL, NULL);
+    clEnqueueWriteBuffer(queue, lightrange, CL_TRUE, 0, sizeof(float)*fscene->num_lights, fscene->lightrange, 0, NULL, NULL);
+    if(fscene->lightbvh->num_nodes > 0){
+        clEnqueueWriteBuffer(queue, lightbvhbounds, CL_TRUE, 0, lightbvhbounds_size, fscene->lightbvh->bounds, 0, NULL, NULL);
+        clEnqueueWriteBuffer(queue, lightbvhnodes, CL_TRUE, 0, lightbvhnodes_size, fscene->lightbvh->nodes, 0, NULL, NULL);
+    }
+    clEnqueueWriteBuffer(queue, objectpos, CL_TRUE, 0, sizeof(float)*num_stored_objects*3, fscene->objectpos, 0, NULL, NULL);
+    clEnqueueWriteBuffer(queue, objectcolor, CL_TRUE, 0, sizeof(float)*num_stored_objects*3, fscene->objectcolor, 0, NULL, NULL);
+    clEnqueueWriteBuffer(queue, materialambient, CL_TRUE, 0, sizeof(float)*fscene->num_materials*3, fscene->materialambient, 0, NULL, NULL);
+    clEnqueueWriteBuffer(queue, materialdiffuse, CL_TRUE, 0, sizeof(float)*fscene->num_materials*3, fscene->materialdiffuse, 0, NULL, NULL);
+    clEnqueueWriteBuffer(queue, materialspecular, CL_TRUE, 0, sizeof(float)*fscene->num_materials*3, fscene->materialspecular, 0, NULL, NULL);
+    clEnqueueWriteBuffer(queue, materialreflectivity, CL_TRUE, 0, sizeof(float)*fscene->num_materials*3, fscene->materialreflectivity, 0, NULL, NULL);
+    clEnqueueWriteBuffer(queue, materialalbedo, CL_TRUE, 0, sizeof(float)*fscene->num_materials, fscene->materialalbedo, 0, NULL, NULL);
+    clEnqueueWriteBuffer(queue, objectradius, CL_TRUE, 0, sizeof(float)*num_stored_objects, fscene->objectradius, 0, NULL, NULL);
+    clEnqueueWriteBuffer(queue, objectmaterial, CL_TRUE, 0, sizeof(int)*num_stored_objects, fscene->objectmaterial, 0, NULL, NULL);
+    if(fscene->num_instances > 0){
+        clEnqueueWriteBuffer(queue, instancetransform, CL_TRUE, 0, instancetransform_size, fscene->instancetransform, 0, NULL, NULL);
+        clEnqueueWriteBuffer(queue, instanceranges, CL_TRUE, 0, instanceranges_size, fscene->instanceranges, 0, NULL, NULL);
+        clEnqueueWriteBuffer(queue, instancebounds, CL_TRUE, 0, instancetransform_size, fscene->instancebounds, 0, NULL, NULL);
+    }
+    if(fscene->objectbvh->num_nodes > 0){
+        clEnqueueWriteBuffer(queue, objectbvhbounds, CL_TRUE, 0, objectbvhbounds_size, fscene->objectbvh->bounds, 0, NULL, NULL);
+        clEnqueueWriteBuffer(queue, objectbvhnodes, CL_TRUE, 0, objectbvhnodes_size, fscene->objectbvh->nodes, 0, NULL, NULL);
+    }
+    TRACE_END(buffers);
+
+    TRACE_BEGIN(kernels, "init_opencl kernels");
+    cl_kernel render_kernel = clCreateKernel(render_program, "render", NULL);
+    cl_kernel shared_render_kernel = clCreateKernel(render_program, "render_shared", NULL);
+    cl_kernel reconstruct_kernel = clCreateKernel(render_program, "reconstruct", NULL);
+    cl_kernel extra_kernel = clCreateKernel(extra_program, extra_kernel_name, NULL);
+
+    //render and render_shared take the same arguments
+    cl_kernel render_kernels[2] = {render_kernel, shared_render_kernel};
+    for(int k = 0; k < 2; k++){
+        cl_kernel kernel = render_kernels[k];
+        set_kernel_arg(kernel, 0, sizeof(cl_mem), &pixelcolors);
+        set_kernel_arg(kernel, 1, sizeof(long), &screensize);
+        set_kernel_arg(kernel, 2, sizeof(cl_mem), &camera);
+        set_kernel_arg(kernel, 3, sizeof(cl_mem), &plane);
+        set_kernel_arg(kernel, 4, sizeof(cl_mem), &ALI);
+        set_kernel_arg(kernel, 5, sizeof(cl_mem), &lightpos);
+        set_kernel_arg(kernel, 6, sizeof(cl_mem), &lightdiffuse);
+        set_kernel_arg(kernel, 7, sizeof(cl_mem), &lightspecular);
+        set_kernel_arg(kernel, 8, sizeof(cl_mem), &objectpos);
+        set_kernel_arg(kernel, 9, sizeof(cl_mem), &objectcolor);
+        set_kernel_arg(kernel, 10, sizeof(cl_mem), &materialambient);
+        set_kernel_arg(kernel, 11, sizeof(cl_mem), &materialdiffuse);
+        set_kernel_arg(kernel, 12, sizeof(cl_mem), &materialspecular);
+        set_kernel_arg(kernel, 13, sizeof(cl_mem), &materialreflectivity);
+        set_kernel_arg(kernel, 14, sizeof(cl_mem), &materialalbedo);
+        set_kernel_arg(kernel, 15, sizeof(cl_mem), &objectradius);
+        set_kernel_arg(kernel, 16, sizeof(int), &fscene->num_lights);
+        set_kernel_arg(kernel, 17, sizeof(int), &fscene->num_objects);
+        set_kernel_arg(kernel, 18, sizeof(cl_mem), &lightrange);
+        set_kernel_arg(kernel, 19, sizeof(cl_mem), &lightbvhbounds);
+        set_kernel_arg(kernel, 20, sizeof(cl_mem), &lightbvhnodes);
+        set_kernel_arg(kernel, 21, sizeof(int), &fscene->num_global_lights);
+        set_kernel_arg(kernel, 22, sizeof(int), &fscene->lightbvh->num_nodes);
+        set_render_resolution(kernel, WIDTH, HEIGHT, 4);
+        set_kernel_arg(kernel, 26, sizeof(cl_mem), &objectids);
+        set_checkerboard(kernel, 0, 0);
+        set_kernel_arg(kernel, 29, sizeof(cl_mem), &objectmaterial);
+        set_kernel_arg(kernel, 30, sizeof(cl_mem), &instancetransform);
+        set_kernel_arg(kernel, 31, sizeof(cl_mem), &instanceranges);
+        set_kernel_arg(kernel, 32, sizeof(cl_mem), &instancebounds);
+        set_kernel_arg(kernel, 33, sizeof(int), &fscene->num_instances);
+        set_kernel_arg(kernel, 34, sizeof(cl_mem), &objectbvhbounds);
+        set_kernel_arg(kernel, 35, sizeof(cl_mem), &objectbvhnodes);
+        set_kernel_arg(kernel, 36, sizeof(int), &fscene->objectbvh->num_nodes);
+        set_kernel_arg(kernel, 37, sizeof(cl_mem), &raystats);
+        set_ray_stats(kernel, 0);
+        set_heat_counter(kernel, -1);
+    }
+
+    set_kernel_arg(reconstruct_kernel, 0, sizeof(cl_mem), &pixelcolors);
+    set_kernel_arg(reconstruct_kernel, 1, sizeof(cl_mem), &objectids);
+    TRACE_END(kernels);
+
+    clReleaseCommandQueue(queue);
+
+    OpenclContext* opencl_context = create_opencl_context(
+        fscene,
+        pixelcolors,
+        camera,
+        plane,
+        ALI,
+        lightpos,
+        lightdiffuse,
+        lightspecular,
+        lightrange,
+        lightbvhbounds,
+        lightbvhnodes,
+        objectpos,
+        objectcolor,
+        materialambient,
+        materialdiffuse,
+        materialspecular,
+        materialreflectivity,
+        materialalbedo,
+        objectradius,
+        objectmaterial,
+        instancetransform,
+        instanceranges,
+        instancebounds,
+        objectbvhbounds,
+        objectbvhnodes,
+        objectids,
+        raystats,
+        render_kernel,
+        shared_render_kernel,
+        reconstruct_kernel,
+        extra_kernel,
+        render_program,
+        extra_program,
+        devices,
+        context
+    );
+
+    size_t* capacity = opencl_context->buffer_capacity;
+    capacity[5] = capacity[6] = capacity[7] = sizeof(float)*fscene->num_lights*3;
+    capacity[8] = capacity[9] = sizeof(float)*num_stored_objects*3;
+    capacity[10] = capacity[11] = capacity[12] = capacity[13] = sizeof(float)*fscene->num_materials*3;
+    capacity[14] = sizeof(float)*fscene->num_materials;
+    capacity[15] = sizeof(float)*num_stored_objects;
+    capacity[18] = sizeof(float)*fscene->num_lights;
+    capacity[19] = nonzero_size(lightbvhbounds_size);
+    capacity[20] = nonzero_size(lightbvhnodes_size);
+    capacity[29] = sizeof(int)*num_stored_objects;
+    capacity[30] = capacity[32] = nonzero_size(instancetransform_size);
+    capacity[31] = nonzero_size(instanceranges_size);
+    capacity[34] = nonzero_size(objectbvhbounds_size);
+    capacity[35] = nonzero_size(objectbvhnodes_size);
+
+    TRACE_END(init);
+    return opencl_context;
+}
+
+//runs the render and post processing kernels over a width x height frame, at most WIDTH x HEIGHT pixels, and
+//reads the samples back into pixels (width*height*3*samples floats)
+void render_opencl_frame(OpenclContext* opencl_context, cl_command_queue queue, float* pixels, int width, int height, int samples){
+    cl_int err;
+    const long screensize = (long)width*height;
+    const size_t screensizebytes = screensize*sizeof(float)*3;
+
+    size_t localsize = 128;
+    size_t globalsize = render_global_size(width, height, samples, localsize);//times the amount of extra rays for the antialliasing
+    set_render_resolution(opencl_context->render_kernel, width, height, samples);
+
+    TRACE_SPAN("clEnqueueNDRangeKernel render") err = clEnqueueNDRangeKernel(queue, opencl_context->render_kernel, 1, NULL, &globalsize, &localsize, 0, NULL, NULL);
+    if (err != CL_SUCCESS) {
+        printf("Error executing queued command: %d\n", err);
+        exit(1);
+    }
+    TRACE_SPAN("clFinish render") clFinish(queue);
+
+    TRACE_SPAN("clEnqueueNDRangeKernel postprocess") err = clEnqueueNDRangeKernel(queue, opencl_context->post_processing_kernel, 1, NULL, &globalsize, &localsize, 0, NULL, NULL);
+    if (err != CL_SUCCESS) {
+        printf("Error executing queued command: %d\n", err);
+        exit(1);
+    }
+    TRACE_SPAN("clFinish postprocess") clFinish(queue);
+
+    TRACE_SPAN("clEnqueueReadBuffer pixelcolors") err = clEnqueueReadBuffer(queue, opencl_context->pixelcolors, CL_TRUE, 0, screensizebytes*samples, pixels, 0, NULL, NULL);
+    if (err != CL_SUCCESS) {
+        printf("Error reading queued buffer: %d\n", err);
+        exit(1);
+    }
+    TRACE_SPAN("clFinish readback") clFinish(queue);
+}
+
+//writes size bytes into the scene buffer bound to render kernel argument arg. a buffer that is too small is
+//replaced by one of the new size and bound again, the others are reused as they are
+void update_scene_buffer(OpenclContext* opencl_context, cl_command_queue queue, int arg, cl_mem* buffer, const void* data, size_t size){
+    cl_int err;
+    if(size > opencl_context->buffer_capacity[arg]){
+        clReleaseMemObject(*buffer);
+        *buffer = clCreateBuffer(opencl_context->context, CL_MEM_READ_ONLY, size, NULL, &err);
+        if(err != CL_SUCCESS){
+            printf("Error creating the buffer for argument %d: %d\n", arg, err);
+            exit(1);
+        }
+        opencl_context->buffer_capacity[arg] = size;
+        set_kernel_arg(opencl_context->render_kernel, arg, sizeof(cl_mem), buffer);
+        set_kernel_arg(opencl_context->shared_render_kernel, arg, sizeof(cl_mem), buffer);
+    }
+    if(size == 0) return;
+
+    //the scene stays alive until the caller's clFinish, the writes do not need to block one by one
+    TRACE_SPAN("clEnqueueWriteBuffer scene") err = clEnqueueWriteBuffer(queue, *buffer, CL_FALSE, 0, size, data, 0, NULL, NULL);
+    if(err != CL_SUCCESS){
+        printf("Error writing the buffer for argument %d: %d\n", arg, err);
+        exit(1);
+    }
+}
+
+//writes only the listed elements of a scene buffer, element_size bytes each starting at data. indices are
+//ascending, runs of them closer than a few elements go out as one write so a thousand moving spheres spread
+//over the array do not turn into a thousand tiny transfers. returns the bytes written
+size_t update_scene_elements(cl_command_queue queue, cl_mem buffer, const void* data, size_t element_size, int* indices, int count){
+    const int max_gap = 8;
+    size_t written = 0;
+    int i = 0;
+    while(i < count){
+        int first = indices[i];
+        int last = first;
+        while(i+1 < count && indices[i+1]-last <= max_gap) last = indices[++i];
+        i++;
+
+        size_t offset = (size_t)first*element_size;
+        size_t size = (size_t)(last-first+1)*element_size;
+        cl_int err;
+        TRACE_SPAN("clEnqueueWriteBuffer elements") err = clEnqueueWriteBuffer(queue, buffer, CL_FALSE, offset, size, (const char*)data+offset, 0, NULL, NULL);
+        if(err != CL_SUCCESS){
+            printf("Error writing %zu bytes at %zu: %d\n", size, offset, err);
+            exit(1);
+        }
+        written += size;
+    }
+    return written;
+}
+
+//writes every scene buffer and count of fscene into a running context, growing the buffers that are too small.
+//the camera and plane buffers and oc->fscene are left to the caller
+void upload_opencl_scene(OpenclContext* oc, cl_command_queue queue, flattenedScene* fscene){
+    const size_t num_stored_objects = (size_t)fscene->num_objects+fscene->num_group_objects;
+    const size_t lights = fscene->num_lights;
+    const size_t materials = fscene->num_materials;
+    const size_t instances = fscene->num_instances;
+    const size_t nodes = fscene->lightbvh->num_nodes;
+    const size_t object_nodes = fscene->objectbvh->num_nodes;
+
+    TRACE_SPAN("clEnqueueWriteBuffer scene") clEnqueueWriteBuffer(queue, oc->ALI, CL_FALSE, 0, sizeof(float)*3, fscene->ALI, 0, NULL, NULL);
+    update_scene_buffer(oc, queue, 5, &oc->lightpos, fscene->lightpos, sizeof(float)*lights*3);
+    update_scene_buffer(oc, queue, 6, &oc->lightdiffuse, fscene->lightdiffuse, sizeof(float)*lights*3);
+    update_scene_buffer(oc, queue, 7, &oc->lightspecular, fscene->lightspecular, sizeof(float)*lights*3);
+    update_scene_buffer(oc, queue, 8, &oc->objectpos, fscene->objectpos, sizeof(float)*num_stored_objects*3);
+    update_scene_buffer(oc, queue, 9, &oc->objectcolor, fscene->objectcolor, sizeof(float)*num_stored_objects*3);
+    update_scene_buffer(oc, queue, 10, &oc->materialambient, fscene->materialambient, sizeof(float)*materials*3);
+    update_scene_buffer(oc, queue, 11, &oc->materialdiffuse, fscene->materialdiffuse, sizeof(float)*materials*3);
+    update_scene_buffer(oc, queue, 12, &oc->materialspecular, fscene->materialspecular, sizeof(float)*materials*3);
+    update_scene_buffer(oc, queue, 13, &oc->materialreflectivity, fscene->materialreflectivity, sizeof(float)*materials*3);
+    update_scene_buffer(oc, queue, 14, &oc->materialalbedo, fscene->materialalbedo, sizeof(float)*materials);
+    update_scene_buffer(oc, queue, 15, &oc->objectradius, fscene->objectradius, sizeof(float)*num_stored_objects);
+    update_scene_buffer(oc, queue, 18, &oc->lightrange, fscene->lightrange, sizeof(float)*lights);
+    update_scene_buffer(oc, queue, 19, &oc->lightbvhbounds, fscene->lightbvh->bounds, sizeof(float)*nodes*6);
+    update_scene_buffer(oc, queue, 20, &oc->lightbvhnodes, fscene->lightbvh->nodes, sizeof(int)*nodes*2);
+    update_scene_buffer(oc, queue, 29, &oc->objectmaterial, fscene->objectmaterial, sizeof(int)*num_stored_objects);
+    update_scene_buffer(oc, queue, 30, &oc->instancetransform, fscene->instancetransform, sizeof(float)*instances*4);
+    update_scene_buffer(oc, queue, 31, &oc->instanceranges, fscene->instanceranges, sizeof(int)*instances*3);
+    update_scene_buffer(oc, queue, 32, &oc->instancebounds, fscene->instancebounds, sizeof(float)*instances*4);
+    update_scene_buffer(oc, queue, 34, &oc->objectbvhbounds, fscene->objectbvh->bounds, sizeof(float)*object_nodes*6);
+    update_scene_buffer(oc, queue, 35, &oc->objectbvhnodes, fscene->objectbvh->nodes, sizeof(int)*object_nodes*2);
+
+    cl_kernel render_kernels[2] = {oc->render_kernel, oc->shared_render_kernel};
+    for(int k = 0; k < 2; k++){
+        set_kernel_arg(render_kernels[k], 16, sizeof(int), &fscene->num_lights);
+        set_kernel_arg(render_kernels[k], 17, sizeof(int), &fscene->num_objects);
+        set_kernel_arg(render_kernels[k], 21, sizeof(int), &fscene->num_global_lights);
+        set_kernel_arg(render_kernels[k], 22, sizeof(int), &fscene->lightbvh->num_nodes);
+        set_kernel_arg(render_kernels[k], 33, sizeof(int), &fscene->num_instances);
+        set_kernel_arg(render_kernels[k], 36, sizeof(int), &fscene->objectbvh->num_nodes);
+    }
+    TRACE_SPAN("clFinish scene upload") clFinish(queue);
+}
+
+//swaps the scene of a running context for fscene without touching the context, programs or kernels.
+//the camera and plane are kept where the user moved them. the context takes fscene and destroys the old one
+void reload_opencl_scene(OpenclContext* oc, cl_command_queue queue, flattenedScene* fscene){
+    flattenedScene* old = oc->fscene;
+    memcpy(fscene->camera, old->camera, sizeof(fscene->camera));
+    memcpy(fscene->plane, old->plane, sizeof(fscene->plane));
+    upload_opencl_scene(oc, queue, fscene);
+
+    oc->fscene = fscene;
+    destroy_flattened_scene(old);
+}
+
+#endif
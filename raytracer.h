@@ -0,0 +1,412 @@
+#ifndef RAYTRACER_H
+#define RAYTRACER_H
+#include <stdlib.h>
+#include <math.h>
+#include "vector.h"
+#include "utils.h"
+#include "stats.h"
+
+#ifndef WIDTH
+#define WIDTH 1080
+#endif
+#ifndef HEIGHT
+#define HEIGHT 720
+#endif
+
+//implementation with some adjusts for the collision checking function
+float quadraticFormula(float a, float b, float c){
+    float delta = b*b - 4*a*c;
+    if(delta < 0) return delta;
+    delta = sqrtf(delta);
+
+    float t1 = (-b+delta)/(2*a);
+    float t2 = (-b-delta)/(2*a);
+
+    if(fmin(t1, t2) < 0) return fmax(t1, t2);
+    else return fmin(t1,t2);
+}
+
+//Se não houver colisão retorna uma estrutura com colObject vazio
+Collision* checkRayCollisions(vector3D * dir, vector3D * origin, ObjectList * objects){
+    float t = INFINITY;
+    Collision* collision = create_collision();
+    
+    ObjectList* index = objects;
+    while(index->sphere != NULL){
+        vector3D * oc = subtractVectors(index->sphere->center, origin);
+        float a = dotProduct(dir, dir);
+        float b = 2*dotProduct(oc, dir);
+        float c = dotProduct(oc, oc)-index->sphere->radius*index->sphere->radius;
+        free(oc);
+
+        float temp = quadraticFormula(a, b, c);
+        ray_counters[STAT_SPHERE_TESTS]++;
+        /*
+            there is a bug in the reflexion that ocurs when two objects are pretty close to each other,
+            it is originated from this line bellow, it ignores collisions too close to the origin, something
+            that makes sense for rays originated from the camera but not for rays originated from other objects.
+            The problem is that changing this to temp > 0 causes a lot of dots and artifacts to appear
+            dont really understand why but need to take a look at this. 
+            There is the chance that it is a perspective thing too, i need to test it.
+        */
+        if(temp >= 1 && temp < t){ 
+            t = temp;
+            vector3D* scale = scaleVector(dir, t);
+            vector3D* sumn = addVectors(origin, scale);
+            update_collision(collision, *sumn, index->sphere);
+            free(scale);
+            free(sumn);
+        }
+        
+        index = index->next;
+    }
+
+    ray_counters[collision->colObject == NULL ? STAT_MISSES : STAT_HITS]++;
+    return collision;
+}
+
+float checkSingleObjectCollisionDistance(vector3D * dir, vector3D * origin, Sphere* sphere){
+        vector3D * oc = subtractVectors(sphere->center, origin);
+        float a = dotProduct(dir, dir);
+        float b = 2*dotProduct(oc, dir);
+        float c = dotProduct(oc, oc)-sphere->radius*sphere->radius;
+        free(oc);
+
+        return quadraticFormula(a, b, c);
+}
+
+int isInShadow(Collision* col, Light* light, ObjectList* objects){
+    ray_counters[STAT_SHADOW_RAYS]++;
+    ObjectList* index = objects;
+    while(index->sphere != NULL){
+        if(index->sphere == col->colObject){
+            index = index->next;
+            continue;
+        }
+
+        vector3D* sub = subtractVectors(&col->colPoint, light->position);
+        float t = checkSingleObjectCollisionDistance(sub, &col->colPoint, index->sphere);
+        free(sub);
+        ray_counters[STAT_SPHERE_TESTS]++;
+
+        if(0 < t && t < 1){
+            return 1;
+        }
+
+        index = index->next;
+    }
+    return 0;
+}
+
+//smooth falloff that reaches zero at the light range, lights without range are not attenuated
+float lightAttenuation(float distance, float range){
+    if(range <= 0) return 1;
+    float ratio = distance/range;
+    float window = clamp(1 - ratio*ratio*ratio*ratio, 0, 1);
+    return window*window;
+}
+
+void shadeLight(Collision* col, Light* light, vector3D* normalized, vector3D* view, Scene* scene, Color* drawn_color){
+    if(isInShadow(col, light, scene->objects)) return;
+
+    vector3D* sub = subtractVectors(&col->colPoint, light->position);
+    float attenuation = lightAttenuation(getMagnitude(sub), light->range);
+    vector3D* L = normalizeVector(sub);
+    free(sub);
+
+    float dot = dotProduct(L, normalized);
+
+    vector3D* scaled = scaleVector(normalized, 2*dot);
+    vector3D* reflectance = subtractVectors(L, scaled);
+    free(scaled);
+
+    float dot2 = dotProduct(reflectance, view);
+    free(L);
+    free(reflectance);
+
+    if(dot < 0) return;
+
+    Color* diffuseProd = productColors(light->diffuse, col->colObject->material->diffuse);
+    Color* diffuseScale = scaleColor(diffuseProd, dot*attenuation);
+    Color* diffuseResult = clampColor(diffuseScale, 0, 1);
+    addColors(drawn_color, diffuseResult);
+    free(diffuseProd);
+    free(diffuseScale);
+    free(diffuseResult);
+
+    dot2 = powf(dot2, col->colObject->material->albedo);
+    
+    Color* specProd = productColors(light->specular, col->colObject->material->specular);
+    Color* specScale = scaleColor(specProd, dot2*attenuation);
+    Color* specResult = clampColor(specScale, 0, 1);
+    addColors(drawn_color, specResult);
+    free(specProd);
+    free(specScale);
+    free(specResult);
+
+    return;
+}
+
+Color* checkCollisionColor(Collision* col, Scene* scene){
+    Color * drawn_color = create_color(0, 0, 0);
+
+    vector3D* sub = subtractVectors(col->colObject->center, &col->colPoint);
+    vector3D* normalized = normalizeVector(sub);
+    free(sub);
+
+    vector3D* normCam = normalizeVector(scene->camera);
+    vector3D* view = subtractVectors(&col->colPoint , normCam);
+    free(normCam);
+
+    if(scene->lightbvh == NULL){
+        //no culling, every light pays for its shadow test
+        LightList* index = scene->lights;
+        while(index->light != NULL){
+            shadeLight(col, index->light, normalized, view, scene, drawn_color);
+            index = index->next;
+        }
+    }else{
+        for(int i = 0; i < scene->num_global_lights; i++){
+            shadeLight(col, scene->light_array[i], normalized, view, scene, drawn_color);
+        }
+
+        //only the ranged lights whose influence sphere contains the hit point
+        vector3D* p = &col->colPoint;
+        int stack[BVH_STACK_SIZE];
+        int top = 0;
+        if(scene->lightbvh->num_nodes > 0) stack[top++] = 0;
+        while(top > 0){
+            int node = stack[--top];
+            if(!bvh_node_contains(scene->lightbvh, node, p->x, p->y, p->z)) continue;
+
+            int first = scene->lightbvh->nodes[node*2];
+            int count = scene->lightbvh->nodes[node*2+1];
+            if(count == 0){
+                stack[top++] = first;
+                stack[top++] = first+1;
+                continue;
+            }
+            for(int i = first; i < first+count; i++){
+                Light* light = scene->light_array[i];
+                vector3D* toLight = subtractVectors(p, light->position);
+                float distance = getMagnitude(toLight);
+                free(toLight);
+
+                if(distance < light->range) shadeLight(col, light, normalized, view, scene, drawn_color);
+            }
+        }
+    }
+
+    Color* ambProd = productColors(col->colObject->material->ambient, scene->ALI);
+    addColors(drawn_color, ambProd);
+    free(ambProd);
+
+    Color* hueScale = scaleColor(col->colObject->color, 0.2);
+    addColors(drawn_color, hueScale);
+    free(hueScale);
+
+    free(normalized);
+    free(view);
+
+    Color* result = clampColor(drawn_color, 0, 1);
+    free(drawn_color);
+    return result;
+}
+
+//shading plus reflections of a ray that already hit something, does not destroy the collision
+Color* colorFromCollision(Collision* collision, vector3D * dir, Scene* scene, int depth);
+
+//hit receives the first sphere the ray hits (NULL on a miss), pass NULL if you dont care
+Color* colorFromRecursiveRayCast(vector3D * dir, vector3D * origin, Scene* scene, int depth, Sphere** hit){
+    if(depth <= 0) return create_color(0, 0, 0);
+
+    Collision* collision = checkRayCollisions(dir, origin, scene->objects);
+    if(hit != NULL) *hit = collision->colObject;
+    if(collision->colObject == NULL){
+        destroy_collision(collision);
+
+        return create_color(0, 0, 0);
+    }
+
+    Color* final_color = colorFromCollision(collision, dir, scene, depth);
+    destroy_collision(collision);
+
+    return final_color;
+}
+
+Color* colorFromCollision(Collision* collision, vector3D * dir, Scene* scene, int depth){
+    Color* drawn_color = create_color(0, 0, 0);
+
+    Color* colColor = checkCollisionColor(collision, scene);
+    Color* reflecScaled = scaleColor(collision->colObject->material->reflectivity, depth/2); //3 de depth hard coded basicamente, dá pra melhorar depois
+    Color* reflecColor = productColors(colColor, reflecScaled);
+    free(colColor);
+    free(reflecScaled);
+
+    addColors(drawn_color, reflecColor);
+    free(reflecColor);
+
+    vector3D* inverse = scaleVector(dir, -1);
+    vector3D* V = normalizeVector(inverse);
+    vector3D* sub = subtractVectors(collision->colObject->center, &collision->colPoint);
+    vector3D* N = normalizeVector(sub);
+    float dot = dotProduct(V, N);
+    vector3D* normalScaled = scaleVector(N, 2*dot);
+    vector3D* reflectance = subtractVectors(V, normalScaled);
+    free(inverse);
+    free(V);
+    free(sub);
+    free(N);
+    free(normalScaled);
+
+    if(depth > 1) ray_counters[STAT_REFLECTION_RAYS]++; //depth 1 is the last bounce, it casts nothing
+    Color* reflected = colorFromRecursiveRayCast(reflectance, &collision->colPoint, scene, depth-1, NULL);
+    addColors(drawn_color, reflected);
+    free(reflected);
+    free(reflectance);
+
+    Color* final_color = clampColor(drawn_color, 0, 1);
+    free(drawn_color);
+
+    return final_color;
+}
+
+//point on the view plane for one of the 4 antialliasing samples of pixel x, y, sample 0 is the pixel corner
+vector3D* samplePoint(Scene* scene, int x, int y, int width, int height, int index){
+    float alpha;
+    float beta;
+    switch (index)
+    {
+    case 0:
+        alpha = (float)x/width;
+        beta = (float)y/height;
+        break;
+    case 1:
+        alpha = ((float)x + 0.5)/width;
+        beta = (float)y/height;
+        break;
+    case 2:
+        alpha = (float)x/width;
+        beta = ((float)y + 0.5)/height;
+        break;
+    default:
+        alpha = ((float)x + 0.5)/width;
+        beta = ((float)y + 0.5)/height;
+        break;
+    }
+
+    //(1-alpha)*x1 + alpha*x2
+    vector3D* scalex1 = scaleVector(scene->plane->x1, 1.0-alpha);
+    vector3D* scalex2 = scaleVector(scene->plane->x2, alpha);
+    vector3D * t = addVectors(scalex1, scalex2);
+    free(scalex1);
+    free(scalex2);
+
+    vector3D* scalex3 = scaleVector(scene->plane->x3, 1.0-alpha);
+    vector3D* scalex4 = scaleVector(scene->plane->x4, alpha);
+    vector3D * b = addVectors(scalex3, scalex4);
+    free(scalex3);
+    free(scalex4);
+
+    vector3D* scalet = scaleVector(t, 1.0-beta);
+    vector3D* scaleb = scaleVector(b, beta);
+    vector3D * origin = addVectors(scalet, scaleb);
+    free(scalet);
+    free(scaleb);
+
+    free(t);
+    free(b);
+
+    return origin;
+}
+
+Color* antialliased(Scene* scene, int x, int y, int width, int height, Sphere** hit){
+    Color* base_color = create_color(0, 0, 0);
+    int index = 0;
+    while(index < 4){
+        vector3D * origin = samplePoint(scene, x, y, width, height, index);
+        vector3D * direction = subtractVectors(scene->camera, origin);
+
+        Color* renderedColor = colorFromRecursiveRayCast(direction, origin, scene, 3, index == 0 ? hit : NULL);
+        addColors(base_color, renderedColor);
+        free(origin);
+        free(direction);
+        free(renderedColor);
+
+        index+=1;
+    }
+
+    Color* averageColor = scaleColor(base_color, (float)1/4);
+    Color* finalColor = clampColor(averageColor, 0, 1);
+    free(base_color);
+    free(averageColor);
+
+    return finalColor;
+}
+
+//same as antialliased but every sample is only intersected, each distinct sphere hit in the pixel is shaded
+//once (shadows and reflections included) from its first sample and the result is reused by the others
+Color* antialliasedShared(Scene* scene, int x, int y, int width, int height, Sphere** hit){
+    Collision* collisions[4];
+    vector3D* directions[4];
+    Color* colors[4];
+    int owner[4];
+
+    for(int index = 0; index < 4; index++){
+        vector3D * origin = samplePoint(scene, x, y, width, height, index);
+        directions[index] = subtractVectors(scene->camera, origin);
+        collisions[index] = checkRayCollisions(directions[index], origin, scene->objects);
+        free(origin);
+    }
+    if(hit != NULL) *hit = collisions[0]->colObject;
+
+    Color* base_color = create_color(0, 0, 0);
+    for(int index = 0; index < 4; index++){
+        owner[index] = index;
+        for(int k = 0; k < index; k++){
+            if(collisions[k]->colObject == collisions[index]->colObject){
+                owner[index] = k;
+                break;
+            }
+        }
+
+        if(owner[index] != index) colors[index] = colors[owner[index]];
+        else if(collisions[index]->colObject == NULL) colors[index] = create_color(0, 0, 0);
+        else colors[index] = colorFromCollision(collisions[index], directions[index], scene, 3);
+
+        addColors(base_color, colors[index]);
+    }
+
+    for(int index = 0; index < 4; index++){
+        if(owner[index] == index) free(colors[index]);
+        destroy_collision(collisions[index]);
+        free(directions[index]);
+    }
+
+    Color* averageColor = scaleColor(base_color, (float)1/4);
+    Color* finalColor = clampColor(averageColor, 0, 1);
+    free(base_color);
+    free(averageColor);
+
+    return finalColor;
+}
+
+//one pixel of a width x height frame, samples is 1 (no antialliasing) or 4
+//hit gets the sphere seen by the first sample, can be NULL
+Color* renderPixel(Scene* scene, int x, int y, int width, int height, int samples, int shared_shading, Sphere** hit){
+    ray_counters[STAT_PRIMARY_RAYS] += samples > 1 ? 4 : 1;
+    if(samples > 1 && shared_shading) return antialliasedShared(scene, x, y, width, height, hit);
+    if(samples > 1) return antialliased(scene, x, y, width, height, hit);
+
+    vector3D* origin = samplePoint(scene, x, y, width, height, 0);
+    vector3D* direction = subtractVectors(scene->camera, origin);
+
+    Color* renderedColor = colorFromRecursiveRayCast(direction, origin, scene, 3, hit);
+
+    free(direction);
+    free(origin);
+
+    return renderedColor;
+}
+
+#endif
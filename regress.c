@@ -0,0 +1,464 @@
+#define CL_TARGET_OPENCL_VERSION 200
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <CL/cl.h>
+#include "vector.h"
+#include "utils.h"
+#include "raytracer.h"
+#include "opencl.h"
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "frame_writer.h"
+#include "tonemap.h"
+#include "tiles.h"
+
+//the image and speed regression suite: renders every case of a manifest (regress.txt) through its backend,
+//compares the result with the golden image stored for it and the time of each stage with the budget recorded
+//for it, and exits with 1 listing what drifted or got slower. --update renders everything and stores the
+//results as the new goldens and budgets, after a change that is meant to alter the images or the speed
+//usage: ./regress [manifest] [--golden dir] [--update] [--psnr db] [--slack percent] [--runs n]
+//       [--image-program path] [--postprocess file]
+//the backends are cpu and cpu-shared (raytracer.h, like the image mode of main.c), opencl and opencl-shared
+//(the render kernels on whatever device init_opencl finds, a cpu runtime like pocl works) and image (image.c
+//run as its own process, start up and kernel build included)
+
+#define MAX_CASES 64
+#define MAX_STAGES 2
+//a stage has to be this much slower too before it counts as a regression, shorter ones are mostly timer noise
+#define MIN_REGRESSION_MS 2
+
+typedef struct RegressCase{
+    char name[64];
+    char scene[256];
+    char backend[32];
+    int width;
+    int height;
+    int samples;
+} RegressCase;
+
+//what one run of a case gave: the image and the time of each of its stages
+typedef struct RegressResult{
+    uint8_t* rgb;
+    int num_stages;
+    const char* stages[MAX_STAGES];
+    double ms[MAX_STAGES]; //the best of the runs
+    char error[320];
+} RegressResult;
+
+typedef struct Budget{
+    char name[64];
+    char stage[32];
+    double ms;
+} Budget;
+
+double now_ms(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1000.0 + ts.tv_nsec/1000000.0;
+}
+
+//name scene backend WxH samples per line, # starts a comment
+int load_manifest(const char* path, RegressCase* cases){
+    FILE* file = fopen(path, "r");
+    if(file == NULL){
+        printf("Could not open the manifest %s\n", path);
+        exit(2);
+    }
+    char line[1024];
+    int count = 0;
+    int line_number = 0;
+    while(fgets(line, sizeof(line), file)){
+        line_number++;
+        char* comment = strchr(line, '#');
+        if(comment != NULL) *comment = '\0';
+        char size[32];
+        RegressCase parsed;
+        RegressCase* c = &parsed;
+        int fields = sscanf(line, "%63s %255s %31s %31s %d", c->name, c->scene, c->backend, size, &c->samples);
+        if(fields <= 0) continue;
+        if(count == MAX_CASES){
+            printf("%s: more than %d cases\n", path, MAX_CASES);
+            exit(2);
+        }
+        if(fields != 5 || !parse_size(size, &c->width, &c->height) || c->samples < 1 || c->samples > 4){
+            printf("%s:%d: expected name scene backend WxH samples\n", path, line_number);
+            exit(2);
+        }
+        if(c->width > WIDTH || c->height > HEIGHT){
+            printf("%s:%d: %s is bigger than the %dx%d buffers\n", path, line_number, size, WIDTH, HEIGHT);
+            exit(2);
+        }
+        cases[count++] = parsed;
+    }
+    fclose(file);
+    return count;
+}
+
+//the golden images are binary ppms, NULL if there is none or it is not one
+uint8_t* read_ppm(const char* path, int* width, int* height){
+    FILE* file = fopen(path, "rb");
+    if(file == NULL) return NULL;
+    int max_value;
+    uint8_t* rgb = NULL;
+    if(fscanf(file, "P6 %d %d %d", width, height, &max_value) == 3 && max_value == 255 && fgetc(file) != EOF){
+        size_t size = (size_t)*width**height*3;
+        rgb = (uint8_t*)malloc(size);
+        if(fread(rgb, 1, size, file) != size){
+            free(rgb);
+            rgb = NULL;
+        }
+    }
+    fclose(file);
+    return rgb;
+}
+
+int write_ppm(const char* path, const uint8_t* rgb, int width, int height){
+    size_t size;
+    uint8_t* data = encode_image(FRAME_PPM, rgb, width, height, &size);
+    FILE* file = fopen(path, "wb");
+    int ok = file != NULL && fwrite(data, 1, size, file) == size;
+    if(file != NULL && fclose(file) != 0) ok = 0;
+    free(data);
+    return ok;
+}
+
+void add_stage(RegressResult* result, const char* stage, double ms){
+    for(int s = 0; s < result->num_stages; s++){
+        if(!strcmp(result->stages[s], stage)){
+            if(ms < result->ms[s]) result->ms[s] = ms;
+            return;
+        }
+    }
+    result->stages[result->num_stages] = stage;
+    result->ms[result->num_stages++] = ms;
+}
+
+//the image mode of main.c without the window: the tracer maps every pixel as it goes, so there is one stage.
+//its y goes up, the rows are written the other way round
+void render_cpu(RegressCase* c, int shared_shading, int runs, RegressResult* result){
+    flattenedScene* fscene = load_flattened_scene(c->scene);
+    if(fscene == NULL){
+        snprintf(result->error, sizeof(result->error), "could not load %s", c->scene);
+        return;
+    }
+    Scene* scene = scene_from_flattened(fscene);
+    destroy_flattened_scene(fscene);
+    ToneSettings tone = default_tone_settings();
+    result->rgb = (uint8_t*)malloc((size_t)c->width*c->height*3);
+    for(int run = 0; run < runs; run++){
+        double start = now_ms();
+        for(int y = 0; y < c->height; y++){
+            uint8_t* row = result->rgb+(size_t)(c->height-1-y)*c->width*3;
+            for(int x = 0; x < c->width; x++){
+                Color* color = renderPixel(scene, x, y, c->width, c->height, c->samples, shared_shading, NULL);
+                uint32_t pixel = tone_map_pixel(&tone, color->red, color->green, color->blue, x, c->height-1-y);
+                free(color);
+                row[x*3] = (pixel >> 16) & 0xff;
+                row[x*3+1] = (pixel >> 8) & 0xff;
+                row[x*3+2] = pixel & 0xff;
+            }
+        }
+        add_stage(result, "trace", now_ms()-start);
+    }
+    destroy_scene(scene);
+}
+
+//the render kernel and the read back as one stage, the resolve to 8 bit as the other. the post processing
+//kernel of image.c belongs to the user, so it is left out and the context gets the camera one of main.c
+void render_opencl(RegressCase* c, int shared_shading, int runs, RegressResult* result){
+    flattenedScene* fscene = load_flattened_scene(c->scene);
+    if(fscene == NULL){
+        snprintf(result->error, sizeof(result->error), "could not load %s", c->scene);
+        return;
+    }
+    OpenclContext* opencl_context = init_opencl(fscene, "cam_dir.txt", "cam_dir");
+    cl_command_queue queue = clCreateCommandQueueWithProperties(opencl_context->context, opencl_context->devices, NULL, NULL);
+    cl_kernel render_kernel = shared_shading ? opencl_context->shared_render_kernel : opencl_context->render_kernel;
+    set_render_resolution(render_kernel, c->width, c->height, c->samples);
+    size_t localsize = 128;
+    size_t globalsize = render_global_size(c->width, c->height, shared_shading ? 1 : c->samples, localsize);
+    const size_t samples_size = sizeof(float)*3*c->width*c->height*c->samples;
+    float* pixels = (float*)malloc(samples_size);
+    ToneMapper* tone_mapper = create_tone_mapper(default_tone_settings());
+    result->rgb = (uint8_t*)malloc((size_t)c->width*c->height*3);
+
+    for(int run = 0; run < runs; run++){
+        double start = now_ms();
+        cl_int err = clEnqueueNDRangeKernel(queue, render_kernel, 1, NULL, &globalsize, &localsize, 0, NULL, NULL);
+        if(err == CL_SUCCESS) err = clFinish(queue);
+        if(err == CL_SUCCESS) err = clEnqueueReadBuffer(queue, opencl_context->pixelcolors, CL_TRUE, 0, samples_size, pixels, 0, NULL, NULL);
+        if(err != CL_SUCCESS){
+            snprintf(result->error, sizeof(result->error), "opencl error %d", err);
+            break;
+        }
+        add_stage(result, "render", now_ms()-start);
+
+        start = now_ms();
+        tone_map_rgb(tone_mapper, pixels, c->samples, c->width, c->height, result->rgb);
+        add_stage(result, "resolve", now_ms()-start);
+    }
+
+    destroy_tone_mapper(tone_mapper);
+    free(pixels);
+    destroy_openclcontext(opencl_context);
+    clReleaseCommandQueue(queue);
+}
+
+//image.c from start to finish as one stage, written to a ppm and read back. --size is only passed for other
+//sizes than its own, it renders in tiles then
+void render_image_program(RegressCase* c, const char* program, const char* postprocess, int runs, RegressResult* result){
+    if(c->samples != 4){
+        snprintf(result->error, sizeof(result->error), "image.c always renders 4 samples");
+        return;
+    }
+    char base[64];
+    snprintf(base, sizeof(base), "/tmp/regress_%d", (int)getpid());
+    char output[96];
+    snprintf(output, sizeof(output), "%s.ppm", base);
+    char size[32];
+    snprintf(size, sizeof(size), "%dx%d", c->width, c->height);
+    int own_size = c->width == WIDTH && c->height == HEIGHT;
+
+    for(int run = 0; run < runs; run++){
+        double start = now_ms();
+        pid_t child = fork();
+        if(child == 0){
+            //its progress lines would break up the report
+            int null = open("/dev/null", O_WRONLY);
+            dup2(null, STDOUT_FILENO);
+            if(own_size) execl(program, program, c->scene, base, postprocess, "--format", "ppm", (char*)NULL);
+            else execl(program, program, c->scene, base, postprocess, "--format", "ppm", "--size", size, (char*)NULL);
+            _exit(127);
+        }
+        int status = 0;
+        waitpid(child, &status, 0);
+        double ms = now_ms()-start;
+        if(!WIFEXITED(status) || WEXITSTATUS(status) != 0){
+            if(WIFEXITED(status) && WEXITSTATUS(status) == 127) snprintf(result->error, sizeof(result->error), "could not run %s", program);
+            else snprintf(result->error, sizeof(result->error), "%s failed with status %d", program, WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+            return;
+        }
+        add_stage(result, "run", ms);
+    }
+
+    int width, height;
+    result->rgb = read_ppm(output, &width, &height);
+    unlink(output);
+    if(result->rgb == NULL || width != c->width || height != c->height){
+        snprintf(result->error, sizeof(result->error), "%s did not write a %s ppm", program, size);
+    }
+}
+
+//psnr over the rgb bytes, INFINITY for identical images, and the largest difference of a channel
+double image_psnr(const uint8_t* a, const uint8_t* b, size_t size, int* max_difference){
+    double squared = 0;
+    *max_difference = 0;
+    for(size_t i = 0; i < size; i++){
+        int difference = abs((int)a[i]-(int)b[i]);
+        if(difference > *max_difference) *max_difference = difference;
+        squared += difference*difference;
+    }
+    if(squared == 0) return INFINITY;
+    return 10*log10(255.0*255.0/(squared/size));
+}
+
+//the differences 8 times brighter, to see at a glance where an image drifted
+void write_difference(const char* path, const uint8_t* a, const uint8_t* b, int width, int height){
+    size_t size = (size_t)width*height*3;
+    uint8_t* difference = (uint8_t*)malloc(size);
+    for(size_t i = 0; i < size; i++){
+        int value = abs((int)a[i]-(int)b[i])*8;
+        difference[i] = value > 255 ? 255 : value;
+    }
+    write_ppm(path, difference, width, height);
+    free(difference);
+}
+
+int load_budgets(const char* path, Budget* budgets, int max_budgets){
+    FILE* file = fopen(path, "r");
+    if(file == NULL) return 0;
+    int count = 0;
+    while(count < max_budgets && fscanf(file, "%63s %31s %lf", budgets[count].name, budgets[count].stage, &budgets[count].ms) == 3) count++;
+    fclose(file);
+    return count;
+}
+
+//drops every budget of the case name, the others keep their order
+int remove_budgets(Budget* budgets, int count, const char* name){
+    int kept = 0;
+    for(int i = 0; i < count; i++){
+        if(strcmp(budgets[i].name, name)) budgets[kept++] = budgets[i];
+    }
+    return kept;
+}
+
+Budget* find_budget(Budget* budgets, int count, const char* name, const char* stage){
+    for(int i = 0; i < count; i++){
+        if(!strcmp(budgets[i].name, name) && !strcmp(budgets[i].stage, stage)) return &budgets[i];
+    }
+    return NULL;
+}
+
+int main(int argc, char* argv[]){
+    char* golden_option = take_option(&argc, argv, "--golden");
+    char* psnr_option = take_option(&argc, argv, "--psnr");
+    char* slack_option = take_option(&argc, argv, "--slack");
+    char* runs_option = take_option(&argc, argv, "--runs");
+    char* program_option = take_option(&argc, argv, "--image-program");
+    char* postprocess_option = take_option(&argc, argv, "--postprocess");
+    int update = take_flag(&argc, argv, "--update");
+    if(argc > 2){
+        printf("Usage: ./regress [manifest] [--golden dir] [--update] [--psnr db] [--slack percent] [--runs n] [--image-program path] [--postprocess file]\n");
+        exit(2);
+    }
+    const char* manifest = argc > 1 ? argv[1] : "regress.txt";
+    const char* golden = golden_option ? golden_option : "golden";
+    //40 dB is about one level of difference on every channel, far below what an eye notices
+    double min_psnr = psnr_option ? atof(psnr_option) : 40;
+    double slack = slack_option ? atof(slack_option) : 10;
+    //the best of a few runs, a single one is at the mercy of whatever else the machine is doing
+    int runs = runs_option ? atoi(runs_option) : 3;
+    if(runs < 1) runs = 1;
+    const char* image_program = program_option ? program_option : "./image";
+    const char* postprocess = postprocess_option ? postprocess_option : "postprocess.txt";
+
+    RegressCase cases[MAX_CASES];
+    int num_cases = load_manifest(manifest, cases);
+    char budgets_path[512];
+    snprintf(budgets_path, sizeof(budgets_path), "%s/budgets.txt", golden);
+    Budget budgets[MAX_CASES*MAX_STAGES];
+    if(!update && access(budgets_path, R_OK) != 0){
+        printf("No goldens in %s on this machine yet, they are not in the repository. Run ./regress --update once\n", golden);
+        printf("before the change to check, then ./regress after it\n");
+        exit(2);
+    }
+    int num_budgets = load_budgets(budgets_path, budgets, MAX_CASES*MAX_STAGES);
+    if(update){
+        //a case that fails keeps the budgets it had, the ones of cases no longer in the manifest go
+        int kept = 0;
+        for(int b = 0; b < num_budgets; b++){
+            for(int i = 0; i < num_cases; i++){
+                if(!strcmp(budgets[b].name, cases[i].name)){
+                    budgets[kept++] = budgets[b];
+                    break;
+                }
+            }
+        }
+        num_budgets = kept;
+    }
+    if(update && mkdir(golden, 0755) != 0 && errno != EEXIST){
+        printf("Could not create the golden directory %s\n", golden);
+        exit(2);
+    }
+
+    printf("%-20s %-14s %10s %9s   %s\n", "case", "backend", "psnr", "max diff", "stages (ms, budget)");
+    int failures = 0;
+    for(int i = 0; i < num_cases; i++){
+        RegressCase* c = &cases[i];
+        RegressResult result;
+        memset(&result, 0, sizeof(result));
+        if(!strcmp(c->backend, "cpu") || !strcmp(c->backend, "cpu-shared")) render_cpu(c, !strcmp(c->backend, "cpu-shared"), runs, &result);
+        else if(!strcmp(c->backend, "opencl") || !strcmp(c->backend, "opencl-shared")) render_opencl(c, !strcmp(c->backend, "opencl-shared"), runs, &result);
+        else if(!strcmp(c->backend, "image")) render_image_program(c, image_program, postprocess, runs, &result);
+        else snprintf(result.error, sizeof(result.error), "unknown backend, use cpu, cpu-shared, opencl, opencl-shared or image");
+
+        if(result.error[0] != '\0'){
+            printf("%-20s %-14s FAILED: %s\n", c->name, c->backend, result.error);
+            free(result.rgb);
+            failures++;
+            continue;
+        }
+
+        char golden_path[512];
+        snprintf(golden_path, sizeof(golden_path), "%s/%s.ppm", golden, c->name);
+        if(update){
+            if(!write_ppm(golden_path, result.rgb, c->width, c->height)){
+                printf("Could not write %s\n", golden_path);
+                exit(1);
+            }
+            printf("%-20s %-14s %10s %9s  ", c->name, c->backend, "stored", "");
+            num_budgets = remove_budgets(budgets, num_budgets, c->name);
+            for(int s = 0; s < result.num_stages; s++){
+                Budget* budget = &budgets[num_budgets++];
+                snprintf(budget->name, sizeof(budget->name), "%s", c->name);
+                snprintf(budget->stage, sizeof(budget->stage), "%s", result.stages[s]);
+                budget->ms = result.ms[s];
+                printf(" %s %.1f", result.stages[s], result.ms[s]);
+            }
+            printf("\n");
+            free(result.rgb);
+            continue;
+        }
+
+        //every problem of the case goes on its line, then the files to look at
+        char problems[1024] = "";
+        int golden_width, golden_height;
+        uint8_t* expected = read_ppm(golden_path, &golden_width, &golden_height);
+        double psnr = 0;
+        int max_difference = 0;
+        if(expected == NULL) snprintf(problems, sizeof(problems), " no golden image %s, run with --update;", golden_path);
+        else if(golden_width != c->width || golden_height != c->height) snprintf(problems, sizeof(problems), " the golden image is %dx%d;", golden_width, golden_height);
+        else{
+            psnr = image_psnr(result.rgb, expected, (size_t)c->width*c->height*3, &max_difference);
+            if(psnr < min_psnr){
+                char path[600];
+                snprintf(path, sizeof(path), "%s/%s.actual.ppm", golden, c->name);
+                write_ppm(path, result.rgb, c->width, c->height);
+                snprintf(path, sizeof(path), "%s/%s.diff.ppm", golden, c->name);
+                write_difference(path, result.rgb, expected, c->width, c->height);
+                size_t length = strlen(problems);
+                snprintf(problems+length, sizeof(problems)-length, " image drifted below %.1f dB, see %s/%s.actual.ppm and .diff.ppm;", min_psnr, golden, c->name);
+            }
+        }
+
+        char psnr_text[16];
+        if(expected == NULL) snprintf(psnr_text, sizeof(psnr_text), "-");
+        else if(isinf(psnr)) snprintf(psnr_text, sizeof(psnr_text), "identical");
+        else snprintf(psnr_text, sizeof(psnr_text), "%.1f dB", psnr);
+        printf("%-20s %-14s %10s %9d  ", c->name, c->backend, psnr_text, max_difference);
+        for(int s = 0; s < result.num_stages; s++){
+            Budget* budget = find_budget(budgets, num_budgets, c->name, result.stages[s]);
+            if(budget == NULL){
+                printf(" %s %.1f (no budget)", result.stages[s], result.ms[s]);
+                size_t length = strlen(problems);
+                snprintf(problems+length, sizeof(problems)-length, " no budget for %s, run with --update;", result.stages[s]);
+                continue;
+            }
+            double change = (result.ms[s]/budget->ms-1)*100;
+            printf(" %s %.1f (%.1f, %+.0f%%)", result.stages[s], result.ms[s], budget->ms, change);
+            if(change > slack && result.ms[s]-budget->ms > MIN_REGRESSION_MS){
+                size_t length = strlen(problems);
+                snprintf(problems+length, sizeof(problems)-length, " %s took %.1f ms, %.0f%% over its %.1f ms budget;", result.stages[s], result.ms[s], change, budget->ms);
+            }
+        }
+        printf("\n");
+        if(problems[0] != '\0'){
+            printf("    FAILED:%s\n", problems);
+            failures++;
+        }
+        free(expected);
+        free(result.rgb);
+    }
+
+    if(update){
+        FILE* file = fopen(budgets_path, "w");
+        if(file == NULL){
+            printf("Could not write %s\n", budgets_path);
+            exit(1);
+        }
+        for(int b = 0; b < num_budgets; b++) fprintf(file, "%s %s %.3f\n", budgets[b].name, budgets[b].stage, budgets[b].ms);
+        fclose(file);
+        printf("Stored %d golden images and %d budgets in %s%s\n", num_cases-failures, num_budgets, golden, failures ? ", the failed cases kept their old ones" : "");
+        return failures ? 1 : 0;
+    }
+    if(failures) printf("%d of %d cases failed (psnr below %.1f dB or a stage over %.0f%% of its budget)\n", failures, num_cases, min_psnr, slack);
+    else printf("All %d cases passed\n", num_cases);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,203 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "vector.h"
+#include "utils.h"
+#include "net.h"
+
+//sends requests to render_server and measures them, or measures starting a whole render process per image to
+//compare against. the latencies are printed as requests per second and the 50th and 99th percentiles
+//usage: ./render_client socket|host:port "render scene.json [options]" [--out file] [--repeat n] [--clients c]
+//       ./render_client --exec n command [args...]
+
+double now_ms(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1000.0 + ts.tv_nsec/1000000.0;
+}
+
+int compare_doubles(const void* a, const void* b){
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y)-(x < y);
+}
+
+//sorts the latencies, in ms, and prints the summary of count requests that took seconds in total
+void print_latencies(const char* what, double* latencies, int count, double seconds){
+    qsort(latencies, count, sizeof(double), compare_doubles);
+    //nearest rank
+    int p50 = (int)ceil(0.50*count)-1;
+    int p99 = (int)ceil(0.99*count)-1;
+    printf("%s: %d requests in %.2f s, %.1f requests/s, p50 %.1f ms, p99 %.1f ms\n", what, count, seconds, count/seconds, latencies[p50], latencies[p99]);
+}
+
+//sends one request line and waits for its answer. the image bytes end up in *image (NULL when the server wrote
+//them to a file), 0 on errors, which are printed
+int send_request(int fd, const char* request, char** image, size_t* size){
+    size_t length = strlen(request);
+    if(send(fd, request, length, MSG_NOSIGNAL) != (ssize_t)length || send(fd, "\n", 1, MSG_NOSIGNAL) != 1){
+        printf("Lost the connection to the server\n");
+        return 0;
+    }
+
+    char header[600];
+    size_t used = 0;
+    while(used < sizeof(header)-1){
+        if(!read_all(fd, &header[used], 1)){
+            printf("Lost the connection to the server\n");
+            return 0;
+        }
+        if(header[used++] == '\n') break;
+    }
+    header[used] = '\0';
+    if(strncmp(header, "ok ", 3)){
+        printf("%s", header);
+        return 0;
+    }
+
+    *size = strtoull(header+3, NULL, 10);
+    *image = NULL;
+    if(*size == 0) return 1;
+    *image = (char*)malloc(*size);
+    if(!read_all(fd, *image, *size)){
+        printf("Lost the connection to the server\n");
+        free(*image);
+        *image = NULL;
+        return 0;
+    }
+    return 1;
+}
+
+typedef struct BenchClient{
+    const char* socket_path;
+    const char* request;
+    double* latencies; //this client's part of the shared array
+    int count;
+    int ok;
+} BenchClient;
+
+void* bench_client_thread(void* argument){
+    BenchClient* client = (BenchClient*)argument;
+    int fd = connect_address(client->socket_path);
+    client->ok = fd >= 0;
+    for(int r = 0; r < client->count && client->ok; r++){
+        char* image = NULL;
+        size_t size;
+        double start = now_ms();
+        client->ok = send_request(fd, client->request, &image, &size);
+        client->latencies[r] = now_ms()-start;
+        free(image);
+    }
+    if(fd >= 0) close(fd);
+    return NULL;
+}
+
+//runs command count times one after the other, each one waited for before the next starts
+int bench_exec(int count, char* command[]){
+    double* latencies = (double*)malloc(sizeof(double)*count);
+    double start = now_ms();
+    for(int r = 0; r < count; r++){
+        double process_start = now_ms();
+        pid_t pid = fork();
+        if(pid == 0){
+            int null_fd = open("/dev/null", O_WRONLY);
+            dup2(null_fd, STDOUT_FILENO);
+            execvp(command[0], command);
+            _exit(127);
+        }
+        int status;
+        if(pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0){
+            printf("%s failed\n", command[0]);
+            free(latencies);
+            return 0;
+        }
+        latencies[r] = now_ms()-process_start;
+    }
+    print_latencies("one process per render", latencies, count, (now_ms()-start)/1000);
+    free(latencies);
+    return 1;
+}
+
+int main(int argc, char* argv[]){
+    if(argc >= 4 && !strcmp(argv[1], "--exec")){
+        int count = atoi(argv[2]);
+        if(count < 1){
+            printf("--exec needs the number of runs\n");
+            exit(2);
+        }
+        return bench_exec(count, &argv[3]) ? 0 : 1;
+    }
+
+    char* out_option = take_option(&argc, argv, "--out");
+    char* repeat_option = take_option(&argc, argv, "--repeat");
+    char* clients_option = take_option(&argc, argv, "--clients");
+    if(argc != 3){
+        printf("Usage: ./render_client socket|host:port \"render scene.json [options]\" [--out file] [--repeat n] [--clients c]\n"
+        "       ./render_client --exec n command [args...]\n");
+        exit(2);
+    }
+
+    if(repeat_option == NULL && clients_option == NULL){
+        int fd = connect_address(argv[1]);
+        if(fd < 0){
+            printf("Could not connect to %s\n", argv[1]);
+            exit(1);
+        }
+        char* image = NULL;
+        size_t size;
+        int ok = send_request(fd, argv[2], &image, &size);
+        close(fd);
+        if(!ok) exit(1);
+        if(image != NULL){
+            FILE* file = out_option ? fopen(out_option, "wb") : stdout;
+            if(file == NULL || fwrite(image, 1, size, file) != size){
+                printf("Could not write the image\n");
+                exit(1);
+            }
+            if(file != stdout) fclose(file);
+            free(image);
+        }
+        return 0;
+    }
+
+    //each client has its own connection and sends its requests one after the other, so the server queue holds
+    //up to one request per client
+    int repeat = repeat_option ? atoi(repeat_option) : 100;
+    int num_clients = clients_option ? atoi(clients_option) : 1;
+    if(repeat < 1 || num_clients < 1){
+        printf("--repeat and --clients take a positive number\n");
+        exit(2);
+    }
+    double* latencies = (double*)malloc(sizeof(double)*repeat);
+    BenchClient* clients = (BenchClient*)malloc(sizeof(BenchClient)*num_clients);
+    pthread_t* threads = (pthread_t*)malloc(sizeof(pthread_t)*num_clients);
+    double start = now_ms();
+    int first = 0;
+    for(int c = 0; c < num_clients; c++){
+        int count = repeat/num_clients+(c < repeat % num_clients);
+        clients[c] = (BenchClient){argv[1], argv[2], &latencies[first], count, 1};
+        first += count;
+        pthread_create(&threads[c], NULL, bench_client_thread, &clients[c]);
+    }
+    int ok = 1;
+    for(int c = 0; c < num_clients; c++){
+        pthread_join(threads[c], NULL);
+        if(!clients[c].ok) ok = 0;
+    }
+    double seconds = (now_ms()-start)/1000;
+    if(ok){
+        char what[64];
+        snprintf(what, sizeof(what), "render_server, %d client%s", num_clients, num_clients > 1 ? "s" : "");
+        print_latencies(what, latencies, repeat, seconds);
+    }
+    free(latencies);
+    free(clients);
+    free(threads);
+    return ok ? 0 : 1;
+}
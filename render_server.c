@@ -0,0 +1,451 @@
+#define CL_TARGET_OPENCL_VERSION 200
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <CL/cl.h>
+#include "vector.h"
+#include "utils.h"
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+#define WIDTH 1080
+#define HEIGHT 720
+
+#include "opencl.h"
+#include "camera_path.h"
+#include "frame_writer.h"
+#include "tiles.h"
+#include "net.h"
+#include "tonemap.h"
+
+//renders on request over a unix socket or tcp, keeping the opencl context, the compiled kernels and the scenes
+//loaded between requests so a render costs only the render. every request is one line:
+//  render scene.json [--camera x,y,z,yaw,pitch] [--size WxH] [--tile x,y,w,h] [--samples 1-4] [--format ppm|pam|png|jpg|rgb] [--output file]
+//                    [--tonemap clamp|reinhard|filmic] [--exposure f] [--srgb] [--dither]
+//and the answer is "ok n\n" followed by the n bytes of the image, n is 0 when it went to --output instead, or
+//"error message\n". the requests of every client go into one queue and are rendered in the order they came.
+//--tile renders only that rectangle of a --size image, what tile_coordinator hands out to its workers. a scene
+//is only named by its path, there are no deltas over the socket: an edited file is reloaded by the next request
+//usage: ./render_server socket|port postprocess.txt scene.json [more scenes...] [--scenes n]
+
+#define SERVER_MAX_CLIENTS 64
+#define SERVER_MAX_QUEUE 256
+#define SERVER_REQUEST_LINE 8192
+#define SERVER_MAX_TOKENS 32
+
+//a scene kept in memory between requests, reloaded when its file changes
+typedef struct ResidentScene{
+    char path[4096];
+    struct timespec mtime;
+    flattenedScene* fscene; //NULL for a free entry
+    long last_used;
+} ResidentScene;
+
+typedef struct Client{
+    int fd; //-1 for a free entry
+    long serial; //tells a client from a later one that got the same entry
+    char line[SERVER_REQUEST_LINE];
+    int used;
+} Client;
+
+typedef struct QueuedRequest{
+    int client;
+    long serial;
+    char* line;
+    struct timespec queued;
+} QueuedRequest;
+
+typedef struct RenderServer{
+    int listen_fd;
+    int tcp;
+    OpenclContext* opencl_context; //its fscene is the scene on the device, NULL once that one was dropped
+    cl_command_queue queue;
+    ResidentScene* scenes;
+    int num_scenes;
+    long uses;
+    Client clients[SERVER_MAX_CLIENTS];
+    long next_serial;
+    QueuedRequest requests[SERVER_MAX_QUEUE];
+    int first_request;
+    int num_requests;
+    float* pixels;
+    uint8_t* rgb;
+    ToneMapper* tone_mapper;
+} RenderServer;
+
+volatile sig_atomic_t server_running = 1;
+
+void stop_server(int signal_number){
+    (void)signal_number;
+    server_running = 0;
+}
+
+void close_client(RenderServer* server, int c){
+    close(server->clients[c].fd);
+    server->clients[c].fd = -1;
+}
+
+//the client that sent the request, -1 if it is gone
+int request_client(RenderServer* server, QueuedRequest* request){
+    Client* client = &server->clients[request->client];
+    return client->fd >= 0 && client->serial == request->serial ? request->client : -1;
+}
+
+void reply_error(RenderServer* server, QueuedRequest* request, const char* format, ...){
+    char message[512];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(message, sizeof(message)-1, format, args);
+    va_end(args);
+    if(length < 0) length = 0;
+    if(length > (int)sizeof(message)-2) length = sizeof(message)-2;
+    printf("Request failed: %s\n", message);
+
+    int c = request_client(server, request);
+    if(c < 0) return;
+    char reply[sizeof(message)+8];
+    int reply_length = snprintf(reply, sizeof(reply), "error %.*s\n", length, message);
+    if(!send_all(server->clients[c].fd, reply, reply_length)) close_client(server, c);
+}
+
+void drop_scene(RenderServer* server, ResidentScene* scene){
+    if(server->opencl_context != NULL && server->opencl_context->fscene == scene->fscene) server->opencl_context->fscene = NULL;
+    destroy_flattened_scene(scene->fscene);
+    scene->fscene = NULL;
+}
+
+//the scene of path, loaded if it is not resident or its file changed since. when every entry is taken the one
+//used the longest ago makes room. NULL if the file cannot be loaded
+ResidentScene* get_scene(RenderServer* server, char* path){
+    struct stat info;
+    if(stat(path, &info) != 0) return NULL;
+
+    ResidentScene* scene = NULL;
+    for(int s = 0; s < server->num_scenes && scene == NULL; s++){
+        if(server->scenes[s].fscene != NULL && !strcmp(server->scenes[s].path, path)) scene = &server->scenes[s];
+    }
+    if(scene != NULL && (scene->mtime.tv_sec != info.st_mtim.tv_sec || scene->mtime.tv_nsec != info.st_mtim.tv_nsec)){
+        printf("%s changed, loading it again\n", path);
+        drop_scene(server, scene);
+    }
+    if(scene == NULL){
+        scene = &server->scenes[0];
+        for(int s = 0; s < server->num_scenes; s++){
+            if(server->scenes[s].fscene == NULL){
+                scene = &server->scenes[s];
+                break;
+            }
+            if(server->scenes[s].last_used < scene->last_used) scene = &server->scenes[s];
+        }
+        if(scene->fscene != NULL) drop_scene(server, scene);
+    }
+
+    if(scene->fscene == NULL){
+        scene->fscene = load_flattened_scene(path);
+        if(scene->fscene == NULL) return NULL;
+        snprintf(scene->path, sizeof(scene->path), "%s", path);
+        scene->mtime = info.st_mtim;
+    }
+    scene->last_used = ++server->uses;
+    return scene;
+}
+
+//renders one request and sends the answer
+void handle_request(RenderServer* server, QueuedRequest* request){
+    //a client that left does not need its renders anymore
+    if(request_client(server, request) < 0) return;
+
+    char* argv[SERVER_MAX_TOKENS+1];
+    int argc = 0;
+    for(char* token = strtok(request->line, " \t\r"); token != NULL; token = strtok(NULL, " \t\r")){
+        if(argc == SERVER_MAX_TOKENS){
+            reply_error(server, request, "too many arguments");
+            return;
+        }
+        argv[argc++] = token;
+    }
+    argv[argc] = NULL;
+    if(argc == 0) return;
+
+    char* camera_option = take_option(&argc, argv, "--camera");
+    char* size_option = take_option(&argc, argv, "--size");
+    char* tile_option = take_option(&argc, argv, "--tile");
+    char* samples_option = take_option(&argc, argv, "--samples");
+    char* format_option = take_option(&argc, argv, "--format");
+    char* output_option = take_option(&argc, argv, "--output");
+    ToneSettings tone;
+    int tone_valid = take_tone_options(&argc, argv, &tone);
+    if(strcmp(argv[0], "render") || argc != 2){
+        reply_error(server, request, "expected render scene.json [--camera x,y,z,yaw,pitch] [--size WxH] [--tile x,y,w,h] [--samples 1-4] [--format ppm|pam|png|jpg|rgb] [--output file] [--tonemap clamp|reinhard|filmic] [--exposure f] [--srgb] [--dither]");
+        return;
+    }
+
+    int width = WIDTH; int height = HEIGHT;
+    if(size_option != NULL && !parse_size(size_option, &width, &height)){
+        reply_error(server, request, "--size takes WxH");
+        return;
+    }
+    //a tile of a bigger image is rendered alone, with the plane cut down to it
+    int tile_x = 0; int tile_y = 0;
+    int image_width = width; int image_height = height;
+    if(tile_option != NULL){
+        if(sscanf(tile_option, "%d,%d,%d,%d", &tile_x, &tile_y, &width, &height) != 4 || tile_x < 0 || tile_y < 0 || width < 1 || height < 1 ||
+            tile_x+width > image_width || tile_y+height > image_height){
+            reply_error(server, request, "--tile takes x,y,w,h inside the --size image");
+            return;
+        }
+    }
+    //the frame is rendered in the buffers of a WIDTH x HEIGHT one
+    if((long)width*height > (long)WIDTH*HEIGHT){
+        reply_error(server, request, "an image can have at most %d pixels", WIDTH*HEIGHT);
+        return;
+    }
+    int samples = samples_option ? atoi(samples_option) : 4;
+    if(samples < 1 || samples > 4){
+        reply_error(server, request, "--samples goes from 1 to 4");
+        return;
+    }
+    if(!tone_valid){
+        reply_error(server, request, "--tonemap is clamp, reinhard or filmic and --exposure a number above 0");
+        return;
+    }
+    FrameFormat format = FRAME_PNG;
+    if(format_option != NULL && (!parse_frame_format(format_option, &format) || format == FRAME_Y4M)){
+        reply_error(server, request, "unknown format %s, use ppm, pam, png, jpg or rgb", format_option);
+        return;
+    }
+    CameraPose pose;
+    if(camera_option != NULL && sscanf(camera_option, "%f,%f,%f,%f,%f", &pose.position[0], &pose.position[1], &pose.position[2], &pose.yaw, &pose.pitch) != 5){
+        reply_error(server, request, "--camera takes x,y,z,yaw,pitch");
+        return;
+    }
+
+    ResidentScene* scene = get_scene(server, argv[1]);
+    if(scene == NULL){
+        reply_error(server, request, "could not load %s", argv[1]);
+        return;
+    }
+    OpenclContext* opencl_context = server->opencl_context;
+    flattenedScene* fscene = scene->fscene;
+    if(opencl_context->fscene != fscene){
+        upload_opencl_scene(opencl_context, server->queue, fscene);
+        opencl_context->fscene = fscene;
+    }
+
+    //the scene plane is relative to the camera, its first corner holds the half sizes
+    float camera[3];
+    float plane[12];
+    if(camera_option != NULL){
+        apply_camera_pose(&pose, fscene->plane[0], fscene->plane[1], camera, plane);
+    }else{
+        memcpy(camera, fscene->camera, sizeof(camera));
+        for(int corner = 0; corner < 4; corner++){
+            plane[corner*3] = fscene->plane[corner*3]+camera[0];
+            plane[corner*3+1] = fscene->plane[corner*3+1]+camera[1];
+            plane[corner*3+2] = fscene->plane[corner*3+2]+camera[2]+1;
+        }
+    }
+    if(tile_option != NULL){
+        float full_plane[12];
+        memcpy(full_plane, plane, sizeof(plane));
+        tile_plane(full_plane, tile_x, tile_y, width, height, image_width, image_height, plane);
+    }
+    cl_int err = clEnqueueWriteBuffer(server->queue, opencl_context->camera, CL_TRUE, 0, sizeof(float)*3, camera, 0, NULL, NULL);
+    if(err == CL_SUCCESS) err = clEnqueueWriteBuffer(server->queue, opencl_context->plane, CL_TRUE, 0, sizeof(float)*12, plane, 0, NULL, NULL);
+    if (err != CL_SUCCESS) {
+        printf("Error executing queued command: %d\n", err);
+        exit(1);
+    }
+    render_opencl_frame(opencl_context, server->queue, server->pixels, width, height, samples);
+    //dithered from the corner of the whole image, so the tiles of one line up
+    server->tone_mapper->settings = tone;
+    ToneJob job = {server->pixels, samples, (long)width*height*3, width, height, server->rgb, width*3, TONE_RGB8, tile_x, tile_y, 0};
+    tone_map_frame(server->tone_mapper, &job);
+
+    size_t size;
+    uint8_t* image = encode_image(format, server->rgb, width, height, &size);
+    if(image == NULL){
+        reply_error(server, request, "could not encode the image");
+        return;
+    }
+    if(output_option != NULL){
+        FILE* file = fopen(output_option, "wb");
+        int written = file != NULL && fwrite(image, 1, size, file) == size;
+        if(file != NULL && fclose(file) != 0) written = 0;
+        free(image);
+        if(!written){
+            reply_error(server, request, "could not write %s", output_option);
+            return;
+        }
+        image = NULL;
+        size = 0;
+    }
+
+    int c = request_client(server, request);
+    char header[64];
+    int header_size = snprintf(header, sizeof(header), "ok %zu\n", size);
+    if(!send_all(server->clients[c].fd, header, header_size) || (size > 0 && !send_all(server->clients[c].fd, image, size))) close_client(server, c);
+    free(image);
+
+    printf("Rendered %s %dx%d, %d samples, in %.1f ms since it was queued\n", argv[1], width, height, samples, elapsed_seconds(&request->queued)*1000);
+}
+
+//reads what a client sent, every full line goes into the queue. 0 if the client is gone
+int read_client(RenderServer* server, int c){
+    Client* client = &server->clients[c];
+    ssize_t received = recv(client->fd, client->line+client->used, sizeof(client->line)-1-client->used, 0);
+    if(received < 0 && errno == EINTR) return 1;
+    if(received <= 0) return 0;
+    client->used += received;
+
+    char* start = client->line;
+    char* end;
+    while((end = memchr(start, '\n', client->line+client->used-start)) != NULL){
+        *end = '\0';
+        QueuedRequest request = {c, client->serial, strdup(start), {0, 0}};
+        clock_gettime(CLOCK_MONOTONIC, &request.queued);
+        start = end+1;
+        if(server->num_requests == SERVER_MAX_QUEUE){
+            reply_error(server, &request, "the queue is full");
+            free(request.line);
+            continue;
+        }
+        server->requests[(server->first_request+server->num_requests) % SERVER_MAX_QUEUE] = request;
+        server->num_requests++;
+    }
+    client->used -= start-client->line;
+    memmove(client->line, start, client->used);
+    if(client->used == (int)sizeof(client->line)-1){
+        printf("A request is longer than %d bytes, closing its connection\n", SERVER_REQUEST_LINE-1);
+        return 0;
+    }
+    return 1;
+}
+
+//waits for new clients and requests, only blocks when nothing is queued
+void poll_clients(RenderServer* server){
+    struct pollfd fds[SERVER_MAX_CLIENTS+1];
+    int client_index[SERVER_MAX_CLIENTS+1];
+    int num_fds = 0;
+    fds[num_fds].fd = server->listen_fd;
+    fds[num_fds++].events = POLLIN;
+    for(int c = 0; c < SERVER_MAX_CLIENTS; c++){
+        if(server->clients[c].fd < 0) continue;
+        client_index[num_fds] = c;
+        fds[num_fds].fd = server->clients[c].fd;
+        fds[num_fds++].events = POLLIN;
+    }
+
+    if(poll(fds, num_fds, server->num_requests > 0 ? 0 : -1) <= 0) return;
+
+    for(int f = 1; f < num_fds; f++){
+        if(fds[f].revents == 0) continue;
+        int c = client_index[f];
+        if(!read_client(server, c)) close_client(server, c);
+    }
+    if(fds[0].revents & POLLIN){
+        int fd = accept(server->listen_fd, NULL, NULL);
+        if(fd < 0) return;
+        int c = 0;
+        while(c < SERVER_MAX_CLIENTS && server->clients[c].fd >= 0) c++;
+        if(c == SERVER_MAX_CLIENTS){
+            const char* busy = "error too many clients\n";
+            send_all(fd, busy, strlen(busy));
+            close(fd);
+            return;
+        }
+        if(server->tcp){
+            int no_delay = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+        }
+        server->clients[c].fd = fd;
+        server->clients[c].serial = ++server->next_serial;
+        server->clients[c].used = 0;
+    }
+}
+
+int main(int argc, char* argv[]){
+    char* scenes_option = take_option(&argc, argv, "--scenes");
+    if(argc < 4){
+        printf("Usage: ./render_server socket|port postprocess.txt scene.json [more scenes...] [--scenes n]\n");
+        exit(2);
+    }
+    int num_scenes = scenes_option ? atoi(scenes_option) : 8;
+    if(num_scenes < argc-3) num_scenes = argc-3;
+
+    RenderServer* server = (RenderServer*)calloc(1, sizeof(RenderServer));
+    server->num_scenes = num_scenes;
+    server->scenes = (ResidentScene*)calloc(num_scenes, sizeof(ResidentScene));
+    for(int c = 0; c < SERVER_MAX_CLIENTS; c++) server->clients[c].fd = -1;
+
+    //the first scene is the one the context starts with, the rest are only loaded
+    ResidentScene* first = get_scene(server, argv[3]);
+    if(first == NULL){
+        printf("Error: Could not load the scene\n");
+        exit(1);
+    }
+    for(int s = 4; s < argc; s++){
+        if(get_scene(server, argv[s]) == NULL) printf("Skipping %s\n", argv[s]);
+    }
+    server->opencl_context = init_opencl(first->fscene, argv[2], "postprocess");
+    set_kernel_arg(server->opencl_context->post_processing_kernel, 0, sizeof(cl_mem), &server->opencl_context->pixelcolors);
+    server->queue = clCreateCommandQueueWithProperties(server->opencl_context->context, server->opencl_context->devices, NULL, NULL);
+    server->pixels = (float*)malloc(sizeof(float)*WIDTH*HEIGHT*3*4);
+    server->rgb = (uint8_t*)malloc((size_t)WIDTH*HEIGHT*3);
+    server->tone_mapper = create_tone_mapper(default_tone_settings());
+
+    server->listen_fd = listen_address(argv[1]);
+    server->tcp = is_port_address(argv[1]);
+    if(server->listen_fd < 0) exit(1);
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stop_server;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+    printf("Listening on %s\n", argv[1]);
+    fflush(stdout);
+
+    long served = 0;
+    while(server_running){
+        poll_clients(server);
+        if(server->num_requests == 0) continue;
+
+        QueuedRequest request = server->requests[server->first_request];
+        server->first_request = (server->first_request+1) % SERVER_MAX_QUEUE;
+        server->num_requests--;
+        handle_request(server, &request);
+        free(request.line);
+        served++;
+        fflush(stdout);
+    }
+    printf("Stopping after %ld requests\n", served);
+
+    close(server->listen_fd);
+    if(!server->tcp) unlink(argv[1]);
+    for(int c = 0; c < SERVER_MAX_CLIENTS; c++){
+        if(server->clients[c].fd >= 0) close(server->clients[c].fd);
+    }
+    for(int r = 0; r < server->num_requests; r++) free(server->requests[(server->first_request+r) % SERVER_MAX_QUEUE].line);
+    //the context only points at one of the resident scenes, they are all destroyed here
+    server->opencl_context->fscene = NULL;
+    for(int s = 0; s < server->num_scenes; s++){
+        if(server->scenes[s].fscene != NULL) destroy_flattened_scene(server->scenes[s].fscene);
+    }
+    destroy_openclcontext(server->opencl_context);
+    clReleaseCommandQueue(server->queue);
+    free(server->scenes);
+    free(server->pixels);
+    free(server->rgb);
+    destroy_tone_mapper(server->tone_mapper);
+    free(server);
+    return 0;
+}
@@ -0,0 +1,133 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include "utils.h"
+#include "frame_ring.h"
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "frame_writer.h"
+
+//a consumer of the shared memory ring of ./main --shm name: reads the frames in place and writes them out with
+//the frame writer, as a video stream by default. it is also the example for consumers in other programs
+//usage: ./ring_record name output [--frames n] [--format y4m|rgb|ppm|pam|png|jpg] [--fps n] [--latest] [--idle s]
+
+volatile sig_atomic_t stopping = 0;
+
+void stop_recording(int signal_number){
+    (void)signal_number;
+    stopping = 1;
+}
+
+void sleep_ms(int ms){
+    struct timespec pause = {ms/1000, (ms%1000)*1000000L};
+    nanosleep(&pause, NULL);
+}
+
+//rows of 0xAARRGGBB pixels to the rgb the frame writer takes
+void argb_to_rgb(const uint8_t* pixels, int stride, uint8_t* rgb, int width, int height){
+    for(int y = 0; y < height; y++){
+        const uint32_t* row = (const uint32_t*)(pixels+(size_t)y*stride);
+        uint8_t* out = rgb+(size_t)y*width*3;
+        for(int x = 0; x < width; x++){
+            uint32_t pixel = row[x];
+            out[x*3] = (pixel >> 16) & 0xff;
+            out[x*3+1] = (pixel >> 8) & 0xff;
+            out[x*3+2] = pixel & 0xff;
+        }
+    }
+}
+
+int main(int argc, char* argv[]){
+    char* frames_option = take_option(&argc, argv, "--frames");
+    char* format_option = take_option(&argc, argv, "--format");
+    char* fps_option = take_option(&argc, argv, "--fps");
+    char* idle_option = take_option(&argc, argv, "--idle");
+    //only the newest frame each time, for consumers slower than the renderer that would rather skip than lag
+    int latest = take_flag(&argc, argv, "--latest");
+    if(argc < 3){
+        printf("Usage: ./ring_record name output [--frames n] [--format y4m|rgb|ppm|pam|png|jpg] [--fps n] [--latest] [--idle s]\n");
+        exit(2);
+    }
+    FrameFormat format = FRAME_Y4M;
+    if(format_option != NULL && !parse_frame_format(format_option, &format)){
+        printf("Unknown format %s, use y4m, rgb, ppm, pam, png or jpg\n", format_option);
+        exit(2);
+    }
+    int max_frames = frames_option ? atoi(frames_option) : 0; //0 records until the renderer goes quiet
+    int fps = fps_option ? atoi(fps_option) : 30;
+    if(fps < 1) fps = 30;
+    //no new frame for this long ends the recording, the renderer closed or stopped moving
+    double idle_seconds = idle_option ? atof(idle_option) : 2;
+
+    signal(SIGINT, stop_recording);
+    signal(SIGTERM, stop_recording);
+
+    //the renderer may still be starting
+    FrameRing* ring = NULL;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while(!stopping && (ring = open_frame_ring(argv[1])) == NULL && elapsed_seconds(&start) < idle_seconds) sleep_ms(10);
+    if(ring == NULL){
+        printf("No frame ring named %s\n", argv[1]);
+        exit(1);
+    }
+    if(ring->header->format != FRAME_RING_ARGB8888){
+        printf("Unknown pixel format %u in %s\n", ring->header->format, ring->name);
+        destroy_frame_ring(ring);
+        exit(1);
+    }
+
+    //the output takes the size of the first frame, frames at another size (the live mode lowering its
+    //resolution while moving) are skipped
+    FrameWriter* writer = NULL;
+    int width = 0; int height = 0;
+    int recorded = 0;
+    int skipped = 0;
+    uint64_t first_sequence = 0;
+    uint64_t last_sequence = 0;
+    struct timespec last_frame;
+    clock_gettime(CLOCK_MONOTONIC, &last_frame);
+    while(!stopping && (max_frames == 0 || recorded < max_frames)){
+        FrameRingSlot* slot = frame_ring_acquire(ring, latest);
+        if(slot == NULL){
+            if(elapsed_seconds(&last_frame) >= idle_seconds) break;
+            sleep_ms(1);
+            continue;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &last_frame);
+
+        if(writer == NULL){
+            width = slot->width;
+            height = slot->height;
+            first_sequence = slot->sequence;
+            writer = create_frame_writer(format, argv[2], width, height, fps);
+            if(writer == NULL){
+                destroy_frame_ring(ring);
+                exit(1);
+            }
+        }
+        if((int)slot->width != width || (int)slot->height != height){
+            skipped++;
+            frame_ring_release(ring);
+            continue;
+        }
+        uint8_t* rgb = frame_writer_next(writer);
+        if(rgb == NULL){
+            frame_ring_release(ring);
+            break;
+        }
+        argb_to_rgb(frame_ring_pixels(slot), slot->stride, rgb, width, height);
+        last_sequence = slot->sequence;
+        frame_ring_release(ring);
+        frame_writer_submit(writer);
+        recorded++;
+    }
+
+    //gaps in the sequence are frames the renderer had no slot for, or that --latest passed over
+    unsigned long long offered = recorded > 0 ? last_sequence-first_sequence+1 : 0;
+    printf("Recorded %d frames of %dx%d, %llu rendered meanwhile, %d at another size skipped, %llu dropped by the renderer\n", recorded, width, height, offered, skipped, (unsigned long long)atomic_load(&ring->header->dropped));
+    int ok = writer == NULL || destroy_frame_writer(writer);
+    destroy_frame_ring(ring);
+    return ok ? 0 : 1;
+}
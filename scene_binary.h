@@ -0,0 +1,218 @@
+#ifndef SCENE_BINARY_H
+#define SCENE_BINARY_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "vector.h"
+
+//binary scene files: a header followed by one section per flattenedScene array, in the same layout the
+//opencl buffers use, so loading is a mmap and a few pointer assignments. the lights and the plain spheres are
+//stored already sorted for their bvhs, which are stored too. numbers are written in the machine's byte order
+
+#define SCENE_BINARY_MAGIC "3DRSCENE"
+#define SCENE_BINARY_VERSION 4 //2: material table instead of per sphere materials, 3: groups and instances, 4: sphere bvh
+#define SCENE_BINARY_ALIGNMENT 64 //every section starts on a cache line
+
+enum SceneSection{
+    SECTION_OBJECTPOS,
+    SECTION_OBJECTRADIUS,
+    SECTION_OBJECTCOLOR,
+    SECTION_OBJECTMATERIAL,
+    SECTION_MATERIALAMBIENT,
+    SECTION_MATERIALDIFFUSE,
+    SECTION_MATERIALSPECULAR,
+    SECTION_MATERIALREFLECTIVITY,
+    SECTION_MATERIALALBEDO,
+    SECTION_LIGHTPOS,
+    SECTION_LIGHTDIFFUSE,
+    SECTION_LIGHTSPECULAR,
+    SECTION_LIGHTRANGE,
+    SECTION_LIGHTBVHBOUNDS,
+    SECTION_LIGHTBVHNODES,
+    SECTION_INSTANCETRANSFORM,
+    SECTION_INSTANCERANGES,
+    SECTION_INSTANCEBOUNDS,
+    SECTION_OBJECTBVHBOUNDS,
+    SECTION_OBJECTBVHNODES,
+    SCENE_SECTION_COUNT
+};
+
+typedef struct SceneBinaryHeader{
+    char magic[8];
+    uint32_t version;
+    uint32_t num_objects;
+    uint32_t num_lights;
+    uint32_t num_global_lights;
+    uint32_t num_light_nodes;
+    uint32_t num_materials;
+    uint32_t num_group_objects;
+    uint32_t num_instances;
+    uint32_t num_object_nodes;
+    uint32_t section_count;
+    float camera[3];
+    float plane[12];
+    float ALI[3];
+    uint64_t offsets[SCENE_SECTION_COUNT]; //from the start of the file
+    uint64_t sizes[SCENE_SECTION_COUNT]; //in bytes
+} SceneBinaryHeader;
+
+//pointer to each section array of the scene and its size in bytes, the scene needs its lightbvh and objectbvh
+void scene_sections(flattenedScene* fscene, void** pointers[SCENE_SECTION_COUNT], uint64_t sizes[SCENE_SECTION_COUNT]){
+    uint64_t objects = (uint64_t)fscene->num_objects+fscene->num_group_objects;
+    uint64_t lights = fscene->num_lights;
+    uint64_t nodes = fscene->lightbvh->num_nodes;
+    uint64_t materials = fscene->num_materials;
+    uint64_t instances = fscene->num_instances;
+    uint64_t object_nodes = fscene->objectbvh->num_nodes;
+
+    pointers[SECTION_OBJECTPOS] = (void**)&fscene->objectpos; sizes[SECTION_OBJECTPOS] = sizeof(float)*objects*3;
+    pointers[SECTION_OBJECTRADIUS] = (void**)&fscene->objectradius; sizes[SECTION_OBJECTRADIUS] = sizeof(float)*objects;
+    pointers[SECTION_OBJECTCOLOR] = (void**)&fscene->objectcolor; sizes[SECTION_OBJECTCOLOR] = sizeof(float)*objects*3;
+    pointers[SECTION_OBJECTMATERIAL] = (void**)&fscene->objectmaterial; sizes[SECTION_OBJECTMATERIAL] = sizeof(int)*objects;
+    pointers[SECTION_MATERIALAMBIENT] = (void**)&fscene->materialambient; sizes[SECTION_MATERIALAMBIENT] = sizeof(float)*materials*3;
+    pointers[SECTION_MATERIALDIFFUSE] = (void**)&fscene->materialdiffuse; sizes[SECTION_MATERIALDIFFUSE] = sizeof(float)*materials*3;
+    pointers[SECTION_MATERIALSPECULAR] = (void**)&fscene->materialspecular; sizes[SECTION_MATERIALSPECULAR] = sizeof(float)*materials*3;
+    pointers[SECTION_MATERIALREFLECTIVITY] = (void**)&fscene->materialreflectivity; sizes[SECTION_MATERIALREFLECTIVITY] = sizeof(float)*materials*3;
+    pointers[SECTION_MATERIALALBEDO] = (void**)&fscene->materialalbedo; sizes[SECTION_MATERIALALBEDO] = sizeof(float)*materials;
+    pointers[SECTION_LIGHTPOS] = (void**)&fscene->lightpos; sizes[SECTION_LIGHTPOS] = sizeof(float)*lights*3;
+    pointers[SECTION_LIGHTDIFFUSE] = (void**)&fscene->lightdiffuse; sizes[SECTION_LIGHTDIFFUSE] = sizeof(float)*lights*3;
+    pointers[SECTION_LIGHTSPECULAR] = (void**)&fscene->lightspecular; sizes[SECTION_LIGHTSPECULAR] = sizeof(float)*lights*3;
+    pointers[SECTION_LIGHTRANGE] = (void**)&fscene->lightrange; sizes[SECTION_LIGHTRANGE] = sizeof(float)*lights;
+    pointers[SECTION_LIGHTBVHBOUNDS] = (void**)&fscene->lightbvh->bounds; sizes[SECTION_LIGHTBVHBOUNDS] = sizeof(float)*nodes*6;
+    pointers[SECTION_LIGHTBVHNODES] = (void**)&fscene->lightbvh->nodes; sizes[SECTION_LIGHTBVHNODES] = sizeof(int)*nodes*2;
+    pointers[SECTION_INSTANCETRANSFORM] = (void**)&fscene->instancetransform; sizes[SECTION_INSTANCETRANSFORM] = sizeof(float)*instances*4;
+    pointers[SECTION_INSTANCERANGES] = (void**)&fscene->instanceranges; sizes[SECTION_INSTANCERANGES] = sizeof(int)*instances*3;
+    pointers[SECTION_INSTANCEBOUNDS] = (void**)&fscene->instancebounds; sizes[SECTION_INSTANCEBOUNDS] = sizeof(float)*instances*4;
+    pointers[SECTION_OBJECTBVHBOUNDS] = (void**)&fscene->objectbvh->bounds; sizes[SECTION_OBJECTBVHBOUNDS] = sizeof(float)*object_nodes*6;
+    pointers[SECTION_OBJECTBVHNODES] = (void**)&fscene->objectbvh->nodes; sizes[SECTION_OBJECTBVHNODES] = sizeof(int)*object_nodes*2;
+}
+
+uint64_t align_offset(uint64_t offset){
+    return (offset+SCENE_BINARY_ALIGNMENT-1)/SCENE_BINARY_ALIGNMENT*SCENE_BINARY_ALIGNMENT;
+}
+
+int is_binary_scene(char* file_path){
+    char magic[8];
+    FILE* file = fopen(file_path, "rb");
+    if(file == NULL) return 0;
+    size_t read = fread(magic, 1, 8, file);
+    fclose(file);
+    return read == 8 && !memcmp(magic, SCENE_BINARY_MAGIC, 8);
+}
+
+//fscene must have its bvhs built (see build_flattened_light_bvh and build_flattened_object_bvh), returns 0 on errors
+int write_binary_scene(flattenedScene* fscene, char* file_path){
+    FILE* file = fopen(file_path, "wb");
+    if(file == NULL){
+        printf("Could not open %s for writing\n", file_path);
+        return 0;
+    }
+
+    SceneBinaryHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SCENE_BINARY_MAGIC, 8);
+    header.version = SCENE_BINARY_VERSION;
+    header.num_objects = fscene->num_objects;
+    header.num_lights = fscene->num_lights;
+    header.num_global_lights = fscene->num_global_lights;
+    header.num_light_nodes = fscene->lightbvh->num_nodes;
+    header.num_materials = fscene->num_materials;
+    header.num_group_objects = fscene->num_group_objects;
+    header.num_instances = fscene->num_instances;
+    header.num_object_nodes = fscene->objectbvh->num_nodes;
+    header.section_count = SCENE_SECTION_COUNT;
+    memcpy(header.camera, fscene->camera, sizeof(header.camera));
+    memcpy(header.plane, fscene->plane, sizeof(header.plane));
+    memcpy(header.ALI, fscene->ALI, sizeof(header.ALI));
+
+    void** pointers[SCENE_SECTION_COUNT];
+    scene_sections(fscene, pointers, header.sizes);
+    uint64_t offset = align_offset(sizeof(header));
+    for(int i = 0; i < SCENE_SECTION_COUNT; i++){
+        header.offsets[i] = offset;
+        offset = align_offset(offset+header.sizes[i]);
+    }
+
+    int ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    static const char padding[SCENE_BINARY_ALIGNMENT] = {0};
+    uint64_t position = sizeof(header);
+    for(int i = 0; i < SCENE_SECTION_COUNT && ok; i++){
+        ok = fwrite(padding, 1, header.offsets[i]-position, file) == header.offsets[i]-position;
+        if(ok && header.sizes[i] > 0) ok = fwrite(*pointers[i], 1, header.sizes[i], file) == header.sizes[i];
+        position = header.offsets[i]+header.sizes[i];
+    }
+
+    if(fclose(file) != 0) ok = 0;
+    if(!ok) printf("Error writing %s\n", file_path);
+    return ok;
+}
+
+//maps a binary scene, the arrays of the returned scene point into the file mapping (copy on write, so
+//moving things around does not touch the file) and destroy_flattened_scene unmaps it. NULL on errors
+flattenedScene* map_binary_scene(char* file_path){
+    int fd = open(file_path, O_RDONLY);
+    if(fd < 0){
+        printf("Could not open file\n");
+        return NULL;
+    }
+    struct stat info;
+    if(fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(SceneBinaryHeader)){
+        printf("Error: %s is too small to be a binary scene\n", file_path);
+        close(fd);
+        return NULL;
+    }
+
+    size_t size = info.st_size;
+    char* mapping = (char*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(mapping == MAP_FAILED){
+        printf("Error mapping %s\n", file_path);
+        return NULL;
+    }
+
+    SceneBinaryHeader* header = (SceneBinaryHeader*)mapping;
+    if(memcmp(header->magic, SCENE_BINARY_MAGIC, 8) || header->version != SCENE_BINARY_VERSION || header->section_count != SCENE_SECTION_COUNT){
+        printf("Error: %s is not a version %d binary scene\n", file_path, SCENE_BINARY_VERSION);
+        munmap(mapping, size);
+        return NULL;
+    }
+
+    flattenedScene* fscene = (flattenedScene*)malloc(sizeof(flattenedScene));
+    memset(fscene, 0, sizeof(flattenedScene));
+    fscene->mapping = mapping;
+    fscene->mapping_size = size;
+    fscene->num_objects = header->num_objects;
+    fscene->num_lights = header->num_lights;
+    fscene->num_global_lights = header->num_global_lights;
+    fscene->num_materials = header->num_materials;
+    fscene->num_group_objects = header->num_group_objects;
+    fscene->num_instances = header->num_instances;
+    memcpy(fscene->camera, header->camera, sizeof(fscene->camera));
+    memcpy(fscene->plane, header->plane, sizeof(fscene->plane));
+    memcpy(fscene->ALI, header->ALI, sizeof(fscene->ALI));
+    fscene->lightbvh = (SphereBVH*)malloc(sizeof(SphereBVH));
+    fscene->lightbvh->num_nodes = header->num_light_nodes;
+    fscene->objectbvh = (SphereBVH*)malloc(sizeof(SphereBVH));
+    fscene->objectbvh->num_nodes = header->num_object_nodes;
+
+    void** pointers[SCENE_SECTION_COUNT];
+    uint64_t sizes[SCENE_SECTION_COUNT];
+    scene_sections(fscene, pointers, sizes);
+    for(int i = 0; i < SCENE_SECTION_COUNT; i++){
+        if(sizes[i] != header->sizes[i] || header->offsets[i] % SCENE_BINARY_ALIGNMENT != 0 || header->offsets[i]+sizes[i] > size){
+            printf("Error: section %d of %s is corrupted\n", i, file_path);
+            destroy_flattened_scene(fscene);
+            return NULL;
+        }
+        *pointers[i] = mapping+header->offsets[i];
+    }
+
+    return fscene;
+}
+
+#endif
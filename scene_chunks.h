@@ -0,0 +1,451 @@
+#ifndef SCENE_CHUNKS_H
+#define SCENE_CHUNKS_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "vector.h"
+
+//chunked scene files, for scenes with more spheres than fit in memory. the spheres are split in space into
+//chunks of a few thousand, every chunk is stored on its own pages with its bounds and a small bvh, so a
+//renderer can map the file and only keep the chunks it is working with resident (see ChunkCache).
+//instances are expanded into plain spheres when the file is written, the lights and materials are small
+//and always resident. numbers are written in the machine's byte order
+
+#define SCENE_CHUNKS_MAGIC "3DRCHUNK"
+#define SCENE_CHUNKS_VERSION 1
+#define SCENE_CHUNKS_ALIGNMENT 4096 //every chunk starts on a page, so it can be brought in and dropped alone
+#define CHUNK_SPHERES 4096 //default spheres per chunk
+
+typedef struct SceneChunksHeader{
+    char magic[8];
+    uint32_t version;
+    uint32_t num_chunks;
+    uint64_t num_spheres;
+    uint32_t num_lights;
+    uint32_t num_global_lights;
+    uint32_t num_materials;
+    uint32_t padding;
+    float camera[3];
+    float plane[12];
+    float ALI[3];
+    uint64_t chunks_offset; //the SceneChunk table
+    uint64_t lights_offset; //lightpos, lightdiffuse, lightspecular (3 floats per light) and lightrange, one after the other
+    uint64_t materials_offset; //ambient, diffuse, specular, reflectivity (3 floats per material) and albedo
+} SceneChunksHeader;
+
+typedef struct SceneChunk{
+    float bounds[6]; //min x, y, z then max x, y, z of every sphere in the chunk
+    uint32_t num_spheres;
+    uint32_t num_nodes;
+    uint64_t first_id; //the spheres of the chunk are first_id .. first_id+num_spheres-1 in the whole scene
+    uint64_t offset; //from the start of the file, see chunk_arrays for the layout
+    uint64_t size; //in bytes, a multiple of the alignment
+} SceneChunk;
+
+//the arrays of one chunk, they point into the file mapping
+typedef struct ChunkArrays{
+    float* pos; //3 floats per sphere
+    float* radius;
+    float* color; //3 floats per sphere
+    int* material;
+    float* bounds; //bvh of the chunk, same layout as SphereBVH, leaves refer to the sphere order above
+    int* nodes;
+} ChunkArrays;
+
+typedef struct ChunkedScene{
+    char* mapping;
+    size_t mapping_size;
+    int fd; //kept open to drop evicted chunks from the page cache too
+    SceneChunksHeader* header;
+    SceneChunk* chunks;
+    float* lightpos;
+    float* lightdiffuse;
+    float* lightspecular;
+    float* lightrange;
+    float* materialambient;
+    float* materialdiffuse;
+    float* materialspecular;
+    float* materialreflectivity;
+    float* materialalbedo;
+} ChunkedScene;
+
+uint64_t chunk_data_size(uint64_t spheres, uint64_t nodes){
+    return spheres*(sizeof(float)*7+sizeof(int)) + nodes*(sizeof(float)*6+sizeof(int)*2);
+}
+
+uint64_t align_chunk(uint64_t offset){
+    return (offset+SCENE_CHUNKS_ALIGNMENT-1)/SCENE_CHUNKS_ALIGNMENT*SCENE_CHUNKS_ALIGNMENT;
+}
+
+void chunk_arrays(char* data, uint64_t spheres, uint64_t nodes, ChunkArrays* arrays){
+    arrays->pos = (float*)data;
+    arrays->radius = arrays->pos+spheres*3;
+    arrays->color = arrays->radius+spheres;
+    arrays->material = (int*)(arrays->color+spheres*3);
+    arrays->bounds = (float*)(arrays->material+spheres);
+    arrays->nodes = (int*)(arrays->bounds+nodes*6);
+}
+
+void mapped_chunk_arrays(ChunkedScene* cscene, int chunk, ChunkArrays* arrays){
+    SceneChunk* c = &cscene->chunks[chunk];
+    chunk_arrays(cscene->mapping+c->offset, c->num_spheres, c->num_nodes, arrays);
+}
+
+int is_chunked_scene(char* file_path){
+    char magic[8];
+    FILE* file = fopen(file_path, "rb");
+    if(file == NULL) return 0;
+    size_t read = fread(magic, 1, 8, file);
+    fclose(file);
+    return read == 8 && !memcmp(magic, SCENE_CHUNKS_MAGIC, 8);
+}
+
+//splits items (the plain spheres and the instances, an instance is never split) by the median of their
+//centers until a chunk has at most chunk_spheres spheres, leaves get (first, count) pairs into order
+void split_chunk_items(float* centers, int* weights, int* order, int first, int count, int chunk_spheres, int** leaves, int* num_leaves, int* capacity){
+    long weight = 0;
+    for(int i = first; i < first+count; i++) weight += weights[order[i]];
+
+    if(weight <= chunk_spheres || count == 1){
+        if(*num_leaves == *capacity){
+            *capacity *= 2;
+            *leaves = (int*)realloc(*leaves, sizeof(int)*2*(*capacity));
+        }
+        (*leaves)[*num_leaves*2] = first;
+        (*leaves)[*num_leaves*2+1] = count;
+        (*num_leaves)++;
+        return;
+    }
+
+    float cmin[3] = {INFINITY, INFINITY, INFINITY};
+    float cmax[3] = {-INFINITY, -INFINITY, -INFINITY};
+    for(int i = first; i < first+count; i++){
+        for(int k = 0; k < 3; k++){
+            cmin[k] = fminf(cmin[k], centers[order[i]*3+k]);
+            cmax[k] = fmaxf(cmax[k], centers[order[i]*3+k]);
+        }
+    }
+    int axis = 0;
+    if(cmax[1]-cmin[1] > cmax[axis]-cmin[axis]) axis = 1;
+    if(cmax[2]-cmin[2] > cmax[axis]-cmin[axis]) axis = 2;
+
+    int half = count/2;
+    partition_spheres(centers, order, first, first+count-1, first+half, axis);
+    split_chunk_items(centers, weights, order, first, half, chunk_spheres, leaves, num_leaves, capacity);
+    split_chunk_items(centers, weights, order, first+half, count-half, chunk_spheres, leaves, num_leaves, capacity);
+}
+
+//fscene must have its light bvh built (see build_flattened_light_bvh), the lights are stored in that order.
+//only one chunk is expanded in memory at a time, so a scene made of instances can be written much bigger
+//than it would be loaded. returns 0 on errors
+int write_chunked_scene(flattenedScene* fscene, char* file_path, int chunk_spheres){
+    FILE* file = fopen(file_path, "wb");
+    if(file == NULL){
+        printf("Could not open %s for writing\n", file_path);
+        return 0;
+    }
+    if(chunk_spheres < 1) chunk_spheres = CHUNK_SPHERES;
+
+    int num_items = fscene->num_objects+fscene->num_instances;
+    float* centers = (float*)malloc(sizeof(float)*3*(num_items+1));
+    int* weights = (int*)malloc(sizeof(int)*(num_items+1));
+    int* order = (int*)malloc(sizeof(int)*(num_items+1));
+    for(int i = 0; i < fscene->num_objects; i++){
+        memcpy(&centers[i*3], &fscene->objectpos[i*3], sizeof(float)*3);
+        weights[i] = 1;
+    }
+    for(int k = 0; k < fscene->num_instances; k++){
+        memcpy(&centers[(fscene->num_objects+k)*3], &fscene->instancebounds[k*4], sizeof(float)*3);
+        weights[fscene->num_objects+k] = fscene->instanceranges[k*3+1];
+    }
+    for(int i = 0; i < num_items; i++) order[i] = i;
+
+    int capacity = 64;
+    int num_leaves = 0;
+    int* leaves = (int*)malloc(sizeof(int)*2*capacity);
+    if(num_items > 0) split_chunk_items(centers, weights, order, 0, num_items, chunk_spheres, &leaves, &num_leaves, &capacity);
+
+    SceneChunksHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SCENE_CHUNKS_MAGIC, 8);
+    header.version = SCENE_CHUNKS_VERSION;
+    header.num_chunks = num_leaves;
+    header.num_lights = fscene->num_lights;
+    header.num_global_lights = fscene->num_global_lights;
+    header.num_materials = fscene->num_materials;
+    memcpy(header.camera, fscene->camera, sizeof(header.camera));
+    memcpy(header.plane, fscene->plane, sizeof(header.plane));
+    memcpy(header.ALI, fscene->ALI, sizeof(header.ALI));
+    header.chunks_offset = sizeof(header);
+    header.lights_offset = header.chunks_offset+sizeof(SceneChunk)*num_leaves;
+    header.materials_offset = header.lights_offset+sizeof(float)*10*fscene->num_lights;
+    uint64_t offset = align_chunk(header.materials_offset+sizeof(float)*13*fscene->num_materials);
+
+    //the table is written again at the end, once the chunk sizes are known
+    SceneChunk* chunks = (SceneChunk*)calloc(num_leaves+1, sizeof(SceneChunk));
+    int ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    if(ok && num_leaves > 0) ok = fwrite(chunks, sizeof(SceneChunk), num_leaves, file) == (size_t)num_leaves;
+    int lights = fscene->num_lights;
+    int materials = fscene->num_materials;
+    if(ok && lights > 0){
+        ok = fwrite(fscene->lightpos, sizeof(float)*3, lights, file) == (size_t)lights &&
+            fwrite(fscene->lightdiffuse, sizeof(float)*3, lights, file) == (size_t)lights &&
+            fwrite(fscene->lightspecular, sizeof(float)*3, lights, file) == (size_t)lights &&
+            fwrite(fscene->lightrange, sizeof(float), lights, file) == (size_t)lights;
+    }
+    if(ok && materials > 0){
+        ok = fwrite(fscene->materialambient, sizeof(float)*3, materials, file) == (size_t)materials &&
+            fwrite(fscene->materialdiffuse, sizeof(float)*3, materials, file) == (size_t)materials &&
+            fwrite(fscene->materialspecular, sizeof(float)*3, materials, file) == (size_t)materials &&
+            fwrite(fscene->materialreflectivity, sizeof(float)*3, materials, file) == (size_t)materials &&
+            fwrite(fscene->materialalbedo, sizeof(float), materials, file) == (size_t)materials;
+    }
+
+    uint64_t next_id = 0;
+    for(int c = 0; c < num_leaves && ok; c++){
+        int first = leaves[c*2];
+        int count = leaves[c*2+1];
+        int spheres = 0;
+        for(int i = first; i < first+count; i++) spheres += weights[order[i]];
+
+        float* pos = (float*)malloc(sizeof(float)*3*spheres);
+        float* radius = (float*)malloc(sizeof(float)*spheres);
+        float* color = (float*)malloc(sizeof(float)*3*spheres);
+        int* material = (int*)malloc(sizeof(int)*spheres);
+        int s = 0;
+        for(int i = first; i < first+count; i++){
+            int item = order[i];
+            if(item < fscene->num_objects){
+                memcpy(&pos[s*3], &fscene->objectpos[item*3], sizeof(float)*3);
+                radius[s] = fscene->objectradius[item];
+                memcpy(&color[s*3], &fscene->objectcolor[item*3], sizeof(float)*3);
+                material[s] = fscene->objectmaterial[item];
+                s++;
+                continue;
+            }
+            //same transform the kernel applies to the ray, the other way around
+            float* transform = &fscene->instancetransform[(item-fscene->num_objects)*4];
+            int* range = &fscene->instanceranges[(item-fscene->num_objects)*3];
+            for(int j = range[0]; j < range[0]+range[1]; j++){
+                for(int k = 0; k < 3; k++) pos[s*3+k] = fscene->objectpos[j*3+k]*transform[3]+transform[k];
+                radius[s] = fscene->objectradius[j]*transform[3];
+                memcpy(&color[s*3], &fscene->objectcolor[j*3], sizeof(float)*3);
+                material[s] = fscene->objectmaterial[j];
+                s++;
+            }
+        }
+
+        int* sphere_order = (int*)malloc(sizeof(int)*spheres);
+        SphereBVH* bvh = build_sphere_bvh(pos, radius, sphere_order, spheres);
+        permute_floats(pos, sphere_order, spheres, 3);
+        permute_floats(radius, sphere_order, spheres, 1);
+        permute_floats(color, sphere_order, spheres, 3);
+        permute_ints(material, sphere_order, spheres, 1);
+
+        SceneChunk* chunk = &chunks[c];
+        memcpy(chunk->bounds, bvh->bounds, sizeof(chunk->bounds));
+        chunk->num_spheres = spheres;
+        chunk->num_nodes = bvh->num_nodes;
+        chunk->first_id = next_id;
+        chunk->offset = offset;
+        chunk->size = align_chunk(chunk_data_size(spheres, bvh->num_nodes));
+        next_id += spheres;
+
+        ok = fseek(file, offset, SEEK_SET) == 0 &&
+            fwrite(pos, sizeof(float)*3, spheres, file) == (size_t)spheres &&
+            fwrite(radius, sizeof(float), spheres, file) == (size_t)spheres &&
+            fwrite(color, sizeof(float)*3, spheres, file) == (size_t)spheres &&
+            fwrite(material, sizeof(int), spheres, file) == (size_t)spheres &&
+            fwrite(bvh->bounds, sizeof(float)*6, bvh->num_nodes, file) == (size_t)bvh->num_nodes &&
+            fwrite(bvh->nodes, sizeof(int)*2, bvh->num_nodes, file) == (size_t)bvh->num_nodes;
+        offset += chunk->size;
+
+        destroy_sphere_bvh(bvh);
+        free(sphere_order);
+        free(pos);
+        free(radius);
+        free(color);
+        free(material);
+    }
+
+    //the last chunk is padded to the alignment too, the mapping can then drop whole pages of it
+    header.num_spheres = next_id;
+    if(ok) ok = fflush(file) == 0 && ftruncate(fileno(file), offset) == 0;
+    if(ok) ok = fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1;
+    if(ok && num_leaves > 0) ok = fwrite(chunks, sizeof(SceneChunk), num_leaves, file) == (size_t)num_leaves;
+
+    if(fclose(file) != 0) ok = 0;
+    if(!ok) printf("Error writing %s\n", file_path);
+    else printf("Chunked %lu spheres into %d chunks of up to %d, %.1f MB\n", (unsigned long)next_id, num_leaves, chunk_spheres, offset/1e6);
+
+    free(chunks);
+    free(leaves);
+    free(order);
+    free(weights);
+    free(centers);
+    return ok;
+}
+
+//maps a chunked scene without reading any chunk, they are paged in when used. NULL on errors
+ChunkedScene* map_chunked_scene(char* file_path){
+    int fd = open(file_path, O_RDONLY);
+    if(fd < 0){
+        printf("Could not open file\n");
+        return NULL;
+    }
+    struct stat info;
+    if(fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(SceneChunksHeader)){
+        printf("Error: %s is too small to be a chunked scene\n", file_path);
+        close(fd);
+        return NULL;
+    }
+
+    size_t size = info.st_size;
+    char* mapping = (char*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(mapping == MAP_FAILED){
+        printf("Error mapping %s\n", file_path);
+        close(fd);
+        return NULL;
+    }
+    //no read ahead, a fault should only bring in the pages of the chunk being used
+    madvise(mapping, size, MADV_RANDOM);
+
+    SceneChunksHeader* header = (SceneChunksHeader*)mapping;
+    int valid = !memcmp(header->magic, SCENE_CHUNKS_MAGIC, 8) && header->version == SCENE_CHUNKS_VERSION;
+    if(valid){
+        valid = header->chunks_offset+sizeof(SceneChunk)*header->num_chunks <= size &&
+            header->lights_offset+sizeof(float)*10*header->num_lights <= size &&
+            header->materials_offset+sizeof(float)*13*header->num_materials <= size;
+    }
+    if(!valid){
+        printf("Error: %s is not a version %d chunked scene\n", file_path, SCENE_CHUNKS_VERSION);
+        munmap(mapping, size);
+        close(fd);
+        return NULL;
+    }
+    SceneChunk* chunks = (SceneChunk*)(mapping+header->chunks_offset);
+    for(uint32_t c = 0; c < header->num_chunks; c++){
+        if(chunks[c].offset % SCENE_CHUNKS_ALIGNMENT != 0 || chunks[c].offset+chunks[c].size > size ||
+            chunk_data_size(chunks[c].num_spheres, chunks[c].num_nodes) > chunks[c].size){
+            printf("Error: chunk %u of %s is corrupted\n", c, file_path);
+            munmap(mapping, size);
+            close(fd);
+            return NULL;
+        }
+    }
+
+    ChunkedScene* cscene = (ChunkedScene*)malloc(sizeof(ChunkedScene));
+    cscene->mapping = mapping;
+    cscene->mapping_size = size;
+    cscene->fd = fd;
+    cscene->header = header;
+    cscene->chunks = chunks;
+    int lights = header->num_lights;
+    cscene->lightpos = (float*)(mapping+header->lights_offset);
+    cscene->lightdiffuse = cscene->lightpos+lights*3;
+    cscene->lightspecular = cscene->lightdiffuse+lights*3;
+    cscene->lightrange = cscene->lightspecular+lights*3;
+    int materials = header->num_materials;
+    cscene->materialambient = (float*)(mapping+header->materials_offset);
+    cscene->materialdiffuse = cscene->materialambient+materials*3;
+    cscene->materialspecular = cscene->materialdiffuse+materials*3;
+    cscene->materialreflectivity = cscene->materialspecular+materials*3;
+    cscene->materialalbedo = cscene->materialreflectivity+materials*3;
+
+    return cscene;
+}
+
+void destroy_chunked_scene(ChunkedScene* cscene){
+    munmap(cscene->mapping, cscene->mapping_size);
+    close(cscene->fd);
+
+    free(cscene);
+    return;
+}
+
+//keeps at most budget bytes of chunks resident, the least recently used ones are dropped first.
+//dropping a chunk releases its pages from the mapping and from the page cache, so the budget bounds the
+//memory the scene really takes and every load after that is real I/O
+typedef struct ChunkCache{
+    ChunkedScene* cscene;
+    size_t budget;
+    size_t resident_bytes;
+    size_t peak_bytes;
+    char* resident; //per chunk
+    uint64_t* last_use; //per chunk, value of clock when it was last acquired
+    uint64_t clock;
+    long loads;
+    uint64_t bytes_loaded;
+} ChunkCache;
+
+ChunkCache* create_chunk_cache(ChunkedScene* cscene, size_t budget){
+    ChunkCache* cache;
+    cache = (ChunkCache*)malloc(sizeof(ChunkCache));
+
+    int chunks = cscene->header->num_chunks;
+    cache->cscene = cscene;
+    cache->budget = budget;
+    cache->resident_bytes = 0;
+    cache->peak_bytes = 0;
+    cache->resident = (char*)calloc(chunks+1, 1);
+    cache->last_use = (uint64_t*)calloc(chunks+1, sizeof(uint64_t));
+    cache->clock = 0;
+    cache->loads = 0;
+    cache->bytes_loaded = 0;
+
+    //start cold, chunks left in the page cache by an earlier run would not cost any I/O
+    posix_fadvise(cscene->fd, 0, 0, POSIX_FADV_DONTNEED);
+
+    return cache;
+}
+
+void evict_chunk(ChunkCache* cache, int chunk){
+    SceneChunk* c = &cache->cscene->chunks[chunk];
+    madvise(cache->cscene->mapping+c->offset, c->size, MADV_DONTNEED);
+    posix_fadvise(cache->cscene->fd, c->offset, c->size, POSIX_FADV_DONTNEED);
+    cache->resident[chunk] = 0;
+    cache->resident_bytes -= c->size;
+}
+
+//makes the chunk resident, evicting others if the budget is full, and returns its arrays.
+//a chunk bigger than the whole budget is still loaded, alone
+void acquire_chunk(ChunkCache* cache, int chunk, ChunkArrays* arrays){
+    ChunkedScene* cscene = cache->cscene;
+    SceneChunk* c = &cscene->chunks[chunk];
+    cache->last_use[chunk] = ++cache->clock;
+    mapped_chunk_arrays(cscene, chunk, arrays);
+    if(cache->resident[chunk]) return;
+
+    while(cache->resident_bytes+c->size > cache->budget && cache->resident_bytes > 0){
+        int oldest = -1;
+        for(uint32_t i = 0; i < cscene->header->num_chunks; i++){
+            if(cache->resident[i] && (oldest == -1 || cache->last_use[i] < cache->last_use[oldest])) oldest = i;
+        }
+        evict_chunk(cache, oldest);
+    }
+
+    madvise(cscene->mapping+c->offset, c->size, MADV_WILLNEED);
+    cache->resident[chunk] = 1;
+    cache->resident_bytes += c->size;
+    if(cache->resident_bytes > cache->peak_bytes) cache->peak_bytes = cache->resident_bytes;
+    cache->loads++;
+    cache->bytes_loaded += c->size;
+}
+
+void destroy_chunk_cache(ChunkCache* cache){
+    for(uint32_t i = 0; i < cache->cscene->header->num_chunks; i++){
+        if(cache->resident[i]) evict_chunk(cache, i);
+    }
+    free(cache->resident);
+    free(cache->last_use);
+
+    free(cache);
+    return;
+}
+
+#endif
@@ -0,0 +1,29 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "vector.h"
+#include "utils.h"
+
+//converts a json scene to the binary format main and image can mmap, usage: ./scene_convert scene.json scene.bin
+//with --chunks n it writes a chunked scene of n spheres per chunk instead, for chunk_render
+int main(int argc, char* argv[]){
+    char* chunks_option = take_option(&argc, argv, "--chunks");
+    if(argc != 3){
+        printf("Usage: %s <input scene.json> <output scene.bin> [--chunks spheres per chunk]\n", argv[0]);
+        exit(2);
+    }
+
+    flattenedScene* fscene = load_flattened_scene(argv[1]);
+    if(fscene == NULL){
+        printf("Error: Could not load the scene\n");
+        exit(1);
+    }
+
+    int ok;
+    if(chunks_option != NULL) ok = write_chunked_scene(fscene, argv[2], atoi(chunks_option));
+    else ok = write_binary_scene(fscene, argv[2]);
+    if(!ok) exit(1);
+    printf("Wrote %s\n", argv[2]);
+
+    destroy_flattened_scene(fscene);
+    return 0;
+}
@@ -0,0 +1,320 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+#include "vector.h"
+#include "utils.h"
+
+//procedural scenes for scaling and stress tests, same seed same scene on every machine
+//usage: ./scene_gen <uniform|clustered|grid|shells|beads> <spheres> <lights> <output.json|output.bin> [--seed n] [--light-range r]
+
+#define MATERIAL_PRESETS 4
+
+//ambient, diffuse, specular, reflectivity, albedo
+const float material_presets[MATERIAL_PRESETS][5] = {
+    {0.4, 0.4, 0.1, 0.5, 1},
+    {0.3, 0.7, 0.2, 0.1, 4},
+    {0.2, 0.3, 0.8, 0.8, 16},
+    {0.5, 0.5, 0.0, 0.0, 1},
+};
+
+//xorshift, rand() changes between platforms
+uint32_t rng_state;
+
+uint32_t next_random(){
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+float random_range(float min, float max){
+    return min + (max-min)*(next_random()/4294967296.0f);
+}
+
+//box muller, standard deviation 1
+float random_gaussian(){
+    float u = random_range(1e-7f, 1);
+    float v = random_range(0, 1);
+    return sqrtf(-2*logf(u))*cosf(2*M_PI*v);
+}
+
+const char* material_names[MATERIAL_PRESETS] = {"plastic", "matte", "mirror", "chalk"};
+
+//the presets are the first entries of the material table, in order
+void add_material_presets(flattenedScene* fscene){
+    MaterialTable table;
+    init_material_table(&table, fscene);
+    for(int p = 0; p < MATERIAL_PRESETS; p++){
+        const float* m = material_presets[p];
+        float values[MATERIAL_FLOATS] = {m[0], m[0], m[0], m[1], m[1], m[1], m[2], m[2], m[2], m[3], m[3], m[3], m[4]};
+        add_material(&table, values);
+    }
+    free_material_table(&table);
+}
+
+void set_sphere(flattenedScene* fscene, int i, float x, float y, float z, float radius){
+    fscene->objectpos[i*3] = x;
+    fscene->objectpos[i*3+1] = y;
+    fscene->objectpos[i*3+2] = z;
+    fscene->objectradius[i] = radius;
+    fscene->objectcolor[i*3] = random_range(0, 1);
+    fscene->objectcolor[i*3+1] = random_range(0, 1);
+    fscene->objectcolor[i*3+2] = random_range(0, 1);
+    fscene->objectmaterial[i] = next_random() % MATERIAL_PRESETS;
+}
+
+//the spheres fill a cube of half size extent centered at distance, which the default camera sees whole
+void generate_uniform(flattenedScene* fscene, float extent, float distance, float spacing){
+    for(int i = 0; i < fscene->num_objects; i++){
+        set_sphere(fscene, i, random_range(-extent, extent), random_range(-extent, extent)*0.66f, distance+random_range(-extent, extent),
+            spacing*random_range(0.15f, 0.35f));
+    }
+}
+
+void generate_grid(flattenedScene* fscene, float extent, float distance){
+    int side = (int)ceilf(cbrtf(fscene->num_objects));
+    float step = 2*extent/side;
+    for(int i = 0; i < fscene->num_objects; i++){
+        int x = i % side;
+        int y = (i/side) % side;
+        int z = i/(side*side);
+        set_sphere(fscene, i, -extent+step*(x+0.5f), (-extent+step*(y+0.5f))*0.66f, distance-extent+step*(z+0.5f), step*0.3f);
+    }
+}
+
+//gaussian blobs of about 1000 spheres around random centers
+void generate_clustered(flattenedScene* fscene, float extent, float distance, float spacing){
+    int num_clusters = fscene->num_objects/1000+1;
+    float* centers = (float*)malloc(sizeof(float)*num_clusters*3);
+    for(int c = 0; c < num_clusters; c++){
+        centers[c*3] = random_range(-extent, extent)*0.8f;
+        centers[c*3+1] = random_range(-extent, extent)*0.5f;
+        centers[c*3+2] = distance+random_range(-extent, extent)*0.8f;
+    }
+
+    float sigma = extent/(2*cbrtf(num_clusters));
+    for(int i = 0; i < fscene->num_objects; i++){
+        int c = next_random() % num_clusters;
+        set_sphere(fscene, i, centers[c*3]+random_gaussian()*sigma, centers[c*3+1]+random_gaussian()*sigma,
+            centers[c*3+2]+random_gaussian()*sigma, spacing*random_range(0.1f, 0.25f));
+    }
+    free(centers);
+}
+
+//concentric shells of mirror spheres around the center, every shell gets spheres in proportion to its area
+void generate_shells(flattenedScene* fscene, float extent, float distance, float spacing){
+    int num_shells = (int)cbrtf(fscene->num_objects)/2+1;
+    float total_area = 0;
+    for(int s = 1; s <= num_shells; s++) total_area += s*s;
+
+    int i = 0;
+    for(int s = 1; s <= num_shells && i < fscene->num_objects; s++){
+        float shell_radius = extent*s/num_shells;
+        int count = s == num_shells ? fscene->num_objects-i : (int)((double)fscene->num_objects*s*s/total_area);
+        float sphere_radius = fminf(shell_radius*1.5f/sqrtf(count+1), spacing*0.5f);
+
+        //fibonacci sphere, evenly spread points
+        for(int k = 0; k < count; k++, i++){
+            float y = 1-2*(k+0.5f)/count;
+            float r = sqrtf(1-y*y);
+            float angle = k*2.39996323f;
+            set_sphere(fscene, i, cosf(angle)*r*shell_radius, y*shell_radius, distance+sinf(angle)*r*shell_radius, sphere_radius);
+            fscene->objectmaterial[i] = 2;
+        }
+    }
+}
+
+#define BEAD_SPHERES 16
+
+//rows of one bead cluster repeated through instances, the spheres are only stored once
+void generate_beads(flattenedScene* fscene, float extent, float distance, float spacing){
+    int num_instances = (fscene->num_objects+BEAD_SPHERES-1)/BEAD_SPHERES;
+    fscene->num_objects = 0;
+    fscene->num_group_objects = BEAD_SPHERES;
+    fscene->num_instances = num_instances;
+    fscene->instancetransform = (float*)malloc(sizeof(float)*num_instances*4);
+    fscene->instanceranges = (int*)malloc(sizeof(int)*num_instances*3);
+    fscene->instancebounds = (float*)malloc(sizeof(float)*num_instances*4);
+
+    //a ring of beads around a bigger one, about the size of one instance cell
+    set_sphere(fscene, 0, 0, 0, 0, spacing*0.25f);
+    for(int i = 1; i < BEAD_SPHERES; i++){
+        float angle = i*2*M_PI/(BEAD_SPHERES-1);
+        set_sphere(fscene, i, cosf(angle)*spacing*0.9f, sinf(angle)*spacing*0.9f, random_range(-0.2f, 0.2f)*spacing, spacing*0.15f);
+    }
+
+    float cell = 2.4f*spacing; //ring diameter plus a gap
+    int side = (int)ceilf(cbrtf(num_instances));
+    float step = 2*extent/side;
+    for(int i = 0; i < num_instances; i++){
+        int x = i % side;
+        int y = (i/side) % side;
+        int z = i/(side*side);
+        float* transform = &fscene->instancetransform[i*4];
+        transform[0] = -extent+step*(x+0.5f);
+        transform[1] = (-extent+step*(y+0.5f))*0.66f;
+        transform[2] = distance-extent+step*(z+0.5f);
+        transform[3] = step/cell*random_range(0.8f, 1.2f);
+        fscene->instanceranges[i*3] = 0;
+        fscene->instanceranges[i*3+1] = BEAD_SPHERES;
+    }
+    update_instances(fscene);
+}
+
+void generate_lights(flattenedScene* fscene, float extent, float distance, float range){
+    for(int i = 0; i < fscene->num_lights; i++){
+        fscene->lightpos[i*3] = random_range(-extent, extent);
+        fscene->lightpos[i*3+1] = random_range(-extent, extent)*0.66f;
+        fscene->lightpos[i*3+2] = distance+random_range(-extent, extent*0.5f);
+        //keep the total light about the same with any amount of lights
+        float diffuse = range > 0 ? 0.6f : 0.6f/sqrtf(fscene->num_lights);
+        for(int k = 0; k < 3; k++){
+            fscene->lightdiffuse[i*3+k] = diffuse;
+            fscene->lightspecular[i*3+k] = diffuse*0.3f;
+        }
+        fscene->lightrange[i] = range;
+    }
+    //one light without range so the whole scene is lit
+    if(fscene->num_lights > 0) fscene->lightrange[0] = 0;
+}
+
+void write_json_sphere(FILE* file, flattenedScene* fscene, int i, int last){
+    fprintf(file, "        {\"position\": [%g, %g, %g], \"radius\": %g, \"color_rgb\": [%d, %d, %d], \"material\": \"%s\"}%s\n",
+        fscene->objectpos[i*3], fscene->objectpos[i*3+1], fscene->objectpos[i*3+2], fscene->objectradius[i],
+        (int)(fscene->objectcolor[i*3]*255), (int)(fscene->objectcolor[i*3+1]*255), (int)(fscene->objectcolor[i*3+2]*255),
+        material_names[fscene->objectmaterial[i]], last ? "" : ",");
+}
+
+//groups are named after their first sphere, every distinct sphere range the instances use is one group
+void write_json_instances(FILE* file, flattenedScene* fscene){
+    char* written = (char*)calloc(fscene->num_objects+fscene->num_group_objects+1, 1);
+    int first_group = 1;
+    fprintf(file, "    \"groups\": {\n");
+    for(int i = 0; i < fscene->num_instances; i++){
+        int first = fscene->instanceranges[i*3];
+        int count = fscene->instanceranges[i*3+1];
+        if(written[first]) continue;
+        written[first] = 1;
+
+        fprintf(file, "%s        \"group%d\": [\n", first_group ? "" : ",\n", first);
+        for(int j = first; j < first+count; j++) write_json_sphere(file, fscene, j, j == first+count-1);
+        fprintf(file, "        ]");
+        first_group = 0;
+    }
+    fprintf(file, "\n    },\n");
+    free(written);
+
+    fprintf(file, "    \"instances\": [\n");
+    for(int i = 0; i < fscene->num_instances; i++){
+        float* transform = &fscene->instancetransform[i*4];
+        fprintf(file, "        {\"group\": \"group%d\", \"translation\": [%g, %g, %g], \"scale\": %g}%s\n", fscene->instanceranges[i*3],
+            transform[0], transform[1], transform[2], transform[3], i < fscene->num_instances-1 ? "," : "");
+    }
+    fprintf(file, "    ],\n");
+}
+
+int write_json_scene(flattenedScene* fscene, char* file_path){
+    FILE* file = fopen(file_path, "w");
+    if(file == NULL){
+        printf("Could not open %s for writing\n", file_path);
+        return 0;
+    }
+
+    fprintf(file, "{\n    \"camera\": [%g, %g, %g],\n", fscene->camera[0], fscene->camera[1], fscene->camera[2]);
+    fprintf(file, "    \"plane\": [%g, %g],\n", fscene->plane[0], fscene->plane[1]);
+    fprintf(file, "    \"ambient_light_intensity\": %g,\n", fscene->ALI[0]);
+
+    fprintf(file, "    \"materials\": {\n");
+    for(int p = 0; p < MATERIAL_PRESETS; p++){
+        const float* m = material_presets[p];
+        fprintf(file, "        \"%s\": {\"ambient\": %g, \"diffuse\": %g, \"specular\": %g, \"reflectivity\": %g, \"albedo\": %g}%s\n",
+            material_names[p], m[0], m[1], m[2], m[3], m[4], p < MATERIAL_PRESETS-1 ? "," : "");
+    }
+    fprintf(file, "    },\n");
+
+    if(fscene->num_instances > 0) write_json_instances(file, fscene);
+
+    fprintf(file, "    \"objects\": [\n");
+    for(int i = 0; i < fscene->num_objects; i++) write_json_sphere(file, fscene, i, i == fscene->num_objects-1);
+    fprintf(file, "    ],\n");
+
+    fprintf(file, "    \"lights\": [\n");
+    for(int i = 0; i < fscene->num_lights; i++){
+        fprintf(file, "        {\"position\": [%g, %g, %g], \"diffuse\": %g, \"specular\": %g, \"range\": %g}%s\n",
+            fscene->lightpos[i*3], fscene->lightpos[i*3+1], fscene->lightpos[i*3+2], fscene->lightdiffuse[i*3],
+            fscene->lightspecular[i*3], fscene->lightrange[i], i < fscene->num_lights-1 ? "," : "");
+    }
+    fprintf(file, "    ]\n}\n");
+
+    int ok = !ferror(file);
+    if(fclose(file) != 0) ok = 0;
+    if(!ok) printf("Error writing %s\n", file_path);
+    return ok;
+}
+
+int main(int argc, char* argv[]){
+    char* seed_option = take_option(&argc, argv, "--seed");
+    char* range_option = take_option(&argc, argv, "--light-range");
+    if(argc != 5){
+        printf("Usage: %s <uniform|clustered|grid|shells|beads> <spheres> <lights> <output.json|output.bin|output.chunks> [--seed n] [--light-range r]\n", argv[0]);
+        exit(2);
+    }
+
+    char* distribution = argv[1];
+    int num_objects = atoi(argv[2]);
+    int num_lights = atoi(argv[3]);
+    char* output = argv[4];
+    rng_state = seed_option ? (uint32_t)strtoul(seed_option, NULL, 10) : 1;
+    if(rng_state == 0) rng_state = 1; //xorshift gets stuck on 0
+    if(num_objects < 0 || num_lights < 0){
+        printf("The amounts of spheres and lights can not be negative\n");
+        exit(2);
+    }
+
+    //beads only stores one group of spheres, but it is never more than a few
+    flattenedScene* fscene = create_empty_flattened_scene((num_objects > BEAD_SPHERES ? num_objects : BEAD_SPHERES)+1, num_lights+1);
+    fscene->num_objects = num_objects;
+    fscene->num_lights = num_lights;
+    fscene->camera[2] = -1;
+    float corners[12] = {1, 0.66, 0, -1, 0.66, 0, 1, -0.66, 0, -1, -0.66, 0};
+    memcpy(fscene->plane, corners, sizeof(corners));
+    fscene->ALI[0] = fscene->ALI[1] = fscene->ALI[2] = 0.5;
+    add_material_presets(fscene);
+
+    //average distance between sphere centers stays around 4 units, the scene grows with the count
+    float spacing = 4;
+    float extent = spacing*cbrtf(num_objects+1)/2;
+    float distance = 2*extent+10;
+    float range = range_option ? atof(range_option) : 0;
+
+    if(!strcmp(distribution, "uniform")) generate_uniform(fscene, extent, distance, spacing);
+    else if(!strcmp(distribution, "clustered")) generate_clustered(fscene, extent, distance, spacing);
+    else if(!strcmp(distribution, "grid")) generate_grid(fscene, extent, distance);
+    else if(!strcmp(distribution, "shells")) generate_shells(fscene, extent, distance, spacing);
+    else if(!strcmp(distribution, "beads")) generate_beads(fscene, extent, distance, spacing);
+    else{
+        printf("Unknown distribution %s, use uniform, clustered, grid, shells or beads\n", distribution);
+        exit(2);
+    }
+    generate_lights(fscene, extent, distance, range);
+
+    int ok;
+    size_t length = strlen(output);
+    if(length > 4 && !strcmp(output+length-4, ".bin")){
+        build_flattened_light_bvh(fscene);
+        build_flattened_object_bvh(fscene);
+        ok = write_binary_scene(fscene, output);
+    }else if(length > 7 && !strcmp(output+length-7, ".chunks")){
+        build_flattened_light_bvh(fscene);
+        ok = write_chunked_scene(fscene, output, CHUNK_SPHERES);
+    }else{
+        ok = write_json_scene(fscene, output);
+    }
+    if(!ok) exit(1);
+    printf("Wrote %s: %s, %d spheres, %d lights\n", output, distribution, num_objects, num_lights);
+
+    destroy_flattened_scene(fscene);
+    return 0;
+}
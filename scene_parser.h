@@ -0,0 +1,816 @@
+#ifndef SCENE_PARSER_H
+#define SCENE_PARSER_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vector.h"
+
+//streaming json reader for the scene files, it never builds a tree: the file is read in chunks and every
+//number goes straight into the flattenedScene arrays. values can be the old "1, 2, 3" strings or plain
+//json numbers/arrays, so [1, 2, 3] and 10 work too. objects and lights can be a json object of named
+//spheres (like scene.json) or an array. materials are deduplicated into a table, spheres can also refer
+//to one declared in the top level "materials" object by its name. spheres declared in "groups" are stored
+//once and drawn through "instances", each one a translation and a uniform scale of a group
+
+#define SCENE_READER_CHUNK (1 << 20)
+#define SCENE_KEY_SIZE 64
+#define SCENE_NUMBER_SIZE 64
+#define MATERIAL_FLOATS 13 //ambient, diffuse, specular, reflectivity (3 each) and albedo
+
+//fills the material arrays of a flattened scene without repeating identical materials
+typedef struct MaterialTable{
+    flattenedScene* scene;
+    int capacity;
+    int* buckets; //hash of the values to material index, -1 when empty
+    int num_buckets;
+} MaterialTable;
+
+void init_material_table(MaterialTable* table, flattenedScene* scene){
+    table->scene = scene;
+    table->capacity = 0;
+    table->num_buckets = 64;
+    table->buckets = (int*)malloc(sizeof(int)*table->num_buckets);
+    memset(table->buckets, -1, sizeof(int)*table->num_buckets);
+}
+
+void free_material_table(MaterialTable* table){
+    free(table->buckets);
+}
+
+void get_material_values(flattenedScene* scene, int i, float* values){
+    memcpy(&values[0], &scene->materialambient[i*3], sizeof(float)*3);
+    memcpy(&values[3], &scene->materialdiffuse[i*3], sizeof(float)*3);
+    memcpy(&values[6], &scene->materialspecular[i*3], sizeof(float)*3);
+    memcpy(&values[9], &scene->materialreflectivity[i*3], sizeof(float)*3);
+    values[12] = scene->materialalbedo[i];
+}
+
+//fnv-1a over the bytes, identical materials have identical floats
+unsigned int hash_material(float* values){
+    unsigned int hash = 2166136261u;
+    unsigned char* bytes = (unsigned char*)values;
+    for(size_t i = 0; i < sizeof(float)*MATERIAL_FLOATS; i++){
+        hash ^= bytes[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+int find_material_bucket(MaterialTable* table, float* values){
+    float existing[MATERIAL_FLOATS];
+    int bucket = hash_material(values) & (table->num_buckets-1);
+    while(table->buckets[bucket] != -1){
+        get_material_values(table->scene, table->buckets[bucket], existing);
+        if(!memcmp(existing, values, sizeof(existing))) return bucket;
+        bucket = (bucket+1) & (table->num_buckets-1);
+    }
+    return bucket;
+}
+
+//index of the material with these values, added to the table if there is none yet
+int add_material(MaterialTable* table, float* values){
+    flattenedScene* scene = table->scene;
+    int bucket = find_material_bucket(table, values);
+    if(table->buckets[bucket] != -1) return table->buckets[bucket];
+
+    if(scene->num_materials == table->capacity){
+        int capacity = table->capacity > 0 ? table->capacity*2 : 8;
+        scene->materialambient = (float*)realloc(scene->materialambient, sizeof(float)*capacity*3);
+        scene->materialdiffuse = (float*)realloc(scene->materialdiffuse, sizeof(float)*capacity*3);
+        scene->materialspecular = (float*)realloc(scene->materialspecular, sizeof(float)*capacity*3);
+        scene->materialreflectivity = (float*)realloc(scene->materialreflectivity, sizeof(float)*capacity*3);
+        scene->materialalbedo = (float*)realloc(scene->materialalbedo, sizeof(float)*capacity);
+        table->capacity = capacity;
+    }
+
+    int i = scene->num_materials++;
+    memcpy(&scene->materialambient[i*3], &values[0], sizeof(float)*3);
+    memcpy(&scene->materialdiffuse[i*3], &values[3], sizeof(float)*3);
+    memcpy(&scene->materialspecular[i*3], &values[6], sizeof(float)*3);
+    memcpy(&scene->materialreflectivity[i*3], &values[9], sizeof(float)*3);
+    scene->materialalbedo[i] = values[12];
+    table->buckets[bucket] = i;
+
+    //keep the buckets at most half full
+    if(scene->num_materials*2 > table->num_buckets){
+        free(table->buckets);
+        table->num_buckets *= 2;
+        table->buckets = (int*)malloc(sizeof(int)*table->num_buckets);
+        memset(table->buckets, -1, sizeof(int)*table->num_buckets);
+        float existing[MATERIAL_FLOATS];
+        for(int m = 0; m < scene->num_materials; m++){
+            get_material_values(scene, m, existing);
+            table->buckets[find_material_bucket(table, existing)] = m;
+        }
+    }
+    return i;
+}
+
+//collision ids and world space bounding spheres of the instances, their transforms and sphere ranges have to be set
+void update_instances(flattenedScene* scene){
+    int id = scene->num_objects;
+    int cached_first = -1;
+    int cached_count = -1;
+    float center[3] = {0, 0, 0};
+    float radius = 0;
+    for(int i = 0; i < scene->num_instances; i++){
+        int first = scene->instanceranges[i*3];
+        int count = scene->instanceranges[i*3+1];
+        scene->instanceranges[i*3+2] = id;
+        id += count;
+
+        //instances of the same group usually come in a row, the group bounds are only computed once for them
+        if(first != cached_first || count != cached_count){
+            float bounds[6] = {INFINITY, INFINITY, INFINITY, -INFINITY, -INFINITY, -INFINITY};
+            for(int j = first; j < first+count; j++){
+                for(int k = 0; k < 3; k++){
+                    bounds[k] = fminf(bounds[k], scene->objectpos[j*3+k]-scene->objectradius[j]);
+                    bounds[k+3] = fmaxf(bounds[k+3], scene->objectpos[j*3+k]+scene->objectradius[j]);
+                }
+            }
+            radius = 0;
+            for(int k = 0; k < 3; k++) center[k] = count > 0 ? (bounds[k]+bounds[k+3])/2 : 0;
+            for(int j = first; j < first+count; j++){
+                float dx = scene->objectpos[j*3]-center[0];
+                float dy = scene->objectpos[j*3+1]-center[1];
+                float dz = scene->objectpos[j*3+2]-center[2];
+                radius = fmaxf(radius, sqrtf(dx*dx+dy*dy+dz*dz)+scene->objectradius[j]);
+            }
+            cached_first = first;
+            cached_count = count;
+        }
+
+        float* transform = &scene->instancetransform[i*4];
+        for(int k = 0; k < 3; k++) scene->instancebounds[i*4+k] = center[k]*transform[3]+transform[k];
+        scene->instancebounds[i*4+3] = radius*transform[3];
+    }
+}
+
+typedef struct SceneParser{
+    FILE* file; //NULL when parsing a string that is already in memory
+    char* buffer;
+    size_t length;
+    size_t pos;
+    long bytes; //bytes consumed before the current buffer
+    int line;
+    flattenedScene* scene;
+    int object_capacity;
+    int light_capacity;
+    MaterialTable materials;
+    char (*material_names)[SCENE_KEY_SIZE];
+    int* named_materials; //table index of each name
+    int num_named;
+    int named_capacity;
+    char (*group_names)[SCENE_KEY_SIZE];
+    int* group_ranges; //first sphere and sphere count of each group, in parse order until finish_groups
+    int num_groups;
+    int group_capacity;
+    int instance_capacity;
+} SceneParser;
+
+int parser_refill(SceneParser* parser){
+    if(parser->file == NULL) return 0;
+
+    parser->bytes += parser->length;
+    parser->length = fread(parser->buffer, 1, SCENE_READER_CHUNK, parser->file);
+    parser->pos = 0;
+    return parser->length > 0;
+}
+
+int parser_peek(SceneParser* parser){
+    if(parser->pos == parser->length && !parser_refill(parser)) return EOF;
+    return (unsigned char)parser->buffer[parser->pos];
+}
+
+int parser_next(SceneParser* parser){
+    int c = parser_peek(parser);
+    if(c == EOF) return EOF;
+    parser->pos++;
+    if(c == '\n') parser->line++;
+    return c;
+}
+
+void parser_error(SceneParser* parser, const char* message){
+    printf("Error parsing json: %s on line %d\n", message, parser->line);
+}
+
+//skips whitespace and returns the next character without consuming it
+int parser_skip_whitespace(SceneParser* parser){
+    int c = parser_peek(parser);
+    while(c == ' ' || c == '\n' || c == '\t' || c == '\r'){
+        parser_next(parser);
+        c = parser_peek(parser);
+    }
+    return c;
+}
+
+int parser_expect(SceneParser* parser, char expected){
+    if(parser_skip_whitespace(parser) != expected){
+        char message[32];
+        snprintf(message, sizeof(message), "expected '%c'", expected);
+        parser_error(parser, message);
+        return 0;
+    }
+    parser_next(parser);
+    return 1;
+}
+
+//reads a json string, anything past size-1 characters is dropped
+int parser_read_string(SceneParser* parser, char* out, int size){
+    if(!parser_expect(parser, '"')) return 0;
+
+    int length = 0;
+    int c = parser_next(parser);
+    while(c != '"'){
+        if(c == EOF){
+            parser_error(parser, "unterminated string");
+            return 0;
+        }
+        if(c == '\\') c = parser_next(parser);
+        if(length < size-1) out[length++] = c;
+        c = parser_next(parser);
+    }
+    out[length] = '\0';
+    return 1;
+}
+
+int is_number_char(int c){
+    return (c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E';
+}
+
+int parser_read_number(SceneParser* parser, float* out){
+    char number[SCENE_NUMBER_SIZE];
+    int length = 0;
+
+    parser_skip_whitespace(parser);
+    while(is_number_char(parser_peek(parser))){
+        int c = parser_next(parser);
+        if(length < SCENE_NUMBER_SIZE-1) number[length++] = c;
+    }
+    number[length] = '\0';
+
+    char* end;
+    *out = strtof(number, &end);
+    if(length == 0 || *end != '\0'){
+        parser_error(parser, "invalid number");
+        return 0;
+    }
+    return 1;
+}
+
+//the old format, "1, 2, 3", split on the commas while reading
+int parser_read_number_string(SceneParser* parser, float* out, int count){
+    char number[SCENE_NUMBER_SIZE];
+    int length = 0;
+    int found = 0;
+
+    parser_next(parser); //opening quote
+    while(1){
+        int c = parser_next(parser);
+        if(c == EOF){
+            parser_error(parser, "unterminated string");
+            return 0;
+        }
+        if(c == ',' || c == '"'){
+            number[length] = '\0';
+            char* end;
+            float value = strtof(number, &end);
+            while(*end == ' ') end++;
+            if(end == number || *end != '\0'){
+                parser_error(parser, "invalid number in string");
+                return 0;
+            }
+            if(found < count) out[found] = value;
+            found++;
+            length = 0;
+            if(c == '"') break;
+        }else if(c != ' ' || length > 0){
+            if(length < SCENE_NUMBER_SIZE-1) number[length++] = c;
+        }
+    }
+    return found;
+}
+
+//fills count floats from a number, an array of numbers or a legacy number string
+int parser_read_floats(SceneParser* parser, float* out, int count){
+    int c = parser_skip_whitespace(parser);
+    int found = 0;
+
+    if(c == '"'){
+        found = parser_read_number_string(parser, out, count);
+        if(found == 0) return 0;
+    }else if(c == '['){
+        parser_next(parser);
+        if(parser_skip_whitespace(parser) == ']'){
+            parser_next(parser);
+        }else{
+            while(1){
+                float value;
+                if(!parser_read_number(parser, &value)) return 0;
+                if(found < count) out[found] = value;
+                found++;
+
+                c = parser_skip_whitespace(parser);
+                parser_next(parser);
+                if(c == ']') break;
+                if(c != ','){
+                    parser_error(parser, "expected ',' or ']'");
+                    return 0;
+                }
+            }
+        }
+    }else{
+        if(!parser_read_number(parser, out)) return 0;
+        found = 1;
+    }
+
+    if(found < count){
+        parser_error(parser, "not enough values");
+        return 0;
+    }
+    return 1;
+}
+
+//for keys the renderer does not know about
+int parser_skip_value(SceneParser* parser){
+    int c = parser_skip_whitespace(parser);
+    if(c == '"'){
+        char ignored[1];
+        return parser_read_string(parser, ignored, 1);
+    }
+    if(c != '{' && c != '['){
+        //number, true, false or null
+        while(c != ',' && c != '}' && c != ']' && c != EOF){
+            parser_next(parser);
+            c = parser_peek(parser);
+        }
+        return 1;
+    }
+
+    int depth = 0;
+    do{
+        c = parser_next(parser);
+        if(c == '"'){
+            parser->pos--;
+            char ignored[1];
+            if(!parser_read_string(parser, ignored, 1)) return 0;
+        }
+        else if(c == '{' || c == '[') depth++;
+        else if(c == '}' || c == ']') depth--;
+        else if(c == EOF){
+            parser_error(parser, "unexpected end of file");
+            return 0;
+        }
+    }while(depth > 0);
+    return 1;
+}
+
+//after a member or element: 1 if there is another one, 0 at the closing character, -1 on errors
+int parser_continue(SceneParser* parser, char close){
+    int c = parser_skip_whitespace(parser);
+    parser_next(parser);
+    if(c == ',') return 1;
+    if(c == close) return 0;
+    parser_error(parser, close == '}' ? "expected ',' or '}'" : "expected ',' or ']'");
+    return -1;
+}
+
+//first member of a json object, 0 if the object is empty
+int parser_begin_object(SceneParser* parser){
+    if(!parser_expect(parser, '{')) return -1;
+    if(parser_skip_whitespace(parser) == '}'){
+        parser_next(parser);
+        return 0;
+    }
+    return 1;
+}
+
+int parser_read_key(SceneParser* parser, char* key){
+    if(!parser_read_string(parser, key, SCENE_KEY_SIZE)) return 0;
+    return parser_expect(parser, ':');
+}
+
+void parser_grow_objects(SceneParser* parser){
+    flattenedScene* scene = parser->scene;
+    if(scene->num_objects < parser->object_capacity) return;
+
+    int capacity = parser->object_capacity*2;
+    scene->objectpos = (float*)realloc(scene->objectpos, sizeof(float)*capacity*3);
+    scene->objectcolor = (float*)realloc(scene->objectcolor, sizeof(float)*capacity*3);
+    scene->objectradius = (float*)realloc(scene->objectradius, sizeof(float)*capacity);
+    scene->objectmaterial = (int*)realloc(scene->objectmaterial, sizeof(int)*capacity);
+    parser->object_capacity = capacity;
+}
+
+void parser_grow_lights(SceneParser* parser){
+    flattenedScene* scene = parser->scene;
+    if(scene->num_lights < parser->light_capacity) return;
+
+    int capacity = parser->light_capacity*2;
+    scene->lightpos = (float*)realloc(scene->lightpos, sizeof(float)*capacity*3);
+    scene->lightdiffuse = (float*)realloc(scene->lightdiffuse, sizeof(float)*capacity*3);
+    scene->lightspecular = (float*)realloc(scene->lightspecular, sizeof(float)*capacity*3);
+    scene->lightrange = (float*)realloc(scene->lightrange, sizeof(float)*capacity);
+    parser->light_capacity = capacity;
+}
+
+void parser_grow_instances(SceneParser* parser){
+    flattenedScene* scene = parser->scene;
+    if(scene->num_instances < parser->instance_capacity) return;
+
+    int capacity = parser->instance_capacity > 0 ? parser->instance_capacity*2 : 8;
+    scene->instancetransform = (float*)realloc(scene->instancetransform, sizeof(float)*capacity*4);
+    scene->instanceranges = (int*)realloc(scene->instanceranges, sizeof(int)*capacity*3);
+    scene->instancebounds = (float*)realloc(scene->instancebounds, sizeof(float)*capacity*4);
+    parser->instance_capacity = capacity;
+}
+
+//a single value used for the 3 channels, like the old create_material did
+int parser_read_gray(SceneParser* parser, float* out){
+    if(!parser_read_floats(parser, out, 1)) return 0;
+    out[1] = out[0];
+    out[2] = out[0];
+    return 1;
+}
+
+//a material object, out receives the table index
+int parse_material(SceneParser* parser, int* out){
+    char key[SCENE_KEY_SIZE];
+    float values[MATERIAL_FLOATS] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1};
+
+    int more = parser_begin_object(parser);
+    while(more > 0){
+        if(!parser_read_key(parser, key)) return 0;
+
+        int ok;
+        if(!strcmp(key, "ambient")) ok = parser_read_gray(parser, &values[0]);
+        else if(!strcmp(key, "diffuse")) ok = parser_read_gray(parser, &values[3]);
+        else if(!strcmp(key, "specular")) ok = parser_read_gray(parser, &values[6]);
+        else if(!strcmp(key, "reflectivity")) ok = parser_read_gray(parser, &values[9]);
+        else if(!strcmp(key, "albedo")) ok = parser_read_floats(parser, &values[12], 1);
+        else ok = parser_skip_value(parser);
+        if(!ok) return 0;
+
+        more = parser_continue(parser, '}');
+    }
+    if(more < 0) return 0;
+
+    *out = add_material(&parser->materials, values);
+    return 1;
+}
+
+//"materials": {"name": {...}, ...}, has to come before the objects that use the names
+int parse_named_materials(SceneParser* parser){
+    char key[SCENE_KEY_SIZE];
+
+    int more = parser_begin_object(parser);
+    while(more > 0){
+        if(!parser_read_key(parser, key)) return 0;
+
+        if(parser->num_named == parser->named_capacity){
+            parser->named_capacity = parser->named_capacity > 0 ? parser->named_capacity*2 : 8;
+            parser->material_names = realloc(parser->material_names, sizeof(*parser->material_names)*parser->named_capacity);
+            parser->named_materials = (int*)realloc(parser->named_materials, sizeof(int)*parser->named_capacity);
+        }
+        if(!parse_material(parser, &parser->named_materials[parser->num_named])) return 0;
+        strcpy(parser->material_names[parser->num_named], key);
+        parser->num_named++;
+
+        more = parser_continue(parser, '}');
+    }
+    return more == 0;
+}
+
+//"material" of a sphere, either a name or the material itself
+int parse_object_material(SceneParser* parser, int* out){
+    if(parser_skip_whitespace(parser) != '"') return parse_material(parser, out);
+
+    char name[SCENE_KEY_SIZE];
+    if(!parser_read_string(parser, name, SCENE_KEY_SIZE)) return 0;
+    for(int i = 0; i < parser->num_named; i++){
+        if(!strcmp(parser->material_names[i], name)){
+            *out = parser->named_materials[i];
+            return 1;
+        }
+    }
+    parser_error(parser, "unknown material name (the \"materials\" have to come before the objects)");
+    return 0;
+}
+
+int parse_object(SceneParser* parser){
+    parser_grow_objects(parser);
+    flattenedScene* scene = parser->scene;
+    int i = scene->num_objects;
+    char key[SCENE_KEY_SIZE];
+
+    for(int k = 0; k < 3; k++){
+        scene->objectpos[i*3+k] = 0;
+        scene->objectcolor[i*3+k] = 0;
+    }
+    scene->objectradius[i] = 1;
+    scene->objectmaterial[i] = -1;
+
+    int more = parser_begin_object(parser);
+    while(more > 0){
+        if(!parser_read_key(parser, key)) return 0;
+
+        int ok;
+        if(!strcmp(key, "position")) ok = parser_read_floats(parser, &scene->objectpos[i*3], 3);
+        else if(!strcmp(key, "radius")) ok = parser_read_floats(parser, &scene->objectradius[i], 1);
+        else if(!strcmp(key, "color_rgb")){
+            ok = parser_read_floats(parser, &scene->objectcolor[i*3], 3);
+            for(int k = 0; k < 3; k++) scene->objectcolor[i*3+k] /= 255;
+        }
+        else if(!strcmp(key, "material")) ok = parse_object_material(parser, &scene->objectmaterial[i]);
+        else ok = parser_skip_value(parser);
+        if(!ok) return 0;
+
+        more = parser_continue(parser, '}');
+    }
+    if(more < 0) return 0;
+
+    if(scene->objectmaterial[i] == -1){
+        //spheres without material get a black one
+        float values[MATERIAL_FLOATS] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1};
+        scene->objectmaterial[i] = add_material(&parser->materials, values);
+    }
+
+    scene->num_objects++;
+    return 1;
+}
+
+int parse_light(SceneParser* parser){
+    parser_grow_lights(parser);
+    flattenedScene* scene = parser->scene;
+    int i = scene->num_lights;
+    char key[SCENE_KEY_SIZE];
+
+    for(int k = 0; k < 3; k++){
+        scene->lightpos[i*3+k] = 0;
+        scene->lightdiffuse[i*3+k] = 0;
+        scene->lightspecular[i*3+k] = 0;
+    }
+    scene->lightrange[i] = 0;
+
+    int more = parser_begin_object(parser);
+    while(more > 0){
+        if(!parser_read_key(parser, key)) return 0;
+
+        int ok;
+        if(!strcmp(key, "position")) ok = parser_read_floats(parser, &scene->lightpos[i*3], 3);
+        else if(!strcmp(key, "diffuse")) ok = parser_read_gray(parser, &scene->lightdiffuse[i*3]);
+        else if(!strcmp(key, "specular")) ok = parser_read_gray(parser, &scene->lightspecular[i*3]);
+        else if(!strcmp(key, "range")) ok = parser_read_floats(parser, &scene->lightrange[i], 1);
+        else ok = parser_skip_value(parser);
+        if(!ok) return 0;
+
+        more = parser_continue(parser, '}');
+    }
+    if(more < 0) return 0;
+
+    scene->num_lights++;
+    return 1;
+}
+
+//"group": name, "translation": [x, y, z], "scale": s
+int parse_instance(SceneParser* parser){
+    parser_grow_instances(parser);
+    flattenedScene* scene = parser->scene;
+    int i = scene->num_instances;
+    char key[SCENE_KEY_SIZE];
+    char name[SCENE_KEY_SIZE];
+
+    float* transform = &scene->instancetransform[i*4];
+    transform[0] = transform[1] = transform[2] = 0;
+    transform[3] = 1;
+    int group = -1;
+
+    int more = parser_begin_object(parser);
+    while(more > 0){
+        if(!parser_read_key(parser, key)) return 0;
+
+        int ok;
+        if(!strcmp(key, "group")){
+            ok = parser_read_string(parser, name, SCENE_KEY_SIZE);
+            for(int g = 0; ok && g < parser->num_groups; g++){
+                if(!strcmp(parser->group_names[g], name)) group = g;
+            }
+            if(ok && group == -1){
+                parser_error(parser, "unknown group name (the \"groups\" have to come before the instances)");
+                return 0;
+            }
+        }
+        else if(!strcmp(key, "translation")) ok = parser_read_floats(parser, transform, 3);
+        else if(!strcmp(key, "scale")) ok = parser_read_floats(parser, &transform[3], 1);
+        else ok = parser_skip_value(parser);
+        if(!ok) return 0;
+
+        more = parser_continue(parser, '}');
+    }
+    if(more < 0) return 0;
+
+    if(group == -1){
+        parser_error(parser, "instance without a group");
+        return 0;
+    }
+    if(transform[3] <= 0){
+        parser_error(parser, "instance scale has to be positive");
+        return 0;
+    }
+    scene->instanceranges[i*3] = group; //replaced by the sphere range in finish_groups
+
+    scene->num_instances++;
+    return 1;
+}
+
+//"objects" and "lights": {"name": {...}, ...} or [{...}, ...]
+int parse_collection(SceneParser* parser, int (*parse_item)(SceneParser*)){
+    int c = parser_skip_whitespace(parser);
+    if(c != '{' && c != '['){
+        parser_error(parser, "expected an object or an array");
+        return 0;
+    }
+    char close = c == '{' ? '}' : ']';
+    parser_next(parser);
+    if(parser_skip_whitespace(parser) == close){
+        parser_next(parser);
+        return 1;
+    }
+
+    char key[SCENE_KEY_SIZE];
+    int more = 1;
+    while(more > 0){
+        if(close == '}' && !parser_read_key(parser, key)) return 0;
+        if(!parse_item(parser)) return 0;
+        more = parser_continue(parser, close);
+    }
+    return more == 0;
+}
+
+//"groups": {"name": [spheres], ...}, the spheres are parsed like the objects but only drawn by instances
+int parse_groups(SceneParser* parser){
+    char key[SCENE_KEY_SIZE];
+
+    int more = parser_begin_object(parser);
+    while(more > 0){
+        if(!parser_read_key(parser, key)) return 0;
+
+        if(parser->num_groups == parser->group_capacity){
+            parser->group_capacity = parser->group_capacity > 0 ? parser->group_capacity*2 : 8;
+            parser->group_names = realloc(parser->group_names, sizeof(*parser->group_names)*parser->group_capacity);
+            parser->group_ranges = (int*)realloc(parser->group_ranges, sizeof(int)*parser->group_capacity*2);
+        }
+        int first = parser->scene->num_objects;
+        if(!parse_collection(parser, parse_object)) return 0;
+        strcpy(parser->group_names[parser->num_groups], key);
+        parser->group_ranges[parser->num_groups*2] = first;
+        parser->group_ranges[parser->num_groups*2+1] = parser->scene->num_objects-first;
+        parser->num_groups++;
+
+        more = parser_continue(parser, '}');
+    }
+    return more == 0;
+}
+
+//the group spheres were parsed in between the plain ones, they are moved after them (groups in order) and
+//the instances get the final sphere range of their group
+void finish_groups(SceneParser* parser){
+    flattenedScene* scene = parser->scene;
+    int total = scene->num_objects;
+    int grouped = 0;
+    for(int g = 0; g < parser->num_groups; g++) grouped += parser->group_ranges[g*2+1];
+
+    if(grouped > 0){
+        int* order = (int*)malloc(sizeof(int)*total);
+        char* in_group = (char*)calloc(total, 1);
+        for(int g = 0; g < parser->num_groups; g++){
+            int first = parser->group_ranges[g*2];
+            memset(&in_group[first], 1, parser->group_ranges[g*2+1]);
+        }
+
+        int n = 0;
+        for(int j = 0; j < total; j++){
+            if(!in_group[j]) order[n++] = j;
+        }
+        for(int g = 0; g < parser->num_groups; g++){
+            int first = parser->group_ranges[g*2];
+            parser->group_ranges[g*2] = n;
+            for(int j = first; j < first+parser->group_ranges[g*2+1]; j++) order[n++] = j;
+        }
+
+        permute_floats(scene->objectpos, order, total, 3);
+        permute_floats(scene->objectcolor, order, total, 3);
+        permute_floats(scene->objectradius, order, total, 1);
+        permute_ints(scene->objectmaterial, order, total, 1);
+        free(order);
+        free(in_group);
+    }
+
+    scene->num_objects = total-grouped;
+    scene->num_group_objects = grouped;
+    for(int i = 0; i < scene->num_instances; i++){
+        int group = scene->instanceranges[i*3];
+        scene->instanceranges[i*3] = parser->group_ranges[group*2];
+        scene->instanceranges[i*3+1] = parser->group_ranges[group*2+1];
+    }
+    update_instances(scene);
+}
+
+int parse_scene(SceneParser* parser){
+    flattenedScene* scene = parser->scene;
+    char key[SCENE_KEY_SIZE];
+
+    int more = parser_begin_object(parser);
+    while(more > 0){
+        if(!parser_read_key(parser, key)) return 0;
+
+        int ok;
+        if(!strcmp(key, "camera")) ok = parser_read_floats(parser, scene->camera, 3);
+        else if(!strcmp(key, "plane")){
+            float size[2];
+            ok = parser_read_floats(parser, size, 2);
+            //same corners as create_plane3D
+            if(ok){
+                float corners[12] = {size[0], size[1], 0, -size[0], size[1], 0, size[0], -size[1], 0, -size[0], -size[1], 0};
+                memcpy(scene->plane, corners, sizeof(corners));
+            }
+        }
+        else if(!strcmp(key, "ambient_light_intensity")) ok = parser_read_gray(parser, scene->ALI);
+        else if(!strcmp(key, "materials")) ok = parse_named_materials(parser);
+        else if(!strcmp(key, "objects")) ok = parse_collection(parser, parse_object);
+        else if(!strcmp(key, "lights")) ok = parse_collection(parser, parse_light);
+        else if(!strcmp(key, "groups")) ok = parse_groups(parser);
+        else if(!strcmp(key, "instances")) ok = parse_collection(parser, parse_instance);
+        else ok = parser_skip_value(parser);
+        if(!ok) return 0;
+
+        more = parser_continue(parser, '}');
+    }
+    return more == 0;
+}
+
+flattenedScene* create_empty_flattened_scene(int object_capacity, int light_capacity){
+    flattenedScene* scene = (flattenedScene*)malloc(sizeof(flattenedScene));
+    memset(scene, 0, sizeof(flattenedScene));
+
+    scene->lightpos = (float*)malloc(sizeof(float)*light_capacity*3);
+    scene->lightdiffuse = (float*)malloc(sizeof(float)*light_capacity*3);
+    scene->lightspecular = (float*)malloc(sizeof(float)*light_capacity*3);
+    scene->lightrange = (float*)malloc(sizeof(float)*light_capacity);
+    scene->objectpos = (float*)malloc(sizeof(float)*object_capacity*3);
+    scene->objectcolor = (float*)malloc(sizeof(float)*object_capacity*3);
+    scene->objectradius = (float*)malloc(sizeof(float)*object_capacity);
+    scene->objectmaterial = (int*)malloc(sizeof(int)*object_capacity);
+    //the material arrays are grown by the MaterialTable
+
+    return scene;
+}
+
+//file or string (file NULL), the light bvh is not built here, see load_flattened_scene
+//bytes receives how much of the input was read. returns NULL on errors
+flattenedScene* parse_flattened_scene(FILE* file, char* str, long* bytes){
+    SceneParser parser;
+    parser.file = file;
+    if(file != NULL){
+        parser.buffer = (char*)malloc(SCENE_READER_CHUNK);
+        parser.length = 0;
+    }else{
+        parser.buffer = str;
+        parser.length = strlen(str);
+    }
+    parser.pos = 0;
+    parser.bytes = 0;
+    parser.line = 1;
+    parser.object_capacity = 64;
+    parser.light_capacity = 8;
+    parser.scene = create_empty_flattened_scene(parser.object_capacity, parser.light_capacity);
+    init_material_table(&parser.materials, parser.scene);
+    parser.material_names = NULL;
+    parser.named_materials = NULL;
+    parser.num_named = 0;
+    parser.named_capacity = 0;
+    parser.group_names = NULL;
+    parser.group_ranges = NULL;
+    parser.num_groups = 0;
+    parser.group_capacity = 0;
+    parser.instance_capacity = 0;
+
+    int ok = parse_scene(&parser);
+    if(bytes != NULL) *bytes = parser.bytes+parser.pos;
+    if(file != NULL) free(parser.buffer);
+    free_material_table(&parser.materials);
+    free(parser.material_names);
+    free(parser.named_materials);
+
+    if(ok) finish_groups(&parser);
+    free(parser.group_names);
+    free(parser.group_ranges);
+
+    if(!ok){
+        destroy_flattened_scene(parser.scene);
+        return NULL;
+    }
+    return parser.scene;
+}
+
+#endif
@@ -0,0 +1,111 @@
+#ifndef STATS_H
+#define STATS_H
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+
+//per frame render statistics (--stats, --stats-fd n): how many rays of each kind a frame cast, how many ray
+//sphere tests they took and how many of the closest hit searches found a sphere. the cpu tracer counts into
+//thread local counters that are merged when the frame is done, the render kernel counts per work item, sums
+//its work group in local memory and adds that to a global buffer (see add_ray_stats in render.txt)
+//the counts of the two renderers are not comparable one to one, the kernel skips spheres through the bvh
+
+//the same order as the #defines at the top of render.txt
+enum{STAT_PRIMARY_RAYS, STAT_REFLECTION_RAYS, STAT_SHADOW_RAYS, STAT_SPHERE_TESTS, STAT_HITS, STAT_MISSES, RAY_STATS};
+
+const char* ray_stat_names[RAY_STATS] = {"primary_rays", "reflection_rays", "shadow_rays", "sphere_tests", "hits", "misses"};
+
+//the cpu tracer's counters, each thread counts into its own so the hot loops never share a cache line
+_Thread_local uint64_t ray_counters[RAY_STATS];
+
+typedef struct RenderStats{
+    const char* renderer; //"cpu" or "opencl"
+    int fd; //where the json lines go, -1 for none
+    int write_failed;
+    uint64_t frame;
+    int width;
+    int height;
+    int samples;
+    double frame_ms;
+    uint64_t counters[RAY_STATS];
+} RenderStats;
+
+void init_render_stats(RenderStats* stats, const char* renderer, int fd){
+    memset(stats, 0, sizeof(RenderStats));
+    stats->renderer = renderer;
+    stats->fd = fd;
+    //a reader that goes away should not end the renderer, the writes just fail then
+    if(fd >= 0) signal(SIGPIPE, SIG_IGN);
+}
+
+//clears the counters for a new frame of width x height with samples per pixel
+void begin_render_stats(RenderStats* stats, int width, int height, int samples){
+    memset(stats->counters, 0, sizeof(stats->counters));
+    stats->width = width;
+    stats->height = height;
+    stats->samples = samples;
+    stats->frame_ms = 0;
+}
+
+//adds the counters of the calling thread to the frame and clears them, every rendering thread calls it once
+//it is done with a frame
+void merge_ray_counters(RenderStats* stats){
+    for(int k = 0; k < RAY_STATS; k++){
+        stats->counters[k] += ray_counters[k];
+        ray_counters[k] = 0;
+    }
+}
+
+uint64_t total_rays(const RenderStats* stats){
+    return stats->counters[STAT_PRIMARY_RAYS]+stats->counters[STAT_REFLECTION_RAYS]+stats->counters[STAT_SHADOW_RAYS];
+}
+
+double rays_per_second(const RenderStats* stats){
+    return stats->frame_ms > 0 ? total_rays(stats)/(stats->frame_ms/1000.0) : 0;
+}
+
+//the lines of the overlay the live modes draw over the frame, returns how many were written
+#define STATS_OVERLAY_LINES 5
+int render_stats_overlay(const RenderStats* stats, char lines[STATS_OVERLAY_LINES][96]){
+    const uint64_t* c = stats->counters;
+    uint64_t searches = c[STAT_HITS]+c[STAT_MISSES];
+    snprintf(lines[0], 96, "%s %dx%d x%d  %.2f ms", stats->renderer, stats->width, stats->height, stats->samples, stats->frame_ms);
+    snprintf(lines[1], 96, "rays %.3fM  %.1f Mrays/s", total_rays(stats)/1e6, rays_per_second(stats)/1e6);
+    snprintf(lines[2], 96, "primary %.3fM  reflection %.3fM  shadow %.3fM", c[STAT_PRIMARY_RAYS]/1e6, c[STAT_REFLECTION_RAYS]/1e6, c[STAT_SHADOW_RAYS]/1e6);
+    snprintf(lines[3], 96, "sphere tests %.3fM  %.1f per ray", c[STAT_SPHERE_TESTS]/1e6, total_rays(stats) > 0 ? (double)c[STAT_SPHERE_TESTS]/total_rays(stats) : 0);
+    snprintf(lines[4], 96, "hits %.1f%%  of %.3fM searches", searches > 0 ? 100.0*c[STAT_HITS]/searches : 0, searches/1e6);
+    return STATS_OVERLAY_LINES;
+}
+
+//one json object per line for the frame that just ended, then counts it. after a failed write (the reader
+//closed its end) nothing more is written
+void end_render_stats(RenderStats* stats){
+    stats->frame++;
+    if(stats->fd < 0 || stats->write_failed) return;
+
+    char line[1024];
+    int length = snprintf(line, sizeof(line), "{\"frame\":%llu,\"renderer\":\"%s\",\"width\":%d,\"height\":%d,\"samples\":%d,\"frame_ms\":%.3f",
+        (unsigned long long)stats->frame-1, stats->renderer, stats->width, stats->height, stats->samples, stats->frame_ms);
+    for(int k = 0; k < RAY_STATS; k++){
+        length += snprintf(line+length, sizeof(line)-length, ",\"%s\":%llu", ray_stat_names[k], (unsigned long long)stats->counters[k]);
+    }
+    length += snprintf(line+length, sizeof(line)-length, ",\"rays_per_second\":%.0f}\n", rays_per_second(stats));
+
+    //a pipe takes lines this short in one write, anything else may need a few
+    int written = 0;
+    while(written < length){
+        ssize_t n = write(stats->fd, line+written, length-written);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0){
+            printf("Could not write the render statistics to fd %d, not writing them anymore\n", stats->fd);
+            stats->write_failed = 1;
+            return;
+        }
+        written += n;
+    }
+}
+
+#endif
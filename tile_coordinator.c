@@ -0,0 +1,327 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include "vector.h"
+#include "utils.h"
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+#include "frame_writer.h"
+#include "tiles.h"
+#include "net.h"
+#include "tonemap.h"
+
+//renders one still on several render_server workers, on this host or others. the frame is cut into tiles and
+//every worker gets the next tile that nobody rendered as soon as it has room for one, so fast workers end up
+//doing more of them. a worker that fails or goes quiet for --timeout seconds has its tiles handed to the
+//others, and once no tile is left waiting, idle workers also render the tiles the slow ones are still on,
+//whichever copy comes back first is used. the workers need the scene at the same path
+//usage: ./tile_coordinator scene.json output --size WxH worker [more workers...] [--tile WxH] [--format ppm|pam]
+//       [--camera x,y,z,yaw,pitch] [--samples 1-4] [--timeout s]
+//a worker is a unix socket path or host:port, see render_server
+
+#define COORDINATOR_MAX_WORKERS 64
+#define COORDINATOR_IN_FLIGHT 2 //tiles sent to a worker at once, so it has the next one queued while it renders
+
+enum{TILE_WAITING, TILE_RENDERING, TILE_DONE};
+
+typedef struct CoordinatorTile{
+    int x;
+    int y;
+    int width;
+    int height;
+    int state;
+    int copies; //workers rendering it right now
+    double started; //ms, when the oldest copy still running was sent
+} CoordinatorTile;
+
+typedef struct Worker{
+    char* address;
+    int fd; //-1 once it failed
+    int tiles[COORDINATOR_IN_FLIGHT]; //in the order they were sent, the answers come back in that order
+    int num_tiles;
+    double waiting_since; //ms, since when the answer for tiles[0] is due
+    char header[64];
+    int header_used;
+    uint8_t* rgb;
+    size_t expected; //payload bytes of tiles[0], 0 while reading the header
+    size_t received;
+    int rendered;
+} Worker;
+
+typedef struct Coordinator{
+    CoordinatorTile* tiles;
+    int num_tiles;
+    int done;
+    int next_waiting; //every tile before it was sent at least once
+    int duplicates; //tiles sent again to an idle worker while a slow one still had them
+    int reassigned; //tiles taken back from a worker that failed
+    Worker workers[COORDINATOR_MAX_WORKERS];
+    int num_workers;
+    TiledImage* image;
+    char request[8192]; //the request line up to the tile
+} Coordinator;
+
+double now_ms(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1000.0 + ts.tv_nsec/1000000.0;
+}
+
+void worker_failed(Coordinator* coordinator, Worker* worker, const char* reason){
+    printf("Worker %s failed: %s", worker->address, reason);
+    int returned = 0;
+    for(int t = 0; t < worker->num_tiles; t++){
+        CoordinatorTile* tile = &coordinator->tiles[worker->tiles[t]];
+        tile->copies--;
+        if(tile->state == TILE_RENDERING && tile->copies == 0){
+            tile->state = TILE_WAITING;
+            if(worker->tiles[t] < coordinator->next_waiting) coordinator->next_waiting = worker->tiles[t];
+            returned++;
+        }
+    }
+    printf(", %d of its tiles go to the others\n", returned);
+    coordinator->reassigned += returned;
+    close(worker->fd);
+    worker->fd = -1;
+    worker->num_tiles = 0;
+}
+
+//1 if the request went out
+int send_tile(Coordinator* coordinator, Worker* worker, int index){
+    CoordinatorTile* tile = &coordinator->tiles[index];
+    char line[sizeof(coordinator->request)+64];
+    int length = snprintf(line, sizeof(line), "%s --tile %d,%d,%d,%d\n", coordinator->request, tile->x, tile->y, tile->width, tile->height);
+    if(!send_all(worker->fd, line, length)) return 0;
+
+    double now = now_ms();
+    if(worker->num_tiles == 0) worker->waiting_since = now;
+    worker->tiles[worker->num_tiles++] = index;
+    if(tile->copies == 0) tile->started = now;
+    tile->copies++;
+    tile->state = TILE_RENDERING;
+    return 1;
+}
+
+//the next tile for worker, one nobody has yet or else a copy of the one running the longest elsewhere, which
+//only an idle worker takes so duplicates never delay new tiles. -1 if there is none
+int pick_tile(Coordinator* coordinator, Worker* worker){
+    while(coordinator->next_waiting < coordinator->num_tiles && coordinator->tiles[coordinator->next_waiting].state != TILE_WAITING) coordinator->next_waiting++;
+    if(coordinator->next_waiting < coordinator->num_tiles) return coordinator->next_waiting;
+    if(worker->num_tiles > 0) return -1;
+
+    int oldest = -1;
+    for(int t = 0; t < coordinator->num_tiles; t++){
+        CoordinatorTile* tile = &coordinator->tiles[t];
+        if(tile->state != TILE_RENDERING || tile->copies != 1) continue;
+        if(oldest < 0 || tile->started < coordinator->tiles[oldest].started) oldest = t;
+    }
+    if(oldest >= 0) coordinator->duplicates++;
+    return oldest;
+}
+
+void assign_tiles(Coordinator* coordinator){
+    for(int w = 0; w < coordinator->num_workers; w++){
+        Worker* worker = &coordinator->workers[w];
+        while(worker->fd >= 0 && worker->num_tiles < COORDINATOR_IN_FLIGHT){
+            int index = pick_tile(coordinator, worker);
+            if(index < 0) break;
+            if(!send_tile(coordinator, worker, index)) worker_failed(coordinator, worker, "the connection was lost");
+        }
+    }
+}
+
+//the answer for the first tile of the worker arrived
+void tile_finished(Coordinator* coordinator, Worker* worker){
+    int index = worker->tiles[0];
+    CoordinatorTile* tile = &coordinator->tiles[index];
+    worker->num_tiles--;
+    memmove(worker->tiles, worker->tiles+1, sizeof(int)*worker->num_tiles);
+    worker->waiting_since = now_ms();
+    worker->expected = 0;
+    worker->header_used = 0;
+    tile->copies--;
+    if(tile->state == TILE_DONE) return;
+
+    if(!write_image_tile(coordinator->image, worker->rgb, tile->x, tile->y, tile->width, tile->height, 0)){
+        printf("Could not write the image\n");
+        exit(1);
+    }
+    tile->state = TILE_DONE;
+    coordinator->done++;
+    worker->rendered++;
+}
+
+//reads whatever the worker sent so far, the header a byte at a time so the pixels after it stay in the socket
+void read_worker(Coordinator* coordinator, Worker* worker){
+    while(worker->fd >= 0){
+        if(worker->expected == 0){
+            char* byte = &worker->header[worker->header_used];
+            ssize_t received = recv(worker->fd, byte, 1, 0);
+            if(received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+            if(received < 0 && errno == EINTR) continue;
+            if(received <= 0){
+                worker_failed(coordinator, worker, "the connection was lost");
+                return;
+            }
+            if(*byte != '\n'){
+                if(++worker->header_used == (int)sizeof(worker->header)-1){
+                    worker_failed(coordinator, worker, "it sent something that is not an answer");
+                    return;
+                }
+                continue;
+            }
+            *byte = '\0';
+
+            //anything but the pixels of the tile, an error or an answer nobody asked for, ends the worker
+            size_t size = 0;
+            if(worker->num_tiles > 0) size = (size_t)coordinator->tiles[worker->tiles[0]].width*coordinator->tiles[worker->tiles[0]].height*3;
+            char reason[128];
+            if(size == 0 || strncmp(worker->header, "ok ", 3) || strtoull(worker->header+3, NULL, 10) != size){
+                snprintf(reason, sizeof(reason), "%s", worker->header);
+                worker_failed(coordinator, worker, reason);
+                return;
+            }
+            worker->expected = size;
+            worker->received = 0;
+            continue;
+        }
+
+        ssize_t received = recv(worker->fd, worker->rgb+worker->received, worker->expected-worker->received, 0);
+        if(received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+        if(received < 0 && errno == EINTR) continue;
+        if(received <= 0){
+            worker_failed(coordinator, worker, "the connection was lost");
+            return;
+        }
+        worker->received += received;
+        if(worker->received == worker->expected) tile_finished(coordinator, worker);
+    }
+}
+
+int main(int argc, char* argv[]){
+    char* size_option = take_option(&argc, argv, "--size");
+    char* tile_option = take_option(&argc, argv, "--tile");
+    char* format_option = take_option(&argc, argv, "--format");
+    char* camera_option = take_option(&argc, argv, "--camera");
+    char* samples_option = take_option(&argc, argv, "--samples");
+    char* timeout_option = take_option(&argc, argv, "--timeout");
+    ToneSettings tone;
+    int tone_valid = take_tone_options(&argc, argv, &tone);
+    int width, height;
+    int tile_width = 256; int tile_height = 256;
+    if(argc < 4 || !tone_valid || size_option == NULL || !parse_size(size_option, &width, &height) || (tile_option != NULL && !parse_size(tile_option, &tile_width, &tile_height))){
+        printf("Usage: ./tile_coordinator scene.json output --size WxH worker [more workers...] [--tile WxH] [--format ppm|pam] [--camera x,y,z,yaw,pitch] [--samples 1-4] [--timeout s]\n"
+        "       [--tonemap clamp|reinhard|filmic] [--exposure f] [--srgb] [--dither]\n");
+        exit(2);
+    }
+    if(argc-3 > COORDINATOR_MAX_WORKERS){
+        printf("At most %d workers\n", COORDINATOR_MAX_WORKERS);
+        exit(2);
+    }
+    FrameFormat format = FRAME_PPM;
+    if(format_option != NULL && !parse_frame_format(format_option, &format)){
+        printf("Unknown format %s, use ppm or pam\n", format_option);
+        exit(2);
+    }
+    double timeout_ms = (timeout_option ? atof(timeout_option) : 30)*1000;
+
+    Coordinator* coordinator = (Coordinator*)calloc(1, sizeof(Coordinator));
+    int length = snprintf(coordinator->request, sizeof(coordinator->request), "render %s --size %dx%d --format rgb", argv[1], width, height);
+    if(camera_option != NULL) length += snprintf(coordinator->request+length, sizeof(coordinator->request)-length, " --camera %s", camera_option);
+    if(samples_option != NULL) length += snprintf(coordinator->request+length, sizeof(coordinator->request)-length, " --samples %s", samples_option);
+    //the workers map the colors, with the tile position for the dithering
+    char tone_options[128];
+    tone_options_string(&tone, tone_options, sizeof(tone_options));
+    length += snprintf(coordinator->request+length, sizeof(coordinator->request)-length, " %s", tone_options);
+    if(length >= (int)sizeof(coordinator->request)-64){
+        printf("The scene path is too long\n");
+        exit(2);
+    }
+
+    char file_name[4096];
+    snprintf(file_name, sizeof(file_name), "%s.%s", argv[2], frame_format_extension(format));
+    coordinator->image = create_tiled_image(file_name, format, width, height);
+    if(coordinator->image == NULL) exit(1);
+
+    int columns = (width+tile_width-1)/tile_width;
+    int rows = (height+tile_height-1)/tile_height;
+    coordinator->num_tiles = columns*rows;
+    coordinator->tiles = (CoordinatorTile*)calloc(coordinator->num_tiles, sizeof(CoordinatorTile));
+    for(int t = 0; t < coordinator->num_tiles; t++){
+        CoordinatorTile* tile = &coordinator->tiles[t];
+        tile->x = (t % columns)*tile_width;
+        tile->y = (t/columns)*tile_height;
+        tile->width = width-tile->x < tile_width ? width-tile->x : tile_width;
+        tile->height = height-tile->y < tile_height ? height-tile->y : tile_height;
+    }
+
+    for(int a = 3; a < argc; a++){
+        Worker* worker = &coordinator->workers[coordinator->num_workers++];
+        worker->address = argv[a];
+        worker->fd = connect_address(argv[a]);
+        if(worker->fd < 0){
+            printf("Could not connect to the worker %s\n", argv[a]);
+            continue;
+        }
+        fcntl(worker->fd, F_SETFL, fcntl(worker->fd, F_GETFL) | O_NONBLOCK);
+        worker->rgb = (uint8_t*)malloc((size_t)tile_width*tile_height*3);
+    }
+
+    double start = now_ms();
+    struct pollfd fds[COORDINATOR_MAX_WORKERS];
+    int fd_workers[COORDINATOR_MAX_WORKERS];
+    while(coordinator->done < coordinator->num_tiles){
+        assign_tiles(coordinator);
+
+        int num_fds = 0;
+        for(int w = 0; w < coordinator->num_workers; w++){
+            if(coordinator->workers[w].fd < 0) continue;
+            fd_workers[num_fds] = w;
+            fds[num_fds].fd = coordinator->workers[w].fd;
+            fds[num_fds++].events = POLLIN;
+        }
+        if(num_fds == 0){
+            printf("Every worker failed, %d of %d tiles were rendered\n", coordinator->done, coordinator->num_tiles);
+            exit(1);
+        }
+
+        //wakes up now and then to notice the workers that stopped answering
+        if(poll(fds, num_fds, 100) < 0 && errno != EINTR){
+            printf("poll failed\n");
+            exit(1);
+        }
+        for(int f = 0; f < num_fds; f++){
+            if(fds[f].revents != 0) read_worker(coordinator, &coordinator->workers[fd_workers[f]]);
+        }
+        double now = now_ms();
+        for(int w = 0; w < coordinator->num_workers; w++){
+            Worker* worker = &coordinator->workers[w];
+            if(worker->fd >= 0 && worker->num_tiles > 0 && now-worker->waiting_since > timeout_ms) worker_failed(coordinator, worker, "it stopped answering");
+        }
+    }
+    double seconds = (now_ms()-start)/1000;
+
+    int ok = destroy_tiled_image(coordinator->image);
+    int working = 0;
+    for(int w = 0; w < coordinator->num_workers; w++){
+        Worker* worker = &coordinator->workers[w];
+        printf("  %s: %d tiles%s\n", worker->address, worker->rendered, worker->fd < 0 ? ", failed" : "");
+        if(worker->fd >= 0){
+            working++;
+            close(worker->fd);
+        }
+        free(worker->rgb);
+    }
+    if(ok) printf("Rendered %dx%d in %d tiles on %d workers in %.2f s (%.1f Mpixels/s), %d tiles reassigned, %d rendered twice, saved as %s\n",
+        width, height, coordinator->num_tiles, working, seconds, (double)width*height/seconds/1e6, coordinator->reassigned, coordinator->duplicates, file_name);
+    else printf("Could not write %s\n", file_name);
+    free(coordinator->tiles);
+    free(coordinator);
+    return ok ? 0 : 1;
+}
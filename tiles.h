@@ -0,0 +1,98 @@
+#ifndef TILES_H
+#define TILES_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include "frame_writer.h"
+
+//images bigger than one render, see --size. the frame is rendered a tile at a time through a plane that only
+//covers that tile, so the renderers and their buffers never see more than one tile, and every tile goes into
+//the output file as soon as it is done. only the uncompressed formats can be written out of order like that
+
+//corners of the part of the plane the tile covers, for a width x height image. the plane is bilinear in the
+//pixel coordinates so the corners of any rectangle of it give back exactly the same rays
+void tile_plane(const float plane[], int x, int y, int tile_width, int tile_height, int width, int height, float tile[]){
+    float alpha[2] = {(float)x/width, (float)(x+tile_width)/width};
+    float beta[2] = {(float)y/height, (float)(y+tile_height)/height};
+    for(int corner = 0; corner < 4; corner++){
+        float a = alpha[corner & 1];
+        float b = beta[corner >> 1];
+        for(int k = 0; k < 3; k++){
+            float top = plane[k]*(1-a)+plane[3+k]*a;
+            float bottom = plane[6+k]*(1-a)+plane[9+k]*a;
+            tile[corner*3+k] = top*(1-b)+bottom*b;
+        }
+    }
+}
+
+typedef struct TiledImage{
+    int fd;
+    int width;
+    int height;
+    int header_size;
+} TiledImage;
+
+//NULL if the file cannot be created. the file gets its final size right away, the tiles fill it in
+TiledImage* create_tiled_image(char* file_name, FrameFormat format, int width, int height){
+    if(format != FRAME_PPM && format != FRAME_PAM){
+        printf("Tiled images can only be written as ppm or pam\n");
+        return NULL;
+    }
+    int fd = open(file_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0){
+        printf("Could not create %s\n", file_name);
+        return NULL;
+    }
+
+    TiledImage* image;
+    image = (TiledImage*)malloc(sizeof(TiledImage));
+    image->fd = fd;
+    image->width = width;
+    image->height = height;
+
+    char header[128];
+    image->header_size = raw_image_header(format, width, height, header, sizeof(header));
+    if(pwrite(fd, header, image->header_size, 0) != image->header_size || ftruncate(fd, image->header_size+(off_t)width*height*3) != 0){
+        printf("Could not write %s\n", file_name);
+        close(fd);
+        free(image);
+        return NULL;
+    }
+    return image;
+}
+
+//writes the rows of an rgb tile at x, y of the image. flip puts the first row of the tile at the bottom, for
+//the cpu tracer whose y goes up. 1 if every row was written
+int write_image_tile(TiledImage* image, uint8_t* rgb, int x, int y, int tile_width, int tile_height, int flip){
+    const size_t row_size = (size_t)tile_width*3;
+    for(int row = 0; row < tile_height; row++){
+        int image_row = flip ? image->height-1-(y+row) : y+row;
+        off_t offset = image->header_size+((off_t)image_row*image->width+x)*3;
+        if(pwrite(image->fd, rgb+row*row_size, row_size, offset) != (ssize_t)row_size) return 0;
+    }
+    return 1;
+}
+
+//1 if the file was closed fine
+int destroy_tiled_image(TiledImage* image){
+    int ok = close(image->fd) == 0;
+    free(image);
+    return ok;
+}
+
+//reads "WxH", 0 if it is not two positive numbers
+int parse_size(const char* text, int* width, int* height){
+    return sscanf(text, "%dx%d", width, height) == 2 && *width > 0 && *height > 0;
+}
+
+//resident set high water mark of the process in MB
+double peak_memory_mb(){
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss/1024.0;
+}
+
+#endif
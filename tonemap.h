@@ -0,0 +1,328 @@
+#ifndef TONEMAP_H
+#define TONEMAP_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "utils.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+//the last step of every renderer, float colors to 8 bit: exposure, a tone curve, the srgb transfer curve and
+//ordered dithering, then packed as rgb bytes or ARGB8888 words. the float frames (opencl, the chunk renderer)
+//go through tone_map_frame, 4 channels at a time with sse2 and split in bands of rows over a few threads, the
+//cpu tracer maps its pixels one by one with tone_map_pixel, which does the same math
+
+#define TONE_MAX_THREADS 8
+//rows per job, small enough for the threads to share a 720p frame evenly
+#define TONE_BAND_ROWS 32
+
+typedef enum ToneCurve{
+    TONE_CLAMP, //what the renderers always did, values above 1 are cut
+    TONE_REINHARD, //x/(1+x), never reaches white
+    TONE_FILMIC //the aces fit of Krzysztof Narkowicz, a toe in the shadows and a soft shoulder
+} ToneCurve;
+
+typedef enum TonePacking{
+    TONE_RGB8, //3 bytes per pixel, what the image writers take
+    TONE_ARGB8888 //a uint32 0xAARRGGBB per pixel, what the SDL textures and the frame ring hold
+} TonePacking;
+
+typedef struct ToneSettings{
+    ToneCurve curve;
+    float exposure; //the colors are multiplied by it first
+    int srgb; //encode with the srgb curve, for displays that expect it, instead of writing linear values
+    int dither; //4x4 ordered dithering, hides the banding of smooth gradients
+} ToneSettings;
+
+//a float frame to map: samples planes of width*height*3 floats plane_size floats apart, summed per pixel, into
+//rows of out pitch bytes apart. x, y is where the frame sits in the whole image so the dithering of tiles lines
+//up, flip writes the rows bottom up
+typedef struct ToneJob{
+    const float* pixels;
+    int samples;
+    long plane_size;
+    int width;
+    int height;
+    uint8_t* out;
+    int pitch;
+    TonePacking packing;
+    int x;
+    int y;
+    int flip;
+} ToneJob;
+
+//threads kept between frames, waiting for the bands of the next job
+typedef struct ToneMapper{
+    ToneSettings settings;
+    int num_threads; //1 maps on the calling thread
+    pthread_t threads[TONE_MAX_THREADS];
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    ToneJob job;
+    int generation; //bumped for every job so the threads know there is a new one
+    int next_band;
+    int num_bands;
+    int pending; //bands not finished
+    int closing;
+} ToneMapper;
+
+//bayer 4x4 thresholds in 1/255 steps, centered on 0
+static const float tone_bayer[16] = {
+    -7.5f/16, 0.5f/16, -5.5f/16, 2.5f/16,
+    4.5f/16, -3.5f/16, 6.5f/16, -1.5f/16,
+    -4.5f/16, 3.5f/16, -6.5f/16, 1.5f/16,
+    7.5f/16, -0.5f/16, 5.5f/16, -2.5f/16
+};
+
+ToneSettings default_tone_settings(){
+    ToneSettings settings = {TONE_CLAMP, 1, 0, 0};
+    return settings;
+}
+
+//reads --tonemap clamp|reinhard|filmic, --exposure f, --srgb and --dither out of argv. 0 if a value is not valid
+int take_tone_options(int* argc, char* argv[], ToneSettings* settings){
+    *settings = default_tone_settings();
+    char* curve = take_option(argc, argv, "--tonemap");
+    char* exposure = take_option(argc, argv, "--exposure");
+    settings->srgb = take_flag(argc, argv, "--srgb");
+    settings->dither = take_flag(argc, argv, "--dither");
+    if(curve != NULL){
+        if(!strcmp(curve, "clamp")) settings->curve = TONE_CLAMP;
+        else if(!strcmp(curve, "reinhard")) settings->curve = TONE_REINHARD;
+        else if(!strcmp(curve, "filmic")) settings->curve = TONE_FILMIC;
+        else return 0;
+    }
+    if(exposure != NULL){
+        char* end;
+        settings->exposure = strtof(exposure, &end);
+        if(*end != '\0' || !(settings->exposure > 0)) return 0;
+    }
+    return 1;
+}
+
+//the options that give these settings back, for passing them on to render_server
+void tone_options_string(ToneSettings* settings, char* options, size_t size){
+    const char* curves[] = {"clamp", "reinhard", "filmic"};
+    snprintf(options, size, "--tonemap %s --exposure %g%s%s", curves[settings->curve], settings->exposure, settings->srgb ? " --srgb" : "", settings->dither ? " --dither" : "");
+}
+
+//one channel of a pixel to 0-255, threshold is the dithering offset
+uint8_t tone_map_value(const ToneSettings* settings, float value, float threshold){
+    value *= settings->exposure;
+    if(value < 0) value = 0;
+    if(settings->curve == TONE_REINHARD) value = value/(1+value);
+    else if(settings->curve == TONE_FILMIC) value = (value*(2.51f*value+0.03f))/(value*(2.43f*value+0.59f)+0.14f);
+    if(value > 1) value = 1;
+    if(settings->srgb){
+        //1.055*x^(1/2.4)-0.055 from three square roots, within a quarter of a step of the real curve
+        float s1 = sqrtf(value);
+        float s2 = sqrtf(s1);
+        float s3 = sqrtf(s2);
+        float curved = 0.662002687f*s1+0.684122060f*s2-0.323583601f*s3-0.0225411470f*value;
+        value = value <= 0.0031308f ? 12.92f*value : curved;
+    }
+    int level = (int)(value*255+0.5f+threshold);
+    return level < 0 ? 0 : level > 255 ? 255 : level;
+}
+
+float tone_threshold(const ToneSettings* settings, int x, int y){
+    return settings->dither ? tone_bayer[(y & 3)*4+(x & 3)] : 0;
+}
+
+//an ARGB8888 word for the pixel at x, y of the image
+uint32_t tone_map_pixel(const ToneSettings* settings, float red, float green, float blue, int x, int y){
+    float threshold = tone_threshold(settings, x, y);
+    return (255u << 24) | (tone_map_value(settings, red, threshold) << 16) | (tone_map_value(settings, green, threshold) << 8) | tone_map_value(settings, blue, threshold);
+}
+
+#ifdef __SSE2__
+//tone_map_value on 4 channels. the settings come by value, through a pointer they would be loaded again after
+//every store of the output bytes, which may alias anything
+static inline __m128 tone_map_sse(ToneSettings settings, __m128 value, __m128 threshold){
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1);
+    value = _mm_max_ps(_mm_mul_ps(value, _mm_set1_ps(settings.exposure)), zero);
+    if(settings.curve == TONE_REINHARD) value = _mm_div_ps(value, _mm_add_ps(one, value));
+    else if(settings.curve == TONE_FILMIC){
+        __m128 numerator = _mm_mul_ps(value, _mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.51f), value), _mm_set1_ps(0.03f)));
+        __m128 denominator = _mm_add_ps(_mm_mul_ps(value, _mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.43f), value), _mm_set1_ps(0.59f))), _mm_set1_ps(0.14f));
+        value = _mm_div_ps(numerator, denominator);
+    }
+    value = _mm_min_ps(value, one);
+    if(settings.srgb){
+        __m128 s1 = _mm_sqrt_ps(value);
+        __m128 s2 = _mm_sqrt_ps(s1);
+        __m128 s3 = _mm_sqrt_ps(s2);
+        __m128 curved = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(0.662002687f), s1), _mm_mul_ps(_mm_set1_ps(0.684122060f), s2));
+        curved = _mm_sub_ps(curved, _mm_mul_ps(_mm_set1_ps(0.323583601f), s3));
+        curved = _mm_sub_ps(curved, _mm_mul_ps(_mm_set1_ps(0.0225411470f), value));
+        __m128 linear = _mm_mul_ps(_mm_set1_ps(12.92f), value);
+        __m128 dark = _mm_cmple_ps(value, _mm_set1_ps(0.0031308f));
+        value = _mm_or_ps(_mm_and_ps(dark, linear), _mm_andnot_ps(dark, curved));
+    }
+    return _mm_add_ps(_mm_add_ps(_mm_mul_ps(value, _mm_set1_ps(255)), _mm_set1_ps(0.5f)), threshold);
+}
+#endif
+
+//maps row y of the job into row, width*3 rgb bytes
+void tone_map_row(ToneSettings settings, const ToneJob* job, int y, uint8_t* row){
+    const float* source = job->pixels+(long)y*job->width*3;
+    const int channels = job->width*3;
+    const int samples = job->samples;
+    const long plane_size = job->plane_size;
+    const int image_y = job->y+(job->flip ? job->height-1-y : y);
+    //the thresholds of 4 pixels, 12 channels, repeat along the row
+    float thresholds[12];
+    for(int c = 0; c < 12; c++) thresholds[c] = tone_threshold(&settings, job->x+c/3, image_y);
+
+    int c = 0;
+#ifdef __SSE2__
+    const __m128 pattern[3] = {_mm_loadu_ps(thresholds), _mm_loadu_ps(thresholds+4), _mm_loadu_ps(thresholds+8)};
+    for(; c+16 <= channels; c += 16){
+        __m128 sums[4];
+        for(int v = 0; v < 4; v++){
+            sums[v] = _mm_loadu_ps(source+c+v*4);
+            for(int z = 1; z < samples; z++) sums[v] = _mm_add_ps(sums[v], _mm_loadu_ps(source+plane_size*z+c+v*4));
+            //c is a multiple of 16, so the pattern vector of channel c+v*4 is (c/4+v) % 3
+            sums[v] = tone_map_sse(settings, sums[v], pattern[(c/4+v) % 3]);
+        }
+        //the levels are already rounded and in 0-255 up to the dithering, the saturating packs clamp the rest
+        __m128i low = _mm_packs_epi32(_mm_cvttps_epi32(sums[0]), _mm_cvttps_epi32(sums[1]));
+        __m128i high = _mm_packs_epi32(_mm_cvttps_epi32(sums[2]), _mm_cvttps_epi32(sums[3]));
+        _mm_storeu_si128((__m128i*)(row+c), _mm_packus_epi16(low, high));
+    }
+#endif
+    for(; c < channels; c++){
+        float sum = 0;
+        for(int z = 0; z < samples; z++) sum += source[plane_size*z+c];
+        row[c] = tone_map_value(&settings, sum, thresholds[c % 12]);
+    }
+}
+
+//maps the rows first to last-1 of the job
+void tone_map_rows(const ToneSettings* settings, const ToneJob* job, int first, int last, uint8_t* scratch){
+    for(int y = first; y < last; y++){
+        uint8_t* out = job->out+(long)(job->flip ? job->height-1-y : y)*job->pitch;
+        if(job->packing == TONE_RGB8){
+            tone_map_row(*settings, job, y, out);
+            continue;
+        }
+        tone_map_row(*settings, job, y, scratch);
+        uint32_t* words = (uint32_t*)out;
+        const int width = job->width;
+        for(int x = 0; x < width; x++) words[x] = (255u << 24) | (scratch[x*3] << 16) | (scratch[x*3+1] << 8) | scratch[x*3+2];
+    }
+}
+
+//takes bands of the current job until there are none left, 1 if it did any
+int tone_map_bands(ToneMapper* mapper, uint8_t** scratch, int* scratch_size){
+    int worked = 0;
+    pthread_mutex_lock(&mapper->lock);
+    while(mapper->next_band < mapper->num_bands){
+        int band = mapper->next_band++;
+        ToneJob job = mapper->job;
+        pthread_mutex_unlock(&mapper->lock);
+
+        if(job.width*3 > *scratch_size){
+            *scratch_size = job.width*3;
+            *scratch = (uint8_t*)realloc(*scratch, *scratch_size);
+        }
+        int first = band*TONE_BAND_ROWS;
+        int last = first+TONE_BAND_ROWS < job.height ? first+TONE_BAND_ROWS : job.height;
+        TRACE_SPAN("resolve band") tone_map_rows(&mapper->settings, &job, first, last, *scratch);
+        worked = 1;
+
+        pthread_mutex_lock(&mapper->lock);
+        if(--mapper->pending == 0) pthread_cond_broadcast(&mapper->changed);
+    }
+    pthread_mutex_unlock(&mapper->lock);
+    return worked;
+}
+
+void* tone_mapper_thread(void* argument){
+    ToneMapper* mapper = (ToneMapper*)argument;
+    TRACE_THREAD("tone mapper");
+    uint8_t* scratch = NULL;
+    int scratch_size = 0;
+    int seen = 0;
+    pthread_mutex_lock(&mapper->lock);
+    while(!mapper->closing){
+        if(mapper->generation == seen){
+            pthread_cond_wait(&mapper->changed, &mapper->lock);
+            continue;
+        }
+        seen = mapper->generation;
+        pthread_mutex_unlock(&mapper->lock);
+        tone_map_bands(mapper, &scratch, &scratch_size);
+        pthread_mutex_lock(&mapper->lock);
+    }
+    pthread_mutex_unlock(&mapper->lock);
+    free(scratch);
+    return NULL;
+}
+
+//one thread per core up to TONE_MAX_THREADS, the caller being one of them
+ToneMapper* create_tone_mapper(ToneSettings settings){
+    ToneMapper* mapper = (ToneMapper*)calloc(1, sizeof(ToneMapper));
+    mapper->settings = settings;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    mapper->num_threads = (int)(cpus < 1 ? 1 : cpus > TONE_MAX_THREADS ? TONE_MAX_THREADS : cpus);
+    pthread_mutex_init(&mapper->lock, NULL);
+    pthread_cond_init(&mapper->changed, NULL);
+    for(int t = 1; t < mapper->num_threads; t++) pthread_create(&mapper->threads[t], NULL, tone_mapper_thread, mapper);
+    return mapper;
+}
+
+//maps a whole float frame and returns when it is done, see ToneJob
+void tone_map_frame(ToneMapper* mapper, const ToneJob* job){
+    TRACE_BEGIN(span, "resolve");
+    pthread_mutex_lock(&mapper->lock);
+    mapper->job = *job;
+    mapper->next_band = 0;
+    mapper->num_bands = (job->height+TONE_BAND_ROWS-1)/TONE_BAND_ROWS;
+    mapper->pending = mapper->num_bands;
+    mapper->generation++;
+    pthread_cond_broadcast(&mapper->changed);
+    pthread_mutex_unlock(&mapper->lock);
+
+    uint8_t* scratch = NULL;
+    int scratch_size = 0;
+    tone_map_bands(mapper, &scratch, &scratch_size);
+    free(scratch);
+
+    pthread_mutex_lock(&mapper->lock);
+    while(mapper->pending > 0) pthread_cond_wait(&mapper->changed, &mapper->lock);
+    pthread_mutex_unlock(&mapper->lock);
+    TRACE_END(span);
+}
+
+//the samples planes of the opencl pixelcolors buffer to width*height*3 rgb bytes
+void tone_map_rgb(ToneMapper* mapper, const float* pixels, int samples, int width, int height, uint8_t* rgb){
+    ToneJob job = {pixels, samples, (long)width*height*3, width, height, rgb, width*3, TONE_RGB8, 0, 0, 0};
+    tone_map_frame(mapper, &job);
+}
+
+//the same into ARGB8888 rows pitch bytes apart
+void tone_map_argb(ToneMapper* mapper, const float* pixels, int samples, int width, int height, uint8_t* out, int pitch){
+    ToneJob job = {pixels, samples, (long)width*height*3, width, height, out, pitch, TONE_ARGB8888, 0, 0, 0};
+    tone_map_frame(mapper, &job);
+}
+
+void destroy_tone_mapper(ToneMapper* mapper){
+    if(mapper == NULL) return;
+    pthread_mutex_lock(&mapper->lock);
+    mapper->closing = 1;
+    pthread_cond_broadcast(&mapper->changed);
+    pthread_mutex_unlock(&mapper->lock);
+    for(int t = 1; t < mapper->num_threads; t++) pthread_join(mapper->threads[t], NULL);
+    pthread_mutex_destroy(&mapper->lock);
+    pthread_cond_destroy(&mapper->changed);
+    free(mapper);
+}
+
+#endif
@@ -0,0 +1,174 @@
+#ifndef TRACE_H
+#define TRACE_H
+#include <stdio.h>
+
+//trace spans for chrome://tracing or ui.perfetto.dev. built with -DTRACE, --trace file.json writes when every
+//thread was busy with what: loading the scene, building the opencl programs, every enqueue and clFinish, the
+//resolve, the texture upload, the present and the image encoding, so a stall between the host and the device
+//shows up as a long clFinish or a gap. without -DTRACE the macros below are empty and nothing is compiled in
+//
+//  TRACE_SPAN("clFinish") clFinish(queue);            the span covers the statement or block after it, which
+//                                                     must not break, continue or return out of it
+//  TRACE_BEGIN(build, "build"); ... TRACE_END(build); for spans that are not one block
+//  TRACE_THREAD("frame writer");                      names the calling thread in the trace
+//
+//every thread records its finished spans into its own ring of TRACE_RING_EVENTS, so the threads never wait
+//on each other and a long run keeps the last spans of each thread. the rings are written out at exit
+
+#ifdef TRACE
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+
+#ifndef TRACE_RING_EVENTS
+#define TRACE_RING_EVENTS 32768
+#endif
+
+typedef struct TraceEvent{
+    const char* name; //a string literal, only the pointer is kept
+    uint64_t start; //ns since trace_start
+    uint64_t duration;
+} TraceEvent;
+
+typedef struct TraceRing{
+    TraceEvent events[TRACE_RING_EVENTS];
+    _Atomic uint64_t count; //spans recorded, the ring holds the last TRACE_RING_EVENTS of them
+    int tid;
+    char name[32];
+    struct TraceRing* next;
+} TraceRing;
+
+typedef struct TraceScope{
+    const char* name;
+    uint64_t start;
+    int open;
+} TraceScope;
+
+FILE* trace_file = NULL; //NULL while not tracing
+char trace_path[4096];
+struct timespec trace_origin;
+TraceRing* trace_rings = NULL; //in the order the threads first traced something, the rings outlive them
+int trace_num_threads = 0;
+pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+_Thread_local TraceRing* trace_ring = NULL;
+
+uint64_t trace_now(){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)(now.tv_sec-trace_origin.tv_sec)*1000000000ull+now.tv_nsec-trace_origin.tv_nsec;
+}
+
+//the calling thread's ring, made the first time it is needed
+TraceRing* trace_thread_ring(){
+    if(trace_ring != NULL) return trace_ring;
+    TraceRing* ring = (TraceRing*)calloc(1, sizeof(TraceRing));
+    pthread_mutex_lock(&trace_lock);
+    ring->tid = trace_num_threads++;
+    snprintf(ring->name, sizeof(ring->name), "thread %d", ring->tid);
+    TraceRing** last = &trace_rings;
+    while(*last != NULL) last = &(*last)->next;
+    *last = ring;
+    pthread_mutex_unlock(&trace_lock);
+    trace_ring = ring;
+    return ring;
+}
+
+TraceScope trace_begin(const char* name){
+    TraceScope scope = {name, 0, 1};
+    if(trace_file != NULL) scope.start = trace_now();
+    return scope;
+}
+
+//always 0, so TRACE_SPAN's loop runs once
+int trace_end(TraceScope* scope){
+    if(trace_file == NULL) return 0;
+    uint64_t end = trace_now();
+    TraceRing* ring = trace_thread_ring();
+    uint64_t count = atomic_load_explicit(&ring->count, memory_order_relaxed);
+    TraceEvent* event = &ring->events[count%TRACE_RING_EVENTS];
+    event->name = scope->name;
+    event->start = scope->start;
+    event->duration = end-scope->start;
+    atomic_store_explicit(&ring->count, count+1, memory_order_release);
+    return 0;
+}
+
+void trace_name_thread(const char* name){
+    if(trace_file == NULL) return;
+    TraceRing* ring = trace_thread_ring();
+    snprintf(ring->name, sizeof(ring->name), "%s", name);
+}
+
+//writes every ring as chrome trace json, with the times in microseconds. the other threads should be done by
+//now, a span one of them finishes while its ring is written may come out torn
+void trace_write(){
+    if(trace_file == NULL) return;
+    FILE* file = trace_file;
+    trace_file = NULL;
+
+    uint64_t spans = 0;
+    uint64_t dropped = 0;
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    pthread_mutex_lock(&trace_lock);
+    int first = 1;
+    for(TraceRing* ring = trace_rings; ring != NULL; ring = ring->next){
+        fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}", first ? "" : ",\n", ring->tid, ring->name);
+        first = 0;
+        uint64_t count = atomic_load_explicit(&ring->count, memory_order_acquire);
+        uint64_t oldest = count > TRACE_RING_EVENTS ? count-TRACE_RING_EVENTS : 0;
+        for(uint64_t i = oldest; i < count; i++){
+            TraceEvent* event = &ring->events[i%TRACE_RING_EVENTS];
+            fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                event->name, ring->tid, event->start/1000.0, event->duration/1000.0);
+        }
+        spans += count-oldest;
+        dropped += oldest;
+    }
+    pthread_mutex_unlock(&trace_lock);
+    fprintf(file, "\n]}\n");
+
+    if(fclose(file) != 0) printf("Could not write the trace to %s\n", trace_path);
+    else if(dropped > 0) printf("Wrote %llu spans to %s, the %llu before them did not fit in the rings\n", (unsigned long long)spans, trace_path, (unsigned long long)dropped);
+    else printf("Wrote %llu spans to %s\n", (unsigned long long)spans, trace_path);
+}
+
+//starts recording on every thread and writes the trace to path when the program exits, 0 if path cannot be
+//written. the calling thread is named main
+int trace_start(const char* path){
+    FILE* file = fopen(path, "w");
+    if(file == NULL){
+        printf("Could not open %s for the trace\n", path);
+        return 0;
+    }
+    snprintf(trace_path, sizeof(trace_path), "%s", path);
+    clock_gettime(CLOCK_MONOTONIC, &trace_origin);
+    trace_file = file;
+    trace_name_thread("main");
+    atexit(trace_write);
+    return 1;
+}
+
+#define TRACE_SPAN(name) for(TraceScope trace_scope_ = trace_begin(name); trace_scope_.open; trace_scope_.open = trace_end(&trace_scope_))
+#define TRACE_BEGIN(scope, name) TraceScope scope = trace_begin(name)
+#define TRACE_END(scope) trace_end(&scope)
+#define TRACE_THREAD(name) trace_name_thread(name)
+
+#else
+
+int trace_start(const char* path){
+    printf("--trace needs a build with -DTRACE, ignoring it\n");
+    (void)path;
+    return 0;
+}
+
+#define TRACE_SPAN(name)
+#define TRACE_BEGIN(scope, name)
+#define TRACE_END(scope)
+#define TRACE_THREAD(name)
+
+#endif
+
+#endif
@@ -4,420 +4,292 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
-#include <cJSON.h>
+#include <time.h>
 #include "vector.h"
+#include "scene_parser.h"
+#include "scene_binary.h"
+#include "scene_chunks.h"
+#include "trace.h"
 
 #define SPEED 1
 
-typedef struct OpenclContext{
-    flattenedScene* fscene;
-    cl_mem pixelcolors;
-    cl_mem camera;
-    cl_mem plane;
-    cl_mem ALI;
-    cl_mem lightpos;
-    cl_mem lightdiffuse;
-    cl_mem lightspecular;
-    cl_mem objectpos;
-    cl_mem objectcolor;
-    cl_mem objectambient;
-    cl_mem objectdiffuse;
-    cl_mem objectspecular;
-    cl_mem objectreflectivity;
-    cl_mem objectalbedo;
-    cl_mem objectradius;
-    cl_kernel render_kernel;
-    cl_kernel post_processing_kernel;
-    cl_program render_program;
-    cl_program post_processing_program;
-    cl_device_id devices;
-    cl_context context;
-} OpenclContext;
-
-OpenclContext* create_opencl_context(
-    flattenedScene* fscene,
-    cl_mem pixelcolors,
-    cl_mem camera,
-    cl_mem plane,
-    cl_mem ALI,
-    cl_mem lightpos,
-    cl_mem lightdiffuse,
-    cl_mem lightspecular,
-    cl_mem objectpos,
-    cl_mem objectcolor,
-    cl_mem objectambient,
-    cl_mem objectdiffuse,
-    cl_mem objectspecular,
-    cl_mem objectreflectivity,
-    cl_mem objectalbedo,
-    cl_mem objectradius,
-    cl_kernel render_kernel,
-    cl_kernel post_processing_kernel,
-    cl_program render_program,
-    cl_program post_processing_program,
-    cl_device_id devices,
-    cl_context context
-){
-    OpenclContext * oc;
-    oc = (OpenclContext*)malloc(sizeof(OpenclContext));
-
-    oc->fscene = fscene;
-    oc->pixelcolors = pixelcolors;
-    oc->camera = camera;
-    oc->plane = plane;
-    oc->ALI = ALI;
-    oc->lightpos = lightpos;
-    oc->lightdiffuse = lightdiffuse;
-    oc->lightspecular = lightspecular;
-    oc->objectpos = objectpos;
-    oc->objectcolor = objectcolor;
-    oc->objectambient = objectambient;
-    oc->objectdiffuse = objectdiffuse;
-    oc->objectspecular = objectspecular;
-    oc->objectreflectivity = objectreflectivity;
-    oc->objectalbedo = objectalbedo;
-    oc->objectradius = objectradius;
-    oc->render_kernel = render_kernel;
-    oc->post_processing_kernel = post_processing_kernel;
-    oc->render_program = render_program;
-    oc->post_processing_program = post_processing_program;
-    oc->devices = devices;
-    oc->context = context;
-
-    return oc;
-}
+//lights without range go first (num_global), the ranged ones after them in bvh leaf order,
+//order receives the permutation, so new light i is old light order[i]
+SphereBVH* build_light_bvh(float* lightpos, float* lightrange, int num_lights, int* order, int* num_global){
+    int global = 0;
+    for(int i = 0; i < num_lights; i++){
+        if(lightrange[i] <= 0) order[global++] = i;
+    }
 
-void destroy_openclcontext(OpenclContext *opencl_context){
-    destroy_flattened_scene(opencl_context->fscene);
-    clReleaseMemObject(opencl_context->pixelcolors);
-    clReleaseMemObject(opencl_context->camera);
-    clReleaseMemObject(opencl_context->plane);
-    clReleaseMemObject(opencl_context->ALI);
-    clReleaseMemObject(opencl_context->lightpos);
-    clReleaseMemObject(opencl_context->lightdiffuse);
-    clReleaseMemObject(opencl_context->lightspecular);
-    clReleaseMemObject(opencl_context->objectpos);
-    clReleaseMemObject(opencl_context->objectcolor);
-    clReleaseMemObject(opencl_context->objectambient);
-    clReleaseMemObject(opencl_context->objectdiffuse);
-    clReleaseMemObject(opencl_context->objectspecular);
-    clReleaseMemObject(opencl_context->objectreflectivity);
-    clReleaseMemObject(opencl_context->objectalbedo);
-    clReleaseMemObject(opencl_context->objectradius);
-    clReleaseKernel(opencl_context->render_kernel);
-    clReleaseProgram(opencl_context->render_program);
-    clReleaseKernel(opencl_context->post_processing_kernel);
-    clReleaseProgram(opencl_context->post_processing_program);
-    clReleaseDevice(opencl_context->devices);
-    clReleaseContext(opencl_context->context);
-
-    free(opencl_context);
-}
+    int num_ranged = num_lights-global;
+    float* centers = (float*)malloc(sizeof(float)*(num_ranged*3+1));
+    float* radii = (float*)malloc(sizeof(float)*(num_ranged+1));
+    int* ranged = (int*)malloc(sizeof(int)*(num_ranged+1));
+    int* ranged_order = (int*)malloc(sizeof(int)*(num_ranged+1));
+    int r = 0;
+    for(int i = 0; i < num_lights; i++){
+        if(lightrange[i] <= 0) continue;
+        centers[r*3] = lightpos[i*3];
+        centers[r*3+1] = lightpos[i*3+1];
+        centers[r*3+2] = lightpos[i*3+2];
+        radii[r] = lightrange[i];
+        ranged[r] = i;
+        r++;
+    }
 
-char** str_split(char* a_str, const char a_delim)
-{
-    //from https://stackoverflow.com/questions/9210528/split-string-with-delimiters-in-c
-    //Tenho que voltar e tentar fazer isso do 0 depois, mas parece bem complexo pra algo que não vou usar tanto
-    char** result    = 0;
-    size_t count     = 0;
-    char* tmp        = a_str;
-    char* last_comma = 0;
-    char delim[2];
-    delim[0] = a_delim;
-    delim[1] = 0;
-
-    /* Count how many elements will be extracted. */
-    while (*tmp)
-    {
-        if (a_delim == *tmp)
-        {
-            count++;
-            last_comma = tmp;
-        }
-        tmp++;
+    SphereBVH* bvh = build_sphere_bvh(centers, radii, ranged_order, num_ranged);
+    for(int i = 0; i < num_ranged; i++) order[global+i] = ranged[ranged_order[i]];
+    for(int i = 0; i < bvh->num_nodes; i++){
+        if(bvh->nodes[i*2+1] > 0) bvh->nodes[i*2] += global;
     }
 
-    /* Add space for trailing token. */
-    count += last_comma < (a_str + strlen(a_str) - 1);
+    free(centers);
+    free(radii);
+    free(ranged);
+    free(ranged_order);
 
-    /* Add space for terminating null string so caller
-       knows where the list of returned strings ends. */
-    count++;
+    *num_global = global;
+    return bvh;
+}
 
-    result = (char **)malloc(sizeof(char*) * count);
+void build_scene_light_bvh(Scene* scene){
+    Light** lights = (Light**)malloc(sizeof(Light*)*(scene->num_lights+1));
+    float* lightpos = (float*)malloc(sizeof(float)*(scene->num_lights*3+1));
+    float* lightrange = (float*)malloc(sizeof(float)*(scene->num_lights+1));
+    int* order = (int*)malloc(sizeof(int)*(scene->num_lights+1));
 
-    if (result)
-    {
-        size_t idx  = 0;
-        char* token = strtok(a_str, delim);
+    LightList* index = scene->lights;
+    int i = 0;
+    while(index->light){
+        lights[i] = index->light;
+        lightpos[i*3] = index->light->position->x;
+        lightpos[i*3+1] = index->light->position->y;
+        lightpos[i*3+2] = index->light->position->z;
+        lightrange[i] = index->light->range;
 
-        while (token)
-        {
-            assert(idx < count);
-            *(result + idx++) = strdup(token);
-            token = strtok(0, delim);
-        }
-        assert(idx == count - 1);
-        *(result + idx) = 0;
+        i++;
+        index = index->next;
     }
 
-    return result;
-}
+    destroy_sphere_bvh(scene->lightbvh);
+    free(scene->light_array);
+    scene->lightbvh = build_light_bvh(lightpos, lightrange, scene->num_lights, order, &scene->num_global_lights);
+    scene->light_array = (Light**)malloc(sizeof(Light*)*(scene->num_lights+1));
+    for(i = 0; i < scene->num_lights; i++) scene->light_array[i] = lights[order[i]];
 
-float* parse_string(char* str, int size){
-    float* list = (float *)malloc(sizeof(float) * size);
-    char arg[100];
-    char** tokens = str_split(strcpy(arg, str), ',');
+    free(lights);
+    free(lightpos);
+    free(lightrange);
+    free(order);
+}
 
-    for(int i = 0; i < size; i++){
-        list[i] = atof(tokens[i]);
-        free(tokens[i]);
-    }
-    free(tokens);
+//sorts the lights of a flattened scene for the kernel: lights without range first, then the ranged ones in lightbvh leaf order
+void build_flattened_light_bvh(flattenedScene* fscene){
+    int* order = (int*)malloc(sizeof(int)*(fscene->num_lights+1));
+    destroy_sphere_bvh(fscene->lightbvh);
+    fscene->lightbvh = build_light_bvh(fscene->lightpos, fscene->lightrange, fscene->num_lights, order, &fscene->num_global_lights);
+    permute_floats(fscene->lightpos, order, fscene->num_lights, 3);
+    permute_floats(fscene->lightdiffuse, order, fscene->num_lights, 3);
+    permute_floats(fscene->lightspecular, order, fscene->num_lights, 3);
+    permute_floats(fscene->lightrange, order, fscene->num_lights, 1);
+    free(order);
+}
 
-    return list;
+//sorts the plain spheres of a flattened scene into the leaf order of a bvh over them, which the kernel walks
+//instead of testing every sphere. the group spheres after them are left alone, instances have their own bounds
+void build_flattened_object_bvh(flattenedScene* fscene){
+    int* order = (int*)malloc(sizeof(int)*(fscene->num_objects+1));
+    destroy_sphere_bvh(fscene->objectbvh);
+    fscene->objectbvh = build_sphere_bvh(fscene->objectpos, fscene->objectradius, order, fscene->num_objects);
+    permute_floats(fscene->objectpos, order, fscene->num_objects, 3);
+    permute_floats(fscene->objectradius, order, fscene->num_objects, 1);
+    permute_floats(fscene->objectcolor, order, fscene->num_objects, 3);
+    permute_ints(fscene->objectmaterial, order, fscene->num_objects, 1);
+    free(order);
 }
 
-Scene* load_scene(char* json_str){
+double elapsed_seconds(struct timespec* start){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec-start->tv_sec) + (now.tv_nsec-start->tv_nsec)/1e9;
+}
 
-    
-    cJSON* json = cJSON_Parse(json_str);
-    free(json_str);
+void print_instances(flattenedScene* fscene){
+    if(fscene->num_instances == 0) return;
+    long drawn = 0;
+    for(int i = 0; i < fscene->num_instances; i++) drawn += fscene->instanceranges[i*3+1];
+    printf("  plus %d instances of %d group spheres (%ld spheres drawn)\n", fscene->num_instances, fscene->num_group_objects, drawn);
+}
 
-    if(json == NULL){
-        printf("Error parsing json\n");
+//streams a json scene file (or maps a binary one) into a flattened scene ready for the opencl buffers
+//and prints the load throughput
+flattenedScene* load_flattened_scene(char* file_path){
+    if(is_chunked_scene(file_path)){
+        printf("Error: %s is a chunked scene, render it with chunk_render\n", file_path);
         return NULL;
     }
-
-    vector3D* camera;
-    plane3D* plane;
-    Color* ALI; //ambient light intensity
-    ObjectList* objects = create_objectlist();
-    LightList* lights = create_lightlist();
-    int num_objects = 0;
-    int num_lights = 0;
-
-    cJSON* index = json->child;
-    while(index != NULL){
-        if(!strcmp(index->string, "camera")){
-            float* values = parse_string(index->valuestring, 3);
-            camera = create_vector3D(values[0], values[1], values[2]);
-            free(values);
-        }
-        else if(!strcmp(index->string, "plane")){
-            float* values = parse_string(index->valuestring, 2);
-            plane = create_plane3D(values[0], values[1]);
-            free(values);
-        }
-        else if(!strcmp(index->string, "ambient_light_intensity")){
-            float* values = parse_string(index->valuestring, 1);
-            ALI = create_color(values[0], values[0], values[0]);
-            free(values);
-        }
-        else if(!strcmp(index->string, "objects")){
-            cJSON* objindex = index->child;
-            while(objindex != NULL){
-                vector3D* objpos;
-                float objradius;
-                Color* objcolor;
-                Material* objmat;
-
-                cJSON* objprop = objindex->child;
-                while(objprop != NULL){
-                    if(!strcmp(objprop->string, "position")){
-                        float* values = parse_string(objprop->valuestring, 3);
-                        objpos = create_vector3D(values[0], values[1], values[2]);
-                        free(values);
-                    }
-                    else if(!strcmp(objprop->string, "radius")){
-                        float* values = parse_string(objprop->valuestring, 1);
-                        objradius = values[0];
-                        free(values);
-                    }
-                    else if(!strcmp(objprop->string, "color_rgb")){
-                        float* values = parse_string(objprop->valuestring, 3);
-                        objcolor = create_color(values[0]/255, values[1]/255, values[2]/255);
-                        free(values);
-                    }
-                    else if(!strcmp(objprop->string, "material")){
-                        float ambient;
-                        float diffuse;
-                        float specular;
-                        float reflectivity;
-                        float albedo;
-                        
-                        cJSON* matprop = objprop->child;
-                        while(matprop != NULL){
-                            if(!strcmp(matprop->string, "ambient")){
-                                float* values = parse_string(matprop->valuestring, 1);
-                                ambient = values[0];
-                                free(values);
-                            }
-                            else if(!strcmp(matprop->string, "diffuse")){
-                                float* values = parse_string(matprop->valuestring, 1);
-                                diffuse = values[0];
-                                free(values);
-                            }
-                            else if(!strcmp(matprop->string, "specular")){
-                                float* values = parse_string(matprop->valuestring, 1);
-                                specular = values[0];
-                                free(values);
-                            }
-                            else if(!strcmp(matprop->string, "reflectivity")){
-                                float* values = parse_string(matprop->valuestring, 1);
-                                reflectivity = values[0];
-                                free(values);
-                            }
-                            else if(!strcmp(matprop->string, "albedo")){
-                                float* values = parse_string(matprop->valuestring, 1);
-                                albedo = values[0];
-                                free(values);
-                            }
-                            matprop = matprop->next;
-                        }
-                        objmat = create_material(ambient, diffuse, specular, reflectivity, albedo);
-                    }
-
-                    objprop = objprop->next;
-                }
-                Sphere* object = create_sphere2(objpos, objradius, objcolor, objmat);
-                objects = add_to_objectlist(objects, object);
-                num_objects++;
-
-                objindex = objindex->next;
-            }
-        }
-        else if(!strcmp(index->string, "lights")){
-            cJSON* lightsindex = index->child;
-            while(lightsindex != NULL){
-                vector3D* lightpos;
-                Color* lightdiff;
-                Color* lightspec;
-
-                cJSON* lightprops = lightsindex->child;
-                while(lightprops != NULL){
-                    if(!strcmp(lightprops->string, "position")){
-                        float* values = parse_string(lightprops->valuestring, 3);
-                        lightpos = create_vector3D(values[0], values[1], values[2]);
-                        free(values);
-                    }
-                    if(!strcmp(lightprops->string, "diffuse")){
-                        float* values = parse_string(lightprops->valuestring, 1);
-                        lightdiff = create_color(values[0], values[0], values[0]);
-                        free(values);
-                    }
-                    if(!strcmp(lightprops->string, "specular")){
-                        float* values = parse_string(lightprops->valuestring, 1);
-                        lightspec = create_color(values[0], values[0], values[0]);
-                        free(values);
-                    }
-
-                    lightprops = lightprops->next;
-                }
-                Light* light = create_light2(lightpos, lightdiff, lightspec);
-                lights = add_to_lightlist(lights, light);
-                num_lights++;
-
-                lightsindex = lightsindex->next;
-            } 
+    if(is_binary_scene(file_path)){
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        flattenedScene* fscene;
+        TRACE_SPAN("map_binary_scene") fscene = map_binary_scene(file_path);
+        if(fscene != NULL){
+            double seconds = elapsed_seconds(&start);
+            printf("Mapped %s: %d spheres, %d lights, %.1f MB in %.3f s\n", file_path,
+                fscene->num_objects, fscene->num_lights, fscene->mapping_size/1e6, seconds);
+            print_instances(fscene);
         }
+        return fscene;
+    }
 
-        index = index->next;
+    FILE *file = fopen(file_path, "r");
+    if (file == NULL){
+        printf("Could not open file\n");
+        return NULL;
     }
 
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
 
-    cJSON_Delete(json);
+    long bytes;
+    flattenedScene* fscene;
+    TRACE_SPAN("parse_flattened_scene") fscene = parse_flattened_scene(file, NULL, &bytes);
+    fclose(file);
+    if(fscene == NULL) return NULL;
+    TRACE_SPAN("build bvhs"){
+        build_flattened_light_bvh(fscene);
+        build_flattened_object_bvh(fscene);
+    }
 
-    Scene* scene = create_scene(camera, plane, ALI, lights, objects, num_lights, num_objects);
+    double seconds = elapsed_seconds(&start);
+    if(seconds <= 0) seconds = 1e-9;
+    printf("Loaded %s: %d spheres, %d lights, %.1f MB in %.3f s (%.1f MB/s, %.0f spheres/s)\n", file_path,
+        fscene->num_objects, fscene->num_lights, bytes/1e6, seconds, bytes/1e6/seconds, fscene->num_objects/seconds);
+    print_instances(fscene);
 
-    return scene;
+    return fscene;
 }
 
-flattenedScene* flattenScene(Scene* scene){
-    flattenedScene* flattenned = (flattenedScene*)malloc(sizeof(flattenedScene));
-
-    //deeply regret all my past actions that led me to this moment
-    flattenned->camera[0] = scene->camera->x;
-    flattenned->camera[1] = scene->camera->y;
-    flattenned->camera[2] = scene->camera->z;
-    flattenned->ALI[0] = scene->ALI->red;
-    flattenned->ALI[1] = scene->ALI->green;
-    flattenned->ALI[2] = scene->ALI->blue;
-    flattenned->plane[0] = scene->plane->x1->x;
-    flattenned->plane[1] = scene->plane->x1->y;
-    flattenned->plane[2] = scene->plane->x1->z;
-    flattenned->plane[3] = scene->plane->x2->x;
-    flattenned->plane[4] = scene->plane->x2->y;
-    flattenned->plane[5] = scene->plane->x2->z;
-    flattenned->plane[6] = scene->plane->x3->x;
-    flattenned->plane[7] = scene->plane->x3->y;
-    flattenned->plane[8] = scene->plane->x3->z;
-    flattenned->plane[9] = scene->plane->x4->x;
-    flattenned->plane[10] = scene->plane->x4->y;
-    flattenned->plane[11] = scene->plane->x4->z;
-    flattenned->num_lights = scene->num_lights;
-    flattenned->num_objects = scene->num_objects;
-
-    flattenned->lightpos = (float *)malloc(sizeof(float)*scene->num_lights*3);
-    flattenned->lightdiffuse = (float *)malloc(sizeof(float)*scene->num_lights*3);
-    flattenned->lightspecular = (float *)malloc(sizeof(float)*scene->num_lights*3);
-    flattenned->objectpos = (float *)malloc(sizeof(float)*scene->num_objects*3);
-    flattenned->objectcolor = (float *)malloc(sizeof(float)*scene->num_objects*3);
-    flattenned->objectambient = (float *)malloc(sizeof(float)*scene->num_objects*3);
-    flattenned->objectdiffuse = (float *)malloc(sizeof(float)*scene->num_objects*3);
-    flattenned->objectspecular = (float *)malloc(sizeof(float)*scene->num_objects*3);
-    flattenned->objectreflectivity = (float *)malloc(sizeof(float)*scene->num_objects*3);
-    flattenned->objectradius = (float *)malloc(sizeof(float)*scene->num_objects);
-    flattenned->objectalbedo = (float *)malloc(sizeof(float)*scene->num_objects);
-
-    LightList* lindex = scene->lights;
-    int i = 0;
-    while(lindex->light){
-        flattenned->lightpos[i*3] = lindex->light->position->x;
-        flattenned->lightpos[i*3+1] = lindex->light->position->y;
-        flattenned->lightpos[i*3+2] = lindex->light->position->z;
+//size of everything scene_from_flattened puts in the arena, so it fits in the first block
+size_t scene_arena_size(flattenedScene* fscene){
+    size_t object = arena_aligned(sizeof(ObjectList))+arena_aligned(sizeof(Sphere))+arena_aligned(sizeof(vector3D))+arena_aligned(sizeof(Color));
+    size_t light = arena_aligned(sizeof(LightList))+arena_aligned(sizeof(Light))+arena_aligned(sizeof(vector3D))+2*arena_aligned(sizeof(Color));
+    size_t material = arena_aligned(sizeof(Material))+4*arena_aligned(sizeof(Color));
+    size_t fixed = arena_aligned(sizeof(ObjectList))+arena_aligned(sizeof(LightList))+arena_aligned(sizeof(plane3D))+5*arena_aligned(sizeof(vector3D))+arena_aligned(sizeof(Color));
 
-        flattenned->lightdiffuse[i*3] = lindex->light->diffuse->red;
-        flattenned->lightdiffuse[i*3+1] = lindex->light->diffuse->green;
-        flattenned->lightdiffuse[i*3+2] = lindex->light->diffuse->blue;
+    size_t instanced = arena_aligned(sizeof(ObjectList))+arena_aligned(sizeof(Sphere))+arena_aligned(sizeof(vector3D));
+    size_t num_instanced = 0;
+    for(int i = 0; i < fscene->num_instances; i++) num_instanced += fscene->instanceranges[i*3+1];
 
-        flattenned->lightspecular[i*3] = lindex->light->specular->red;
-        flattenned->lightspecular[i*3+1] = lindex->light->specular->green;
-        flattenned->lightspecular[i*3+2] = lindex->light->specular->blue;
+    return object*fscene->num_objects+instanced*num_instanced+arena_aligned(sizeof(Color)*(fscene->num_group_objects+1))
+        +light*fscene->num_lights+material*fscene->num_materials
+        +arena_aligned(sizeof(Material*)*(fscene->num_materials+1))+fixed;
+}
 
-        i++;
-        lindex = lindex->next;
+Color* arena_color(Arena* arena, float* rgb){
+    Color* color = ARENA_NEW(arena, Color);
+    *color = (Color){rgb[0], rgb[1], rgb[2]};
+    return color;
+}
+vector3D* arena_vector3D(Arena* arena, float* xyz){
+    vector3D* vector = ARENA_NEW(arena, vector3D);
+    *vector = (vector3D){xyz[0], xyz[1], xyz[2]};
+    return vector;
+}
+
+//the linked list scene the cpu tracer uses, objects and lights keep the flattened order.
+//everything is bump allocated from one arena: each list node sits right before its sphere (or light) and its
+//vectors, and the nodes come in the order the list is walked, so the tracer reads memory front to back.
+//destroy_scene frees it all at once. the cpu tracer has no instances, every instance gets its own copy of the
+//group's spheres (moved and scaled), they only share the colors
+Scene* scene_from_flattened(flattenedScene* fscene){
+    TRACE_BEGIN(span, "scene_from_flattened");
+    Arena* arena = create_arena(scene_arena_size(fscene));
+
+    Material** materials = ARENA_ARRAY(arena, Material*, fscene->num_materials+1);
+    for(int i = 0; i < fscene->num_materials; i++){
+        Material* material = ARENA_NEW(arena, Material);
+        material->ambient = arena_color(arena, &fscene->materialambient[i*3]);
+        material->diffuse = arena_color(arena, &fscene->materialdiffuse[i*3]);
+        material->specular = arena_color(arena, &fscene->materialspecular[i*3]);
+        material->reflectivity = arena_color(arena, &fscene->materialreflectivity[i*3]);
+        material->albedo = fscene->materialalbedo[i];
+        materials[i] = material;
     }
-    
-    ObjectList* oindex = scene->objects;
-    i = 0;
-    while(oindex->sphere){
-        flattenned->objectpos[i*3] = oindex->sphere->center->x;
-        flattenned->objectpos[i*3+1] = oindex->sphere->center->y;
-        flattenned->objectpos[i*3+2] = oindex->sphere->center->z;
-        flattenned->objectcolor[i*3] = oindex->sphere->color->red;
-        flattenned->objectcolor[i*3+1] = oindex->sphere->color->green;
-        flattenned->objectcolor[i*3+2] = oindex->sphere->color->blue;
-        flattenned->objectambient[i*3] = oindex->sphere->material->ambient->red;
-        flattenned->objectambient[i*3+1] = oindex->sphere->material->ambient->green;
-        flattenned->objectambient[i*3+2] = oindex->sphere->material->ambient->blue;
-        flattenned->objectdiffuse[i*3] = oindex->sphere->material->diffuse->red;
-        flattenned->objectdiffuse[i*3+1] = oindex->sphere->material->diffuse->green;
-        flattenned->objectdiffuse[i*3+2] = oindex->sphere->material->diffuse->blue;
-        flattenned->objectspecular[i*3] = oindex->sphere->material->specular->red;
-        flattenned->objectspecular[i*3+1] = oindex->sphere->material->specular->green;
-        flattenned->objectspecular[i*3+2] = oindex->sphere->material->specular->blue;
-        flattenned->objectreflectivity[i*3] = oindex->sphere->material->reflectivity->red;
-        flattenned->objectreflectivity[i*3+1] = oindex->sphere->material->reflectivity->green;
-        flattenned->objectreflectivity[i*3+2] = oindex->sphere->material->reflectivity->blue;
-        flattenned->objectradius[i] = oindex->sphere->radius;
-        flattenned->objectalbedo[i] = oindex->sphere->material->albedo;
-        
-        i++;
-        oindex = oindex->next;
+
+    //the lists end in a node without sphere (or light), like the ones create_objectlist makes
+    ObjectList* objects = NULL;
+    ObjectList** object_tail = &objects;
+    for(int i = 0; i < fscene->num_objects; i++){
+        ObjectList* node = ARENA_NEW(arena, ObjectList);
+        Sphere* sphere = ARENA_NEW(arena, Sphere);
+        sphere->center = arena_vector3D(arena, &fscene->objectpos[i*3]);
+        sphere->radius = fscene->objectradius[i];
+        sphere->color = arena_color(arena, &fscene->objectcolor[i*3]);
+        sphere->material = materials[fscene->objectmaterial[i]];
+        node->sphere = sphere;
+        *object_tail = node;
+        object_tail = &node->next;
     }
 
-    return flattenned;
+    int num_spheres = fscene->num_objects;
+    Color* group_colors = ARENA_ARRAY(arena, Color, fscene->num_group_objects+1);
+    for(int j = 0; j < fscene->num_group_objects; j++){
+        float* rgb = &fscene->objectcolor[(fscene->num_objects+j)*3];
+        group_colors[j] = (Color){rgb[0], rgb[1], rgb[2]};
+    }
+    for(int i = 0; i < fscene->num_instances; i++){
+        float* transform = &fscene->instancetransform[i*4];
+        int first = fscene->instanceranges[i*3];
+        for(int j = first; j < first+fscene->instanceranges[i*3+1]; j++){
+            ObjectList* node = ARENA_NEW(arena, ObjectList);
+            Sphere* sphere = ARENA_NEW(arena, Sphere);
+            float center[3];
+            for(int k = 0; k < 3; k++) center[k] = fscene->objectpos[j*3+k]*transform[3]+transform[k];
+            sphere->center = arena_vector3D(arena, center);
+            sphere->radius = fscene->objectradius[j]*transform[3];
+            sphere->color = &group_colors[j-fscene->num_objects];
+            sphere->material = materials[fscene->objectmaterial[j]];
+            node->sphere = sphere;
+            *object_tail = node;
+            object_tail = &node->next;
+            num_spheres++;
+        }
+    }
+    *object_tail = ARENA_NEW(arena, ObjectList);
+    **object_tail = (ObjectList){NULL, NULL};
+
+    LightList* lights = NULL;
+    LightList** light_tail = &lights;
+    for(int i = 0; i < fscene->num_lights; i++){
+        LightList* node = ARENA_NEW(arena, LightList);
+        Light* light = ARENA_NEW(arena, Light);
+        light->position = arena_vector3D(arena, &fscene->lightpos[i*3]);
+        light->diffuse = arena_color(arena, &fscene->lightdiffuse[i*3]);
+        light->specular = arena_color(arena, &fscene->lightspecular[i*3]);
+        light->range = fscene->lightrange[i];
+        node->light = light;
+        *light_tail = node;
+        light_tail = &node->next;
+    }
+    *light_tail = ARENA_NEW(arena, LightList);
+    **light_tail = (LightList){NULL, NULL};
+
+    vector3D* camera = arena_vector3D(arena, fscene->camera);
+    plane3D* plane = ARENA_NEW(arena, plane3D);
+    plane->x1 = arena_vector3D(arena, &fscene->plane[0]);
+    plane->x2 = arena_vector3D(arena, &fscene->plane[3]);
+    plane->x3 = arena_vector3D(arena, &fscene->plane[6]);
+    plane->x4 = arena_vector3D(arena, &fscene->plane[9]);
+    Color* ALI = arena_color(arena, fscene->ALI);
+
+    Scene* scene = create_scene(camera, plane, ALI, lights, objects, fscene->num_lights, num_spheres);
+    set_scene_materials(scene, materials, fscene->num_materials);
+    scene->arena = arena;
+    build_scene_light_bvh(scene);
+
+    TRACE_END(span);
+    return scene;
 }
 
 //compiling errors were coming from here but they should be fixed now
@@ -437,6 +309,31 @@ const char* load_strfile(char* file_path){
     return str;
 }
 
+//removes "name value" from argv and returns the value, or NULL when the option is not there
+char* take_option(int* argc, char* argv[], const char* name){
+    for(int i = 1; i < *argc-1; i++){
+        if(!strcmp(argv[i], name)){
+            char* value = argv[i+1];
+            for(int k = i; k+2 <= *argc; k++) argv[k] = argv[k+2];
+            *argc -= 2;
+            return value;
+        }
+    }
+    return NULL;
+}
+
+//removes a flag without value from argv, returns 1 if it was there
+int take_flag(int* argc, char* argv[], const char* name){
+    for(int i = 1; i < *argc; i++){
+        if(!strcmp(argv[i], name)){
+            for(int k = i; k+1 <= *argc; k++) argv[k] = argv[k+1];
+            *argc -= 1;
+            return 1;
+        }
+    }
+    return 0;
+}
+
 void handle_keyboard_input(const char* key_pressed, flattenedScene* fscene){
     if(!strcmp(key_pressed, "W")){
         fscene->camera[2] += SPEED;
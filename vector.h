@@ -3,6 +3,9 @@
 
 #include <stdlib.h>
 #include <math.h>
+#include <sys/mman.h>
+#include "bvh.h"
+#include "arena.h"
 
 typedef struct vector3D{
     float x;
@@ -27,6 +30,7 @@ typedef struct Light{
     vector3D* position;
     Color* diffuse;
     Color* specular;
+    float range; //0 means the light reaches everything
 } Light;
 
 typedef struct Material{
@@ -35,13 +39,14 @@ typedef struct Material{
     Color* specular;
     Color* reflectivity;
     float albedo;
+    int index; //position in the scene's material table, -1 until it is added to one
 } Material;
 
 typedef struct Sphere{
     vector3D* center;
     float radius;
     Color* color;
-    Material* material;
+    Material* material; //shared, owned by the scene's material table
 } Sphere;
 
 typedef struct Collision{
@@ -67,6 +72,13 @@ typedef struct Scene{
     ObjectList* objects;
     int num_lights;
     int num_objects;
+    //lights without range first then the ranged ones in lightbvh order, NULL bvh means no culling
+    Light** light_array;
+    SphereBVH* lightbvh;
+    int num_global_lights;
+    Material** materials; //deduplicated, the spheres point into it
+    int num_materials;
+    Arena* arena; //when not NULL the lists, spheres, lights, materials, camera and plane all live in it
 } Scene;
 
 typedef struct flattenedScene{
@@ -78,14 +90,27 @@ typedef struct flattenedScene{
     float* lightpos;
     float* lightdiffuse;
     float* lightspecular;
+    float* lightrange;
+    SphereBVH* lightbvh; //only over the ranged lights, which come after the num_global_lights unranged ones
+    int num_global_lights;
+    SphereBVH* objectbvh; //over the num_objects plain spheres, which are stored in its leaf order
     float* objectpos;
     float* objectradius;
     float* objectcolor;
-    float* objectambient;
-    float* objectdiffuse;
-    float* objectspecular;
-    float* objectreflectivity;
-    float* objectalbedo;
+    int* objectmaterial; //index into the material arrays
+    int num_materials;
+    float* materialambient;
+    float* materialdiffuse;
+    float* materialspecular;
+    float* materialreflectivity;
+    float* materialalbedo;
+    int num_group_objects; //spheres stored after the num_objects ones that are only drawn through instances
+    int num_instances;
+    float* instancetransform; //4 floats per instance: translation then uniform scale
+    int* instanceranges; //3 ints per instance: first sphere and sphere count of its group, first collision id
+    float* instancebounds; //4 floats per instance: world space bounding sphere (center, radius)
+    void* mapping; //binary scene file the arrays point into, NULL when they were allocated
+    size_t mapping_size;
 } flattenedScene;
 
 vector3D * create_vector3D(float x, float y, float z){
@@ -139,6 +164,7 @@ Light * create_light(float x, float y, float z, Color* diffuse, Color* specular)
     light->position = create_vector3D(x, y, z);
     light->diffuse = diffuse;
     light->specular = specular;
+    light->range = 0;
 
     return light;
 }
@@ -149,6 +175,7 @@ Light * create_light2(vector3D* position, Color* diffuse, Color* specular){
     light->position = position;
     light->diffuse = diffuse;
     light->specular = specular;
+    light->range = 0;
 
     return light;
 }
@@ -171,6 +198,7 @@ Material * create_material(float ambient, float diffuse, float specular, float r
     material->specular = create_color(specular, specular, specular);
     material->reflectivity = create_color(reflectivity, reflectivity, reflectivity);
     material->albedo = albedo;
+    material->index = -1;
 
     return material;
 }
@@ -185,7 +213,7 @@ void destroy_material(Material* material){
     return;
 }
 
-//colors: [0,1]
+//colors: [0,1], the material is not copied, it has to be in the scene's material table
 Sphere * create_sphere(float x, float y, float z, float radius, float red, float green, float blue, Material* material){
     Sphere* sphere;
     sphere = (Sphere *)malloc(sizeof(Sphere));
@@ -208,11 +236,11 @@ Sphere * create_sphere2(vector3D* position, float radius, Color* color, Material
 
     return sphere;
 }
+//the material is shared, destroy_scene frees it with the table
 void destroy_sphere(Sphere* sphere){
 
     free(sphere->center);
     free(sphere->color);
-    destroy_material(sphere->material);
 
     free(sphere);
     return;
@@ -319,34 +347,73 @@ Scene* create_scene(vector3D* camera, plane3D* plane, Color* ALI, LightList* lig
     scene->objects = objects;
     scene->num_lights = num_lights;
     scene->num_objects = num_objects;
+    scene->light_array = NULL;
+    scene->lightbvh = NULL;
+    scene->num_global_lights = 0;
+    scene->materials = NULL;
+    scene->num_materials = 0;
+    scene->arena = NULL;
 
     return scene;
 }
+//takes ownership of the materials, their index is set to their position in the table
+void set_scene_materials(Scene* scene, Material** materials, int num_materials){
+    scene->materials = materials;
+    scene->num_materials = num_materials;
+    for(int i = 0; i < num_materials; i++) materials[i]->index = i;
+}
 void destroy_scene(Scene* scene){
+    if(scene->arena != NULL){
+        //everything but the light bvh is released in one go
+        destroy_sphere_bvh(scene->lightbvh);
+        free(scene->light_array);
+        destroy_arena(scene->arena);
+        free(scene);
+        return;
+    }
 
     free(scene->ALI);
     free(scene->camera);
     destroy_lightlist(scene->lights);
     destroy_objectlist(scene->objects);
     destroy_plane(scene->plane);
+    destroy_sphere_bvh(scene->lightbvh);
+    free(scene->light_array);
+    for(int i = 0; i < scene->num_materials; i++) destroy_material(scene->materials[i]);
+    free(scene->materials);
     
     free(scene);
     return;
 }
 
 void destroy_flattened_scene(flattenedScene* scene){
+    if(scene->mapping != NULL){
+        //the arrays and the bvh nodes live in the mapping, only the bvh structs were allocated
+        free(scene->lightbvh);
+        free(scene->objectbvh);
+        munmap(scene->mapping, scene->mapping_size);
+        free(scene);
+        return;
+    }
 
     free(scene->lightdiffuse);
     free(scene->lightpos);
     free(scene->lightspecular);
-    free(scene->objectalbedo);
-    free(scene->objectambient);
+    free(scene->lightrange);
+    destroy_sphere_bvh(scene->lightbvh);
+    destroy_sphere_bvh(scene->objectbvh);
     free(scene->objectcolor);
-    free(scene->objectdiffuse);
     free(scene->objectpos);
     free(scene->objectradius);
-    free(scene->objectreflectivity);
-    free(scene->objectspecular);
+    free(scene->objectmaterial);
+    free(scene->materialambient);
+    free(scene->materialdiffuse);
+    free(scene->materialspecular);
+    free(scene->materialreflectivity);
+    free(scene->materialalbedo);
+    free(scene->instancetransform);
+    free(scene->instanceranges);
+    free(scene->instancebounds);
 
     free(scene);
     return;
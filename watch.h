@@ -0,0 +1,80 @@
+#ifndef WATCH_H
+#define WATCH_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/inotify.h>
+
+//tells the live modes when the scene file was saved, see --watch. the directory is watched instead of the
+//file because most editors save by writing a new file and renaming it over the old one, which would leave
+//a watch on the file itself pointing at the deleted inode
+typedef struct SceneWatcher{
+    int fd; //inotify instance, non blocking
+    int watch;
+    char name[NAME_MAX+1]; //file name inside the watched directory
+} SceneWatcher;
+
+//NULL if inotify is not available, the caller just runs without reloading then
+SceneWatcher* create_scene_watcher(char* file_path){
+    SceneWatcher* watcher;
+    watcher = (SceneWatcher*)malloc(sizeof(SceneWatcher));
+
+    char directory[PATH_MAX];
+    const char* slash = strrchr(file_path, '/');
+    if(slash == NULL){
+        strcpy(directory, ".");
+        snprintf(watcher->name, sizeof(watcher->name), "%s", file_path);
+    }else{
+        snprintf(directory, sizeof(directory), "%.*s", (int)(slash-file_path > 0 ? slash-file_path : 1), file_path);
+        snprintf(watcher->name, sizeof(watcher->name), "%s", slash+1);
+    }
+
+    watcher->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(watcher->fd < 0){
+        printf("Could not start inotify, the scene will not be reloaded\n");
+        free(watcher);
+        return NULL;
+    }
+    //close after write and rename into place are the moments the file is complete, plain modify events
+    //come while it is still being written
+    watcher->watch = inotify_add_watch(watcher->fd, directory, IN_CLOSE_WRITE | IN_MOVED_TO);
+    if(watcher->watch < 0){
+        printf("Could not watch %s, the scene will not be reloaded\n", directory);
+        close(watcher->fd);
+        free(watcher);
+        return NULL;
+    }
+
+    return watcher;
+}
+
+//drains the pending events without blocking, 1 if any of them was about the scene file.
+//an editor saving twice in a row between two frames only causes one reload
+int scene_file_changed(SceneWatcher* watcher){
+    if(watcher == NULL) return 0;
+
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    int changed = 0;
+    ssize_t length;
+    while((length = read(watcher->fd, buffer, sizeof(buffer))) > 0){
+        for(char* event_pointer = buffer; event_pointer < buffer+length;){
+            struct inotify_event* event = (struct inotify_event*)event_pointer;
+            if(event->len > 0 && !strcmp(event->name, watcher->name)) changed = 1;
+            event_pointer += sizeof(struct inotify_event)+event->len;
+        }
+    }
+    return changed;
+}
+
+void destroy_scene_watcher(SceneWatcher* watcher){
+    if(watcher == NULL) return;
+
+    close(watcher->fd);
+
+    free(watcher);
+    return;
+}
+
+#endif